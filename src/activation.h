@@ -0,0 +1,46 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <stdlib.h>
+#include <string.h>
+
+//Implementations of sigmoid and tanh, for every gate activation and tanh(c) in both
+//backends. The OpenCL programs have theirs compiled in (-DACTIVATION=<mode>, the FPGA
+//binary gets it from aoc), so setActivationCl must come before the environment is set up.
+//Both backends start from RNN_ACTIVATION=exact|native|rational|lut, exact when unset.
+//	exact		full precision exp and tanh
+//	native		native_exp and native_recip on the device, the hardware reciprocal
+//			estimate on the CPU (the scalar CPU path has none and stays exact)
+//	rational	tanh as x*P(x^2)/Q(x^2) clamped where it saturates to 1 in float,
+//			sigmoid(x) = (1 + tanh(x/2))/2
+//	lut		linear interpolation in a table of sigmoid, tanh(x) = 2*sigmoid(2x) - 1
+//Must match the ACT_* defines in kernels.cl.
+enum activation_mode
+{
+	ACT_EXACT,
+	ACT_NATIVE,
+	ACT_RATIONAL,
+	ACT_LUT
+};
+#define NUM_ACTIVATIONS 4
+
+//sigmoid table over [-LUT_RANGE, LUT_RANGE] in LUT_STEPS intervals, LUT_STEPS + 1 entries
+#define LUT_RANGE 16
+#define LUT_STEPS 512
+
+//bounds on the absolute error against the double precision reference, for sigmoid and tanh
+static const float activation_max_error[NUM_ACTIVATIONS] = {1e-6f, 1e-3f, 1e-6f, 2e-4f};
+static const char *const activation_names[NUM_ACTIVATIONS] = {"exact", "native", "rational", "lut"};
+
+static inline activation_mode activationFromEnv()
+{
+	const char *name = getenv("RNN_ACTIVATION");
+	for(unsigned m = 0; name && m < NUM_ACTIVATIONS; m++)
+	{
+		if(!strcmp(name, activation_names[m]))
+			return (activation_mode)m;
+	}
+	return ACT_EXACT;
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*
+
+Filename: bench_activations.cpp
+Author: agent
+Purpose: Accuracy check and timing of every activation mode. sigmoidCpu/tanhCpu, and with
+ocl sigmoidCl/tanhCl from a program built for each mode, are compared with the reference
+formulas of sigmoidtest/tanhtest in testing/host.cpp. The CPU side also times
+forwardSequence on a window, with the largest difference of its final h from the exact
+run. Exits non-zero when any mode is past activation_max_error.
+
+An FPGA binary has the mode it was compiled with (aoc -DACTIVATION=<n>), run with the
+matching RNN_ACTIVATION to check only that mode on the device.
+
+Usage: bench_activations [cpu|ocl] [steps] [batch]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+10/16/26	Checks the OpenCL kernels of every mode too, and fails past the bounds.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "lstm.hpp"
+#include "bench_common.h"
+
+#define RUNS 5
+#define COUNT (1 << 20)
+
+//sigmoidtest and tanhtest, exp and tanh in double precision
+static void referenceActivations(const std::vector<float> &in, std::vector<double> &sig, std::vector<double> &th)
+{
+	sig.resize(in.size());
+	th.resize(in.size());
+	for(size_t i = 0; i < in.size(); i++)
+	{
+		sig[i] = 1.0/(1.0 + exp(-(double)in[i]));
+		th[i] = tanh((double)in[i]);
+	}
+}
+static double maxError(const std::vector<float> &out, const std::vector<double> &ref)
+{
+	double err = 0.0;
+	for(size_t i = 0; i < out.size(); i++)
+		err = fmax(err, fabs(out[i] - ref[i]));
+	return err;
+}
+static bool report(const char *backend, unsigned m, double sig_err, double tanh_err, double sig_ms, double tanh_ms)
+{
+	const bool pass = sig_err <= activation_max_error[m] && tanh_err <= activation_max_error[m];
+	printf("%s\t%-8s\t%.3g\t\t%.3g\t\t%g\t%.2f\t\t%.2f\t%s\n", backend, activation_names[m], sig_err, tanh_err,
+		activation_max_error[m], sig_ms, tanh_ms, pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+int main(int argc, char **argv)
+{
+	const bool ocl = argc > 1 && strcmp(argv[1], "ocl") == 0;
+	const unsigned steps = argc > 2 ? atoi(argv[2]) : 32;
+	const unsigned batch = argc > 3 ? atoi(argv[3]) : 8;
+	if(steps == 0 || batch == 0)
+	{
+		printf("Usage: %s [cpu|ocl] [steps] [batch]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<float> in(COUNT), sig(COUNT), th(COUNT);
+	std::vector<double> sig_ref, tanh_ref;
+	for(size_t i = 0; i < in.size(); i++) in[i] = -10.0f + 20.0f*i/(COUNT - 1);
+	referenceActivations(in, sig_ref, tanh_ref);
+	bool pass = true;
+
+	printf("%d activations\n", COUNT);
+	printf("backend\tmode\t\tsigmoid error\ttanh error\tbound\tsigmoid ms\ttanh ms\n");
+	for(unsigned m = 0; m < NUM_ACTIVATIONS; m++)
+	{
+		setActivationCpu((activation_mode)m);
+		double sig_ms = 0.0, tanh_ms = 0.0;
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			sigmoidCpu(in.data(), sig.data(), COUNT);
+			const double s = msSince(start);
+			start = std::chrono::steady_clock::now();
+			tanhCpu(in.data(), th.data(), COUNT);
+			if(r > 0)
+			{
+				sig_ms += s;
+				tanh_ms += msSince(start);
+			}
+		}
+		pass = report("cpu", m, maxError(sig, sig_ref), maxError(th, tanh_ref), sig_ms/RUNS, tanh_ms/RUNS) && pass;
+	}
+
+	//the mode is compiled into the program, so every mode gets an environment of its own
+	for(unsigned m = 0; ocl && m < NUM_ACTIVATIONS; m++)
+	{
+		if(getenv("RNN_ACTIVATION") && m != activationFromEnv())
+			continue;
+		setActivationCl((activation_mode)m);
+		if(!setupOclEnv((char*)"kernels"))
+			return 1;
+		clTensor x = createTensorCl(1, COUNT), y = createTensorCl(1, COUNT);
+		uploadTensorCl(x, in.data());
+		double sig_ms = 0.0, tanh_ms = 0.0;
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			sigmoidCl(x, y);
+			finishCl();
+			const double s = msSince(start);
+			if(r == 0)
+				downloadTensorCl(y, sig.data());
+			start = std::chrono::steady_clock::now();
+			tanhCl(x, y);
+			finishCl();
+			if(r == 0)
+				downloadTensorCl(y, th.data());
+			else
+			{
+				sig_ms += s;
+				tanh_ms += msSince(start);
+			}
+		}
+		pass = report("ocl", m, maxError(sig, sig_ref), maxError(th, tanh_ref), sig_ms/RUNS, tanh_ms/RUNS) && pass;
+		releaseTensorCl(x);
+		releaseTensorCl(y);
+		cleanupOclEnv();
+	}
+
+	//what each mode does to a whole window on the CPU
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	std::vector<float> window((size_t)steps*batch*INPUT_SIZE);
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight()*10.0f;
+	std::vector<float> h((size_t)batch*OUTPUT_SIZE), ref(h.size());
+	LSTMCell cell(	w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+			b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data(),
+			BACKEND_CPU, batch);
+
+	printf("\n%u steps, batch %u\n", steps, batch);
+	printf("mode\t\tforward ms\tmax h difference\n");
+	for(unsigned m = 0; m < NUM_ACTIVATIONS; m++)
+	{
+		setActivationCpu((activation_mode)m);
+		double ms = 0.0;
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			cell.reset();
+			cell.forwardSequence(window.data(), steps);
+			cell.getOutput(h.data());
+			if(r > 0)
+				ms += msSince(start);
+		}
+		if(m == ACT_EXACT)
+			ref = h;
+		float diff = 0.0f;
+		for(size_t i = 0; i < h.size(); i++)
+			diff = fmaxf(diff, fabsf(h[i] - ref[i]));
+		printf("%-8s\t%.2f\t\t%g\n", activation_names[m], ms/RUNS, diff);
+	}
+	printf("%s\n", pass ? "PASS" : "FAIL");
+	return pass ? 0 : 1;
+}
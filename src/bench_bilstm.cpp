@@ -0,0 +1,111 @@
+/*
+
+Filename: bench_bilstm.cpp
+Author: agent
+Purpose: A bidirectional window with both directions running at once (BiLSTM) against
+running the forward and then the backward cell, with the largest difference between the
+two outputs.
+
+Usage: bench_bilstm [cpu|ocl] [steps] [batch]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "bilstm.hpp"
+#include "bench_common.h"
+
+#define RUNS 10
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	const unsigned steps = argc > 2 ? atoi(argv[2]) : 128;
+	const unsigned batch = argc > 3 ? atoi(argv[3]) : 1;
+	if(steps == 0 || batch == 0)
+	{
+		printf("Usage: %s [cpu|ocl] [steps] [batch]\n", argv[0]);
+		return 1;
+	}
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	//[0] forward, [1] backward
+	std::vector<float> w[2][NUM_GATES], b[2][NUM_GATES];
+	cl_float *wp[2][NUM_GATES], *bp[2][NUM_GATES];
+	for(unsigned d = 0; d < 2; d++)
+	{
+		randomGates(w[d], b[d], INPUT_SIZE, OUTPUT_SIZE);
+		for(unsigned g = 0; g < NUM_GATES; g++)
+		{
+			wp[d][g] = w[d][g].data();
+			bp[d][g] = b[d][g].data();
+		}
+	}
+
+	const size_t step_size = (size_t)batch*INPUT_SIZE;
+	std::vector<float> window(steps*step_size), reversed(steps*step_size);
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight()*10.0f;
+	for(unsigned t = 0; t < steps; t++)
+		memcpy(&reversed[t*step_size], &window[(steps - 1 - t)*step_size], sizeof(float)*step_size);
+	std::vector<float> h[2], a((size_t)steps*batch*2*OUTPUT_SIZE), c(a.size());
+	h[0].resize((size_t)steps*batch*OUTPUT_SIZE);
+	h[1].resize(h[0].size());
+
+	//one direction after the other
+	double serial = 0.0;
+	{
+		LSTMCell *cells[2];
+		for(unsigned d = 0; d < 2; d++)
+			cells[d] = new LSTMCell(wp[d][GATE_FORGET], wp[d][GATE_INPUT], wp[d][GATE_INTERNAL], wp[d][GATE_OUTPUT],
+						bp[d][GATE_FORGET], bp[d][GATE_INPUT], bp[d][GATE_INTERNAL], bp[d][GATE_OUTPUT],
+						backend, batch);
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for(unsigned d = 0; d < 2; d++)
+			{
+				cells[d]->reset();
+				cells[d]->forwardSequence(d ? reversed.data() : window.data(), steps, h[d].data());
+			}
+			bilstmConcatCpu(h[0].data(), h[1].data(), a.data(), steps, batch, OUTPUT_SIZE);
+			if(r > 0)
+				serial += msSince(start);
+		}
+		delete cells[0];
+		delete cells[1];
+	}
+
+	double concurrent = 0.0;
+	{
+		BiLSTM bi(wp[0], bp[0], wp[1], bp[1], backend, batch);
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			bi.forwardSequence(window.data(), steps, c.data());
+			if(r > 0)
+				concurrent += msSince(start);
+		}
+	}
+
+	float diff = 0.0f;
+	for(size_t i = 0; i < a.size(); i++)
+		diff = fmaxf(diff, fabsf(a[i] - c[i]));
+	printf("%u steps, batch %u\n", steps, batch);
+	printf("one after the other\t%.2f ms\n", serial/RUNS);
+	printf("both at once\t\t%.2f ms\n", concurrent/RUNS);
+	printf("max difference\t\t%g\n", diff);
+
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+
+Filename: bench_bptt.cpp
+Author: agent
+Purpose: Time of one backwardPass over a window for a few checkpoint intervals, with the
+activation memory each keeps and the largest difference of its weight gradients from the
+run that keeps every step. Then every dW/db of a small cell is checked against central
+differences of the loss on the CPU and, with ocl, on the device. Exits non-zero when any
+is further off than GC_MAX_ERROR.
+
+Usage: bench_bptt [cpu|ocl] [steps] [batch]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+10/16/26	Finite difference check of the gradients on both backends.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "lstm.hpp"
+#include "bench_common.h"
+
+#define RUNS 5
+
+//gradient check shape, window and tolerance
+#define GC_IN 3
+#define GC_HIDDEN 4
+#define GC_STEPS 6
+#define GC_BATCH 2
+#define GC_EPSILON 1e-2f
+#define GC_MAX_ERROR 1e-3
+
+//L = sum of d_out*h over the window, the loss whose dL/dh backwardPass is given
+static double windowLoss(LSTMCell &cell, const std::vector<float> &window, const std::vector<float> &d_out)
+{
+	std::vector<float> h(d_out.size());
+	cell.reset();
+	cell.forwardSequence(window.data(), GC_STEPS, h.data());
+	double loss = 0.0;
+	for(size_t i = 0; i < h.size(); i++)
+		loss += (double)d_out[i]*h[i];
+	return loss;
+}
+//largest difference of any dW/db from (L(p + e) - L(p - e))/2e
+static double gradientCheck(lstm_backend backend)
+{
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, GC_IN, GC_HIDDEN);
+	std::vector<float> window(GC_STEPS*GC_BATCH*GC_IN), d_out(GC_STEPS*GC_BATCH*GC_HIDDEN);
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight()*10.0f;
+	for(size_t i = 0; i < d_out.size(); i++) d_out[i] = rand_weight()*10.0f;
+
+	LSTMCell cell(	w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+			b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data(),
+			backend, GC_BATCH, false, TENSOR_F32, GC_IN, GC_HIDDEN);
+	std::vector<float> dw(NUM_GATES*GC_HIDDEN*(GC_HIDDEN + GC_IN)), db(NUM_GATES*GC_HIDDEN);
+	cell.reset();
+	cell.zeroGradients();
+	cell.backwardPass(window.data(), GC_STEPS, d_out.data());
+	cell.getGradients(dw.data(), db.data());
+
+	std::vector<float> pw(dw.size()), pb(db.size());
+	cell.getWeights(pw.data(), pb.data());
+	double err = 0.0;
+	for(size_t i = 0; i < pw.size() + pb.size(); i++)
+	{
+		float &p = i < pw.size() ? pw[i] : pb[i - pw.size()];
+		const float analytic = i < pw.size() ? dw[i] : db[i - pw.size()];
+		const float old = p;
+		p = old + GC_EPSILON;
+		cell.setWeights(pw.data(), pb.data());
+		const double plus = windowLoss(cell, window, d_out);
+		p = old - GC_EPSILON;
+		cell.setWeights(pw.data(), pb.data());
+		const double minus = windowLoss(cell, window, d_out);
+		p = old;
+		err = fmax(err, fabs((plus - minus)/(2.0*GC_EPSILON) - analytic));
+	}
+	cell.setWeights(pw.data(), pb.data());
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	const unsigned steps = argc > 2 ? atoi(argv[2]) : 128;
+	const unsigned batch = argc > 3 ? atoi(argv[3]) : 8;
+	if(steps == 0 || batch == 0)
+	{
+		printf("Usage: %s [cpu|ocl] [steps] [batch]\n", argv[0]);
+		return 1;
+	}
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	std::vector<float> window((size_t)steps*batch*INPUT_SIZE), d_out((size_t)steps*batch*OUTPUT_SIZE);
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight()*10.0f;
+	for(size_t i = 0; i < d_out.size(); i++) d_out[i] = rand_weight();
+
+	LSTMCell cell(	w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+			b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data(),
+			backend, batch);
+	std::vector<float> dw(NUM_GATES*OUTPUT_SIZE*CONCAT_SIZE), db(NUM_GATES*OUTPUT_SIZE), ref(dw.size());
+	unsigned intervals[] = {0, 32, 16, (unsigned)sqrtf((float)steps), 4};
+
+	printf("%u steps, batch %u\n", steps, batch);
+	printf("k\tms\tactivation KB\tmax dW difference\n");
+	for(unsigned n = 0; n < sizeof(intervals)/sizeof(intervals[0]); n++)
+	{
+		const unsigned k = intervals[n] == 0 || intervals[n] > steps ? steps : intervals[n];
+		double ms = 0.0;
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			cell.reset();
+			cell.zeroGradients();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			cell.backwardPass(window.data(), steps, d_out.data(), k);
+			cell.getGradients(dw.data(), db.data());
+			if(r > 0)
+				ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		if(n == 0)
+			ref = dw;
+		float diff = 0.0f;
+		for(size_t i = 0; i < dw.size(); i++)
+			diff = fmaxf(diff, fabsf(dw[i] - ref[i]));
+
+		//checkpoints, then one segment of [h, x], gates, gate gradients and c
+		const unsigned segments = (steps + k - 1)/k;
+		const size_t floats = (size_t)batch*(2*segments*OUTPUT_SIZE
+				+ k*(CONCAT_SIZE + 2*NUM_GATES*OUTPUT_SIZE) + (k + 1)*OUTPUT_SIZE);
+		printf("%u\t%.2f\t%.1f\t\t%g\n", k, ms/RUNS, floats*sizeof(float)/1024.0, diff);
+	}
+
+	bool pass = true;
+	for(int i = 0; i < (backend == BACKEND_OPENCL ? 2 : 1); i++)
+	{
+		const lstm_backend check = i == 0 ? BACKEND_CPU : BACKEND_OPENCL;
+		const double err = gradientCheck(check);
+		pass = pass && err <= GC_MAX_ERROR;
+		printf("%s gradient check, %u x %u, %u steps: max dW/db error %g%s\n", check == BACKEND_CPU ? "cpu" : "ocl",
+			GC_IN, GC_HIDDEN, GC_STEPS, err, err <= GC_MAX_ERROR ? "" : " FAIL");
+	}
+
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "lstm.hpp"
+
+//Fixtures shared by the bench_* programs and tune_kernels. Header only, so it stays out of
+//SRCS and every program links just the objects it already did.
+
+//uniform in [-0.05, 0.05]
+inline float rand_weight() { return float(rand()) / float(RAND_MAX) * 0.1f - 0.05f; }
+
+inline double msSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//random weights of one cell, n_hidden x (n_hidden + n_in) per gate, and n_hidden biases per
+//gate unless b is NULL
+inline void randomGates(std::vector<float> *w, std::vector<float> *b, unsigned n_in, unsigned n_hidden)
+{
+	for(unsigned g = 0; g < NUM_GATES; g++)
+	{
+		w[g].resize((size_t)n_hidden*(n_hidden + n_in));
+		for(size_t i = 0; i < w[g].size(); i++) w[g][i] = rand_weight();
+		if(!b)
+			continue;
+		b[g].resize(n_hidden);
+		for(size_t i = 0; i < b[g].size(); i++) b[g][i] = rand_weight();
+	}
+}
+
+#endif
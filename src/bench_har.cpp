@@ -0,0 +1,156 @@
+/*
+
+Filename: bench_har.cpp
+Author: agent
+Purpose: Time to load a UCI HAR split from its text files on one thread and on every
+thread, and from the binary cache, against CPU inference over the whole split with a
+small LSTM. Without a dataset root a split the size of the HAR test set is generated.
+Also counts the values the fast float parser reads differently from strtof.
+
+Usage: bench_har [root] [split] [threads] [hidden]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+10/16/26	Batches are staged with stageWindows.
+
+*/
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dataset.h"
+#include "lstm.hpp"
+#include "bench_common.h"
+
+//windows in the UCI HAR test split
+#define SYNTHETIC_WINDOWS 2947
+#define BATCH 64
+
+//text in the format of the dataset, "%.7e" with leading spaces
+static bool writeSynthetic(const char *root, const char *split)
+{
+	static const char *const channels[HAR_CHANNELS] = {
+		"body_acc_x", "body_acc_y", "body_acc_z", "body_gyro_x", "body_gyro_y", "body_gyro_z",
+		"total_acc_x", "total_acc_y", "total_acc_z"
+	};
+	const std::string dir = std::string(root) + "/" + split;
+	mkdir(root, 0755);
+	mkdir(dir.c_str(), 0755);
+	mkdir((dir + "/Inertial Signals").c_str(), 0755);
+	for(unsigned c = 0; c <= HAR_CHANNELS; c++)
+	{
+		const std::string path = c < HAR_CHANNELS ? dir + "/Inertial Signals/" + channels[c] + "_" + split + ".txt"
+							: dir + "/y_" + split + ".txt";
+		FILE *file = fopen(path.c_str(), "w");
+		if(!file)
+		{
+			perror(path.c_str());
+			return false;
+		}
+		for(unsigned w = 0; w < SYNTHETIC_WINDOWS; w++)
+		{
+			if(c == HAR_CHANNELS)
+			{
+				fprintf(file, "%u\n", 1 + rand() % HAR_CLASSES);
+				continue;
+			}
+			for(unsigned t = 0; t < HAR_STEPS; t++)
+				fprintf(file, " %s%.7e", t ? " " : "", rand_weight()*20.0f);
+			fprintf(file, "\n");
+		}
+		fclose(file);
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *root = argc > 1 ? argv[1] : "har_synthetic";
+	const char *split = argc > 2 ? argv[2] : "test";
+	unsigned threads = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+	const unsigned hidden = argc > 4 ? atoi(argv[4]) : 32;
+	if(threads == 0)
+		threads = 1;
+	if(hidden == 0)
+	{
+		printf("Usage: %s [root] [split] [threads] [hidden]\n", argv[0]);
+		return 1;
+	}
+	if(argc < 2 && !writeSynthetic(root, split))
+		return 1;
+	const std::string cache = std::string(root) + "/" + split + "/har_" + split + ".bin";
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(!buildHarCache(root, split, cache.c_str(), 1))
+		return 1;
+	const double serial_ms = msSince(start);
+	start = std::chrono::steady_clock::now();
+	if(!buildHarCache(root, split, cache.c_str(), threads))
+		return 1;
+	const double parallel_ms = msSince(start);
+
+	//a cache load includes reading every value once, so the pages are really in
+	harDataset data;
+	start = std::chrono::steady_clock::now();
+	if(!loadHarDataset(root, split, data, cache.c_str()))
+		return 1;
+	const unsigned windows = data.header->num_windows;
+	double sum = 0.0;
+	for(unsigned w = 0; w < windows; w++)
+	{
+		const float *x = datasetWindow(data, w);
+		for(unsigned i = 0; i < HAR_STEPS*HAR_CHANNELS; i++)
+			sum += x[i];
+	}
+	const double cache_ms = msSince(start);
+
+	//channel 0 again with strtof
+	unsigned mismatches = 0;
+	FILE *file = fopen((std::string(root) + "/" + split + "/Inertial Signals/body_acc_x_" + split + ".txt").c_str(), "r");
+	for(unsigned w = 0; file && w < windows; w++)
+	{
+		for(unsigned t = 0; t < HAR_STEPS; t++)
+		{
+			char text[64];
+			if(fscanf(file, "%63s", text) != 1)
+				break;
+			mismatches += strtof(text, NULL) != datasetWindow(data, w)[t*HAR_CHANNELS];
+		}
+	}
+	if(file)
+		fclose(file);
+
+	//the whole split through one layer, BATCH windows at a time
+	std::vector<float> wg[NUM_GATES];
+	randomGates(wg, NULL, HAR_CHANNELS, hidden);
+	LSTMCell cell(	wg[GATE_FORGET].data(), wg[GATE_INPUT].data(), wg[GATE_INTERNAL].data(), wg[GATE_OUTPUT].data(),
+			NULL, NULL, NULL, NULL, BACKEND_CPU, BATCH, false, TENSOR_F32, HAR_CHANNELS, hidden);
+	std::vector<float> staged((size_t)HAR_STEPS*BATCH*HAR_CHANNELS), h((size_t)BATCH*hidden);
+	start = std::chrono::steady_clock::now();
+	for(unsigned w = 0; w < windows; w += BATCH)
+	{
+		stageWindows(	datasetWindow(data, 0), w, std::min((unsigned)BATCH, windows - w), HAR_STEPS, HAR_CHANNELS, BATCH,
+				staged.data(), data.header->window_stride/sizeof(float));
+		cell.reset();
+		cell.forwardSequence(staged.data(), HAR_STEPS);
+		cell.getOutput(h.data());
+	}
+	const double infer_ms = msSince(start);
+
+	printf("%s/%s: %u windows, checksum %g, %u of %u body_acc_x values differ from strtof\n", root, split, windows, sum,
+		mismatches, windows*HAR_STEPS);
+	printf("text, 1 thread\t\t%.1f ms\n", serial_ms);
+	printf("text, %u threads\t%.1f ms\n", threads, parallel_ms);
+	printf("cache\t\t\t%.1f ms\n", cache_ms);
+	printf("inference, H=%u\t%.1f ms\n", hidden, infer_ms);
+	closeDataset(data);
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+
+Filename: bench_int8.cpp
+Author: agent
+Purpose: Accuracy and speed of int8 weights. A random float model is converted to MODEL_I8
+with convertModel, the int8 gate product (quantizeRowsCpu and matrixMultiplyI8Cpu) is
+compared with the float matrixMultiplyCpu, and a cell built from each file runs the same
+window, comparing the final h. Exits non-zero when either error is past its bound.
+
+Usage: bench_int8 [cpu|ocl] [steps] [batch]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created, replaces the int8 report in testing/host.cpp.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include "lstm.hpp"
+#include "bench_common.h"
+
+#define RUNS 5
+//gate error relative to the largest float gate, and absolute error of h
+#define MAX_GATE_ERROR 2e-2
+#define MAX_H_ERROR 1e-2
+
+//final h of the window and the mean time of RUNS runs
+static double runCell(LSTMCell &cell, const std::vector<float> &window, unsigned steps, std::vector<float> &h)
+{
+	double ms = 0.0;
+	for(int r = 0; r < RUNS + 1; r++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		cell.reset();
+		cell.forwardSequence(window.data(), steps);
+		cell.getOutput(h.data());
+		if(r > 0)
+			ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	return ms/RUNS;
+}
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	const unsigned steps = argc > 2 ? atoi(argv[2]) : 32;
+	const unsigned batch = argc > 3 ? atoi(argv[3]) : 8;
+	if(steps == 0 || batch == 0)
+	{
+		printf("Usage: %s [cpu|ocl] [steps] [batch]\n", argv[0]);
+		return 1;
+	}
+	const char *f32_path = "bench_int8_f32.bin";
+	const char *i8_path = "bench_int8_i8.bin";
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	const float *wp[NUM_GATES], *bp[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	for(unsigned g = 0; g < NUM_GATES; g++)
+	{
+		wp[g] = w[g].data();
+		bp[g] = b[g].data();
+	}
+	const unsigned n_in = INPUT_SIZE, n_hidden = OUTPUT_SIZE;
+	lstmModel f32, i8;
+	if(!writeModel(f32_path, 1, &n_in, &n_hidden, wp, bp) || !convertModel(f32_path, i8_path, MODEL_I8) ||
+		!openModel(f32_path, f32) || !openModel(i8_path, i8))
+		return 1;
+
+	//[h, x] rows against all the packed gate weights, as one batched step computes them
+	const int rows = NUM_GATES*OUTPUT_SIZE;
+	std::vector<float> a((size_t)batch*CONCAT_SIZE), ref((size_t)batch*rows), gates(ref.size()), a_scales(batch);
+	std::vector<int8_t> a_q(a.size());
+	std::vector<int32_t> acc(ref.size());
+	for(size_t i = 0; i < a.size(); i++) a[i] = rand_weight()*20.0f;
+	matrixMultiplyCpu(a.data(), (const float *)modelWeights(f32, 0), ref.data(), batch, rows, CONCAT_SIZE);
+	quantizeRowsCpu(a.data(), a_q.data(), a_scales.data(), batch, CONCAT_SIZE);
+	matrixMultiplyI8Cpu(a_q.data(), (const int8_t *)modelWeights(i8, 0), acc.data(), batch, rows, CONCAT_SIZE);
+	const float *w_scales = modelScales(i8, 0);
+	double gate_err = 0.0, gate_max = 0.0;
+	for(unsigned r = 0; r < batch; r++)
+	{
+		for(int c = 0; c < rows; c++)
+		{
+			const size_t i = (size_t)r*rows + c;
+			gates[i] = acc[i]*a_scales[r]*w_scales[c];
+			gate_err = fmax(gate_err, fabs(gates[i] - ref[i]));
+			gate_max = fmax(gate_max, fabs(ref[i]));
+		}
+	}
+
+	std::vector<float> window((size_t)steps*batch*INPUT_SIZE), h_f32((size_t)batch*OUTPUT_SIZE), h_i8(h_f32.size());
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight()*10.0f;
+	double f32_ms, i8_ms;
+	{
+		LSTMCell cell(f32, 0, backend, batch);
+		f32_ms = runCell(cell, window, steps, h_f32);
+	}
+	{
+		LSTMCell cell(i8, 0, backend, batch);
+		i8_ms = runCell(cell, window, steps, h_i8);
+	}
+	double h_err = 0.0;
+	for(size_t i = 0; i < h_f32.size(); i++)
+		h_err = fmax(h_err, fabs(h_i8[i] - h_f32[i]));
+
+	const bool pass = gate_err/gate_max <= MAX_GATE_ERROR && h_err <= MAX_H_ERROR;
+	printf("%u steps, batch %u\n", steps, batch);
+	printf("gates: max abs error %g, relative %g (bound %g)\n", gate_err, gate_err/gate_max, MAX_GATE_ERROR);
+	printf("h: max abs error %g (bound %g)\n", h_err, MAX_H_ERROR);
+	printf("float %.2f ms, int8 %.2f ms per window\n", f32_ms, i8_ms);
+	printf("%s\n", pass ? "PASS" : "FAIL");
+
+	closeModel(f32);
+	closeModel(i8);
+	unlink(f32_path);
+	unlink(i8_path);
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/*
+
+Filename: bench_model.cpp
+Author: agent
+Purpose: Load time and resident memory of a cell built from a mapped model file, against
+reading the same weights into host arrays and handing those to the gate-array constructor.
+
+Usage: bench_model [cpu|ocl] [model file]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "lstm.hpp"
+#include "bench_common.h"
+
+//resident set size in kB
+static long residentKb()
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	char line[256];
+	long kb = -1;
+	while(f && fgets(line, sizeof(line), f))
+	{
+		if(strncmp(line, "VmRSS:", 6) == 0)
+			kb = atol(line + 6);
+	}
+	if(f)
+		fclose(f);
+	return kb;
+}
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	const char *path = argc > 2 ? argv[2] : "bench_model.bin";
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	//write a random single layer model
+	{
+		std::vector<float> w[NUM_GATES], b[NUM_GATES];
+		const float *wp[NUM_GATES], *bp[NUM_GATES];
+		randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+		for(unsigned g = 0; g < NUM_GATES; g++)
+		{
+			wp[g] = w[g].data();
+			bp[g] = b[g].data();
+		}
+		const unsigned n_in = INPUT_SIZE, n_hidden = OUTPUT_SIZE;
+		if(!writeModel(path, 1, &n_in, &n_hidden, wp, bp))
+			return 1;
+	}
+
+	//copying loader: fread each gate into its own array, then the constructor copies again
+	long rss = residentKb();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		lstmModel m;
+		if(!openModel(path, m))
+			return 1;
+		FILE *f = fopen(path, "rb");
+		std::vector<float> w[NUM_GATES], b[NUM_GATES];
+		for(unsigned g = 0; g < NUM_GATES; g++)
+		{
+			w[g].resize(OUTPUT_SIZE*CONCAT_SIZE);
+			b[g].resize(OUTPUT_SIZE);
+			fseek(f, m.header->layers[0].weight_offset + sizeof(float)*g*w[g].size(), SEEK_SET);
+			if(fread(w[g].data(), sizeof(float), w[g].size(), f) != w[g].size())
+				return 1;
+			fseek(f, m.header->layers[0].bias_offset + sizeof(float)*g*b[g].size(), SEEK_SET);
+			if(fread(b[g].data(), sizeof(float), b[g].size(), f) != b[g].size())
+				return 1;
+		}
+		fclose(f);
+		closeModel(m);
+
+		LSTMCell cell(	w[0].data(), w[1].data(), w[2].data(), w[3].data(),
+				b[0].data(), b[1].data(), b[2].data(), b[3].data(), backend);
+		if(backend == BACKEND_OPENCL)
+			finishCl();
+		printf("copy\t%.2f ms\t%+ld kB resident\n", msSince(start), residentKb() - rss);
+	}
+
+	//mapped loader
+	rss = residentKb();
+	start = std::chrono::steady_clock::now();
+	{
+		lstmModel m;
+		if(!openModel(path, m))
+			return 1;
+		LSTMCell cell(m, 0, backend);
+		if(backend == BACKEND_OPENCL)
+			finishCl();
+		printf("mmap\t%.2f ms\t%+ld kB resident\n", msSince(start), residentKb() - rss);
+		closeModel(m);
+	}
+
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return 0;
+}
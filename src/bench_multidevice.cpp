@@ -0,0 +1,75 @@
+/*
+
+Filename: bench_multidevice.cpp
+Author: agent
+Purpose: Windows per second of the multi-device executor over several rounds, with the share
+of windows each device gets as the measured throughputs settle, and the largest difference
+of a few outputs from the CPU backend.
+
+Usage: bench_multidevice [rounds] [windows] [steps] [batch]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+#include "multidevice.h"
+#include "bench_common.h"
+
+#define CHECKED_WINDOWS 4
+
+int main(int argc, char **argv)
+{
+	const unsigned rounds = argc > 1 ? atoi(argv[1]) : 5;
+	const unsigned nwindows = argc > 2 ? atoi(argv[2]) : 256;
+	const unsigned steps = argc > 3 ? atoi(argv[3]) : 128;
+	const unsigned batch = argc > 4 ? atoi(argv[4]) : 8;
+	if(rounds == 0 || nwindows == 0 || steps == 0 || batch == 0)
+	{
+		printf("Usage: %s [rounds] [windows] [steps] [batch]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	std::vector<float> windows((size_t)nwindows*steps*INPUT_SIZE);
+	for(size_t i = 0; i < windows.size(); i++) windows[i] = rand_weight()*10.0f;
+	std::vector<float> outputs((size_t)nwindows*OUTPUT_SIZE);
+
+	MultiDeviceExecutor exec(	"kernels",
+					w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+					b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data(),
+					batch);
+	for(unsigned r = 0; r < rounds; r++)
+	{
+		printf("round %u shares:", r);
+		for(unsigned d = 0; d < exec.devices(); d++)
+			printf(" %.2f", exec.share(d));
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		exec.forwardBatch(windows.data(), nwindows, steps, outputs.data());
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("\t%.1f windows/s\n", nwindows/seconds);
+	}
+
+	LSTMCell ref(	w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+			b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data(),
+			BACKEND_CPU);
+	std::vector<float> h(OUTPUT_SIZE);
+	float diff = 0.0f;
+	for(unsigned i = 0; i < CHECKED_WINDOWS && i < nwindows; i++)
+	{
+		ref.reset();
+		ref.forwardSequence(&windows[(size_t)i*steps*INPUT_SIZE], steps);
+		ref.getOutput(h.data());
+		for(unsigned j = 0; j < OUTPUT_SIZE; j++)
+			diff = fmaxf(diff, fabsf(h[j] - outputs[(size_t)i*OUTPUT_SIZE + j]));
+	}
+	printf("max difference from the CPU backend\t%g\n", diff);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+
+Filename: bench_scheduler.cpp
+Author: agent
+Purpose: Throughput of the inference scheduler as the worker count grows. Every window is
+independent, so windows per second should scale with the thread count until the cores
+(or the device) run out.
+
+Usage: bench_scheduler [cpu|ocl] [max threads] [windows] [steps]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "scheduler.h"
+#include "bench_common.h"
+
+static double runOnce(unsigned threads, lstm_backend backend, std::vector<float> *w, std::vector<float> *b,
+			const std::vector<float> &windows, unsigned nwindows, unsigned steps, std::vector<float> &outputs)
+{
+	InferenceScheduler sched(threads, backend,
+				w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+				b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < nwindows; i++)
+	{
+		inferenceJob job = {&windows[(size_t)i*steps*INPUT_SIZE], steps, &outputs[(size_t)i*OUTPUT_SIZE]};
+		sched.submit(job);
+	}
+	sched.wait();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	unsigned max_threads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	if(max_threads == 0)
+		max_threads = 1;
+	unsigned nwindows = argc > 3 ? atoi(argv[3]) : 4*max_threads;
+	unsigned steps = argc > 4 ? atoi(argv[4]) : 128;
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	std::vector<float> windows((size_t)nwindows*steps*INPUT_SIZE);
+	for(size_t i = 0; i < windows.size(); i++)
+		windows[i] = rand_weight()*20.0f;
+
+	std::vector<float> reference((size_t)nwindows*OUTPUT_SIZE);
+	std::vector<float> outputs((size_t)nwindows*OUTPUT_SIZE);
+
+	printf("%u windows of %u steps, %s backend\n", nwindows, steps, backend == BACKEND_CPU ? "cpu" : "opencl");
+	printf("threads\tseconds\twindows/s\tspeedup\n");
+	double base = 0.0;
+	for(unsigned t = 1; ; t = (t*2 < max_threads) ? t*2 : max_threads)
+	{
+		std::vector<float> &out = (t == 1) ? reference : outputs;
+		const double secs = runOnce(t, backend, w, b, windows, nwindows, steps, out);
+		if(t == 1)
+			base = secs;
+		printf("%u\t%.3f\t%.2f\t\t%.2fx\n", t, secs, nwindows/secs, base/secs);
+
+		//windows are independent, so the worker that ran one must not change its result
+		if(t > 1 && memcmp(reference.data(), outputs.data(), sizeof(float)*outputs.size()) != 0)
+			printf("\toutputs differ from the single thread run\n");
+		if(t == max_threads)
+			break;
+	}
+
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+
+Filename: bench_stacked.cpp
+Author: agent
+Purpose: A stacked model run as a wavefront (StackedLSTM) against running its layers one
+after the other over the whole window, with the largest difference between their outputs.
+
+Usage: bench_stacked [cpu|ocl] [layers] [steps]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "stacked.hpp"
+#include "bench_common.h"
+
+#define RUNS 10
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	const unsigned num_layers = argc > 2 ? atoi(argv[2]) : 2;
+	const unsigned steps = argc > 3 ? atoi(argv[3]) : 128;
+	const char *path = "bench_stacked.bin";
+	if(num_layers == 0 || num_layers > MODEL_MAX_LAYERS || steps == 0)
+	{
+		printf("Usage: %s [cpu|ocl] [layers] [steps]\n", argv[0]);
+		return 1;
+	}
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	//random model, every layer OUTPUT_SIZE wide
+	{
+		std::vector<unsigned> n_in(num_layers, OUTPUT_SIZE), n_hidden(num_layers, OUTPUT_SIZE);
+		n_in[0] = INPUT_SIZE;
+		std::vector<std::vector<float> > w(num_layers*NUM_GATES), b(num_layers*NUM_GATES);
+		std::vector<const float *> wp, bp;
+		for(unsigned l = 0; l < num_layers; l++)
+			randomGates(&w[l*NUM_GATES], &b[l*NUM_GATES], n_in[l], OUTPUT_SIZE);
+		for(unsigned i = 0; i < num_layers*NUM_GATES; i++)
+		{
+			wp.push_back(w[i].data());
+			bp.push_back(b[i].data());
+		}
+		if(!writeModel(path, num_layers, n_in.data(), n_hidden.data(), wp.data(), bp.data()))
+			return 1;
+	}
+	lstmModel m;
+	if(!openModel(path, m))
+		return 1;
+
+	std::vector<float> window(steps*INPUT_SIZE);
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight()*10.0f;
+	std::vector<float> a(steps*OUTPUT_SIZE), b(steps*OUTPUT_SIZE), tmp(steps*OUTPUT_SIZE);
+
+	//layer by layer, every layer finishes the window before the next starts
+	double serial = 0.0;
+	{
+		std::vector<LSTMCell *> cells;
+		for(unsigned k = 0; k < num_layers; k++)
+			cells.push_back(new LSTMCell(m, k, backend));
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			const float *in = window.data();
+			for(unsigned k = 0; k < num_layers; k++)
+			{
+				cells[k]->reset();
+				cells[k]->forwardSequence(in, steps, k + 1 < num_layers ? tmp.data() : a.data());
+				if(k + 1 < num_layers)
+				{
+					std::swap(tmp, b);
+					in = b.data();
+				}
+			}
+			if(r > 0)
+				serial += msSince(start);
+		}
+		for(unsigned k = 0; k < num_layers; k++)
+			delete cells[k];
+	}
+
+	double wavefront = 0.0;
+	{
+		StackedLSTM stack(m, backend);
+		for(int r = 0; r < RUNS + 1; r++)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			stack.reset();
+			stack.forwardSequence(window.data(), steps, b.data());
+			if(r > 0)
+				wavefront += msSince(start);
+		}
+	}
+
+	float diff = 0.0f;
+	for(size_t i = 0; i < a.size(); i++)
+		diff = fmaxf(diff, fabsf(a[i] - b[i]));
+	printf("%u layers, %u steps\n", num_layers, steps);
+	printf("layer by layer\t%.2f ms\n", serial/RUNS);
+	printf("wavefront\t%.2f ms\n", wavefront/RUNS);
+	printf("max difference\t%g\n", diff);
+
+	closeModel(m);
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return 0;
+}
@@ -0,0 +1,241 @@
+/*
+
+Filename: bench_suite.cpp
+Author: agent
+Purpose: Benchmark harness for the backends. Times single ops (GEMV and GEMM shaped matrix
+multiplies, sigmoid), one LSTM timestep, a whole window and a batch of windows. Every case
+runs warmup iterations first, then reports p50/p95/p99 host latency and throughput. On the
+OpenCL backend the kernel time from profiling events is reported next to it, so host overhead
+(launches, transfers, waits) shows up as the difference.
+
+Usage: bench_suite [cpu|ocl|all] [iterations] [json file]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "lstm.hpp"
+#include "cpubackend.h"
+#include "bench_common.h"
+
+#define WARMUP_RUNS 10
+#define WINDOW_STEPS 128
+#define WINDOW_BATCH 8
+
+struct benchResult
+{
+	std::string backend;
+	std::string name;
+	unsigned iterations;
+	//host latency of one iteration in ms
+	double p50, p95, p99, mean;
+	//mean kernel time of one iteration in ms, negative when the backend has none
+	double device;
+	double throughput;
+	const char *unit;
+};
+
+//nearest rank percentile of sorted samples
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	size_t rank = (size_t)(p/100.0*sorted.size() + 0.999999);
+	if(rank == 0)
+		rank = 1;
+	return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+//work is the amount done by one iteration in the unit's base (flops, elements, cell steps)
+static benchResult runCase(lstm_backend backend, const char *name, unsigned iterations,
+				double work, double work_scale, const char *unit, std::function<void()> body)
+{
+	const bool ocl = backend == BACKEND_OPENCL;
+	for(unsigned i = 0; i < WARMUP_RUNS; i++)
+		body();
+	if(ocl)
+	{
+		finishCl();
+		profileKernelsCl(true);
+		takeKernelTimeCl();
+	}
+
+	std::vector<double> host(iterations);
+	double device = 0.0;
+	for(unsigned i = 0; i < iterations; i++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		body();
+		if(ocl)
+			finishCl();
+		host[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(ocl)
+			device += takeKernelTimeCl()*1e-6;
+	}
+	if(ocl)
+		profileKernelsCl(false);
+
+	benchResult r;
+	r.backend = ocl ? "ocl" : "cpu";
+	r.name = name;
+	r.iterations = iterations;
+	r.mean = 0.0;
+	for(unsigned i = 0; i < iterations; i++)
+		r.mean += host[i];
+	r.mean /= iterations;
+	std::sort(host.begin(), host.end());
+	r.p50 = percentile(host, 50.0);
+	r.p95 = percentile(host, 95.0);
+	r.p99 = percentile(host, 99.0);
+	r.device = ocl ? device/iterations : -1.0;
+	r.throughput = work/(r.p50*1e-3)/work_scale;
+	r.unit = unit;
+
+	printf("%-4s %-20s p50 %9.3f  p95 %9.3f  p99 %9.3f ms", r.backend.c_str(), name, r.p50, r.p95, r.p99);
+	if(ocl)
+		printf("  kernel %9.3f ms", r.device);
+	printf("  %10.2f %s\n", r.throughput, unit);
+	return r;
+}
+
+//C = A*B^T with A m x k and B n x k
+static void benchMatmul(lstm_backend backend, const char *name, int m, int n, int k,
+			unsigned iterations, std::vector<benchResult> &results)
+{
+	std::vector<float> a(m*k), b(n*k), c(m*n);
+	for(size_t i = 0; i < a.size(); i++) a[i] = rand_weight();
+	for(size_t i = 0; i < b.size(); i++) b[i] = rand_weight();
+	const double flops = 2.0*m*n*k;
+
+	if(backend == BACKEND_CPU)
+	{
+		results.push_back(runCase(backend, name, iterations, flops, 1e9, "GFLOP/s",
+			[&]() { matrixMultiplyCpu(a.data(), b.data(), c.data(), m, n, k); }));
+		return;
+	}
+	clTensor ta = createTensorCl(m, k);
+	clTensor tb = createTensorCl(n, k);
+	clTensor tc = createTensorCl(m, n);
+	uploadTensorCl(ta, a.data());
+	uploadTensorCl(tb, b.data());
+	results.push_back(runCase(backend, name, iterations, flops, 1e9, "GFLOP/s",
+		[&]() { matrixMultiplyCl(ta, tb, tc); }));
+	releaseTensorCl(ta);
+	releaseTensorCl(tb);
+	releaseTensorCl(tc);
+}
+
+static void benchSigmoid(lstm_backend backend, int count, unsigned iterations, std::vector<benchResult> &results)
+{
+	std::vector<float> in(count), out(count);
+	for(int i = 0; i < count; i++) in[i] = rand_weight()*100.0f;
+
+	if(backend == BACKEND_CPU)
+	{
+		results.push_back(runCase(backend, "sigmoid", iterations, count, 1e9, "Gelem/s",
+			[&]() { sigmoidCpu(in.data(), out.data(), count); }));
+		return;
+	}
+	clTensor tin = createTensorCl(1, count);
+	clTensor tout = createTensorCl(1, count);
+	uploadTensorCl(tin, in.data());
+	results.push_back(runCase(backend, "sigmoid", iterations, count, 1e9, "Gelem/s",
+		[&]() { sigmoidCl(tin, tout); }));
+	releaseTensorCl(tin);
+	releaseTensorCl(tout);
+}
+
+//cell steps through the host pointer entry points, so transfers count towards host time
+static void benchLstm(lstm_backend backend, unsigned iterations, std::vector<benchResult> &results)
+{
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	std::vector<float> window(WINDOW_STEPS*WINDOW_BATCH*INPUT_SIZE);
+	std::vector<float> outputs(WINDOW_STEPS*WINDOW_BATCH*OUTPUT_SIZE);
+	for(size_t i = 0; i < window.size(); i++) window[i] = rand_weight();
+
+	{
+		LSTMCell cell(	w[0].data(), w[1].data(), w[2].data(), w[3].data(),
+				b[0].data(), b[1].data(), b[2].data(), b[3].data(), backend);
+		results.push_back(runCase(backend, "lstm_step", iterations, 1, 1, "steps/s",
+			[&]() { cell.forwardPass(window.data()); cell.getOutput(outputs.data()); }));
+		results.push_back(runCase(backend, "lstm_window", std::max(iterations/8, 1u), WINDOW_STEPS, 1, "steps/s",
+			[&]() { cell.forwardSequence(window.data(), WINDOW_STEPS, outputs.data()); }));
+	}
+	{
+		LSTMCell cell(	w[0].data(), w[1].data(), w[2].data(), w[3].data(),
+				b[0].data(), b[1].data(), b[2].data(), b[3].data(), backend, WINDOW_BATCH);
+		results.push_back(runCase(backend, "lstm_batched_window", std::max(iterations/8, 1u),
+			WINDOW_STEPS*WINDOW_BATCH, 1, "steps/s",
+			[&]() { cell.forwardSequence(window.data(), WINDOW_STEPS, outputs.data()); }));
+	}
+}
+
+static bool writeJson(const char *path, const std::vector<benchResult> &results)
+{
+	FILE *f = fopen(path, "w");
+	if(!f)
+	{
+		printf("Could not write %s\n", path);
+		return false;
+	}
+	fprintf(f, "[\n");
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const benchResult &r = results[i];
+		fprintf(f, "  {\"backend\": \"%s\", \"case\": \"%s\", \"iterations\": %u, \"warmup\": %d, "
+			"\"host_ms\": {\"p50\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"mean\": %.6f}, ",
+			r.backend.c_str(), r.name.c_str(), r.iterations, WARMUP_RUNS, r.p50, r.p95, r.p99, r.mean);
+		if(r.device >= 0.0)
+			fprintf(f, "\"kernel_ms\": %.6f, ", r.device);
+		else
+			fprintf(f, "\"kernel_ms\": null, ");
+		fprintf(f, "\"throughput\": %.6f, \"unit\": \"%s\"}%s\n", r.throughput, r.unit, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "]\n");
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *which = argc > 1 ? argv[1] : "all";
+	const unsigned iterations = argc > 2 ? atoi(argv[2]) : 200;
+	const char *json = argc > 3 ? argv[3] : "bench_suite.json";
+	if(iterations == 0 || (strcmp(which, "cpu") && strcmp(which, "ocl") && strcmp(which, "all")))
+	{
+		printf("Usage: %s [cpu|ocl|all] [iterations] [json file]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<lstm_backend> backends;
+	if(strcmp(which, "ocl"))
+		backends.push_back(BACKEND_CPU);
+	if(strcmp(which, "cpu"))
+	{
+		if(!setupOclEnv((char*)"kernels"))
+			return 1;
+		backends.push_back(BACKEND_OPENCL);
+	}
+
+	std::vector<benchResult> results;
+	for(size_t i = 0; i < backends.size(); i++)
+	{
+		benchMatmul(backends[i], "matmul_gemv", 1, NUM_GATES*OUTPUT_SIZE, CONCAT_SIZE, iterations, results);
+		benchMatmul(backends[i], "matmul_gemm", WINDOW_STEPS, NUM_GATES*OUTPUT_SIZE, INPUT_SIZE, iterations, results);
+		benchSigmoid(backends[i], NUM_GATES*OUTPUT_SIZE*WINDOW_BATCH, iterations, results);
+		benchLstm(backends[i], iterations, results);
+	}
+
+	if(strcmp(which, "cpu"))
+		cleanupOclEnv();
+	return writeJson(json, results) ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+/*
+
+Filename: bench_train.cpp
+Author: agent
+Purpose: Training throughput of the data-parallel trainer in samples per second as the
+thread count grows, for reduced and Hogwild updates, with the loss after the last epoch.
+
+Usage: bench_train [cpu|ocl] [max threads] [samples] [steps] [minibatch]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "trainer.h"
+#include "bench_common.h"
+
+#define EPOCHS 3
+#define LEARNING_RATE 0.5f
+
+int main(int argc, char **argv)
+{
+	lstm_backend backend = (argc > 1 && strcmp(argv[1], "ocl") == 0) ? BACKEND_OPENCL : BACKEND_CPU;
+	unsigned max_threads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	if(max_threads == 0)
+		max_threads = 1;
+	const unsigned nsamples = argc > 3 ? atoi(argv[3]) : 64*max_threads;
+	const unsigned steps = argc > 4 ? atoi(argv[4]) : 32;
+	const unsigned minibatch = argc > 5 ? atoi(argv[5]) : 8*max_threads;
+	if(nsamples == 0 || steps == 0 || minibatch == 0)
+	{
+		printf("Usage: %s [cpu|ocl] [max threads] [samples] [steps] [minibatch]\n", argv[0]);
+		return 1;
+	}
+
+	if(backend == BACKEND_OPENCL && !setupOclEnv((char*)"kernels"))
+		return 1;
+
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	randomGates(w, b, INPUT_SIZE, OUTPUT_SIZE);
+	std::vector<float> windows((size_t)nsamples*steps*INPUT_SIZE), targets((size_t)nsamples*OUTPUT_SIZE);
+	for(size_t i = 0; i < windows.size(); i++) windows[i] = rand_weight()*10.0f;
+	for(size_t i = 0; i < targets.size(); i++) targets[i] = rand_weight()*10.0f;
+
+	printf("%u samples of %u steps, minibatch %u\n", nsamples, steps, minibatch);
+	printf("mode\tthreads\tsamples/s\tloss\n");
+	for(unsigned m = 0; m < 2; m++)
+	{
+		const update_mode mode = m ? UPDATE_HOGWILD : UPDATE_REDUCE;
+		if(mode == UPDATE_HOGWILD && backend != BACKEND_CPU)
+			break;
+		for(unsigned threads = 1; threads <= max_threads; threads *= 2)
+		{
+			DataParallelTrainer trainer(threads, backend,
+						w[GATE_FORGET].data(), w[GATE_INPUT].data(), w[GATE_INTERNAL].data(), w[GATE_OUTPUT].data(),
+						b[GATE_FORGET].data(), b[GATE_INPUT].data(), b[GATE_INTERNAL].data(), b[GATE_OUTPUT].data(),
+						1, mode);
+			double loss = 0.0;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for(unsigned e = 0; e < EPOCHS; e++)
+			{
+				double sum = 0.0;
+				for(unsigned i = 0; i < nsamples; i += minibatch)
+				{
+					const unsigned count = std::min(minibatch, nsamples - i);
+					sum += count*trainer.trainBatch(&windows[(size_t)i*steps*INPUT_SIZE], &targets[(size_t)i*OUTPUT_SIZE],
+									count, steps, LEARNING_RATE);
+				}
+				loss = sum/nsamples;
+			}
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			printf("%s\t%u\t%.1f\t\t%g\n", mode == UPDATE_HOGWILD ? "hogwild" : "reduce", threads,
+				EPOCHS*nsamples/seconds, loss);
+		}
+	}
+
+	if(backend == BACKEND_OPENCL)
+		cleanupOclEnv();
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include "bilstm.hpp"
+#include "trace.h"
+
+BiLSTM::BiLSTM(	cl_float *const fwd_weights[NUM_GATES], cl_float *const fwd_biases[NUM_GATES],
+		cl_float *const bwd_weights[NUM_GATES], cl_float *const bwd_biases[NUM_GATES],
+		lstm_backend backend, unsigned batch, unsigned n_in, unsigned n_hidden)
+{
+	cl_float *const *weights[2] = {fwd_weights, bwd_weights};
+	cl_float *const *biases[2] = {fwd_biases, bwd_biases};
+	const clTensor none = {NULL, 0, 0, TENSOR_F32};
+	this->backend = backend;
+	this->batch = batch;
+	this->joined = none;
+	this->joined_done = NULL;
+	this->envs[0] = this->envs[1] = NULL;
+	if(backend == BACKEND_OPENCL)
+	{
+		this->envs[0] = currentOclEnv();
+		this->envs[1] = forkOclEnv(this->envs[0]);
+	}
+
+	for(unsigned d = 0; d < 2; d++)
+	{
+		cl_float *b[NUM_GATES] = {NULL, NULL, NULL, NULL};
+		if(biases[d])
+		{
+			for(unsigned g = 0; g < NUM_GATES; g++)
+				b[g] = biases[d][g];
+		}
+		if(backend == BACKEND_OPENCL)
+			bindOclEnv(this->envs[d]);
+		this->cells[d] = new LSTMCell(	weights[d][GATE_FORGET], weights[d][GATE_INPUT],
+						weights[d][GATE_INTERNAL], weights[d][GATE_OUTPUT],
+						b[GATE_FORGET], b[GATE_INPUT], b[GATE_INTERNAL], b[GATE_OUTPUT],
+						backend, batch, false, TENSOR_F32, n_in, n_hidden);
+		this->windows[d] = this->outputs[d] = none;
+	}
+	if(backend == BACKEND_OPENCL)
+		bindOclEnv(this->envs[0]);
+}
+BiLSTM::~BiLSTM()
+{
+	for(unsigned d = 2; d-- > 0;)
+	{
+		if(this->backend == BACKEND_OPENCL)
+		{
+			bindOclEnv(this->envs[d]);
+			finishCl();
+		}
+		delete this->cells[d];
+		releaseTensorCl(this->windows[d]);
+		releaseTensorCl(this->outputs[d]);
+	}
+	if(this->backend == BACKEND_OPENCL)
+	{
+		releaseTensorCl(this->joined);
+		if(this->joined_done)
+			clReleaseEvent(this->joined_done);
+		releaseOclEnv(this->envs[1]);
+		bindOclEnv(this->envs[0]);
+	}
+}
+//the window with its timesteps in reverse order, each step keeps its batch rows
+void BiLSTM::reverseWindow(const cl_float *window, unsigned steps)
+{
+	const size_t step_size = (size_t)this->batch*this->cells[0]->inputSize();
+	this->reversed.resize(steps*step_size);
+	for(unsigned t = 0; t < steps; t++)
+		memcpy(&this->reversed[t*step_size], &window[(steps - 1 - t)*step_size], sizeof(float)*step_size);
+}
+void BiLSTM::forwardSequence(const cl_float *window, unsigned steps, clTensor &output, cl_event *event)
+{
+	traceScope span("BiLSTM::forwardSequence");
+	const unsigned rows = steps*this->batch;
+	reverseWindow(window, steps);
+
+	//the uploads block, so the forward window is already running while the reversed one goes over
+	for(unsigned d = 0; d < 2; d++)
+	{
+		LSTMCell *cell = this->cells[d];
+		bindOclEnv(this->envs[d]);
+		if(this->windows[d].rows < rows)
+		{
+			releaseTensorCl(this->windows[d]);
+			releaseTensorCl(this->outputs[d]);
+			this->windows[d] = createTensorCl(rows, cell->inputSize(), CL_MEM_READ_ONLY);
+			this->outputs[d] = createTensorCl(rows, cell->hiddenSize());
+		}
+		cell->reset();
+		cl_event deps[2] = {cell->stepDone(), this->joined_done};
+		uploadRowsCl(this->windows[d], 0, rows, d ? this->reversed.data() : window, CL_TRUE,
+			this->joined_done ? 2 : 1, deps);
+		cell->forwardSequence(this->windows[d], steps, &this->outputs[d]);
+	}
+
+	bindOclEnv(this->envs[0]);
+	cl_event deps[2] = {this->cells[0]->stepDone(), this->cells[1]->stepDone()};
+	if(this->joined_done)
+		clReleaseEvent(this->joined_done);
+	bilstmConcatCl(this->outputs[0], this->outputs[1], steps, this->batch, output, 2, deps, &this->joined_done);
+	if(event)
+	{
+		clRetainEvent(this->joined_done);
+		*event = this->joined_done;
+	}
+}
+void BiLSTM::forwardSequence(const cl_float *window, unsigned steps, cl_float *output)
+{
+	const unsigned rows = steps*this->batch;
+	const unsigned n_hidden = this->cells[0]->hiddenSize();
+	if(this->backend == BACKEND_OPENCL)
+	{
+		if(this->joined.rows < rows)
+		{
+			releaseTensorCl(this->joined);
+			this->joined = createTensorCl(rows, 2*n_hidden);
+		}
+		forwardSequence(window, steps, this->joined);
+		clTensor view = this->joined;
+		view.rows = rows;
+		downloadTensorCl(view, output, CL_TRUE, 1, &this->joined_done);
+		return;
+	}
+
+	traceScope span("BiLSTM::forwardSequence");
+	reverseWindow(window, steps);
+	for(unsigned d = 0; d < 2; d++)
+	{
+		this->cpu_outputs[d].resize((size_t)rows*n_hidden);
+		this->cells[d]->reset();
+	}
+	//both directions may be first into the CPU backend, setupCpuEnv lets one set it up and
+	//the other wait, so they always run with the same kernels and activations
+	std::thread backward([&]{ this->cells[1]->forwardSequence(this->reversed.data(), steps, this->cpu_outputs[1].data()); });
+	this->cells[0]->forwardSequence(window, steps, this->cpu_outputs[0].data());
+	backward.join();
+	bilstmConcatCpu(this->cpu_outputs[0].data(), this->cpu_outputs[1].data(), output, steps, this->batch, n_hidden);
+}
@@ -0,0 +1,49 @@
+#ifndef BILSTM_H
+#define BILSTM_H
+
+#include <vector>
+#include "lstm.hpp"
+
+//Bidirectional layer: a forward cell over the window and a backward cell over the window
+//reversed in time, both running at once. On OpenCL the backward cell enqueues on its own
+//queue, forked from the environment bound at construction. On the CPU it runs on a worker
+//thread while the calling thread runs the forward cell. bilstm_concat joins their h into
+//(steps*batch) x 2*n_hidden rows, [forward h, backward h] of each step in time order, which
+//is what a classifier over the whole window takes.
+//Both directions start every window from zero state.
+class BiLSTM
+{
+	private:
+		lstm_backend backend;
+		unsigned batch;
+		//[0] forward, [1] backward
+		LSTMCell *cells[2];
+		//OpenCL: envs[0] is the caller's, envs[1] the backward queue's and ours to release
+		oclEnv *envs[2];
+		//window and reversed window, and each direction's h for every step
+		clTensor windows[2];
+		clTensor outputs[2];
+		//host output path only
+		clTensor joined;
+		//the last bilstm_concat, the next window may not overwrite outputs before it
+		cl_event joined_done;
+		std::vector<float> reversed;
+		std::vector<float> cpu_outputs[2];
+
+		void reverseWindow(const cl_float *window, unsigned steps);
+	public:
+		//gate arrays indexed by GATE_*, as LSTMCell takes them, biases may be NULL
+		BiLSTM(	cl_float *const fwd_weights[NUM_GATES], cl_float *const fwd_biases[NUM_GATES],
+			cl_float *const bwd_weights[NUM_GATES], cl_float *const bwd_biases[NUM_GATES],
+			lstm_backend = BACKEND_OPENCL, unsigned batch = 1,
+			unsigned n_in = INPUT_SIZE, unsigned n_hidden = OUTPUT_SIZE);
+		~BiLSTM();
+		//OpenCL only. output, at least (steps*batch) x 2*n_hidden, is filled without the host
+		//waiting for it, event (clEnqueue convention) completes with it. window is read before
+		//this returns.
+		void forwardSequence(const cl_float *window, unsigned steps, clTensor &output, cl_event *event = NULL);
+		//either backend, blocks until output holds (steps*batch) x 2*n_hidden
+		void forwardSequence(const cl_float *window, unsigned steps, cl_float *output);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "blockfile.h"
+
+uint64_t alignUp(uint64_t x, uint64_t align)
+{
+	return (x + align - 1)/align*align;
+}
+bool writeBlock(FILE *file, uint64_t offset, const void *data, size_t bytes)
+{
+	return fseek(file, offset, SEEK_SET) == 0 && fwrite(data, 1, bytes, file) == bytes;
+}
+
+void *mapBlockFile(const char *path, size_t header_bytes, const char *what, bool report_missing, size_t &bytes)
+{
+	bytes = 0;
+	const int fd = open(path, O_RDONLY);
+	if(fd < 0)
+	{
+		if(report_missing)
+			perror(path);
+		return NULL;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < header_bytes)
+	{
+		printf("%s is not a %s\n", path, what);
+		close(fd);
+		return NULL;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		perror("mmap");
+		return NULL;
+	}
+	madvise(map, st.st_size, MADV_WILLNEED);
+	bytes = st.st_size;
+	return map;
+}
+void unmapBlockFile(void *map, size_t bytes)
+{
+	if(map)
+		munmap(map, bytes);
+}
+const char *checkBlock(uint64_t offset, uint64_t bytes, uint64_t align, uint64_t file_bytes)
+{
+	if(offset % align)
+		return "unaligned block";
+	if(offset + bytes > file_bytes)
+		return "truncated file";
+	return NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef BLOCKFILE_H
+#define BLOCKFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//Files of aligned blocks behind a fixed header, the layout of model files (model.h) and
+//dataset caches (dataset.h). Blocks are written at their offsets with writeBlock and the
+//file is read back through one mapping, so nothing is copied on load.
+
+//x rounded up to a multiple of align
+uint64_t alignUp(uint64_t x, uint64_t align);
+bool writeBlock(FILE *file, uint64_t offset, const void *data, size_t bytes);
+
+//Private writable mapping of a file at least header_bytes long, NULL on failure. Pages are
+//shared with the page cache (and every other process that has the file open) until
+//something writes to them, so a driver that touches a CL_MEM_USE_HOST_PTR buffer can never
+//modify the file. what names the format in errors, a missing file is only reported when
+//report_missing is set.
+void *mapBlockFile(const char *path, size_t header_bytes, const char *what, bool report_missing, size_t &bytes);
+void unmapBlockFile(void *map, size_t bytes);
+//NULL when offset..offset+bytes is align aligned and inside a file of file_bytes, else the error
+const char *checkBlock(uint64_t offset, uint64_t bytes, uint64_t align, uint64_t file_bytes);
+
+#endif
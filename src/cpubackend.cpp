@@ -0,0 +1,1147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <immintrin.h>
+#include <mutex>
+#include "cpubackend.h"
+
+//gate order of packed weights/biases, must match oclabstract.h and kernels.cl
+#define GATE_FORGET 0
+#define GATE_INPUT 1
+#define GATE_INTERNAL 2
+#define GATE_OUTPUT 3
+#define NUM_GATES 4
+
+#define INDEX(ROW, COLUMN, WIDTH) ((ROW) * (WIDTH) + (COLUMN))
+
+//    D I S P A T C H   T A B L E    //
+
+//Every ISA provides the same handful of primitives, the public functions are built on them
+struct cpuKernels
+{
+	const char *name;
+	//one vector against four rows, the inner loop of both matmul and the fused cell
+	void (*dot4)(const float *x, const float *r0, const float *r1, const float *r2, const float *r3, int k, float *out);
+	float (*dot)(const float *x, const float *r, int k);
+	void (*add)(const float *a, const float *b, float *out, int count);
+	void (*mul)(const float *a, const float *b, float *out, int count);
+	//indexed by activation_mode
+	void (*sigmoid[NUM_ACTIVATIONS])(const float *in, float *out, int count);
+	void (*tanh[NUM_ACTIVATIONS])(const float *in, float *out, int count);
+	//c = f*c_prev + i*g, h = o*tanh(c) over already activated gates
+	void (*cell)(const float *f, const float *i, const float *g, const float *o,
+			const float *prev_state, float *curr_state, float *curr_output, int count);
+	//int8 dot product with int32 accumulation
+	int32_t (*doti8)(const int8_t *x, const int8_t *r, int k);
+	//16-bit storage to float, IEEE half or bfloat16
+	void (*widen)(const uint16_t *in, float *out, int count, bool bf16);
+};
+
+//    S C A L A R    //
+
+static void dot4Scalar(const float *x, const float *r0, const float *r1, const float *r2, const float *r3, int k, float *out)
+{
+	float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	for(int i = 0; i < k; i++)
+	{
+		s0 += x[i]*r0[i];
+		s1 += x[i]*r1[i];
+		s2 += x[i]*r2[i];
+		s3 += x[i]*r3[i];
+	}
+	out[0] = s0; out[1] = s1; out[2] = s2; out[3] = s3;
+}
+static float dotScalar(const float *x, const float *r, int k)
+{
+	float sum = 0;
+	for(int i = 0; i < k; i++)
+		sum += x[i]*r[i];
+	return sum;
+}
+static void addScalar(const float *a, const float *b, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = a[i] + b[i];
+}
+static void mulScalar(const float *a, const float *b, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = a[i] * b[i];
+}
+static void sigmoidScalar(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = 1.0f / (1.0f + expf(-in[i]));
+}
+static void tanhScalar(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = tanhf(in[i]);
+}
+//ACT_RATIONAL: tanh = x*P(x^2)/Q(x^2), clamped where tanh rounds to +-1 in float. The
+//coefficients must match tanh_rational in kernels.cl, bench_activations checks both.
+#define TANH_CLAMP 7.90531110763549805f
+#define TANH_A1 4.89352455891786e-03f
+#define TANH_A3 6.37261928875436e-04f
+#define TANH_A5 1.48572235717979e-05f
+#define TANH_A7 5.12229709037114e-08f
+#define TANH_A9 -8.60467152213735e-11f
+#define TANH_A11 2.00018790482477e-13f
+#define TANH_A13 -2.76076847742355e-16f
+#define TANH_B0 4.89352518554385e-03f
+#define TANH_B2 2.26843463243900e-03f
+#define TANH_B4 1.18534705686654e-04f
+#define TANH_B6 1.19825839466702e-06f
+
+static inline float tanhRational(float x)
+{
+	x = fminf(fmaxf(x, -TANH_CLAMP), TANH_CLAMP);
+	const float x2 = x*x;
+	float p = TANH_A13;
+	p = p*x2 + TANH_A11;
+	p = p*x2 + TANH_A9;
+	p = p*x2 + TANH_A7;
+	p = p*x2 + TANH_A5;
+	p = p*x2 + TANH_A3;
+	p = p*x2 + TANH_A1;
+	float q = TANH_B6;
+	q = q*x2 + TANH_B4;
+	q = q*x2 + TANH_B2;
+	q = q*x2 + TANH_B0;
+	return x*p/q;
+}
+static void sigmoidRationalScalar(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = 0.5f + 0.5f*tanhRational(0.5f*in[i]);
+}
+static void tanhRationalScalar(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = tanhRational(in[i]);
+}
+//ACT_LUT: sigmoid at -LUT_RANGE + i*2*LUT_RANGE/LUT_STEPS, filled by setupCpuEnv
+static float sigmoid_lut[LUT_STEPS + 1];
+#define LUT_SCALE (LUT_STEPS/(2.0f*LUT_RANGE))
+
+static inline float sigmoidLut(float x)
+{
+	const float t = (fminf(fmaxf(x, -LUT_RANGE), LUT_RANGE) + LUT_RANGE)*LUT_SCALE;
+	const int i = t < LUT_STEPS - 1 ? (int)t : LUT_STEPS - 1;
+	return sigmoid_lut[i] + (t - i)*(sigmoid_lut[i + 1] - sigmoid_lut[i]);
+}
+static void sigmoidLutScalar(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = sigmoidLut(in[i]);
+}
+static void tanhLutScalar(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i++)
+		out[i] = 2.0f*sigmoidLut(2.0f*in[i]) - 1.0f;
+}
+static void cellScalar(const float *f, const float *i, const float *g, const float *o,
+			const float *prev_state, float *curr_state, float *curr_output, int count)
+{
+	for(int u = 0; u < count; u++)
+	{
+		const float c = f[u]*prev_state[u] + i[u]*g[u];
+		curr_state[u] = c;
+		curr_output[u] = o[u]*tanhf(c);
+	}
+}
+static int32_t doti8Scalar(const int8_t *x, const int8_t *r, int k)
+{
+	int32_t sum = 0;
+	for(int i = 0; i < k; i++)
+		sum += (int32_t)x[i]*(int32_t)r[i];
+	return sum;
+}
+static float halfToFloat(uint16_t h)
+{
+	const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	const uint32_t exp = (h >> 10) & 0x1f;
+	const uint32_t mant = h & 0x3ff;
+	uint32_t bits;
+	float f;
+	if(exp == 0)
+	{
+		//zero or subnormal, mant*2^-24 is exact in float
+		f = ldexpf((float)mant, -24);
+		memcpy(&bits, &f, sizeof(bits));
+		bits |= sign;
+	}
+	else if(exp == 31)
+		bits = sign | 0x7f800000 | (mant << 13);
+	else
+		bits = sign | ((exp + 112) << 23) | (mant << 13);
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+static void widenScalar(const uint16_t *in, float *out, int count, bool bf16)
+{
+	for(int i = 0; i < count; i++)
+	{
+		if(bf16)
+		{
+			const uint32_t bits = (uint32_t)in[i] << 16;
+			memcpy(&out[i], &bits, sizeof(float));
+		}
+		else
+			out[i] = halfToFloat(in[i]);
+	}
+}
+
+//    A V X 2    //
+
+//Cephes style expf, accurate to a couple of ulp over the clamped range
+#define EXP_HI 88.3762626647949f
+#define EXP_LO -88.3762626647949f
+#define LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+
+__attribute__((target("avx2,fma")))
+static inline __m256 exp256(__m256 x)
+{
+	x = _mm256_min_ps(x, _mm256_set1_ps(EXP_HI));
+	x = _mm256_max_ps(x, _mm256_set1_ps(EXP_LO));
+
+	__m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(LOG2E), _mm256_set1_ps(0.5f));
+	fx = _mm256_floor_ps(fx);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C1), x);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C2), x);
+
+	__m256 y = _mm256_set1_ps(EXP_P0);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P1));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+	y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+	__m256i n = _mm256_cvttps_epi32(fx);
+	n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+__attribute__((target("avx2,fma")))
+static inline __m256 sigmoid256(__m256 x)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	return _mm256_div_ps(one, _mm256_add_ps(one, exp256(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+}
+//tanh(x) = 1 - 2/(exp(2x) + 1), saturates cleanly at both ends
+__attribute__((target("avx2,fma")))
+static inline __m256 tanh256(__m256 x)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	__m256 e = exp256(_mm256_mul_ps(two, x));
+	return _mm256_sub_ps(one, _mm256_div_ps(two, _mm256_add_ps(e, one)));
+}
+__attribute__((target("avx2,fma")))
+static inline float hsum256(__m256 v)
+{
+	__m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+	lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+	return _mm_cvtss_f32(lo);
+}
+__attribute__((target("avx2,fma")))
+static void dot4Avx2(const float *x, const float *r0, const float *r1, const float *r2, const float *r3, int k, float *out)
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	__m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+	int i = 0;
+	for(; i + 8 <= k; i += 8)
+	{
+		const __m256 v = _mm256_loadu_ps(&x[i]);
+		s0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&r0[i]), s0);
+		s1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&r1[i]), s1);
+		s2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&r2[i]), s2);
+		s3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(&r3[i]), s3);
+	}
+	float t0 = hsum256(s0), t1 = hsum256(s1), t2 = hsum256(s2), t3 = hsum256(s3);
+	for(; i < k; i++)
+	{
+		t0 += x[i]*r0[i];
+		t1 += x[i]*r1[i];
+		t2 += x[i]*r2[i];
+		t3 += x[i]*r3[i];
+	}
+	out[0] = t0; out[1] = t1; out[2] = t2; out[3] = t3;
+}
+__attribute__((target("avx2,fma")))
+static float dotAvx2(const float *x, const float *r, int k)
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	int i = 0;
+	for(; i + 16 <= k; i += 16)
+	{
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&r[i]), s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[i + 8]), _mm256_loadu_ps(&r[i + 8]), s1);
+	}
+	for(; i + 8 <= k; i += 8)
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x[i]), _mm256_loadu_ps(&r[i]), s0);
+	float sum = hsum256(_mm256_add_ps(s0, s1));
+	for(; i < k; i++)
+		sum += x[i]*r[i];
+	return sum;
+}
+__attribute__((target("avx2,fma")))
+static void addAvx2(const float *a, const float *b, float *out, int count)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], _mm256_add_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i])));
+	for(; i < count; i++)
+		out[i] = a[i] + b[i];
+}
+__attribute__((target("avx2,fma")))
+static void mulAvx2(const float *a, const float *b, float *out, int count)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], _mm256_mul_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i])));
+	for(; i < count; i++)
+		out[i] = a[i] * b[i];
+}
+__attribute__((target("avx2,fma")))
+static void sigmoidAvx2(const float *in, float *out, int count)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], sigmoid256(_mm256_loadu_ps(&in[i])));
+	sigmoidScalar(&in[i], &out[i], count - i);
+}
+__attribute__((target("avx2,fma")))
+static void tanhAvx2(const float *in, float *out, int count)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], tanh256(_mm256_loadu_ps(&in[i])));
+	tanhScalar(&in[i], &out[i], count - i);
+}
+//ACT_NATIVE: the reciprocal estimate, about 12 bits, instead of the divide
+__attribute__((target("avx2,fma")))
+static void sigmoidNativeAvx2(const float *in, float *out, int count)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+	{
+		const __m256 e = exp256(_mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&in[i])));
+		_mm256_storeu_ps(&out[i], _mm256_rcp_ps(_mm256_add_ps(one, e)));
+	}
+	sigmoidScalar(&in[i], &out[i], count - i);
+}
+__attribute__((target("avx2,fma")))
+static void tanhNativeAvx2(const float *in, float *out, int count)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+	{
+		const __m256 e = exp256(_mm256_mul_ps(two, _mm256_loadu_ps(&in[i])));
+		_mm256_storeu_ps(&out[i], _mm256_fnmadd_ps(two, _mm256_rcp_ps(_mm256_add_ps(e, one)), one));
+	}
+	tanhScalar(&in[i], &out[i], count - i);
+}
+__attribute__((target("avx2,fma")))
+static inline __m256 tanhRational256(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-TANH_CLAMP)), _mm256_set1_ps(TANH_CLAMP));
+	const __m256 x2 = _mm256_mul_ps(x, x);
+	__m256 p = _mm256_set1_ps(TANH_A13);
+	p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(TANH_A11));
+	p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(TANH_A9));
+	p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(TANH_A7));
+	p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(TANH_A5));
+	p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(TANH_A3));
+	p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(TANH_A1));
+	__m256 q = _mm256_set1_ps(TANH_B6);
+	q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(TANH_B4));
+	q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(TANH_B2));
+	q = _mm256_fmadd_ps(q, x2, _mm256_set1_ps(TANH_B0));
+	return _mm256_div_ps(_mm256_mul_ps(x, p), q);
+}
+__attribute__((target("avx2,fma")))
+static void sigmoidRationalAvx2(const float *in, float *out, int count)
+{
+	const __m256 half = _mm256_set1_ps(0.5f);
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], _mm256_fmadd_ps(half, tanhRational256(_mm256_mul_ps(half, _mm256_loadu_ps(&in[i]))), half));
+	sigmoidRationalScalar(&in[i], &out[i], count - i);
+}
+__attribute__((target("avx2,fma")))
+static void tanhRationalAvx2(const float *in, float *out, int count)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], tanhRational256(_mm256_loadu_ps(&in[i])));
+	tanhRationalScalar(&in[i], &out[i], count - i);
+}
+//both ends of every interval come in with one gather each
+__attribute__((target("avx2,fma")))
+static inline __m256 sigmoidLut256(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-LUT_RANGE)), _mm256_set1_ps(LUT_RANGE));
+	const __m256 t = _mm256_mul_ps(_mm256_add_ps(x, _mm256_set1_ps(LUT_RANGE)), _mm256_set1_ps(LUT_SCALE));
+	const __m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(t), _mm256_set1_epi32(LUT_STEPS - 1));
+	const __m256 lo = _mm256_i32gather_ps(sigmoid_lut, i, 4);
+	const __m256 hi = _mm256_i32gather_ps(&sigmoid_lut[1], i, 4);
+	return _mm256_fmadd_ps(_mm256_sub_ps(t, _mm256_cvtepi32_ps(i)), _mm256_sub_ps(hi, lo), lo);
+}
+__attribute__((target("avx2,fma")))
+static void sigmoidLutAvx2(const float *in, float *out, int count)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], sigmoidLut256(_mm256_loadu_ps(&in[i])));
+	sigmoidLutScalar(&in[i], &out[i], count - i);
+}
+__attribute__((target("avx2,fma")))
+static void tanhLutAvx2(const float *in, float *out, int count)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(&out[i], _mm256_fmsub_ps(two, sigmoidLut256(_mm256_mul_ps(two, _mm256_loadu_ps(&in[i]))), one));
+	tanhLutScalar(&in[i], &out[i], count - i);
+}
+__attribute__((target("avx2,fma")))
+static void cellAvx2(const float *f, const float *ig, const float *g, const float *o,
+			const float *prev_state, float *curr_state, float *curr_output, int count)
+{
+	int u = 0;
+	for(; u + 8 <= count; u += 8)
+	{
+		__m256 c = _mm256_mul_ps(_mm256_loadu_ps(&f[u]), _mm256_loadu_ps(&prev_state[u]));
+		c = _mm256_fmadd_ps(_mm256_loadu_ps(&ig[u]), _mm256_loadu_ps(&g[u]), c);
+		_mm256_storeu_ps(&curr_state[u], c);
+		_mm256_storeu_ps(&curr_output[u], _mm256_mul_ps(_mm256_loadu_ps(&o[u]), tanh256(c)));
+	}
+	cellScalar(&f[u], &ig[u], &g[u], &o[u], &prev_state[u], &curr_state[u], &curr_output[u], count - u);
+}
+//widened to int16 so madd can pair them up into int32 lanes, 16 bytes per step.
+//Shared with the AVX-512 table, which only assumes AVX-512F.
+__attribute__((target("avx2,fma")))
+static int32_t doti8Avx2(const int8_t *x, const int8_t *r, int k)
+{
+	__m256i acc = _mm256_setzero_si256();
+	int i = 0;
+	for(; i + 16 <= k; i += 16)
+	{
+		const __m256i a = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)&x[i]));
+		const __m256i b = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)&r[i]));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a, b));
+	}
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+	sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(sum) + doti8Scalar(&x[i], &r[i], k - i);
+}
+//F16C came in before AVX2, every CPU that gets this table has it. Shared with AVX-512.
+__attribute__((target("avx2,fma,f16c")))
+static void widenAvx2(const uint16_t *in, float *out, int count, bool bf16)
+{
+	int i = 0;
+	for(; i + 8 <= count; i += 8)
+	{
+		const __m128i h = _mm_loadu_si128((const __m128i *)&in[i]);
+		if(bf16)
+			_mm256_storeu_ps(&out[i], _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16)));
+		else
+			_mm256_storeu_ps(&out[i], _mm256_cvtph_ps(h));
+	}
+	widenScalar(&in[i], &out[i], count - i, bf16);
+}
+
+//    A V X - 5 1 2    //
+
+//tails are handled with masked loads and stores instead of a scalar loop
+#define TAIL_MASK(n) ((__mmask16)((1u << (n)) - 1))
+
+__attribute__((target("avx512f")))
+static inline __m512 exp512(__m512 x)
+{
+	x = _mm512_min_ps(x, _mm512_set1_ps(EXP_HI));
+	x = _mm512_max_ps(x, _mm512_set1_ps(EXP_LO));
+
+	__m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(LOG2E), _mm512_set1_ps(0.5f));
+	fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C1), x);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C2), x);
+
+	__m512 y = _mm512_set1_ps(EXP_P0);
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P1));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P2));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P3));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P4));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P5));
+	y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+	//scalef applies the 2^n without building the exponent bits by hand
+	return _mm512_scalef_ps(y, fx);
+}
+__attribute__((target("avx512f")))
+static inline __m512 sigmoid512(__m512 x)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	return _mm512_div_ps(one, _mm512_add_ps(one, exp512(_mm512_sub_ps(_mm512_setzero_ps(), x))));
+}
+__attribute__((target("avx512f")))
+static inline __m512 tanh512(__m512 x)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	__m512 e = exp512(_mm512_mul_ps(two, x));
+	return _mm512_sub_ps(one, _mm512_div_ps(two, _mm512_add_ps(e, one)));
+}
+__attribute__((target("avx512f")))
+static void dot4Avx512(const float *x, const float *r0, const float *r1, const float *r2, const float *r3, int k, float *out)
+{
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+	__m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+	int i = 0;
+	for(; i + 16 <= k; i += 16)
+	{
+		const __m512 v = _mm512_loadu_ps(&x[i]);
+		s0 = _mm512_fmadd_ps(v, _mm512_loadu_ps(&r0[i]), s0);
+		s1 = _mm512_fmadd_ps(v, _mm512_loadu_ps(&r1[i]), s1);
+		s2 = _mm512_fmadd_ps(v, _mm512_loadu_ps(&r2[i]), s2);
+		s3 = _mm512_fmadd_ps(v, _mm512_loadu_ps(&r3[i]), s3);
+	}
+	if(i < k)
+	{
+		const __mmask16 m = TAIL_MASK(k - i);
+		const __m512 v = _mm512_maskz_loadu_ps(m, &x[i]);
+		s0 = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m, &r0[i]), s0);
+		s1 = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m, &r1[i]), s1);
+		s2 = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m, &r2[i]), s2);
+		s3 = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(m, &r3[i]), s3);
+	}
+	out[0] = _mm512_reduce_add_ps(s0);
+	out[1] = _mm512_reduce_add_ps(s1);
+	out[2] = _mm512_reduce_add_ps(s2);
+	out[3] = _mm512_reduce_add_ps(s3);
+}
+__attribute__((target("avx512f")))
+static float dotAvx512(const float *x, const float *r, int k)
+{
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+	int i = 0;
+	for(; i + 32 <= k; i += 32)
+	{
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(&x[i]), _mm512_loadu_ps(&r[i]), s0);
+		s1 = _mm512_fmadd_ps(_mm512_loadu_ps(&x[i + 16]), _mm512_loadu_ps(&r[i + 16]), s1);
+	}
+	for(; i < k; i += 16)
+	{
+		const __mmask16 m = k - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(k - i);
+		s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, &x[i]), _mm512_maskz_loadu_ps(m, &r[i]), s0);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+}
+__attribute__((target("avx512f")))
+static void addAvx512(const float *a, const float *b, float *out, int count)
+{
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		_mm512_mask_storeu_ps(&out[i], m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, &a[i]), _mm512_maskz_loadu_ps(m, &b[i])));
+	}
+}
+__attribute__((target("avx512f")))
+static void mulAvx512(const float *a, const float *b, float *out, int count)
+{
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		_mm512_mask_storeu_ps(&out[i], m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, &a[i]), _mm512_maskz_loadu_ps(m, &b[i])));
+	}
+}
+__attribute__((target("avx512f")))
+static void sigmoidAvx512(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		_mm512_mask_storeu_ps(&out[i], m, sigmoid512(_mm512_maskz_loadu_ps(m, &in[i])));
+	}
+}
+__attribute__((target("avx512f")))
+static void tanhAvx512(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		_mm512_mask_storeu_ps(&out[i], m, tanh512(_mm512_maskz_loadu_ps(m, &in[i])));
+	}
+}
+//rcp14 is good to 14 bits
+__attribute__((target("avx512f")))
+static void sigmoidNativeAvx512(const float *in, float *out, int count)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		const __m512 e = exp512(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_maskz_loadu_ps(m, &in[i])));
+		_mm512_mask_storeu_ps(&out[i], m, _mm512_rcp14_ps(_mm512_add_ps(one, e)));
+	}
+}
+__attribute__((target("avx512f")))
+static void tanhNativeAvx512(const float *in, float *out, int count)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		const __m512 e = exp512(_mm512_mul_ps(two, _mm512_maskz_loadu_ps(m, &in[i])));
+		_mm512_mask_storeu_ps(&out[i], m, _mm512_fnmadd_ps(two, _mm512_rcp14_ps(_mm512_add_ps(e, one)), one));
+	}
+}
+__attribute__((target("avx512f")))
+static inline __m512 tanhRational512(__m512 x)
+{
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-TANH_CLAMP)), _mm512_set1_ps(TANH_CLAMP));
+	const __m512 x2 = _mm512_mul_ps(x, x);
+	__m512 p = _mm512_set1_ps(TANH_A13);
+	p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(TANH_A11));
+	p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(TANH_A9));
+	p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(TANH_A7));
+	p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(TANH_A5));
+	p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(TANH_A3));
+	p = _mm512_fmadd_ps(p, x2, _mm512_set1_ps(TANH_A1));
+	__m512 q = _mm512_set1_ps(TANH_B6);
+	q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(TANH_B4));
+	q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(TANH_B2));
+	q = _mm512_fmadd_ps(q, x2, _mm512_set1_ps(TANH_B0));
+	return _mm512_div_ps(_mm512_mul_ps(x, p), q);
+}
+__attribute__((target("avx512f")))
+static void sigmoidRationalAvx512(const float *in, float *out, int count)
+{
+	const __m512 half = _mm512_set1_ps(0.5f);
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		const __m512 x = _mm512_mul_ps(half, _mm512_maskz_loadu_ps(m, &in[i]));
+		_mm512_mask_storeu_ps(&out[i], m, _mm512_fmadd_ps(half, tanhRational512(x), half));
+	}
+}
+__attribute__((target("avx512f")))
+static void tanhRationalAvx512(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		_mm512_mask_storeu_ps(&out[i], m, tanhRational512(_mm512_maskz_loadu_ps(m, &in[i])));
+	}
+}
+//masked off lanes load 0, which is a valid index, so the gathers need no mask
+__attribute__((target("avx512f")))
+static inline __m512 sigmoidLut512(__m512 x)
+{
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-LUT_RANGE)), _mm512_set1_ps(LUT_RANGE));
+	const __m512 t = _mm512_mul_ps(_mm512_add_ps(x, _mm512_set1_ps(LUT_RANGE)), _mm512_set1_ps(LUT_SCALE));
+	const __m512i i = _mm512_min_epi32(_mm512_cvttps_epi32(t), _mm512_set1_epi32(LUT_STEPS - 1));
+	const __m512 lo = _mm512_i32gather_ps(i, sigmoid_lut, 4);
+	const __m512 hi = _mm512_i32gather_ps(i, &sigmoid_lut[1], 4);
+	return _mm512_fmadd_ps(_mm512_sub_ps(t, _mm512_cvtepi32_ps(i)), _mm512_sub_ps(hi, lo), lo);
+}
+__attribute__((target("avx512f")))
+static void sigmoidLutAvx512(const float *in, float *out, int count)
+{
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		_mm512_mask_storeu_ps(&out[i], m, sigmoidLut512(_mm512_maskz_loadu_ps(m, &in[i])));
+	}
+}
+__attribute__((target("avx512f")))
+static void tanhLutAvx512(const float *in, float *out, int count)
+{
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	for(int i = 0; i < count; i += 16)
+	{
+		const __mmask16 m = count - i >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - i);
+		const __m512 x = _mm512_mul_ps(two, _mm512_maskz_loadu_ps(m, &in[i]));
+		_mm512_mask_storeu_ps(&out[i], m, _mm512_fmsub_ps(two, sigmoidLut512(x), one));
+	}
+}
+__attribute__((target("avx512f")))
+static void cellAvx512(const float *f, const float *ig, const float *g, const float *o,
+			const float *prev_state, float *curr_state, float *curr_output, int count)
+{
+	for(int u = 0; u < count; u += 16)
+	{
+		const __mmask16 m = count - u >= 16 ? (__mmask16)0xFFFF : TAIL_MASK(count - u);
+		__m512 c = _mm512_mul_ps(_mm512_maskz_loadu_ps(m, &f[u]), _mm512_maskz_loadu_ps(m, &prev_state[u]));
+		c = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, &ig[u]), _mm512_maskz_loadu_ps(m, &g[u]), c);
+		_mm512_mask_storeu_ps(&curr_state[u], m, c);
+		_mm512_mask_storeu_ps(&curr_output[u], m, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, &o[u]), tanh512(c)));
+	}
+}
+
+//the scalar path has no reciprocal estimate, its native activations are the exact ones
+static const cpuKernels scalar_kernels = {"scalar", dot4Scalar, dotScalar, addScalar, mulScalar,
+	{sigmoidScalar, sigmoidScalar, sigmoidRationalScalar, sigmoidLutScalar},
+	{tanhScalar, tanhScalar, tanhRationalScalar, tanhLutScalar},
+	cellScalar, doti8Scalar, widenScalar};
+static const cpuKernels avx2_kernels = {"avx2", dot4Avx2, dotAvx2, addAvx2, mulAvx2,
+	{sigmoidAvx2, sigmoidNativeAvx2, sigmoidRationalAvx2, sigmoidLutAvx2},
+	{tanhAvx2, tanhNativeAvx2, tanhRationalAvx2, tanhLutAvx2},
+	cellAvx2, doti8Avx2, widenAvx2};
+static const cpuKernels avx512_kernels = {"avx512", dot4Avx512, dotAvx512, addAvx512, mulAvx512,
+	{sigmoidAvx512, sigmoidNativeAvx512, sigmoidRationalAvx512, sigmoidLutAvx512},
+	{tanhAvx512, tanhNativeAvx512, tanhRationalAvx512, tanhLutAvx512},
+	cellAvx512, doti8Avx2, widenAvx2};
+
+static const cpuKernels *kernels = NULL;
+static activation_mode activation = ACT_EXACT;
+
+//    S E T U P    //
+
+//Picks the widest ISA the CPU reports through CPUID. RNN_CPU_ISA=scalar|avx2|avx512
+//caps the choice, which is how the paths get benchmarked against each other.
+static std::once_flag cpu_setup;
+
+//everything it sets is published to other threads by call_once
+static void initCpuEnv()
+{
+	__builtin_cpu_init();
+	const char *cap = getenv("RNN_CPU_ISA");
+
+	kernels = &scalar_kernels;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && !(cap && !strcmp(cap, "scalar")))
+		kernels = &avx2_kernels;
+	if(__builtin_cpu_supports("avx512f") && !(cap && (!strcmp(cap, "scalar") || !strcmp(cap, "avx2"))))
+		kernels = &avx512_kernels;
+
+	for(int i = 0; i <= LUT_STEPS; i++)
+		sigmoid_lut[i] = 1.0/(1.0 + exp(-(-LUT_RANGE + i/(double)LUT_SCALE)));
+	activation = activationFromEnv();
+
+	printf("Using %s CPU kernels with %s activations for calculation.\n", kernels->name, activation_names[activation]);
+}
+bool setupCpuEnv()
+{
+	std::call_once(cpu_setup, initCpuEnv);
+	return true;
+}
+void setActivationCpu(activation_mode mode)
+{
+	setupCpuEnv();
+	activation = mode;
+}
+activation_mode activationCpu()
+{
+	setupCpuEnv();
+	return activation;
+}
+const char *cpuIsaName()
+{
+	setupCpuEnv();
+	return kernels->name;
+}
+float *allocCpu(size_t count)
+{
+	float *p = NULL;
+	if(posix_memalign((void **)&p, CPU_ALIGN, sizeof(float)*(count ? count : 1)))
+		perror("posix_memalign");
+	return p;
+}
+void freeCpu(float *p)
+{
+	free(p);
+}
+
+//    O P E R A T I O N S    //
+
+//four rows of b share each load of a, and each block of four b rows stays in cache
+//while every row of a goes past it. With a batch in a that reuses each weight B times.
+void matrixMultiplyCpu(const float *a, const float *b, float *output, int m, int n, int k)
+{
+	setupCpuEnv();
+	int col = 0;
+	for(; col + 4 <= n; col += 4)
+	{
+		const float *r0 = &b[INDEX(col, 0, k)];
+		const float *r1 = &b[INDEX(col + 1, 0, k)];
+		const float *r2 = &b[INDEX(col + 2, 0, k)];
+		const float *r3 = &b[INDEX(col + 3, 0, k)];
+		for(int row = 0; row < m; row++)
+			kernels->dot4(&a[INDEX(row, 0, k)], r0, r1, r2, r3, k, &output[INDEX(row, col, n)]);
+	}
+	for(; col < n; col++)
+	{
+		for(int row = 0; row < m; row++)
+			output[INDEX(row, col, n)] = kernels->dot(&a[INDEX(row, 0, k)], &b[INDEX(col, 0, k)], k);
+	}
+}
+//matrixMultiplyCpu over 16-bit b. Each block of four b rows is widened once into a small
+//per-thread buffer and then shared by every row of a, so memory only ever sees the 16-bit
+//weights and the conversion costs 1/m of the multiply.
+static thread_local float *wide_rows = NULL;
+static thread_local int wide_cap = 0;
+void matrixMultiplyHalfCpu(const float *a, const uint16_t *b, float *output, int m, int n, int k, bool bf16)
+{
+	setupCpuEnv();
+	if(wide_cap < 4*k)
+	{
+		freeCpu(wide_rows);
+		wide_rows = allocCpu(4*k);
+		wide_cap = 4*k;
+	}
+	int col = 0;
+	for(; col + 4 <= n; col += 4)
+	{
+		kernels->widen(&b[INDEX(col, 0, k)], wide_rows, 4*k, bf16);
+		for(int row = 0; row < m; row++)
+			kernels->dot4(	&a[INDEX(row, 0, k)], wide_rows, &wide_rows[k], &wide_rows[2*k], &wide_rows[3*k],
+					k, &output[INDEX(row, col, n)]);
+	}
+	for(; col < n; col++)
+	{
+		kernels->widen(&b[INDEX(col, 0, k)], wide_rows, k, bf16);
+		for(int row = 0; row < m; row++)
+			output[INDEX(row, col, n)] = kernels->dot(&a[INDEX(row, 0, k)], wide_rows, k);
+	}
+}
+void matrixAddCpu(const float *a, const float *b, float *output, int count)
+{
+	setupCpuEnv();
+	kernels->add(a, b, output, count);
+}
+void matrixElemMulCpu(const float *a, const float *b, float *output, int count)
+{
+	setupCpuEnv();
+	kernels->mul(a, b, output, count);
+}
+void sigmoidCpu(const float *in, float *out, int count)
+{
+	setupCpuEnv();
+	kernels->sigmoid[activation](in, out, count);
+}
+void tanhCpu(const float *in, float *out, int count)
+{
+	setupCpuEnv();
+	kernels->tanh[activation](in, out, count);
+}
+void matrixConcatCpu(const float *a, const float *b, float *output, int rows, int a_cols, int b_cols)
+{
+	const int width = a_cols + b_cols;
+	for(int r = 0; r < rows; r++)
+	{
+		memcpy(&output[INDEX(r, 0, width)], &a[INDEX(r, 0, a_cols)], sizeof(float)*a_cols);
+		memcpy(&output[INDEX(r, a_cols, width)], &b[INDEX(r, 0, b_cols)], sizeof(float)*b_cols);
+	}
+}
+void bilstmConcatCpu(const float *fwd, const float *bwd, float *output, int steps, int batch, int n_hidden)
+{
+	for(int t = 0; t < steps; t++)
+	{
+		for(int r = 0; r < batch; r++)
+		{
+			const int row = t*batch + r;
+			memcpy(&output[INDEX(row, 0, 2*n_hidden)], &fwd[INDEX(row, 0, n_hidden)], sizeof(float)*n_hidden);
+			memcpy(&output[INDEX(row, n_hidden, 2*n_hidden)], &bwd[INDEX((steps - 1 - t)*batch + r, 0, n_hidden)],
+				sizeof(float)*n_hidden);
+		}
+	}
+}
+//bias, activations and state update for one row of gate pre-activations, in place
+static void cellRow(float *row, const float *bias,
+			const float *prev_state, float *curr_state, float *curr_output, int n_hidden)
+{
+	kernels->add(row, bias, row, NUM_GATES*n_hidden);
+
+	float *f = &row[GATE_FORGET*n_hidden];
+	float *i = &row[GATE_INPUT*n_hidden];
+	float *g = &row[GATE_INTERNAL*n_hidden];
+	float *o = &row[GATE_OUTPUT*n_hidden];
+	kernels->sigmoid[activation](f, f, n_hidden);
+	kernels->sigmoid[activation](i, i, n_hidden);
+	kernels->tanh[activation](g, g, n_hidden);
+	kernels->sigmoid[activation](o, o, n_hidden);
+	if(activation == ACT_EXACT)
+	{
+		kernels->cell(f, i, g, o, prev_state, curr_state, curr_output, n_hidden);
+		return;
+	}
+	//the fused cell has the exact tanh built in, the gates stay intact for training
+	kernels->mul(i, g, curr_output, n_hidden);
+	kernels->mul(f, prev_state, curr_state, n_hidden);
+	kernels->add(curr_state, curr_output, curr_state, n_hidden);
+	kernels->tanh[activation](curr_state, curr_output, n_hidden);
+	kernels->mul(o, curr_output, curr_output, n_hidden);
+}
+//every batch row of gate pre-activations, plus the projected input half when there is one
+static void cellRows(float *gates, const float *proj, const float *bias,
+			const float *prev_state, float *curr_state, float *curr_output, int n_hidden, int batch)
+{
+	const int gate_width = NUM_GATES*n_hidden;
+	for(int b = 0; b < batch; b++)
+	{
+		float *row = &gates[INDEX(b, 0, gate_width)];
+		if(proj)
+			kernels->add(row, &proj[INDEX(b, 0, gate_width)], row, gate_width);
+		cellRow(	row, bias,
+				&prev_state[INDEX(b, 0, n_hidden)],
+				&curr_state[INDEX(b, 0, n_hidden)],
+				&curr_output[INDEX(b, 0, n_hidden)],
+				n_hidden);
+	}
+}
+//Batched step: one matmul of the B x (H + I) concatenation against all packed gate weights,
+//then the activations and the state update run vectorised along each row.
+void lstmCellCpu(const float *prev_output, const float *curr_input,
+		const float *weights, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_in, int n_hidden, int batch, float *scratch)
+{
+	setupCpuEnv();
+	const int width = n_hidden + n_in;
+	const int gate_width = NUM_GATES*n_hidden;
+	float *gates = scratch;
+	float *concat = &scratch[batch*gate_width];
+
+	matrixConcatCpu(prev_output, curr_input, concat, batch, n_hidden, n_in);
+	matrixMultiplyCpu(concat, weights, gates, batch, gate_width, width);
+	cellRows(gates, NULL, bias, prev_state, curr_state, curr_output, n_hidden, batch);
+}
+void lstmCellHalfCpu(const float *prev_output, const float *curr_input,
+		const uint16_t *weights, bool bf16, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_in, int n_hidden, int batch, float *scratch)
+{
+	setupCpuEnv();
+	const int width = n_hidden + n_in;
+	const int gate_width = NUM_GATES*n_hidden;
+	float *gates = scratch;
+	float *concat = &scratch[batch*gate_width];
+
+	matrixConcatCpu(prev_output, curr_input, concat, batch, n_hidden, n_in);
+	matrixMultiplyHalfCpu(concat, weights, gates, batch, gate_width, width, bf16);
+	cellRows(gates, NULL, bias, prev_state, curr_state, curr_output, n_hidden, batch);
+}
+//Same step with the input half already done: only h goes through the recurrent weights.
+void lstmCellProjectedCpu(const float *prev_output, const float *proj,
+		const float *weights_h, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_hidden, int batch, float *scratch)
+{
+	setupCpuEnv();
+	matrixMultiplyCpu(prev_output, weights_h, scratch, batch, NUM_GATES*n_hidden, n_hidden);
+	cellRows(scratch, proj, bias, prev_state, curr_state, curr_output, n_hidden, batch);
+}
+void lstmCellProjectedHalfCpu(const float *prev_output, const float *proj,
+		const uint16_t *weights_h, bool bf16, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_hidden, int batch, float *scratch)
+{
+	setupCpuEnv();
+	matrixMultiplyHalfCpu(prev_output, weights_h, scratch, batch, NUM_GATES*n_hidden, n_hidden, bf16);
+	cellRows(scratch, proj, bias, prev_state, curr_state, curr_output, n_hidden, batch);
+}
+
+//    1 6 - B I T   S T O R A G E    //
+
+//round to nearest even, overflow goes to infinity and NaN stays NaN
+static uint16_t floatToHalf(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	const uint16_t sign = (x >> 16) & 0x8000;
+	x &= 0x7fffffff;
+	if(x >= 0x7f800000)
+		return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+	//65520 and up rounds past the largest half
+	if(x >= 0x477ff000)
+		return sign | 0x7c00;
+	//below 2^-14 the result is subnormal, mant*2^-24
+	if(x < 0x38800000)
+	{
+		float a;
+		memcpy(&a, &x, sizeof(a));
+		return sign | (uint16_t)lrintf(a*16777216.0f);
+	}
+	//rebias the exponent from 127 to 15 and round off 13 mantissa bits
+	x += 0xc8000fff + ((x >> 13) & 1);
+	return sign | (x >> 13);
+}
+static uint16_t floatToBf16(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	if((x & 0x7fffffff) > 0x7f800000)
+		return (x >> 16) | 0x40;
+	return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+void floatToHalfCpu(const float *in, uint16_t *out, size_t count, bool bf16)
+{
+	for(size_t i = 0; i < count; i++)
+		out[i] = bf16 ? floatToBf16(in[i]) : floatToHalf(in[i]);
+}
+void halfToFloatCpu(const uint16_t *in, float *out, size_t count, bool bf16)
+{
+	setupCpuEnv();
+	kernels->widen(in, out, count, bf16);
+}
+
+//    I N T 8    //
+
+//symmetric per-row quantization, row r is in[r] ~= out[r]*scales[r]
+void quantizeRowsCpu(const float *in, int8_t *out, float *scales, int rows, int cols)
+{
+	for(int r = 0; r < rows; r++)
+	{
+		const float *row = &in[INDEX(r, 0, cols)];
+		float absmax = 0.0f;
+		for(int c = 0; c < cols; c++)
+			absmax = fmaxf(absmax, fabsf(row[c]));
+		const float scale = absmax > 0.0f ? absmax/127.0f : 1.0f;
+		const float inv = 1.0f/scale;
+		for(int c = 0; c < cols; c++)
+			out[INDEX(r, c, cols)] = (int8_t)lrintf(row[c]*inv);
+		scales[r] = scale;
+	}
+}
+void matrixMultiplyI8Cpu(const int8_t *a, const int8_t *b, int32_t *output, int m, int n, int k)
+{
+	setupCpuEnv();
+	for(int col = 0; col < n; col++)
+	{
+		for(int row = 0; row < m; row++)
+			output[INDEX(row, col, n)] = kernels->doti8(&a[INDEX(row, 0, k)], &b[INDEX(col, 0, k)], k);
+	}
+}
+//The concatenated [h, x] rows are quantized on the fly with one scale per row, so the whole
+//product runs in int8 with int32 accumulators. Both scales are applied as the accumulators
+//turn back into gate pre-activations, right before the bias and activations.
+void lstmCellI8Cpu(const float *prev_output, const float *curr_input,
+		const int8_t *weights, const float *w_scales, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_in, int n_hidden, int batch, float *scratch)
+{
+	setupCpuEnv();
+	const int width = n_hidden + n_in;
+	const int gate_width = NUM_GATES*n_hidden;
+	float *gates = scratch;
+	float *concat = &gates[batch*gate_width];
+	float *a_scales = &concat[batch*width];
+	int32_t *acc = (int32_t *)&a_scales[batch];
+	int8_t *concat_q = (int8_t *)&acc[batch*gate_width];
+
+	matrixConcatCpu(prev_output, curr_input, concat, batch, n_hidden, n_in);
+	quantizeRowsCpu(concat, concat_q, a_scales, batch, width);
+	matrixMultiplyI8Cpu(concat_q, weights, acc, batch, gate_width, width);
+
+	for(int b = 0; b < batch; b++)
+	{
+		float *row = &gates[INDEX(b, 0, gate_width)];
+		for(int j = 0; j < gate_width; j++)
+			row[j] = (float)acc[INDEX(b, j, gate_width)]*w_scales[j]*a_scales[b];
+		cellRow(	row, bias,
+				&prev_state[INDEX(b, 0, n_hidden)],
+				&curr_state[INDEX(b, 0, n_hidden)],
+				&curr_output[INDEX(b, 0, n_hidden)],
+				n_hidden);
+	}
+}
+
+//    T R A I N I N G    //
+
+//cellRow keeps the activated gates in the row, which is all the backward pass needs from it
+void lstmPointwiseTrainCpu(float *acts, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output, int n_hidden, int batch)
+{
+	setupCpuEnv();
+	cellRows(acts, NULL, bias, prev_state, curr_state, curr_output, n_hidden, batch);
+}
+void lstmBackwardPointwiseCpu(const float *acts, const float *prev_state, const float *curr_state,
+		const float *d_out, const float *d_hidden, float *d_state, float *d_pre, int n_hidden, int batch)
+{
+	setupCpuEnv();
+	const int gate_width = NUM_GATES*n_hidden;
+	for(int b = 0; b < batch; b++)
+	{
+		const float *f = &acts[INDEX(b, GATE_FORGET*n_hidden, gate_width)];
+		const float *i = &acts[INDEX(b, GATE_INPUT*n_hidden, gate_width)];
+		const float *g = &acts[INDEX(b, GATE_INTERNAL*n_hidden, gate_width)];
+		const float *o = &acts[INDEX(b, GATE_OUTPUT*n_hidden, gate_width)];
+		float *dp = &d_pre[INDEX(b, 0, gate_width)];
+		//tanh(c) as the forward pass computed it, parked in the output gate block that is
+		//only written after each unit has read its value
+		kernels->tanh[activation](&curr_state[INDEX(b, 0, n_hidden)], &dp[GATE_OUTPUT*n_hidden], n_hidden);
+		for(int u = 0; u < n_hidden; u++)
+		{
+			const int at = INDEX(b, u, n_hidden);
+			const float tc = dp[GATE_OUTPUT*n_hidden + u];
+			const float dh = d_out[at] + d_hidden[at];
+			const float dc = d_state[at] + dh*o[u]*(1.0f - tc*tc);
+			d_state[at] = dc*f[u];
+
+			dp[GATE_FORGET*n_hidden + u] = dc*prev_state[at]*f[u]*(1.0f - f[u]);
+			dp[GATE_INPUT*n_hidden + u] = dc*g[u]*i[u]*(1.0f - i[u]);
+			dp[GATE_INTERNAL*n_hidden + u] = dc*i[u]*(1.0f - g[u]*g[u]);
+			dp[GATE_OUTPUT*n_hidden + u] = dh*tc*o[u]*(1.0f - o[u]);
+		}
+	}
+}
+void matrixMultiplyNnCpu(const float *a, const float *b, float *output, int m, int n, int k, int ldb)
+{
+	memset(output, 0, sizeof(float)*m*n);
+	for(int row = 0; row < m; row++)
+	{
+		float *out = &output[INDEX(row, 0, n)];
+		for(int i = 0; i < k; i++)
+		{
+			const float x = a[INDEX(row, i, k)];
+			const float *r = &b[INDEX(i, 0, ldb)];
+			for(int col = 0; col < n; col++)
+				out[col] += x*r[col];
+		}
+	}
+}
+void matrixMultiplyTnCpu(const float *a, const float *b, float *output, int m, int n, int k)
+{
+	for(int i = 0; i < k; i++)
+	{
+		const float *r = &b[INDEX(i, 0, n)];
+		for(int row = 0; row < m; row++)
+		{
+			const float x = a[INDEX(i, row, m)];
+			float *out = &output[INDEX(row, 0, n)];
+			for(int col = 0; col < n; col++)
+				out[col] += x*r[col];
+		}
+	}
+}
+void columnSumCpu(const float *a, float *output, int rows, int cols)
+{
+	for(int r = 0; r < rows; r++)
+	{
+		for(int col = 0; col < cols; col++)
+			output[col] += a[INDEX(r, col, cols)];
+	}
+}
+void axpyCpu(const float *x, float *y, float alpha, int count)
+{
+	for(int i = 0; i < count; i++)
+		y[i] += alpha*x[i];
+}
@@ -0,0 +1,91 @@
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "activation.h"
+
+//CPU implementations of the oclabstract operation set, for hosts without an accelerator.
+//Shapes follow oclabstract.h: matrices are row-major and the second matmul operand is
+//stored transposed. The ISA (AVX-512, AVX2+FMA or scalar) is picked once at runtime.
+
+//alignment of buffers from allocCpu, one AVX-512 register
+#define CPU_ALIGN 64
+
+//The kernels are picked on first use, by whichever thread gets there first while any others
+//wait for it, so there is nothing to set up before starting workers. Everything else here
+//is reentrant.
+bool setupCpuEnv();
+const char *cpuIsaName();
+//activation_mode of every sigmoid and tanh below, RNN_ACTIVATION until set
+void setActivationCpu(activation_mode mode);
+activation_mode activationCpu();
+float *allocCpu(size_t count);
+void freeCpu(float *p);
+
+//a is MxK, b is NxK (stored transposed), output is MxN
+void matrixMultiplyCpu(const float *a, const float *b, float *output, int m, int n, int k);
+void matrixAddCpu(const float *a, const float *b, float *output, int count);
+void matrixElemMulCpu(const float *a, const float *b, float *output, int count);
+void sigmoidCpu(const float *in, float *out, int count);
+void tanhCpu(const float *in, float *out, int count);
+//row-wise concatenation, output row r is [a row r, b row r]
+void matrixConcatCpu(const float *a, const float *b, float *output, int rows, int a_cols, int b_cols);
+//same as bilstmConcatCl
+void bilstmConcatCpu(const float *fwd, const float *bwd, float *output, int steps, int batch, int n_hidden);
+
+//fused timestep, same layout as lstmCellCl: weights is NUM_GATES*H x (H + I) in GATE_* order,
+//bias is NUM_GATES x H, the h/x/c operands are batch rows deep.
+//scratch must hold batch*(NUM_GATES*H + H + I) floats.
+void lstmCellCpu(const float *prev_output, const float *curr_input,
+		const float *weights, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_in, int n_hidden, int batch, float *scratch);
+//recurrent half of the step, the input half comes in as proj (batch x NUM_GATES*H, no bias).
+//weights_h is NUM_GATES*H x H, scratch must hold batch*NUM_GATES*H floats.
+void lstmCellProjectedCpu(const float *prev_output, const float *proj,
+		const float *weights_h, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_hidden, int batch, float *scratch);
+
+//16-bit weight storage, IEEE half or bfloat16 when bf16 is set. The rows are widened to
+//float inside the matmul, everything else including the bias stays float.
+void floatToHalfCpu(const float *in, uint16_t *out, size_t count, bool bf16);
+void halfToFloatCpu(const uint16_t *in, float *out, size_t count, bool bf16);
+void matrixMultiplyHalfCpu(const float *a, const uint16_t *b, float *output, int m, int n, int k, bool bf16);
+void lstmCellHalfCpu(const float *prev_output, const float *curr_input,
+		const uint16_t *weights, bool bf16, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_in, int n_hidden, int batch, float *scratch);
+void lstmCellProjectedHalfCpu(const float *prev_output, const float *proj,
+		const uint16_t *weights_h, bool bf16, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_hidden, int batch, float *scratch);
+
+//int8 weights with one float scale per output row, int32 accumulation
+void quantizeRowsCpu(const float *in, int8_t *out, float *scales, int rows, int cols);
+//raw int32 products, the caller applies the row scales
+void matrixMultiplyI8Cpu(const int8_t *a, const int8_t *b, int32_t *output, int m, int n, int k);
+//lstmCellCpu with int8 weights (NUM_GATES*H x (H + I)) and w_scales (NUM_GATES*H).
+//scratch must hold LSTM_I8_SCRATCH(batch, n_in, n_hidden) floats.
+#define LSTM_I8_SCRATCH(B, I, H) ((B)*(2*NUM_GATES*(H) + 2*((H) + (I)) + 1))
+void lstmCellI8Cpu(const float *prev_output, const float *curr_input,
+		const int8_t *weights, const float *w_scales, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output,
+		int n_in, int n_hidden, int batch, float *scratch);
+
+//Training, same as the oclabstract.h training functions with the rows already picked.
+//acts holds the gate pre-activations (no bias) and is left holding the activated gates.
+void lstmPointwiseTrainCpu(float *acts, const float *bias,
+		const float *prev_state, float *curr_state, float *curr_output, int n_hidden, int batch);
+void lstmBackwardPointwiseCpu(const float *acts, const float *prev_state, const float *curr_state,
+		const float *d_out, const float *d_hidden, float *d_state, float *d_pre, int n_hidden, int batch);
+//a is MxK, output is MxN from the first n columns of b (K x ldb)
+void matrixMultiplyNnCpu(const float *a, const float *b, float *output, int m, int n, int k, int ldb);
+//output += a^T*b, a is KxM and b is KxN
+void matrixMultiplyTnCpu(const float *a, const float *b, float *output, int m, int n, int k);
+//output += column sums of a
+void columnSumCpu(const float *a, float *output, int rows, int cols);
+void axpyCpu(const float *x, float *y, float alpha, int count);
+
+#endif
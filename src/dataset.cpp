@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "blockfile.h"
+#include "dataset.h"
+#include "trace.h"
+
+//channel order of the cache
+static const char *const har_channels[HAR_CHANNELS] = {
+	"body_acc_x", "body_acc_y", "body_acc_z",
+	"body_gyro_x", "body_gyro_y", "body_gyro_z",
+	"total_acc_x", "total_acc_y", "total_acc_z"
+};
+
+//lines per parse task, enough tasks that every thread stays busy when there are more
+//threads than channel files
+#define PARSE_CHUNK_LINES 256
+
+static std::string channelPath(const char *root, const char *split, unsigned channel)
+{
+	return std::string(root) + "/" + split + "/Inertial Signals/" + har_channels[channel] + "_" + split + ".txt";
+}
+static std::string labelPath(const char *root, const char *split)
+{
+	return std::string(root) + "/" + split + "/y_" + split + ".txt";
+}
+//total size and newest mtime of every text file of split, false if one is missing
+static bool sourceStats(const char *root, const char *split, uint64_t &bytes, int64_t &mtime)
+{
+	bytes = 0;
+	mtime = 0;
+	for(unsigned c = 0; c <= HAR_CHANNELS; c++)
+	{
+		const std::string path = c < HAR_CHANNELS ? channelPath(root, split, c) : labelPath(root, split);
+		struct stat st;
+		if(stat(path.c_str(), &st) != 0)
+			return false;
+		bytes += st.st_size;
+		if(st.st_mtime > mtime)
+			mtime = st.st_mtime;
+	}
+	return true;
+}
+
+//Runs fn(0) .. fn(tasks - 1) on up to threads threads, each taking the next task when it
+//finishes one.
+template <typename F>
+static void parallelFor(unsigned threads, size_t tasks, F fn)
+{
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> pool;
+	auto worker = [&]()
+	{
+		for(size_t t = next.fetch_add(1); t < tasks; t = next.fetch_add(1))
+			fn(t);
+	};
+	for(unsigned i = 1; i < threads && i < tasks; i++)
+		pool.push_back(std::thread(worker));
+	worker();
+	for(unsigned i = 0; i < pool.size(); i++)
+		pool[i].join();
+}
+
+//powers of ten that are exact in a double
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+//Parses the float at p (the text must end in a NUL) and returns the character after it,
+//or NULL if there is none. Up to 19 significant digits are gathered into an integer and
+//scaled by one exact power of ten in double, which only differs from strtof when the double
+//rounds onto a float halfway point. Anything longer or further out goes to strtof.
+static const char *parseFloat(const char *p, float &out)
+{
+	const char *start = p;
+	const bool neg = *p == '-';
+	if(*p == '-' || *p == '+')
+		p++;
+	uint64_t mantissa = 0;
+	int digits = 0, exp10 = 0;
+	bool any = false;
+	for(; *p >= '0' && *p <= '9'; p++, any = true)
+	{
+		if(digits < 19)
+		{
+			mantissa = mantissa*10 + (*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+			exp10++;
+	}
+	if(*p == '.')
+	{
+		for(p++; *p >= '0' && *p <= '9'; p++, any = true)
+		{
+			if(digits < 19)
+			{
+				mantissa = mantissa*10 + (*p - '0');
+				digits += mantissa != 0;
+				exp10--;
+			}
+		}
+	}
+	if(!any)
+		return NULL;
+	if(*p == 'e' || *p == 'E')
+	{
+		const char *e = p + 1;
+		const bool eneg = *e == '-';
+		if(*e == '-' || *e == '+')
+			e++;
+		if(*e >= '0' && *e <= '9')
+		{
+			int x = 0;
+			for(; *e >= '0' && *e <= '9'; e++)
+				x = x < 10000 ? x*10 + (*e - '0') : x;
+			exp10 += eneg ? -x : x;
+			p = e;
+		}
+	}
+	if(digits >= 19 || mantissa >= (1ull << 53) || exp10 > 22 || exp10 < -22)
+	{
+		char *end;
+		out = strtof(start, &end);
+		return end;
+	}
+	const double value = exp10 >= 0 ? (double)mantissa*pow10_table[exp10] : (double)mantissa/pow10_table[-exp10];
+	out = (float)(neg ? -value : value);
+	return p;
+}
+
+//whole file plus a NUL, and where each line with anything but whitespace on it starts
+struct textFile
+{
+	std::vector<char> text;
+	std::vector<size_t> lines;
+};
+static bool readText(const std::string &path, textFile &file)
+{
+	const int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		perror(path.c_str());
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		perror(path.c_str());
+		close(fd);
+		return false;
+	}
+	file.text.resize(st.st_size + 1);
+	size_t done = 0;
+	while(done < (size_t)st.st_size)
+	{
+		const ssize_t n = read(fd, &file.text[done], st.st_size - done);
+		if(n <= 0)
+			break;
+		done += n;
+	}
+	close(fd);
+	if(done != (size_t)st.st_size)
+	{
+		printf("Failed to read %s\n", path.c_str());
+		return false;
+	}
+	file.text[done] = '\0';
+
+	const char *text = file.text.data();
+	for(size_t pos = 0; pos < done;)
+	{
+		const char *nl = (const char *)memchr(text + pos, '\n', done - pos);
+		const size_t end = nl ? nl - text : done;
+		size_t p = pos;
+		while(p < end && isSpace(text[p]))
+			p++;
+		if(p < end)
+			file.lines.push_back(pos);
+		pos = end + 1;
+	}
+	return true;
+}
+
+//Reads the channel files one per thread, then parses them in PARSE_CHUNK_LINES chunks
+//straight into the interleaved [window][timestep][channel] layout.
+static bool parseHar(const char *root, const char *split, unsigned threads, std::vector<float> &data,
+			std::vector<uint32_t> &labels)
+{
+	traceScope span("parseHar");
+	textFile files[HAR_CHANNELS];
+	std::atomic<bool> ok(true);
+	parallelFor(threads, HAR_CHANNELS, [&](size_t c)
+	{
+		if(!readText(channelPath(root, split, c), files[c]))
+			ok = false;
+	});
+	if(!ok)
+		return false;
+	const size_t windows = files[0].lines.size();
+	for(unsigned c = 1; c < HAR_CHANNELS; c++)
+	{
+		if(files[c].lines.size() != windows)
+		{
+			printf("%s has %zu windows, %s has %zu\n", channelPath(root, split, c).c_str(), files[c].lines.size(),
+				channelPath(root, split, 0).c_str(), windows);
+			return false;
+		}
+	}
+
+	data.resize(windows*HAR_STEPS*HAR_CHANNELS);
+	const size_t chunks = (windows + PARSE_CHUNK_LINES - 1)/PARSE_CHUNK_LINES;
+	parallelFor(threads, HAR_CHANNELS*chunks, [&](size_t task)
+	{
+		const unsigned c = task % HAR_CHANNELS;
+		const size_t first = task/HAR_CHANNELS*PARSE_CHUNK_LINES;
+		const size_t last = first + PARSE_CHUNK_LINES < windows ? first + PARSE_CHUNK_LINES : windows;
+		for(size_t w = first; w < last && ok; w++)
+		{
+			const char *p = &files[c].text[files[c].lines[w]];
+			float *out = &data[w*HAR_STEPS*HAR_CHANNELS + c];
+			for(unsigned t = 0; t < HAR_STEPS; t++)
+			{
+				while(isSpace(*p))
+					p++;
+				p = parseFloat(p, out[t*HAR_CHANNELS]);
+				if(!p)
+				{
+					printf("%s: line %zu has fewer than %d values\n", channelPath(root, split, c).c_str(), w + 1,
+						HAR_STEPS);
+					ok = false;
+					break;
+				}
+			}
+		}
+	});
+	if(!ok)
+		return false;
+
+	textFile y;
+	if(!readText(labelPath(root, split), y))
+		return false;
+	if(y.lines.size() != windows)
+	{
+		printf("%s has %zu labels for %zu windows\n", labelPath(root, split).c_str(), y.lines.size(), windows);
+		return false;
+	}
+	labels.resize(windows);
+	for(size_t w = 0; w < windows; w++)
+	{
+		const unsigned long label = strtoul(&y.text[y.lines[w]], NULL, 10);
+		if(label < 1 || label > HAR_CLASSES)
+		{
+			printf("%s: line %zu is not an activity\n", labelPath(root, split).c_str(), w + 1);
+			return false;
+		}
+		labels[w] = label - 1;
+	}
+	return true;
+}
+//written under a temporary name and renamed, so a reader never maps a partial cache
+bool buildHarCache(const char *root, const char *split, const char *cache_path, unsigned threads)
+{
+	threads = threads ? threads : std::thread::hardware_concurrency();
+	threads = threads ? threads : 1;
+	datasetHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DATASET_MAGIC, sizeof(h.magic));
+	h.version = DATASET_VERSION;
+	if(!sourceStats(root, split, h.source_bytes, h.source_mtime))
+	{
+		printf("%s/%s is missing UCI HAR files\n", root, split);
+		return false;
+	}
+	std::vector<float> data;
+	std::vector<uint32_t> labels;
+	if(!parseHar(root, split, threads, data, labels))
+		return false;
+
+	const size_t window_bytes = sizeof(float)*HAR_STEPS*HAR_CHANNELS;
+	h.num_windows = labels.size();
+	h.steps = HAR_STEPS;
+	h.channels = HAR_CHANNELS;
+	h.window_stride = alignUp(window_bytes, DATASET_WINDOW_ALIGN);
+	h.data_offset = alignUp(sizeof(h), DATASET_ALIGN);
+	h.data_bytes = h.window_stride*h.num_windows;
+	h.label_offset = alignUp(h.data_offset + h.data_bytes, DATASET_ALIGN);
+	h.label_bytes = sizeof(uint32_t)*h.num_windows;
+
+	const std::string tmp = std::string(cache_path) + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if(!file)
+	{
+		perror(tmp.c_str());
+		return false;
+	}
+	bool ok = writeBlock(file, 0, &h, sizeof(h));
+	if(h.window_stride == window_bytes)
+		ok = ok && writeBlock(file, h.data_offset, data.data(), h.data_bytes);
+	for(size_t w = 0; ok && h.window_stride != window_bytes && w < h.num_windows; w++)
+		ok = writeBlock(file, h.data_offset + w*h.window_stride, &data[w*HAR_STEPS*HAR_CHANNELS], window_bytes);
+	ok = ok && writeBlock(file, h.label_offset, labels.data(), h.label_bytes);
+	if(fclose(file) != 0)
+		ok = false;
+	if(ok && rename(tmp.c_str(), cache_path) != 0)
+	{
+		perror(cache_path);
+		ok = false;
+	}
+	if(!ok)
+	{
+		printf("Failed to write dataset cache %s\n", cache_path);
+		unlink(tmp.c_str());
+	}
+	return ok;
+}
+
+//mapped with mapBlockFile as model files are, so windows can back CL_MEM_USE_HOST_PTR
+//buffers. A missing cache is not an error, loadHarDataset builds it.
+bool openDataset(const char *path, harDataset &dataset)
+{
+	dataset.map = NULL;
+	dataset.bytes = 0;
+	dataset.header = NULL;
+
+	size_t bytes;
+	void *map = mapBlockFile(path, sizeof(datasetHeader), "dataset cache", false, bytes);
+	if(!map)
+		return false;
+
+	const datasetHeader *h = (const datasetHeader *)map;
+	const char *err = NULL;
+	if(memcmp(h->magic, DATASET_MAGIC, sizeof(h->magic)) != 0)
+		err = "bad magic";
+	else if(h->version != DATASET_VERSION)
+		err = "unsupported version";
+	else if(h->steps == 0 || h->channels == 0 || h->window_stride < sizeof(float)*h->steps*h->channels ||
+		h->data_bytes != h->window_stride*h->num_windows || h->label_bytes != sizeof(uint32_t)*h->num_windows)
+		err = "shape does not match its block sizes";
+	else if(h->window_stride % DATASET_WINDOW_ALIGN)
+		err = "unaligned block";
+	if(!err)
+		err = checkBlock(h->data_offset, h->data_bytes, DATASET_ALIGN, bytes);
+	if(!err)
+		err = checkBlock(h->label_offset, h->label_bytes, DATASET_ALIGN, bytes);
+	if(err)
+	{
+		printf("%s: %s\n", path, err);
+		unmapBlockFile(map, bytes);
+		return false;
+	}
+
+	dataset.map = map;
+	dataset.bytes = bytes;
+	dataset.header = h;
+	return true;
+}
+void closeDataset(harDataset &dataset)
+{
+	unmapBlockFile(dataset.map, dataset.bytes);
+	dataset.map = NULL;
+	dataset.bytes = 0;
+	dataset.header = NULL;
+}
+const float *datasetWindow(const harDataset &dataset, unsigned window)
+{
+	return (const float *)((const char *)dataset.map + dataset.header->data_offset + window*dataset.header->window_stride);
+}
+const uint32_t *datasetLabels(const harDataset &dataset)
+{
+	return (const uint32_t *)((const char *)dataset.map + dataset.header->label_offset);
+}
+
+//a cache is used as it is when the text files are gone
+bool loadHarDataset(const char *root, const char *split, harDataset &dataset, const char *cache_path, unsigned threads)
+{
+	traceScope span("loadHarDataset");
+	const std::string path = cache_path ? std::string(cache_path)
+					: std::string(root) + "/" + split + "/har_" + split + ".bin";
+	uint64_t bytes;
+	int64_t mtime;
+	const bool sources = sourceStats(root, split, bytes, mtime);
+	if(openDataset(path.c_str(), dataset))
+	{
+		if(!sources || (dataset.header->source_bytes == bytes && dataset.header->source_mtime == mtime))
+			return true;
+		closeDataset(dataset);
+	}
+	return buildHarCache(root, split, path.c_str(), threads) && openDataset(path.c_str(), dataset);
+}
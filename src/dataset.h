@@ -0,0 +1,73 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//UCI HAR inertial signals. Each split (train, test) has one text file per channel under
+//<root>/<split>/Inertial Signals/, <channel>_<split>.txt with one window of HAR_STEPS
+//whitespace separated floats per line, and the activity of every window in
+//<root>/<split>/y_<split>.txt.
+//
+//Parsing the text is slow, so the first load writes a binary cache next to it that later
+//runs mmap, the same way as model files:
+//
+//	offset 0:	datasetHeader
+//	then:		windows, num_windows x steps x channels floats ([window][timestep][channel],
+//			the layout LSTMCell::forwardSequence and DataParallelTrainer take with
+//			n_in = channels), every window starting on a DATASET_WINDOW_ALIGN boundary
+//			window_stride bytes apart, and labels (num_windows uint32, the activity
+//			minus one), each block starting on a DATASET_ALIGN boundary
+//
+//All fields are little endian.
+
+#define DATASET_MAGIC "RNNHAR\0\0"
+#define DATASET_VERSION 1
+#define DATASET_ALIGN 4096
+//a full cache line, so aligned loads of any width up to 512 bits work from a window start
+#define DATASET_WINDOW_ALIGN 64
+
+#define HAR_STEPS 128
+#define HAR_CHANNELS 9
+#define HAR_CLASSES 6
+
+struct datasetHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_windows;
+	uint32_t steps;
+	uint32_t channels;
+	uint64_t window_stride;
+	uint64_t data_offset;
+	uint64_t data_bytes;
+	uint64_t label_offset;
+	uint64_t label_bytes;
+	//total size and newest mtime of the text files the cache was built from, a cache that
+	//no longer matches them is rebuilt
+	uint64_t source_bytes;
+	int64_t source_mtime;
+};
+
+//an open cache, windows stay valid until closeDataset
+struct harDataset
+{
+	void *map;
+	size_t bytes;
+	const datasetHeader *header;
+};
+
+//Opens <cache_path>, or when it is missing or stale parses the text files of split with
+//threads threads (0 for one per core), writes the cache and opens that. cache_path may be
+//NULL for <root>/<split>/har_<split>.bin.
+bool loadHarDataset(const char *root, const char *split, harDataset &dataset, const char *cache_path = NULL,
+			unsigned threads = 0);
+//Parses the text files and writes the cache without opening it.
+bool buildHarCache(const char *root, const char *split, const char *cache_path, unsigned threads = 0);
+bool openDataset(const char *path, harDataset &dataset);
+void closeDataset(harDataset &dataset);
+//steps x channels floats, DATASET_WINDOW_ALIGN aligned
+const float *datasetWindow(const harDataset &dataset, unsigned window);
+const uint32_t *datasetLabels(const harDataset &dataset);
+
+#endif
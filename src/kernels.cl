@@ -1,4 +1,4 @@
-/* 
+/*
 Filename: kernels.cl
 Author: Zach Sherer
 Purpose: Kernels for the LSTM.
@@ -8,73 +8,1357 @@ Acknowledgements:
 Date		|	Change
 --------------------------------------------------------------------------------------
 11/04/18	|	File created to provide the acceleration for the LSTM.
+10/16/26	|	Switched to float to match the cl_float host tensors. matrix_mul and
+		|	matrix_concat take their shapes as arguments, added matrix_elem_mul.
+		|
+10/16/26	|	Added lstm_cell, the sigpass idea carried through to a whole timestep.
+		|
+10/16/26	|	Added lstm_sequence, a single work group that runs a whole window.
+		|
+10/16/26	|	Batch dimension for the LSTM kernels, added lstm_pointwise for the
+		|	GEMM based batched step.
+		|
+10/16/26	|	Added lstm_cell_projected for steps whose input projection is cached.
+		|
+10/16/26	|	Added lstm_sequence_projected, the persistent loop for split weights.
+		|
+10/16/26	|	Added lstm_cell_i8 for int8 weights with per-row scales.
+		|
+10/16/26	|	fp16/bf16 storage for weights, biases and projections, converted
+		|	as it is loaded and stored with all arithmetic in float.
+		|
+10/16/26	|	matrix_mul takes a per_item column count for the autotuner and
+		|	bounds checks its range, which is now rounded up to the work group.
+		|
+10/16/26	|	matrix_mul is now a tiled, register blocked GEMM, and matrix_vec_mul
+		|	covers products with only a few rows of a.
+		|
+10/16/26	|	The LSTM kernels take their sizes from SPEC_N_IN/SPEC_N_HIDDEN when
+		|	the program is built for one shape.
+		|
+10/16/26	|	Added bilstm_concat to join the two directions of a BiLSTM.
+		|
+10/16/26	|	Training kernels for backpropagation through time.
+		|
+10/16/26	|	sigmoid_f/tanh_f pick the activation implementation (ACTIVATION)
+		|	for every kernel.
+		|
+10/16/26	|	Added quantize_rows and matrix_vec_mul_i8 for the batched int8 step.
+		|
+10/16/26	|	Added gemm_geometry so the host can read back the matrix_mul tiling.
+		|
+10/16/26	|	matrix_mul_nn and matrix_mul_tn are transposed variants of the tiled
+		|	matrix_mul, sharing its tiling.
 
 */
 
 #define X 0
 #define Y 1
-#define SOURCES 6
-#define PREV_GROUP 0
-#define CURR_GROUP 1
+#define MAX_WINDOW_SIZE 1024
+#define MAX_UNITS_PER_ITEM 8
+#define MAX_COLS_PER_ITEM 4
 
+//matrix_mul tiling: GEMM_TILE square output tiles, GEMM_TILE_K deep slices of K, and
+//GEMM_WPT x GEMM_WPT outputs per work item. GEMM_TILE_K must be a multiple of 4. Any of them
+//may be set with -D, the host reads the work group size and tile back from the program
+//(gemm_geometry) and the autotuner builds programs with other tilings to try.
+#ifndef GEMM_TILE
+#define GEMM_TILE 32
+#endif
+#ifndef GEMM_TILE_K
+#define GEMM_TILE_K 16
+#endif
+#ifndef GEMM_WPT
+#define GEMM_WPT 4
+#endif
+#define GEMM_LOCAL (GEMM_TILE/GEMM_WPT)
+//matrix_vec_mul: most rows of a it takes and the K slice staged at a time (a multiple of 4)
+#define GEMV_MAX_ROWS 8
+#define GEMV_TILE_K 128
+
+//Shape specialization. A program built with -DSPEC_N_IN=<I> -DSPEC_N_HIDDEN=<H> ignores the
+//size arguments of the LSTM kernels and uses the constants instead, so every loop over the
+//hidden or input size has a trip count the compiler knows.
+#ifdef SPEC_N_IN
+#define N_IN(ARG) SPEC_N_IN
+#else
+#define N_IN(ARG) (ARG)
+#endif
+#ifdef SPEC_N_HIDDEN
+#define N_HIDDEN(ARG) SPEC_N_HIDDEN
+#else
+#define N_HIDDEN(ARG) (ARG)
+#endif
+
+//Activation implementation, from -DACTIVATION=<mode>, see activation.h for the error of
+//each. Must match activation_mode there.
+#define ACT_EXACT 0
+#define ACT_NATIVE 1
+#define ACT_RATIONAL 2
+#define ACT_LUT 3
+#ifndef ACTIVATION
+#define ACTIVATION ACT_EXACT
+#endif
+#define LUT_RANGE 16
+#define LUT_STEPS 512
+
+#if ACTIVATION == ACT_LUT
+//sigmoid at -LUT_RANGE + i*2*LUT_RANGE/LUT_STEPS
+__constant float sigmoid_lut[LUT_STEPS + 1] = {
+	1.12535162e-07f, 1.19793056e-07f, 1.27519043e-07f, 1.35743313e-07f, 1.44498004e-07f, 1.53817323e-07f,
+	1.63737686e-07f, 1.74297858e-07f, 1.85539102e-07f, 1.97505343e-07f, 2.10243341e-07f, 2.23802869e-07f,
+	2.3823691e-07f, 2.53601867e-07f, 2.69957777e-07f, 2.87368553e-07f, 3.05902227e-07f, 3.25631219e-07f,
+	3.46632621e-07f, 3.68988496e-07f, 3.927862e-07f, 4.18118723e-07f, 4.45085052e-07f, 4.73790558e-07f,
+	5.04347408e-07f, 5.36875004e-07f, 5.71500447e-07f, 6.08359037e-07f, 6.47594798e-07f, 6.89361046e-07f,
+	7.33820981e-07f, 7.81148331e-07f, 8.31528028e-07f, 8.8515693e-07f, 9.42244594e-07f, 1.00301409e-06f,
+	1.06770287e-06f, 1.13656371e-06f, 1.20986568e-06f, 1.28789522e-06f, 1.37095721e-06f, 1.45937622e-06f,
+	1.55349775e-06f, 1.65368959e-06f, 1.76034321e-06f, 1.87387538e-06f, 1.99472972e-06f, 2.12337846e-06f,
+	2.2603243e-06f, 2.40610234e-06f, 2.56128221e-06f, 2.72647027e-06f, 2.90231199e-06f, 3.08949445e-06f,
+	3.28874907e-06f, 3.50085441e-06f, 3.72663928e-06f, 3.96698591e-06f, 4.22283344e-06f, 4.49518158e-06f,
+	4.78509449e-06f, 5.093705e-06f, 5.42221897e-06f, 5.77192003e-06f, 6.1441746e-06f, 6.54043723e-06f,
+	6.96225625e-06f, 7.41127987e-06f, 7.88926259e-06f, 8.39807203e-06f, 8.9396963e-06f, 9.51625169e-06f,
+	1.0129991e-05f, 1.07833122e-05f, 1.14787681e-05f, 1.2219076e-05f, 1.30071285e-05f, 1.38460046e-05f,
+	1.4738982e-05f, 1.56895497e-05f, 1.67014218e-05f, 1.77785519e-05f, 1.89251482e-05f, 2.01456909e-05f,
+	2.14449484e-05f, 2.28279972e-05f, 2.43002407e-05f, 2.58674311e-05f, 2.75356911e-05f, 2.93115386e-05f,
+	3.12019114e-05f, 3.32141949e-05f, 3.53562507e-05f, 3.76364472e-05f, 4.00636922e-05f, 4.26474682e-05f,
+	4.53978687e-05f, 4.83256382e-05f, 5.14422137e-05f, 5.47597698e-05f, 5.82912657e-05f, 6.2050496e-05f,
+	6.60521449e-05f, 7.03118427e-05f, 7.48462275e-05f, 7.96730099e-05f, 8.48110417e-05f, 9.02803902e-05f,
+	9.61024155e-05f, 0.000102299855f, 0.00010889691f, 0.000115919343f, 0.000123394576f, 0.000131351797f,
+	0.000139822076f, 0.000148838483f, 0.000158436219f, 0.000168652754f, 0.000179527969f, 0.000191104316f,
+	0.000203426978f, 0.00021654405f, 0.000230506722f, 0.000245369481f, 0.000261190319f, 0.000278030964f,
+	0.000295957114f, 0.000315038694f, 0.00033535013f, 0.000356970635f, 0.000379984515f, 0.000404481498f,
+	0.000430557081f, 0.000458312901f, 0.000487857123f, 0.000519304864f, 0.000552778637f, 0.000588408819f,
+	0.000626334158f, 0.000666702309f, 0.000709670399f, 0.000755405633f, 0.000804085936f, 0.000855900637f,
+	0.000911051194f, 0.000969751968f, 0.00103223104f, 0.00109873107f, 0.00116951027f, 0.0012448433f,
+	0.00132502242f, 0.0014103585f, 0.00150118226f, 0.00159784549f, 0.00170072241f, 0.00181021103f,
+	0.00192673466f, 0.00205074354f, 0.00218271645f, 0.00232316252f, 0.00247262316f, 0.00263167397f,
+	0.00280092697f, 0.00298103273f, 0.00317268284f, 0.00337661238f, 0.00359360258f, 0.00382448364f,
+	0.00407013772f, 0.00433150202f, 0.00460957218f, 0.00490540571f, 0.00522012569f, 0.0055549247f,
+	0.00591106886f, 0.00628990214f, 0.00669285092f, 0.00712142875f, 0.00757724127f, 0.00806199153f,
+	0.00857748541f, 0.00912563739f, 0.00970847648f, 0.0103281525f, 0.0109869426f, 0.011687258f,
+	0.0124316509f, 0.0132228218f, 0.014063627f, 0.0149570866f, 0.0159063917f, 0.0169149133f,
+	0.01798621f, 0.0191240368f, 0.0203323533f, 0.0216153328f, 0.0229773699f, 0.0244230901f,
+	0.0259573572f, 0.0275852822f, 0.0293122308f, 0.0311438305f, 0.0330859784f, 0.0351448464f,
+	0.0373268873f, 0.0396388391f, 0.0420877279f, 0.0446808703f, 0.0474258732f, 0.0503306326f,
+	0.0534033298f, 0.0566524253f, 0.0600866502f, 0.0637149943f, 0.0675466911f, 0.0715911994f,
+	0.07585818f, 0.0803574688f, 0.085099045f, 0.090092994f, 0.0953494649f, 0.100878623f,
+	0.106690594f, 0.112795406f, 0.119202922f, 0.125922765f, 0.13296424f, 0.140336249f,
+	0.148047198f, 0.156104897f, 0.164516463f, 0.173288206f, 0.182425524f, 0.191932786f,
+	0.201813222f, 0.212068804f, 0.222700139f, 0.233706357f, 0.245085013f, 0.256831991f,
+	0.268941421f, 0.281405607f, 0.294214972f, 0.307358017f, 0.320821301f, 0.334589441f,
+	0.348645135f, 0.362969206f, 0.377540669f, 0.39233683f, 0.4073334f, 0.422504635f,
+	0.437823499f, 0.453261848f, 0.468790627f, 0.484380084f, 0.5f, 0.515619916f,
+	0.531209373f, 0.546738152f, 0.562176501f, 0.577495365f, 0.5926666f, 0.60766317f,
+	0.622459331f, 0.637030794f, 0.651354865f, 0.665410559f, 0.679178699f, 0.692641983f,
+	0.705785028f, 0.718594393f, 0.731058579f, 0.743168009f, 0.754914987f, 0.766293643f,
+	0.777299861f, 0.787931196f, 0.798186778f, 0.808067214f, 0.817574476f, 0.826711794f,
+	0.835483537f, 0.843895103f, 0.851952802f, 0.859663751f, 0.86703576f, 0.874077235f,
+	0.880797078f, 0.887204594f, 0.893309406f, 0.899121377f, 0.904650535f, 0.909907006f,
+	0.914900955f, 0.919642531f, 0.92414182f, 0.928408801f, 0.932453309f, 0.936285006f,
+	0.93991335f, 0.943347575f, 0.94659667f, 0.949669367f, 0.952574127f, 0.95531913f,
+	0.957912272f, 0.960361161f, 0.962673113f, 0.964855154f, 0.966914022f, 0.968856169f,
+	0.970687769f, 0.972414718f, 0.974042643f, 0.97557691f, 0.97702263f, 0.978384667f,
+	0.979667647f, 0.980875963f, 0.98201379f, 0.983085087f, 0.984093608f, 0.985042913f,
+	0.985936373f, 0.986777178f, 0.987568349f, 0.988312742f, 0.989013057f, 0.989671847f,
+	0.990291524f, 0.990874363f, 0.991422515f, 0.991938008f, 0.992422759f, 0.992878571f,
+	0.993307149f, 0.993710098f, 0.994088931f, 0.994445075f, 0.994779874f, 0.995094594f,
+	0.995390428f, 0.995668498f, 0.995929862f, 0.996175516f, 0.996406397f, 0.996623388f,
+	0.996827317f, 0.997018967f, 0.997199073f, 0.997368326f, 0.997527377f, 0.997676837f,
+	0.997817284f, 0.997949256f, 0.998073265f, 0.998189789f, 0.998299278f, 0.998402155f,
+	0.998498818f, 0.998589642f, 0.998674978f, 0.998755157f, 0.99883049f, 0.998901269f,
+	0.998967769f, 0.999030248f, 0.999088949f, 0.999144099f, 0.999195914f, 0.999244594f,
+	0.99929033f, 0.999333298f, 0.999373666f, 0.999411591f, 0.999447221f, 0.999480695f,
+	0.999512143f, 0.999541687f, 0.999569443f, 0.999595519f, 0.999620015f, 0.999643029f,
+	0.99966465f, 0.999684961f, 0.999704043f, 0.999721969f, 0.99973881f, 0.999754631f,
+	0.999769493f, 0.999783456f, 0.999796573f, 0.999808896f, 0.999820472f, 0.999831347f,
+	0.999841564f, 0.999851162f, 0.999860178f, 0.999868648f, 0.999876605f, 0.999884081f,
+	0.999891103f, 0.9998977f, 0.999903898f, 0.99990972f, 0.999915189f, 0.999920327f,
+	0.999925154f, 0.999929688f, 0.999933948f, 0.99993795f, 0.999941709f, 0.99994524f,
+	0.999948558f, 0.999951674f, 0.999954602f, 0.999957353f, 0.999959936f, 0.999962364f,
+	0.999964644f, 0.999966786f, 0.999968798f, 0.999970688f, 0.999972464f, 0.999974133f,
+	0.9999757f, 0.999977172f, 0.999978555f, 0.999979854f, 0.999981075f, 0.999982221f,
+	0.999983299f, 0.99998431f, 0.999985261f, 0.999986154f, 0.999986993f, 0.999987781f,
+	0.999988521f, 0.999989217f, 0.99998987f, 0.999990484f, 0.99999106f, 0.999991602f,
+	0.999992111f, 0.999992589f, 0.999993038f, 0.99999346f, 0.999993856f, 0.999994228f,
+	0.999994578f, 0.999994906f, 0.999995215f, 0.999995505f, 0.999995777f, 0.999996033f,
+	0.999996273f, 0.999996499f, 0.999996711f, 0.999996911f, 0.999997098f, 0.999997274f,
+	0.999997439f, 0.999997594f, 0.99999774f, 0.999997877f, 0.999998005f, 0.999998126f,
+	0.99999824f, 0.999998346f, 0.999998447f, 0.999998541f, 0.999998629f, 0.999998712f,
+	0.99999879f, 0.999998863f, 0.999998932f, 0.999998997f, 0.999999058f, 0.999999115f,
+	0.999999168f, 0.999999219f, 0.999999266f, 0.999999311f, 0.999999352f, 0.999999392f,
+	0.999999428f, 0.999999463f, 0.999999496f, 0.999999526f, 0.999999555f, 0.999999582f,
+	0.999999607f, 0.999999631f, 0.999999653f, 0.999999674f, 0.999999694f, 0.999999713f,
+	0.99999973f, 0.999999746f, 0.999999762f, 0.999999776f, 0.99999979f, 0.999999802f,
+	0.999999814f, 0.999999826f, 0.999999836f, 0.999999846f, 0.999999856f, 0.999999864f,
+	0.999999872f, 0.99999988f, 0.999999887f
+};
+#endif
+
+#if ACTIVATION == ACT_RATIONAL
+//x*P(x^2)/Q(x^2), past +-7.9053111 tanh rounds to +-1 in float
+inline float tanh_rational(float x)
+{
+	x = clamp(x, -7.90531110763549805f, 7.90531110763549805f);
+	const float x2 = x*x;
+	float p = -2.76076847742355e-16f;
+	p = mad(p, x2, 2.00018790482477e-13f);
+	p = mad(p, x2, -8.60467152213735e-11f);
+	p = mad(p, x2, 5.12229709037114e-08f);
+	p = mad(p, x2, 1.48572235717979e-05f);
+	p = mad(p, x2, 6.37261928875436e-04f);
+	p = mad(p, x2, 4.89352455891786e-03f);
+	float q = 1.19825839466702e-06f;
+	q = mad(q, x2, 1.18534705686654e-04f);
+	q = mad(q, x2, 2.26843463243900e-03f);
+	q = mad(q, x2, 4.89352518554385e-03f);
+	return x*p/q;
+}
+#endif
+
+inline float sigmoid_f(float x)
+{
+#if ACTIVATION == ACT_NATIVE
+	return native_recip(1.0f + native_exp(-x));
+#elif ACTIVATION == ACT_RATIONAL
+	return mad(0.5f, tanh_rational(0.5f*x), 0.5f);
+#elif ACTIVATION == ACT_LUT
+	const float t = (clamp(x, (float)-LUT_RANGE, (float)LUT_RANGE) + LUT_RANGE)*(LUT_STEPS/(2.0f*LUT_RANGE));
+	const int i = min((int)t, LUT_STEPS - 1);
+	return mix(sigmoid_lut[i], sigmoid_lut[i + 1], t - i);
+#else
+	return 1.0f / (1.0f + exp(-x));
+#endif
+}
+inline float tanh_f(float x)
+{
+#if ACTIVATION == ACT_NATIVE
+	return 1.0f - 2.0f*native_recip(native_exp(2.0f*x) + 1.0f);
+#elif ACTIVATION == ACT_RATIONAL
+	return tanh_rational(x);
+#elif ACTIVATION == ACT_LUT
+	return 2.0f*sigmoid_f(2.0f*x) - 1.0f;
+#else
+	return tanh(x);
+#endif
+}
+
+//gate order inside the packed weight and bias tensors
+#define GATE_FORGET 0
+#define GATE_INPUT 1
+#define GATE_INTERNAL 2
+#define GATE_OUTPUT 3
+#define NUM_GATES 4
+
+#define INDEX(ROW, COLUMN, WIDTH) ((ROW) * (WIDTH) + (COLUMN))
+
+//storage types, must match tensor_type in oclabstract.h
+#define TENSOR_F32 0
+#define TENSOR_I8 1
+#define TENSOR_F16 2
+#define TENSOR_BF16 3
+
+//Element i of a float, half or bfloat16 buffer, widened to float. Buffers are declared as
+//float and reinterpreted here, vload_half needs no fp16 extension.
+inline float load_elem(__global const float *p, const int i, const int type)
+{
+	if(type == TENSOR_F16)
+		return vload_half(i, (__global const half *)p);
+	if(type == TENSOR_BF16)
+		return as_float((uint)((__global const ushort *)p)[i] << 16);
+	return p[i];
+}
+//the reverse, rounding to nearest even
+inline void store_elem(__global float *p, const int i, const float v, const int type)
+{
+	if(type == TENSOR_F16)
+		vstore_half_rte(v, i, (__global half *)p);
+	else if(type == TENSOR_BF16)
+	{
+		const uint u = as_uint(v);
+		((__global ushort *)p)[i] = (ushort)((u + 0x7fffu + ((u >> 16) & 1u)) >> 16);
+	}
+	else
+		p[i] = v;
+}
+
+//element-wise kernels are safe to run in place, so no restrict on them
 __kernel void matrix_add(
-	__global const	double restrict *a,
-	__global const	double restrict *b,
-	__global	double restrict *out
+	__global const	float *a,
+	__global const	float *b,
+	__global	float *out
 )
 {
 	const int tid = get_global_id(X);
 	out[tid] = a[tid] + b[tid];
 }
 
+__kernel void matrix_elem_mul(
+	__global const	float *a,
+	__global const	float *b,
+	__global	float *out
+)
+{
+	const int tid = get_global_id(X);
+	out[tid] = a[tid] * b[tid];
+}
+
+//Four neighbouring elements of row row of a rows x cols matrix, from column col on.
+//Anything outside the matrix reads as zero, so tiles need no edge cases of their own.
+inline float4 load_elem4(__global const float *p, const int row, const int col,
+			const int rows, const int cols, const int type)
+{
+	if(row < rows && col + 3 < cols)
+	{
+		if(type == TENSOR_F32)
+			return vload4(0, p + INDEX(row, col, cols));
+		if(type == TENSOR_F16)
+			return vload_half4(0, (__global const half *)p + INDEX(row, col, cols));
+	}
+	float4 v = (float4)(0.0f);
+	if(row < rows)
+	{
+		const int i = INDEX(row, col, cols);
+		if(col < cols)		v.s0 = load_elem(p, i, type);
+		if(col + 1 < cols)	v.s1 = load_elem(p, i + 1, type);
+		if(col + 2 < cols)	v.s2 = load_elem(p, i + 2, type);
+		if(col + 3 < cols)	v.s3 = load_elem(p, i + 3, type);
+	}
+	return v;
+}
+
+//A GEMM_TILE x GEMM_TILE_K tile of the rows x k matrix p from row r0 and column k0.
+inline void gemm_load_tile(__local float (*tile)[GEMM_TILE_K + 1], __global const float *p,
+			const int r0, const int k0, const int rows, const int k, const int type, const int lid)
+{
+	for(int i = lid; i < GEMM_TILE*GEMM_TILE_K/4; i += GEMM_LOCAL*GEMM_LOCAL)
+	{
+		const int r = i/(GEMM_TILE_K/4);
+		const int c = i%(GEMM_TILE_K/4)*4;
+		const float4 v = load_elem4(p, r0 + r, k0 + c, rows, k, type);
+		tile[r][c] = v.s0; tile[r][c + 1] = v.s1; tile[r][c + 2] = v.s2; tile[r][c + 3] = v.s3;
+	}
+}
+
+//The same tile when p is stored transposed, k x rows with rows ld apart: tile[r][kk] is
+//p[k0 + kk][r0 + r]. Neighbouring work items read neighbouring elements of a row of p.
+inline void gemm_load_tile_t(__local float (*tile)[GEMM_TILE_K + 1], __global const float *p,
+			const int r0, const int k0, const int rows, const int k, const int ld, const int lid)
+{
+	for(int i = lid; i < GEMM_TILE*GEMM_TILE_K; i += GEMM_LOCAL*GEMM_LOCAL)
+	{
+		const int r = i%GEMM_TILE;
+		const int kk = i/GEMM_TILE;
+		tile[r][kk] = r0 + r < rows && k0 + kk < k ? p[INDEX(k0 + kk, r0 + r, ld)] : 0.0f;
+	}
+}
+
+//acc += a_tile*b_tile^T over one GEMM_TILE_K slice, for the outputs of work item (lx, ly)
+inline void gemm_accumulate(__local float (*a_tile)[GEMM_TILE_K + 1], __local float (*b_tile)[GEMM_TILE_K + 1],
+			float acc[GEMM_WPT][GEMM_WPT], const int lx, const int ly)
+{
+	#pragma unroll
+	for(int kk = 0; kk < GEMM_TILE_K; kk++)
+	{
+		float a_reg[GEMM_WPT];
+		float b_reg[GEMM_WPT];
+		for(int w = 0; w < GEMM_WPT; w++)
+		{
+			a_reg[w] = a_tile[ly + w*GEMM_LOCAL][kk];
+			b_reg[w] = b_tile[lx + w*GEMM_LOCAL][kk];
+		}
+		for(int wy = 0; wy < GEMM_WPT; wy++)
+			for(int wx = 0; wx < GEMM_WPT; wx++)
+				acc[wy][wx] += a_reg[wy]*b_reg[wx];
+	}
+}
+
+//Tiled GEMM: a is MxK, b is NxK (already transposed), out is MxN, any sizes.
+//b and out may be half storage, the sum is always float.
+//Each work group computes a GEMM_TILE x GEMM_TILE block of out, staging GEMM_TILE_K wide
+//slices of a and b in local memory. Each work item keeps a GEMM_WPT x GEMM_WPT block of
+//sums in registers, rows and columns GEMM_LOCAL apart so neighbouring items store neighbours.
+//2d range of ceil(N/GEMM_TILE)*GEMM_LOCAL x ceil(M/GEMM_TILE)*GEMM_LOCAL.
+__attribute__((reqd_work_group_size(GEMM_LOCAL, GEMM_LOCAL, 1)))
 __kernel void matrix_mul(
-	__global const	double restrict *a,
-	__global const	double restrict *b,
-	__global	double restrict *out
+	__global const	float *restrict a,
+	__global const	float *restrict b,
+	__global	float *restrict out,
+	const int m,
+	const int n,
+	const int k,
+	const int b_type,
+	const int out_type
 )
 {
-	const int row = get_global_id(X);
-	const int col = get_global_id(Y);
+	//one float of padding per row keeps the column reads off a single bank
+	__local float a_tile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float b_tile[GEMM_TILE][GEMM_TILE_K + 1];
+
+	const int lx = get_local_id(X);
+	const int ly = get_local_id(Y);
+	const int lid = INDEX(ly, lx, GEMM_LOCAL);
+	const int col0 = get_group_id(X)*GEMM_TILE;
+	const int row0 = get_group_id(Y)*GEMM_TILE;
+
+	float acc[GEMM_WPT][GEMM_WPT];
+	for(int wy = 0; wy < GEMM_WPT; wy++)
+		for(int wx = 0; wx < GEMM_WPT; wx++)
+			acc[wy][wx] = 0.0f;
+
+	for(int k0 = 0; k0 < k; k0 += GEMM_TILE_K)
+	{
+		gemm_load_tile(a_tile, a, row0, k0, m, k, TENSOR_F32, lid);
+		gemm_load_tile(b_tile, b, col0, k0, n, k, b_type, lid);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		gemm_accumulate(a_tile, b_tile, acc, lx, ly);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
 
-	double sum = 0;
-	for(unsigned i = 0; i < SOURCES; i++)
+	for(int wy = 0; wy < GEMM_WPT; wy++)
 	{
-		sum += a[i*
-	
+		const int row = row0 + ly + wy*GEMM_LOCAL;
+		for(int wx = 0; wx < GEMM_WPT; wx++)
+		{
+			const int col = col0 + lx + wx*GEMM_LOCAL;
+			if(row < m && col < n)
+				store_elem(out, INDEX(row, col, n), acc[wy][wx], out_type);
+		}
+	}
+}
+
+//matrix_mul with b not transposed for backpropagation: output = a*b, m rows of a from a_row
+//on and the first n of b's ldb columns. Carries dL/dh to the previous step through W_h.
+//Same tiling and range as matrix_mul.
+__attribute__((reqd_work_group_size(GEMM_LOCAL, GEMM_LOCAL, 1)))
+__kernel void matrix_mul_nn(
+	__global const	float *restrict a,
+	const int a_row,
+	__global const	float *restrict b,
+	__global	float *restrict output,
+	const int m,
+	const int n,
+	const int k,
+	const int ldb
+)
+{
+	__local float a_tile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float b_tile[GEMM_TILE][GEMM_TILE_K + 1];
+
+	const int lx = get_local_id(X);
+	const int ly = get_local_id(Y);
+	const int lid = INDEX(ly, lx, GEMM_LOCAL);
+	const int col0 = get_group_id(X)*GEMM_TILE;
+	const int row0 = get_group_id(Y)*GEMM_TILE;
+
+	float acc[GEMM_WPT][GEMM_WPT];
+	for(int wy = 0; wy < GEMM_WPT; wy++)
+		for(int wx = 0; wx < GEMM_WPT; wx++)
+			acc[wy][wx] = 0.0f;
+
+	for(int k0 = 0; k0 < k; k0 += GEMM_TILE_K)
+	{
+		gemm_load_tile(a_tile, a + INDEX(a_row, 0, k), row0, k0, m, k, TENSOR_F32, lid);
+		gemm_load_tile_t(b_tile, b, col0, k0, n, k, ldb, lid);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		gemm_accumulate(a_tile, b_tile, acc, lx, ly);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for(int wy = 0; wy < GEMM_WPT; wy++)
+	{
+		const int row = row0 + ly + wy*GEMM_LOCAL;
+		for(int wx = 0; wx < GEMM_WPT; wx++)
+		{
+			const int col = col0 + lx + wx*GEMM_LOCAL;
+			if(row < m && col < n)
+				output[INDEX(row, col, n)] = acc[wy][wx];
+		}
+	}
+}
+
+//matrix_mul with a transposed for weight gradients: output += a^T*b, a is k x m and b is
+//k x n, summed over every step and window of a segment in one pass. Same tiling and range
+//as matrix_mul.
+__attribute__((reqd_work_group_size(GEMM_LOCAL, GEMM_LOCAL, 1)))
+__kernel void matrix_mul_tn(
+	__global const	float *restrict a,
+	__global const	float *restrict b,
+	__global	float *restrict output,
+	const int m,
+	const int n,
+	const int k
+)
+{
+	__local float a_tile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float b_tile[GEMM_TILE][GEMM_TILE_K + 1];
+
+	const int lx = get_local_id(X);
+	const int ly = get_local_id(Y);
+	const int lid = INDEX(ly, lx, GEMM_LOCAL);
+	const int col0 = get_group_id(X)*GEMM_TILE;
+	const int row0 = get_group_id(Y)*GEMM_TILE;
+
+	float acc[GEMM_WPT][GEMM_WPT];
+	for(int wy = 0; wy < GEMM_WPT; wy++)
+		for(int wx = 0; wx < GEMM_WPT; wx++)
+			acc[wy][wx] = 0.0f;
+
+	for(int k0 = 0; k0 < k; k0 += GEMM_TILE_K)
+	{
+		gemm_load_tile_t(a_tile, a, row0, k0, m, k, m, lid);
+		gemm_load_tile_t(b_tile, b, col0, k0, n, k, n, lid);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		gemm_accumulate(a_tile, b_tile, acc, lx, ly);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for(int wy = 0; wy < GEMM_WPT; wy++)
+	{
+		const int row = row0 + ly + wy*GEMM_LOCAL;
+		for(int wx = 0; wx < GEMM_WPT; wx++)
+		{
+			const int col = col0 + lx + wx*GEMM_LOCAL;
+			if(row < m && col < n)
+				output[INDEX(row, col, n)] += acc[wy][wx];
+		}
+	}
+}
+
+//The tiling matrix_mul was compiled with: GEMM_TILE, GEMM_WPT and GEMM_TILE_K. One work item.
+__kernel void gemm_geometry(
+	__global	int *geometry
+)
+{
+	geometry[0] = GEMM_TILE;
+	geometry[1] = GEMM_WPT;
+	geometry[2] = GEMM_TILE_K;
+}
+
+//GEMV flavour of matrix_mul for M up to GEMV_MAX_ROWS, e.g. the batch rows of one step,
+//where a GEMM_TILE tall tile would be mostly padding. a is staged in local memory
+//GEMV_TILE_K columns at a time and every work item streams per_item (up to
+//MAX_COLS_PER_ITEM) rows of b past all M rows of it, so each weight is read once per launch.
+//1d range of at least N/per_item, any work group size.
+__kernel void matrix_vec_mul(
+	__global const	float *restrict a,
+	__global const	float *restrict b,
+	__global	float *restrict out,
+	const int m,
+	const int n,
+	const int k,
+	const int b_type,
+	const int out_type,
+	const int per_item
+)
+{
+	__local float a_tile[GEMV_MAX_ROWS*GEMV_TILE_K];
+
+	const int col0 = get_global_id(X)*per_item;
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+
+	float acc[GEMV_MAX_ROWS][MAX_COLS_PER_ITEM];
+	for(int r = 0; r < GEMV_MAX_ROWS; r++)
+		for(int j = 0; j < MAX_COLS_PER_ITEM; j++)
+			acc[r][j] = 0.0f;
+
+	for(int k0 = 0; k0 < k; k0 += GEMV_TILE_K)
+	{
+		//zero padded past k and m, so the loop below can always take whole float4s
+		for(int i = lid; i < GEMV_MAX_ROWS*GEMV_TILE_K; i += lsize)
+		{
+			const int r = i/GEMV_TILE_K;
+			const int c = k0 + i%GEMV_TILE_K;
+			a_tile[i] = (r < m && c < k) ? a[INDEX(r, c, k)] : 0.0f;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		//work items past the end still have to reach both barriers
+		for(int c = 0; col0 < n && c < GEMV_TILE_K && k0 + c < k; c += 4)
+		{
+			float4 x[GEMV_MAX_ROWS];
+			for(int r = 0; r < GEMV_MAX_ROWS; r++)
+				x[r] = vload4(0, &a_tile[INDEX(r, c, GEMV_TILE_K)]);
+			for(int j = 0; j < MAX_COLS_PER_ITEM; j++)
+			{
+				if(j >= per_item)
+					break;
+				const float4 w = load_elem4(b, col0 + j, k0 + c, n, k, b_type);
+				for(int r = 0; r < GEMV_MAX_ROWS; r++)
+					acc[r][j] += dot(w, x[r]);
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for(int j = 0; j < MAX_COLS_PER_ITEM; j++)
+	{
+		const int col = col0 + j;
+		if(j >= per_item || col >= n)
+			break;
+		for(int r = 0; r < m && r < GEMV_MAX_ROWS; r++)
+			store_elem(out, INDEX(r, col, n), acc[r][j], out_type);
+	}
+}
+
+//Symmetric int8 quantization of every row of a, with one scale per row (absmax/127) so
+//each batch row keeps its own range, the activation half of matrix_vec_mul_i8.
+//	a_scales:	m, row r is a_q[r]*a_scales[r]
+//	absmax:		local scratch of one float per work item
+//2d range of any width x m, work groups one row tall and as wide as the range.
+__kernel void quantize_rows(
+	__global const	float *restrict a,
+	__global	char *restrict a_q,
+	__global	float *restrict a_scales,
+	const int k,
+	__local		float *absmax
+)
+{
+	const int row = get_global_id(Y);
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+
+	float m = 0.0f;
+	for(int i = lid; i < k; i += lsize)
+		m = fmax(m, fabs(a[INDEX(row, i, k)]));
+	absmax[lid] = m;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for(int stride = 1; stride < lsize; stride *= 2)
+	{
+		if(lid % (2*stride) == 0 && lid + stride < lsize)
+			absmax[lid] = fmax(absmax[lid], absmax[lid + stride]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	const float scale = absmax[0] > 0.0f ? absmax[0]/127.0f : 1.0f;
+	const float inv = 1.0f/scale;
+	for(int i = lid; i < k; i += lsize)
+		a_q[INDEX(row, i, k)] = (char)rint(a[INDEX(row, i, k)]*inv);
+	if(lid == 0)
+		a_scales[row] = scale;
+}
+
+//matrix_vec_mul for int8 a and b from quantize_rows and a MODEL_I8 file. Products are
+//summed in int32 and both row scales applied once at the end, so b is read as int8, a
+//quarter of the float traffic. Rows of a are taken GEMV_MAX_ROWS at a time, one block per
+//range row, so a batch of B reads every weight ceil(B/GEMV_MAX_ROWS) times.
+//	b_scales:	n, weight row c is b[c]*b_scales[c]
+//2d range of at least N/per_item x ceil(M/GEMV_MAX_ROWS), work groups one block tall.
+__kernel void matrix_vec_mul_i8(
+	__global const	char *restrict a_q,
+	__global const	float *restrict a_scales,
+	__global const	char *restrict b,
+	__global const	float *restrict b_scales,
+	__global	float *restrict out,
+	const int m,
+	const int n,
+	const int k,
+	const int per_item
+)
+{
+	__local char a_tile[GEMV_MAX_ROWS*GEMV_TILE_K];
+
+	const int col0 = get_global_id(X)*per_item;
+	const int row0 = get_global_id(Y)*GEMV_MAX_ROWS;
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+
+	int acc[GEMV_MAX_ROWS][MAX_COLS_PER_ITEM];
+	for(int r = 0; r < GEMV_MAX_ROWS; r++)
+		for(int j = 0; j < MAX_COLS_PER_ITEM; j++)
+			acc[r][j] = 0;
+
+	for(int k0 = 0; k0 < k; k0 += GEMV_TILE_K)
+	{
+		//zero padded past k and m, a zero activation adds nothing whatever the weight
+		for(int i = lid; i < GEMV_MAX_ROWS*GEMV_TILE_K; i += lsize)
+		{
+			const int r = row0 + i/GEMV_TILE_K;
+			const int c = k0 + i%GEMV_TILE_K;
+			a_tile[i] = (r < m && c < k) ? a_q[INDEX(r, c, k)] : 0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for(int c = 0; col0 < n && c < GEMV_TILE_K && k0 + c < k; c += 4)
+		{
+			int4 x[GEMV_MAX_ROWS];
+			for(int r = 0; r < GEMV_MAX_ROWS; r++)
+				x[r] = convert_int4(vload4(0, &a_tile[INDEX(r, c, GEMV_TILE_K)]));
+			for(int j = 0; j < MAX_COLS_PER_ITEM; j++)
+			{
+				const int col = col0 + j;
+				if(j >= per_item || col >= n)
+					break;
+				int4 w;
+				if(k0 + c + 3 < k)
+					w = convert_int4(vload4(0, &b[INDEX(col, k0 + c, k)]));
+				else
+				{
+					w = (int4)(0);
+					w.s0 = b[INDEX(col, k0 + c, k)];
+					if(k0 + c + 1 < k) w.s1 = b[INDEX(col, k0 + c + 1, k)];
+					if(k0 + c + 2 < k) w.s2 = b[INDEX(col, k0 + c + 2, k)];
+				}
+				for(int r = 0; r < GEMV_MAX_ROWS; r++)
+				{
+					const int4 p = w*x[r];
+					acc[r][j] += p.s0 + p.s1 + p.s2 + p.s3;
+				}
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for(int j = 0; j < MAX_COLS_PER_ITEM; j++)
+	{
+		const int col = col0 + j;
+		if(j >= per_item || col >= n)
+			break;
+		for(int r = 0; r < GEMV_MAX_ROWS && row0 + r < m; r++)
+			out[INDEX(row0 + r, col, n)] = (float)acc[r][j]*b_scales[col]*a_scales[row0 + r];
+	}
 }
 
 __kernel void sigmoid_activation(
-	__global const	double restrict *input,
-	__global 	double restrict *output
+	__global const	float *input,
+	__global 	float *output
 )
 {
-	int tid = get_global_id(0);
-	output[tid] = 1.0 / (1 + exp(-input[tid]));
+	int tid = get_global_id(X);
+	output[tid] = sigmoid_f(input[tid]);
 }
 __kernel void tanh_activation(
-	__global const	double restrict *input,
-	__global 	double restrict *output
+	__global const	float *input,
+	__global 	float *output
 )
 {
-	int tid = get_global_id(0);
-	output[tid] = tanh(input[tid]);
+	int tid = get_global_id(X);
+	output[tid] = tanh_f(input[tid]);
 }
-//dimensions must be hardened for this kernel
-//exactly two workgroups, one to write the vertices from each matrix
+//row-wise concatenation, 2d range of (a_cols + b_cols) x rows
 __kernel void matrix_concat(
-	__global const 	double restrict *prev_input,
-	__global const 	double restrict *curr_input,
-	__global 	double restrict *output
+	__global const 	float *restrict prev_input,
+	__global const 	float *restrict curr_input,
+	__global 	float *restrict output,
+	const int a_cols,
+	const int b_cols
+)
+{
+	const int col = get_global_id(X);
+	const int row = get_global_id(Y);
+	const int width = a_cols + b_cols;
+
+	if(col < a_cols)
+		output[INDEX(row, col, width)] = prev_input[INDEX(row, col, a_cols)];
+	else
+		output[INDEX(row, col, width)] = curr_input[INDEX(row, col - a_cols, b_cols)];
+}
+//Both directions of a bidirectional window into one (steps*batch) x 2*n_hidden tensor.
+//Row t*batch + r is [fwd h of step t, bwd h of step t] for window r. The backward cell ran on
+//the reversed window, so its h for step t is its row (steps-1-t)*batch + r.
+//2d range of 2*n_hidden x steps*batch.
+__kernel void bilstm_concat(
+	__global const 	float *restrict fwd,
+	__global const 	float *restrict bwd,
+	__global 	float *restrict output,
+	const int steps,
+	const int batch,
+	const int n_hidden
+)
+{
+	const int col = get_global_id(X);
+	const int row = get_global_id(Y);
+	const int t = row / batch;
+	const int r = row - t*batch;
+
+	if(col < n_hidden)
+		output[INDEX(row, col, 2*n_hidden)] = fwd[INDEX(row, col, n_hidden)];
+	else
+		output[INDEX(row, col, 2*n_hidden)] = bwd[INDEX((steps - 1 - t)*batch + r, col - n_hidden, n_hidden)];
+}
+
+//Fused LSTM timestep. Grew out of sigpass in testing/kernel_passes.cl: the reduction,
+//bias and activation of all four gates and the state update happen in one launch.
+//	weights:	4*n_hidden x (n_hidden + n_in), gate-major rows in GATE_* order
+//	bias:		4*n_hidden
+//	w_type/b_type:	storage of weights and bias
+//	concat:		local scratch of n_hidden + n_in floats
+//2d range of hidden units x batch rows, work groups must be one batch row tall.
+//One work item per hidden unit. Each work group stages its row of [h_prev, x] in local
+//memory once, so the concatenation never touches global memory.
+__attribute__((max_work_group_size(MAX_WINDOW_SIZE)))
+__kernel void lstm_cell(
+	__global const	float *restrict prev_output,
+	__global const	float *restrict curr_input,
+	__global const	float *restrict weights,
+	__global const	float *restrict bias,
+	__global const	float *restrict prev_state,
+	__global	float *restrict curr_state,
+	__global	float *restrict curr_output,
+	const int n_in_arg,
+	const int n_hidden_arg,
+	const int w_type,
+	const int b_type,
+	__local		float *concat
 )
 {
-	int tid = get_local_id(0);
-	int gid = get_group_id(0);
-	int abs_id = tid + gid*get_local_size(0);
+	const int n_in = N_IN(n_in_arg);
+	const int n_hidden = N_HIDDEN(n_hidden_arg);
+	const int unit = get_global_id(X);
+	const int b = get_global_id(Y);
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+	const int width = n_hidden + n_in;
+
+	for(int i = lid; i < width; i += lsize)
+	{
+		concat[i] = (i < n_hidden) ? prev_output[INDEX(b, i, n_hidden)] : curr_input[INDEX(b, i - n_hidden, n_in)];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(unit >= n_hidden)
+		return;
 
-	switch(gid)
+	float gate[NUM_GATES];
+	for(int n = 0; n < NUM_GATES; n++)
 	{
-	PREV_GROUP:	output[abs_id] = prev_input[tid];
-	CURR_GROUP:	output[abs_id] = curr_input[tid];
+		const int row = n*n_hidden + unit;
+		float sum = load_elem(bias, row, b_type);
+		for(int k = 0; k < width; k++)
+		{
+			sum += load_elem(weights, INDEX(row, k, width), w_type) * concat[k];
+		}
+		gate[n] = sum;
 	}
+
+	const float f = sigmoid_f(gate[GATE_FORGET]);
+	const float i = sigmoid_f(gate[GATE_INPUT]);
+	const float g = tanh_f(gate[GATE_INTERNAL]);
+	const float o = sigmoid_f(gate[GATE_OUTPUT]);
+
+	const float c = f*prev_state[INDEX(b, unit, n_hidden)] + i*g;
+	curr_state[INDEX(b, unit, n_hidden)] = c;
+	curr_output[INDEX(b, unit, n_hidden)] = o*tanh_f(c);
+}
+
+//lstm_cell with the input half of every gate already computed, so only h goes through
+//the recurrent weights. Used when input projections are cached across overlapping windows.
+//	proj:		rows of NUM_GATES*n_hidden input projections (no bias), batch row b of this
+//			step is row proj_row + b
+//	weights:	4*n_hidden x n_hidden recurrent weights, GATE_* order
+//	*_type:		storage of proj, weights and bias
+//	hidden:		local scratch of n_hidden floats
+//2d range of hidden units x batch rows, work groups must be one batch row tall.
+__attribute__((max_work_group_size(MAX_WINDOW_SIZE)))
+__kernel void lstm_cell_projected(
+	__global const	float *restrict prev_output,
+	__global const	float *restrict proj,
+	__global const	float *restrict weights,
+	__global const	float *restrict bias,
+	__global const	float *restrict prev_state,
+	__global	float *restrict curr_state,
+	__global	float *restrict curr_output,
+	const int proj_row,
+	const int n_hidden_arg,
+	const int p_type,
+	const int w_type,
+	const int b_type,
+	__local		float *hidden
+)
+{
+	const int n_hidden = N_HIDDEN(n_hidden_arg);
+	const int unit = get_global_id(X);
+	const int b = get_global_id(Y);
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+	const int x_gates = INDEX(proj_row + b, 0, NUM_GATES*n_hidden);
+
+	for(int i = lid; i < n_hidden; i += lsize)
+	{
+		hidden[i] = prev_output[INDEX(b, i, n_hidden)];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(unit >= n_hidden)
+		return;
+
+	float gate[NUM_GATES];
+	for(int n = 0; n < NUM_GATES; n++)
+	{
+		const int row = n*n_hidden + unit;
+		float sum = load_elem(bias, row, b_type) + load_elem(proj, x_gates + row, p_type);
+		for(int k = 0; k < n_hidden; k++)
+		{
+			sum += load_elem(weights, INDEX(row, k, n_hidden), w_type) * hidden[k];
+		}
+		gate[n] = sum;
+	}
+
+	const float f = sigmoid_f(gate[GATE_FORGET]);
+	const float i = sigmoid_f(gate[GATE_INPUT]);
+	const float g = tanh_f(gate[GATE_INTERNAL]);
+	const float o = sigmoid_f(gate[GATE_OUTPUT]);
+
+	const float c = f*prev_state[INDEX(b, unit, n_hidden)] + i*g;
+	curr_state[INDEX(b, unit, n_hidden)] = c;
+	curr_output[INDEX(b, unit, n_hidden)] = o*tanh_f(c);
+}
+
+//lstm_cell for int8 weights. The staged [h, x] row is quantized in local memory with one
+//scale for the row, every gate is an int8 dot product with an int32 accumulator, and the
+//weight row scale and the activation scale are applied together just before the activation.
+//	weights:	4*n_hidden x (n_hidden + n_in) int8, gate-major rows in GATE_* order
+//	w_scales:	4*n_hidden, weight row r is weights[r]*w_scales[r]
+//	concat:		local scratch of n_hidden + n_in + local size floats
+//	concat_q:	local scratch of n_hidden + n_in chars
+//2d range of hidden units x batch rows, work groups must be one batch row tall.
+__attribute__((max_work_group_size(MAX_WINDOW_SIZE)))
+__kernel void lstm_cell_i8(
+	__global const	float *restrict prev_output,
+	__global const	float *restrict curr_input,
+	__global const	char *restrict weights,
+	__global const	float *restrict w_scales,
+	__global const	float *restrict bias,
+	__global const	float *restrict prev_state,
+	__global	float *restrict curr_state,
+	__global	float *restrict curr_output,
+	const int n_in_arg,
+	const int n_hidden_arg,
+	__local		float *concat,
+	__local		char *concat_q
+)
+{
+	const int n_in = N_IN(n_in_arg);
+	const int n_hidden = N_HIDDEN(n_hidden_arg);
+	const int unit = get_global_id(X);
+	const int b = get_global_id(Y);
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+	const int width = n_hidden + n_in;
+	__local float *absmax = &concat[width];
+
+	float m = 0.0f;
+	for(int i = lid; i < width; i += lsize)
+	{
+		const float v = (i < n_hidden) ? prev_output[INDEX(b, i, n_hidden)] : curr_input[INDEX(b, i - n_hidden, n_in)];
+		concat[i] = v;
+		m = fmax(m, fabs(v));
+	}
+	absmax[lid] = m;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	//max over the work group, the local size need not be a power of two
+	for(int stride = 1; stride < lsize; stride *= 2)
+	{
+		if(lid % (2*stride) == 0 && lid + stride < lsize)
+			absmax[lid] = fmax(absmax[lid], absmax[lid + stride]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	const float a_scale = absmax[0] > 0.0f ? absmax[0]/127.0f : 1.0f;
+	const float inv = 1.0f/a_scale;
+	for(int i = lid; i < width; i += lsize)
+	{
+		concat_q[i] = (char)rint(concat[i]*inv);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if(unit >= n_hidden)
+		return;
+
+	float gate[NUM_GATES];
+	for(int n = 0; n < NUM_GATES; n++)
+	{
+		const int row = n*n_hidden + unit;
+		int acc = 0;
+		for(int k = 0; k < width; k++)
+		{
+			acc += (int)weights[INDEX(row, k, width)] * (int)concat_q[k];
+		}
+		gate[n] = (float)acc*w_scales[row]*a_scale + bias[row];
+	}
+
+	const float f = sigmoid_f(gate[GATE_FORGET]);
+	const float i = sigmoid_f(gate[GATE_INPUT]);
+	const float g = tanh_f(gate[GATE_INTERNAL]);
+	const float o = sigmoid_f(gate[GATE_OUTPUT]);
+
+	const float c = f*prev_state[INDEX(b, unit, n_hidden)] + i*g;
+	curr_state[INDEX(b, unit, n_hidden)] = c;
+	curr_output[INDEX(b, unit, n_hidden)] = o*tanh_f(c);
+}
+
+//Second half of the batched step. The gate pre-activations come from one matrix_mul of
+//the B x (n_hidden + n_in) concatenation against all the packed gate weights, which
+//reuses every weight across the batch instead of re-reading it per window.
+//	gates:		B x 4*n_hidden, GATE_* blocks of n_hidden columns
+//	b_type:		storage of bias
+//2d range of n_hidden x B
+__kernel void lstm_pointwise(
+	__global const	float *restrict gates,
+	__global const	float *restrict bias,
+	__global const	float *restrict prev_state,
+	__global	float *restrict curr_state,
+	__global	float *restrict curr_output,
+	const int n_hidden_arg,
+	const int b_type
+)
+{
+	const int n_hidden = N_HIDDEN(n_hidden_arg);
+	const int unit = get_global_id(X);
+	const int b = get_global_id(Y);
+	__global const float *row = &gates[INDEX(b, 0, NUM_GATES*n_hidden)];
+
+	const float f = sigmoid_f(row[GATE_FORGET*n_hidden + unit] + load_elem(bias, GATE_FORGET*n_hidden + unit, b_type));
+	const float i = sigmoid_f(row[GATE_INPUT*n_hidden + unit] + load_elem(bias, GATE_INPUT*n_hidden + unit, b_type));
+	const float g = tanh_f(row[GATE_INTERNAL*n_hidden + unit] + load_elem(bias, GATE_INTERNAL*n_hidden + unit, b_type));
+	const float o = sigmoid_f(row[GATE_OUTPUT*n_hidden + unit] + load_elem(bias, GATE_OUTPUT*n_hidden + unit, b_type));
+
+	const float c = f*prev_state[INDEX(b, unit, n_hidden)] + i*g;
+	curr_state[INDEX(b, unit, n_hidden)] = c;
+	curr_output[INDEX(b, unit, n_hidden)] = o*tanh_f(c);
+}
+
+//dot products of one gate row against the staged [h, x], from either address space.
+//OpenCL 1.x has no generic pointers, hence the two copies. The local copy is always float,
+//the global row starts at element first of w and is in w_type storage.
+inline float gate_row_global(__global const float *restrict w, const int first, __local const float *concat,
+				const int width, const int w_type)
+{
+	float sum = 0.0f;
+	for(int k = 0; k < width; k++)
+		sum += load_elem(w, first + k, w_type) * concat[k];
+	return sum;
+}
+inline float gate_row_local(__local const float *w, __local const float *concat, const int width)
+{
+	float sum = 0.0f;
+	for(int k = 0; k < width; k++)
+		sum += w[k] * concat[k];
+	return sum;
+}
+
+//Persistent LSTM: one work group runs every timestep of a window in a single launch.
+//	inputs:		steps x batch x n_in, time-major
+//	hidden/state:	batch x n_hidden, initial h and c on entry, final h and c on exit
+//	outputs:	steps x batch x n_hidden, h for every timestep
+//	w_type/b_type:	storage of weights and bias
+//	concat:		local scratch of n_hidden + n_in floats, h lives here between steps
+//	wcache:		local float copy of the weights when cache_weights is set
+//Each work item owns up to MAX_UNITS_PER_ITEM hidden units and keeps their c in private
+//memory for the whole window, so neither h nor c goes back to global memory until the end.
+//Must be launched as exactly one work group per batch row.
+__attribute__((max_work_group_size(MAX_WINDOW_SIZE)))
+__kernel void lstm_sequence(
+	__global const	float *restrict inputs,
+	__global const	float *restrict weights,
+	__global const	float *restrict bias,
+	__global	float *restrict hidden,
+	__global	float *restrict state,
+	__global	float *restrict outputs,
+	const int steps,
+	const int batch,
+	const int n_in_arg,
+	const int n_hidden_arg,
+	const int cache_weights,
+	const int w_type,
+	const int b_type,
+	__local		float *concat,
+	__local		float *wcache
+)
+{
+	const int n_in = N_IN(n_in_arg);
+	const int n_hidden = N_HIDDEN(n_hidden_arg);
+	const int b = get_group_id(X);
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+	const int width = n_hidden + n_in;
+
+	//weights are read from global memory once per launch when they fit on chip
+	if(cache_weights)
+	{
+		for(int i = lid; i < NUM_GATES*n_hidden*width; i += lsize)
+			wcache[i] = load_elem(weights, i, w_type);
+	}
+
+	float c[MAX_UNITS_PER_ITEM];
+	float h[MAX_UNITS_PER_ITEM];
+	for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+	{
+		const int unit = lid + u*lsize;
+		c[u] = (unit < n_hidden) ? state[INDEX(b, unit, n_hidden)] : 0.0f;
+	}
+	for(int i = lid; i < width; i += lsize)
+	{
+		concat[i] = (i < n_hidden) ? hidden[INDEX(b, i, n_hidden)] : inputs[INDEX(b, i - n_hidden, n_in)];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for(int t = 0; t < steps; t++)
+	{
+		for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+		{
+			const int unit = lid + u*lsize;
+			if(unit >= n_hidden)
+				break;
+
+			float gate[NUM_GATES];
+			for(int n = 0; n < NUM_GATES; n++)
+			{
+				const int row = n*n_hidden + unit;
+				if(cache_weights)
+					gate[n] = gate_row_local(&wcache[INDEX(row, 0, width)], concat, width);
+				else
+					gate[n] = gate_row_global(weights, INDEX(row, 0, width), concat, width, w_type);
+				gate[n] += load_elem(bias, row, b_type);
+			}
+
+			const float f = sigmoid_f(gate[GATE_FORGET]);
+			const float i = sigmoid_f(gate[GATE_INPUT]);
+			const float g = tanh_f(gate[GATE_INTERNAL]);
+			const float o = sigmoid_f(gate[GATE_OUTPUT]);
+
+			c[u] = f*c[u] + i*g;
+			h[u] = o*tanh_f(c[u]);
+		}
+		//everyone has finished reading this step's [h, x]
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+		{
+			const int unit = lid + u*lsize;
+			if(unit >= n_hidden)
+				break;
+			concat[unit] = h[u];
+			outputs[INDEX(t*batch + b, unit, n_hidden)] = h[u];
+		}
+		if(t + 1 < steps)
+		{
+			for(int i = lid; i < n_in; i += lsize)
+				concat[n_hidden + i] = inputs[INDEX((t + 1)*batch + b, i, n_in)];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+	{
+		const int unit = lid + u*lsize;
+		if(unit >= n_hidden)
+			break;
+		state[INDEX(b, unit, n_hidden)] = c[u];
+		hidden[INDEX(b, unit, n_hidden)] = concat[unit];
+	}
+}
+
+//lstm_sequence for split weights. The input half of every gate for the whole window comes in
+//precomputed from one matrix_mul of the window against W_x, so the serial loop only does
+//the h*W_h^T product and is half as long per step.
+//	proj:		steps x batch x 4*n_hidden, time-major, no bias
+//	weights:	4*n_hidden x n_hidden recurrent weights
+//	*_type:		storage of proj, weights and bias
+//	h_local:	local scratch of n_hidden floats
+//	wcache:		local float copy of the weights when cache_weights is set
+//Same geometry as lstm_sequence, exactly one work group per batch row.
+__attribute__((max_work_group_size(MAX_WINDOW_SIZE)))
+__kernel void lstm_sequence_projected(
+	__global const	float *restrict proj,
+	__global const	float *restrict weights,
+	__global const	float *restrict bias,
+	__global	float *restrict hidden,
+	__global	float *restrict state,
+	__global	float *restrict outputs,
+	const int steps,
+	const int batch,
+	const int n_hidden_arg,
+	const int cache_weights,
+	const int p_type,
+	const int w_type,
+	const int b_type,
+	__local		float *h_local,
+	__local		float *wcache
+)
+{
+	const int n_hidden = N_HIDDEN(n_hidden_arg);
+	const int b = get_group_id(X);
+	const int lid = get_local_id(X);
+	const int lsize = get_local_size(X);
+	const int gate_width = NUM_GATES*n_hidden;
+
+	if(cache_weights)
+	{
+		for(int i = lid; i < gate_width*n_hidden; i += lsize)
+			wcache[i] = load_elem(weights, i, w_type);
+	}
+
+	float c[MAX_UNITS_PER_ITEM];
+	float h[MAX_UNITS_PER_ITEM];
+	for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+	{
+		const int unit = lid + u*lsize;
+		c[u] = (unit < n_hidden) ? state[INDEX(b, unit, n_hidden)] : 0.0f;
+	}
+	for(int i = lid; i < n_hidden; i += lsize)
+	{
+		h_local[i] = hidden[INDEX(b, i, n_hidden)];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for(int t = 0; t < steps; t++)
+	{
+		const int x_gates = INDEX(t*batch + b, 0, gate_width);
+		for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+		{
+			const int unit = lid + u*lsize;
+			if(unit >= n_hidden)
+				break;
+
+			float gate[NUM_GATES];
+			for(int n = 0; n < NUM_GATES; n++)
+			{
+				const int row = n*n_hidden + unit;
+				if(cache_weights)
+					gate[n] = gate_row_local(&wcache[INDEX(row, 0, n_hidden)], h_local, n_hidden);
+				else
+					gate[n] = gate_row_global(weights, INDEX(row, 0, n_hidden), h_local, n_hidden, w_type);
+				gate[n] += load_elem(bias, row, b_type) + load_elem(proj, x_gates + row, p_type);
+			}
+
+			const float f = sigmoid_f(gate[GATE_FORGET]);
+			const float i = sigmoid_f(gate[GATE_INPUT]);
+			const float g = tanh_f(gate[GATE_INTERNAL]);
+			const float o = sigmoid_f(gate[GATE_OUTPUT]);
+
+			c[u] = f*c[u] + i*g;
+			h[u] = o*tanh_f(c[u]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+		{
+			const int unit = lid + u*lsize;
+			if(unit >= n_hidden)
+				break;
+			h_local[unit] = h[u];
+			outputs[INDEX(t*batch + b, unit, n_hidden)] = h[u];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for(int u = 0; u < MAX_UNITS_PER_ITEM; u++)
+	{
+		const int unit = lid + u*lsize;
+		if(unit >= n_hidden)
+			break;
+		state[INDEX(b, unit, n_hidden)] = c[u];
+		hidden[INDEX(b, unit, n_hidden)] = h_local[unit];
+	}
+}
+
+//    T R A I N I N G    //
+
+//Used by LSTMCell::backwardPass, float storage only. Row arguments pick a batch of rows out
+//of a tensor that holds a whole segment of steps.
+
+//lstm_pointwise for a training forward step, also keeping what the backward pass needs.
+//	pre:		B x 4*n_hidden gate pre-activations without bias
+//	acts:		the activated gates, to rows act_row.. of 4*n_hidden columns
+//	states:		c of the previous step at rows prev_row.., c of this step to rows curr_row..
+//2d range of n_hidden x B
+__kernel void lstm_pointwise_train(
+	__global const	float *restrict pre,
+	__global const	float *restrict bias,
+	__global	float *restrict acts,
+	const int act_row,
+	__global	float *states,
+	const int prev_row,
+	const int curr_row,
+	__global	float *restrict hidden,
+	const int n_hidden
+)
+{
+	const int unit = get_global_id(X);
+	const int b = get_global_id(Y);
+	__global const float *row = &pre[INDEX(b, 0, NUM_GATES*n_hidden)];
+	__global float *act = &acts[INDEX(act_row + b, 0, NUM_GATES*n_hidden)];
+
+	const float f = sigmoid_f(row[GATE_FORGET*n_hidden + unit] + bias[GATE_FORGET*n_hidden + unit]);
+	const float i = sigmoid_f(row[GATE_INPUT*n_hidden + unit] + bias[GATE_INPUT*n_hidden + unit]);
+	const float g = tanh_f(row[GATE_INTERNAL*n_hidden + unit] + bias[GATE_INTERNAL*n_hidden + unit]);
+	const float o = sigmoid_f(row[GATE_OUTPUT*n_hidden + unit] + bias[GATE_OUTPUT*n_hidden + unit]);
+	act[GATE_FORGET*n_hidden + unit] = f;
+	act[GATE_INPUT*n_hidden + unit] = i;
+	act[GATE_INTERNAL*n_hidden + unit] = g;
+	act[GATE_OUTPUT*n_hidden + unit] = o;
+
+	const float c = f*states[INDEX(prev_row + b, unit, n_hidden)] + i*g;
+	states[INDEX(curr_row + b, unit, n_hidden)] = c;
+	hidden[INDEX(b, unit, n_hidden)] = o*tanh_f(c);
+}
+
+//Gate gradients of one step, the cell equations run backwards.
+//	d_out:		dL/dh from the loss, rows out_row..
+//	d_hidden:	dL/dh through the next step
+//	d_state:	dL/dc from the next step in, for the previous step out
+//	d_pre:		dL/d(pre-activation), to rows act_row.. like acts
+//2d range of n_hidden x B
+__kernel void lstm_backward_pointwise(
+	__global const	float *restrict acts,
+	const int act_row,
+	__global const	float *restrict states,
+	const int prev_row,
+	const int curr_row,
+	__global const	float *restrict d_out,
+	const int out_row,
+	__global const	float *restrict d_hidden,
+	__global	float *restrict d_state,
+	__global	float *restrict d_pre,
+	const int n_hidden
+)
+{
+	const int unit = get_global_id(X);
+	const int b = get_global_id(Y);
+	__global const float *act = &acts[INDEX(act_row + b, 0, NUM_GATES*n_hidden)];
+	__global float *dp = &d_pre[INDEX(act_row + b, 0, NUM_GATES*n_hidden)];
+
+	const float f = act[GATE_FORGET*n_hidden + unit];
+	const float i = act[GATE_INPUT*n_hidden + unit];
+	const float g = act[GATE_INTERNAL*n_hidden + unit];
+	const float o = act[GATE_OUTPUT*n_hidden + unit];
+	const float tc = tanh_f(states[INDEX(curr_row + b, unit, n_hidden)]);
+
+	const float dh = d_out[INDEX(out_row + b, unit, n_hidden)] + d_hidden[INDEX(b, unit, n_hidden)];
+	const float dc = d_state[INDEX(b, unit, n_hidden)] + dh*o*(1.0f - tc*tc);
+	d_state[INDEX(b, unit, n_hidden)] = dc*f;
+
+	dp[GATE_FORGET*n_hidden + unit] = dc*states[INDEX(prev_row + b, unit, n_hidden)]*f*(1.0f - f);
+	dp[GATE_INPUT*n_hidden + unit] = dc*g*i*(1.0f - i);
+	dp[GATE_INTERNAL*n_hidden + unit] = dc*i*(1.0f - g*g);
+	dp[GATE_OUTPUT*n_hidden + unit] = dh*tc*o*(1.0f - o);
+}
+
+//output[col] += sum of the first rows rows of a, for bias gradients. 1d range of cols.
+__kernel void column_sum(
+	__global const	float *restrict a,
+	__global	float *restrict output,
+	const int rows,
+	const int cols
+)
+{
+	const int col = get_global_id(X);
+	if(col >= cols)
+		return;
+
+	float sum = 0.0f;
+	for(int r = 0; r < rows; r++)
+		sum += a[INDEX(r, col, cols)];
+	output[col] += sum;
+}
+
+//y += alpha*x, a gradient step
+__kernel void matrix_axpy(
+	__global const	float *restrict x,
+	__global	float *restrict y,
+	const float alpha
+)
+{
+	const int tid = get_global_id(X);
+	y[tid] += alpha*x[tid];
 }
-	
@@ -1,43 +1,1039 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 #include "lstm.hpp"
+#include "trace.h"
 
-LSTMCell::LSTMCell(float *forget, float *input, float *internal, float *output)
+//Everything backwardPass keeps between calls, sized for the longest window and segment seen.
+//Device tensors on OpenCL, host vectors on the CPU, the gradient accumulators either way.
+struct lstmTraining
 {
-	this.w_forget = forget;
-	this.w_input = input;
-	this.w_internal = internal;
-	this.w_output = output;
+	//NUM_GATES*n_hidden x n_concat and NUM_GATES x n_hidden
+	clTensor d_weights;
+	clTensor d_bias;
+	//the window and dL/dh for every step, uploaded once per call
+	clTensor window;
+	clTensor d_out;
+	//h and c at the start of every segment, segments*batch rows
+	clTensor ckpt_h;
+	clTensor ckpt_c;
+	//one recomputed segment: [h, x] (k*batch x n_concat), the activated gates and their
+	//gradients (k*batch x NUM_GATES*n_hidden), and c from the segment start on ((k+1)*batch rows)
+	clTensor seg_z;
+	clTensor seg_acts;
+	clTensor seg_dp;
+	clTensor seg_c;
+	//batch x n_hidden: h while recomputing, dL/dh and dL/dc flowing back
+	clTensor hidden;
+	clTensor d_hidden;
+	clTensor d_state;
+
+	std::vector<float> cpu_d_weights, cpu_d_bias;
+	std::vector<float> cpu_ckpt_h, cpu_ckpt_c;
+	std::vector<float> cpu_seg_z, cpu_seg_acts, cpu_seg_dp, cpu_seg_c;
+	std::vector<float> cpu_hidden, cpu_d_hidden, cpu_d_state;
+};
+static void releaseTraining(lstmTraining *tr)
+{
+	if(!tr)
+		return;
+	clTensor *all[] = {	&tr->d_weights, &tr->d_bias, &tr->window, &tr->d_out, &tr->ckpt_h, &tr->ckpt_c,
+				&tr->seg_z, &tr->seg_acts, &tr->seg_dp, &tr->seg_c,
+				&tr->hidden, &tr->d_hidden, &tr->d_state};
+	for(unsigned i = 0; i < sizeof(all)/sizeof(all[0]); i++)
+		releaseTensorCl(*all[i]);
+	delete tr;
 }
-//think of these like sets of instructions
-//for 3 input: S1 S2 D
-//for 2 input: S1 D
-inline void LSTMCell::forget()
+//recreated rather than grown, nothing in them outlives a backwardPass call
+static void growTensor(clTensor &t, size_t rows, size_t cols)
 {
-	matrixMultiplyCL	(this.concat_input,	this.w_forget, 		this.forget_calc);
-	matrixAddCL		(this.forget_calc, 	this.b_forget, 		this.forget_calc);
-	sigmoidCL		(this.forget_calc, 	this.forget_calc);
+	if(t.rows >= rows)
+		return;
+	releaseTensorCl(t);
+	t = createTensorCl(rows, cols);
 }
-inline void LSTMCell::input()
+static void growVector(std::vector<float> &v, size_t size)
 {
-	matrixMultiplyCL	(this.concat_input, 	this.w_input, 		this.input_calc);
-	matrixAddCL		(this.input_calc, 	this.b_input, 		this.input_calc);
-	sigmoidCL		(this.input_calc, 	this.input_calc);
+	if(v.size() < size)
+		v.resize(size);
+}
+
+LSTMCell::LSTMCell(	cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+			cl_float *forget_bias, cl_float *input_bias, cl_float *internal_bias, cl_float *output_bias,
+			lstm_backend backend, unsigned batch, bool split_weights, tensor_type storage,
+			unsigned n_in, unsigned n_hidden)
+{
+	cl_float *weights[NUM_GATES] = {forget, input, internal, output};
+	cl_float *biases[NUM_GATES] = {forget_bias, input_bias, internal_bias, output_bias};
+
+	if(storage == TENSOR_I8)
+	{
+		printf("int8 cells are built from a quantized model file\n");
+		exit(1);
+	}
+	initMembers(backend, batch, split_weights, storage, n_in, n_hidden);
+	const bool half = storage != TENSOR_F32;
+	const bool bf16 = storage == TENSOR_BF16;
+
+	if(backend == BACKEND_CPU)
+	{
+		if(half)
+			this->cpu_weights_h = (uint16_t *)allocCpu(NUM_GATES*this->n_hidden*this->n_concat/2);
+		else
+			this->cpu_weights = allocCpu(NUM_GATES*this->n_hidden*this->n_concat);
+		this->cpu_bias		= allocCpu(NUM_GATES*this->n_hidden);
+		this->owns_weights	= true;
+		for(unsigned g = 0; g < NUM_GATES; g++)
+		{
+			if(half)
+				floatToHalfCpu(weights[g], &this->cpu_weights_h[g*this->n_hidden*this->n_concat], this->n_hidden*this->n_concat, bf16);
+			else
+				memcpy(&this->cpu_weights[g*this->n_hidden*this->n_concat], weights[g], sizeof(float)*this->n_hidden*this->n_concat);
+			if(biases[g])
+				memcpy(&this->cpu_bias[g*this->n_hidden], biases[g], sizeof(float)*this->n_hidden);
+			else
+				memset(&this->cpu_bias[g*this->n_hidden], 0, sizeof(float)*this->n_hidden);
+		}
+		initState();
+		return;
+	}
+
+	//weights and biases are uploaded once and stay resident for the life of the cell, where
+	//applyGradients updates them. 16-bit storage is converted on the host a gate at a time
+	//on the way up.
+	this->w_gates = createTensorCl(NUM_GATES*this->n_hidden, this->n_concat, CL_MEM_READ_WRITE, NULL, storage);
+	this->b_gates = createTensorCl(NUM_GATES, this->n_hidden, CL_MEM_READ_WRITE, NULL, storage);
+	this->owns_weights = true;
+	std::vector<uint16_t> staged(half ? this->n_hidden*this->n_concat : 0);
+	std::vector<float> zeros(this->n_hidden, 0.0f);
+	for(unsigned g = 0; g < NUM_GATES; g++)
+	{
+		const float *b = biases[g] ? biases[g] : zeros.data();
+		if(!half)
+		{
+			uploadRowsCl(this->w_gates, g*this->n_hidden, this->n_hidden, weights[g]);
+			uploadRowsCl(this->b_gates, g, 1, b);
+			continue;
+		}
+		floatToHalfCpu(weights[g], staged.data(), this->n_hidden*this->n_concat, bf16);
+		uploadRowsCl(this->w_gates, g*this->n_hidden, this->n_hidden, staged.data());
+		floatToHalfCpu(b, staged.data(), this->n_hidden, bf16);
+		uploadRowsCl(this->b_gates, g, 1, staged.data());
+	}
+	initState();
 }
-inline void LSTMCell::internal()
+//The file is already in the packed layout, so nothing is copied on the host: the CPU backend
+//reads the mapping directly and the device buffers are created over it with
+//CL_MEM_USE_HOST_PTR. The model must stay open for the life of the cell.
+LSTMCell::LSTMCell(const lstmModel &model, unsigned layer, lstm_backend backend, unsigned batch, bool split_weights)
 {
-	matrixMultiplyCL	(this.concat_input, 	this.w_internal, 	this.internal_calc);
-	matrixAddCL		(this.internal_calc, 	this.b_internal, 	this.internal_calc);
-	tanhCL			(this.internal_calc, 	this.internal_calc);
+	if(layer >= model.header->num_layers)
+	{
+		printf("Model has no layer %u\n", layer);
+		exit(1);
+	}
+
+	tensor_type storage = TENSOR_F32;
+	if(model.header->dtype == MODEL_I8)
+		storage = TENSOR_I8;
+	else if(model.header->dtype == MODEL_F16)
+		storage = TENSOR_F16;
+	else if(model.header->dtype == MODEL_BF16)
+		storage = TENSOR_BF16;
+	if(storage == TENSOR_I8 && split_weights)
+	{
+		printf("int8 models run with packed weights, ignoring split_weights\n");
+		split_weights = false;
+	}
+	initMembers(backend, batch, split_weights, storage,
+			model.header->layers[layer].n_in, model.header->layers[layer].n_hidden);
+
+	void *weights = (void *)modelWeights(model, layer);
+	cl_float *bias = (cl_float *)modelBias(model, layer);
+	cl_float *scales = storage == TENSOR_I8 ? (cl_float *)modelScales(model, layer) : NULL;
+	if(backend == BACKEND_CPU)
+	{
+		if(storage == TENSOR_I8)
+		{
+			this->cpu_weights_i8	= (const int8_t *)weights;
+			this->cpu_w_scales	= scales;
+		}
+		else if(storage != TENSOR_F32)
+			this->cpu_weights_h	= (uint16_t *)weights;
+		else
+			this->cpu_weights	= (float *)weights;
+		this->cpu_bias		= bias;
+		this->owns_weights	= false;
+		initState();
+		return;
+	}
+
+	//biases are float in every model file
+	this->w_gates = createTensorCl(	NUM_GATES*this->n_hidden, this->n_concat, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
+					weights, storage);
+	this->b_gates = createTensorCl(NUM_GATES, this->n_hidden, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, bias);
+	if(storage == TENSOR_I8)
+		this->w_scales = createTensorCl(NUM_GATES*this->n_hidden, 1, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, scales);
+	initState();
 }
-inline void LSTMCell::output()
+void LSTMCell::initMembers(lstm_backend backend, unsigned batch, bool split_weights, tensor_type storage,
+			unsigned n_in, unsigned n_hidden)
 {
-	matrixMultiplyCL	(this.concat_input,	this.w_output, 		this.output_calc);
-	matrixAddCL		(this.output_calc, 	this.b_output, 		this.output_calc);
-	sigmoidCL		(this.output_calc, 	this.output_calc);
+	this->backend = backend;
+	this->n_in = n_in;
+	this->n_hidden = n_hidden;
+	this->n_concat = n_hidden + n_in;
+	//the shape is fixed for the cell's life, so its kernels can be too
+	if(backend == BACKEND_OPENCL)
+		specializeOclEnv(n_in, n_hidden);
+	this->batch = batch;
+	this->split = split_weights;
+	this->storage = storage;
+	this->step_done = NULL;
+	const clTensor none = {NULL, 0, 0, TENSOR_F32};
+	this->w_gates = this->b_gates = this->w_scales = none;
+	this->concat_q = this->concat_scales = none;
+	this->window_buf = this->seq_outputs = none;
+	this->w_x = this->w_h = this->proj_ring = this->proj_step = this->seq_proj = none;
+	this->cpu_weights = this->cpu_bias = NULL;
+	this->cpu_weights_i8 = NULL;
+	this->cpu_w_scales = NULL;
+	this->cpu_weights_h = this->cpu_wx_h = this->cpu_wh_h = NULL;
+	this->cpu_wx = this->cpu_wh = this->cpu_proj_ring = this->cpu_seq_proj = NULL;
+	this->proj_slots = this->cpu_seq_proj_rows = 0;
+	this->owns_weights = false;
+	this->train = NULL;
 }
-inline void LSTMCell::nextState()
+//h/c and scratch for either backend, once the weights are in place
+void LSTMCell::initState()
 {
-	matrixMultiplyCL	(this.forget_calc, 	this.prev_state, 	this.forget_calc);
-	matrixMultiplyCL	(this.input_calc, 	this.internal_calc, 	this.input_calc);
-	matrixAddCL		(this.forget_calc,	this.input_calc);
+	if(this->backend == BACKEND_CPU)
+	{
+		this->cpu_prev_output	= allocCpu(batch*this->n_hidden);
+		this->cpu_curr_output	= allocCpu(batch*this->n_hidden);
+		this->cpu_prev_state	= allocCpu(batch*this->n_hidden);
+		this->cpu_curr_state	= allocCpu(batch*this->n_hidden);
+		this->cpu_scratch	= allocCpu(this->storage == TENSOR_I8 ? LSTM_I8_SCRATCH(batch, this->n_in, this->n_hidden) :
+								batch*(NUM_GATES*this->n_hidden + this->n_concat));
+		reset();
+		if(this->split)
+		{
+			splitWeights();
+			if(this->owns_weights)
+			{
+				freeCpu(this->cpu_weights);
+				freeCpu((float *)this->cpu_weights_h);
+			}
+			this->cpu_weights = NULL;
+			this->cpu_weights_h = NULL;
+		}
+		return;
+	}
+
+	this->concat_input	= createTensorCl(batch, this->n_concat);
+	this->gates_calc	= createTensorCl(batch, NUM_GATES*this->n_hidden);
+	if(this->storage == TENSOR_I8 && batch > 1)
+	{
+		this->concat_q		= createTensorCl(batch, this->n_concat, CL_MEM_READ_WRITE, NULL, TENSOR_I8);
+		this->concat_scales	= createTensorCl(batch, 1);
+	}
+
+	this->curr_input	= createTensorCl(batch, this->n_in);
+	this->curr_output	= createTensorCl(batch, this->n_hidden);
+	this->prev_output	= createTensorCl(batch, this->n_hidden);
+	this->curr_state	= createTensorCl(batch, this->n_hidden);
+	this->prev_state	= createTensorCl(batch, this->n_hidden);
+
+	reset();
+	//split straight from the packed upload, then drop the packed copy
+	if(this->split)
+	{
+		splitWeights();
+		finishCl();
+		releaseTensorCl(this->w_gates);
+	}
 }
+LSTMCell::~LSTMCell()
+{
+	releaseTraining(this->train);
+	if(this->backend == BACKEND_CPU)
+	{
+		if(this->owns_weights)
+		{
+			freeCpu(cpu_weights);
+			freeCpu((float *)cpu_weights_h);
+			freeCpu(cpu_bias);
+		}
+		float *all[] = {	cpu_prev_output, cpu_curr_output,
+					cpu_prev_state, cpu_curr_state, cpu_scratch,
+					cpu_wx, cpu_wh, (float *)cpu_wx_h, (float *)cpu_wh_h,
+					cpu_proj_ring, cpu_seq_proj};
+		for(unsigned i = 0; i < sizeof(all)/sizeof(all[0]); i++)
+			freeCpu(all[i]);
+		return;
+	}
+
+	clTensor *all[] = {	&w_gates, &b_gates, &w_scales, &concat_input, &gates_calc, &concat_q, &concat_scales,
+				&curr_input, &curr_output, &prev_output, &curr_state, &prev_state,
+				&seq_outputs, &window_buf, &w_x, &w_h, &proj_ring, &proj_step, &seq_proj};
+	for(unsigned i = 0; i < sizeof(all)/sizeof(all[0]); i++)
+		releaseTensorCl(*all[i]);
+	if(this->step_done)
+		clReleaseEvent(this->step_done);
+}
+//clears h and c, call between independent windows
+void LSTMCell::reset()
+{
+	traceScope span("LSTMCell::reset");
+	if(this->backend == BACKEND_CPU)
+	{
+		memset(this->cpu_prev_output, 0, sizeof(float)*this->batch*this->n_hidden);
+		memset(this->cpu_prev_state, 0, sizeof(float)*this->batch*this->n_hidden);
+		return;
+	}
+
+	cl_event fills[2];
+	cl_uint nwait = this->step_done ? 1 : 0;
+	const cl_event *wait = this->step_done ? &this->step_done : NULL;
+	fillTensorCl(this->prev_output, 0.0f, nwait, wait, &fills[0]);
+	fillTensorCl(this->prev_state, 0.0f, nwait, wait, &fills[1]);
+
+	if(this->step_done)
+		clReleaseEvent(this->step_done);
+	markerCl(2, fills, &this->step_done);
+	clReleaseEvent(fills[0]);
+	clReleaseEvent(fills[1]);
+}
+//one timestep on whatever is in curr_input. A single window is one fused launch. A batch
+//is one matrix-matrix product for all four gates, so each weight is read once for every
+//window instead of once per window, followed by the element-wise half of the cell. int8
+//batches quantize [h, x] by row first and take the int8 product.
+void LSTMCell::step(cl_event input_ready)
+{
+	cl_event deps[2] = {this->step_done, input_ready};
+	cl_event done;
+
+	if(this->storage == TENSOR_I8 && this->batch > 1)
+	{
+		cl_event e[3];
+		matrixConcatCl	 (this->prev_output,	this->curr_input,	this->concat_input,	2, deps, &e[0]);
+		quantizeRowsCl	 (this->concat_input,	this->concat_q,		this->concat_scales,	1, &e[0], &e[1]);
+		matrixMultiplyI8Cl(this->concat_q,	this->concat_scales,	this->w_gates,		this->w_scales,
+				  this->gates_calc,	1, &e[1], &e[2]);
+		lstmPointwiseCl	 (this->gates_calc,	this->b_gates,
+				  this->prev_state,	this->curr_state,	this->curr_output,	1, &e[2], &done);
+		for(unsigned i = 0; i < 3; i++)
+			clReleaseEvent(e[i]);
+	}
+	else if(this->storage == TENSOR_I8)
+	{
+		lstmCellI8Cl(	this->prev_output,	this->curr_input,
+				this->w_gates,		this->w_scales,		this->b_gates,
+				this->prev_state,	this->curr_state,	this->curr_output,
+				2, deps, &done);
+	}
+	else if(this->batch == 1)
+	{
+		lstmCellCl(	this->prev_output,	this->curr_input,
+				this->w_gates,		this->b_gates,
+				this->prev_state,	this->curr_state,	this->curr_output,
+				2, deps, &done);
+	}
+	else
+	{
+		cl_event e[2];
+		matrixConcatCl	(this->prev_output,	this->curr_input,	this->concat_input,	2, deps, &e[0]);
+		matrixMultiplyCl(this->concat_input,	this->w_gates,		this->gates_calc,	1, &e[0], &e[1]);
+		lstmPointwiseCl	(this->gates_calc,	this->b_gates,
+				 this->prev_state,	this->curr_state,	this->curr_output,	1, &e[1], &done);
+		clReleaseEvent(e[0]);
+		clReleaseEvent(e[1]);
+	}
+
+	clReleaseEvent(this->step_done);
+	this->step_done = done;
+
+	//this step's output is the next step's history, swapping handles costs nothing
+	std::swap(this->prev_output, this->curr_output);
+	std::swap(this->prev_state, this->curr_state);
+}
+void LSTMCell::stepCpu(const float *new_input)
+{
+	if(this->storage == TENSOR_I8)
+		lstmCellI8Cpu(	this->cpu_prev_output,	new_input,
+				this->cpu_weights_i8,	this->cpu_w_scales,	this->cpu_bias,
+				this->cpu_prev_state,	this->cpu_curr_state,	this->cpu_curr_output,
+				this->n_in, this->n_hidden, this->batch, this->cpu_scratch);
+	else if(this->storage != TENSOR_F32)
+		lstmCellHalfCpu(this->cpu_prev_output,	new_input,
+				this->cpu_weights_h,	this->storage == TENSOR_BF16,	this->cpu_bias,
+				this->cpu_prev_state,	this->cpu_curr_state,	this->cpu_curr_output,
+				this->n_in, this->n_hidden, this->batch, this->cpu_scratch);
+	else
+		lstmCellCpu(	this->cpu_prev_output,	new_input,
+				this->cpu_weights,	this->cpu_bias,
+				this->cpu_prev_state,	this->cpu_curr_state,	this->cpu_curr_output,
+				this->n_in, this->n_hidden, this->batch, this->cpu_scratch);
 
+	std::swap(this->cpu_prev_output, this->cpu_curr_output);
+	std::swap(this->cpu_prev_state, this->cpu_curr_state);
+}
+//new_input is read asynchronously and must stay valid until the next getOutput/getState
+void LSTMCell::forwardPass(const cl_float *new_input)
+{
+	traceScope span("LSTMCell::forwardPass");
+	if(this->backend == BACKEND_CPU && this->split)
+	{
+		float *proj = cpuProjection(this->batch);
+		projectCpu(new_input, proj, this->batch);
+		stepProjectedCpu(proj);
+		return;
+	}
+	if(this->backend == BACKEND_CPU)
+	{
+		stepCpu(new_input);
+		return;
+	}
+	if(this->split)
+	{
+		cl_event e[2];
+		uploadTensorCl(this->curr_input, new_input, CL_FALSE, 1, &this->step_done, &e[0]);
+		matrixMultiplyCl(this->curr_input, this->w_x, this->gates_calc, 1, &e[0], &e[1]);
+		clReleaseEvent(e[0]);
+		clReleaseEvent(this->step_done);
+		this->step_done = e[1];
+		stepProjectedCl(this->gates_calc, 0);
+		return;
+	}
+
+	cl_event uploaded;
+	uploadTensorCl(this->curr_input, new_input, CL_FALSE, 1, &this->step_done, &uploaded);
+	step(uploaded);
+	clReleaseEvent(uploaded);
+}
+void LSTMCell::forwardPass(const clTensor &input, size_t row, cl_uint num_events, const cl_event *wait_list,
+			cl_event *consumed)
+{
+	traceScope span("LSTMCell::forwardPass device");
+	std::vector<cl_event> deps(wait_list, wait_list + num_events);
+	deps.push_back(this->step_done);
+	cl_event copied;
+	copyRowsCl(input, row, this->curr_input, 0, this->batch, deps.size(), deps.data(), &copied);
+	if(this->split)
+	{
+		cl_event e;
+		matrixMultiplyCl(this->curr_input, this->w_x, this->gates_calc, 1, &copied, &e);
+		clReleaseEvent(this->step_done);
+		this->step_done = e;
+		stepProjectedCl(this->gates_calc, 0);
+	}
+	else
+		step(copied);
+
+	if(consumed)
+		*consumed = copied;
+	else
+		clReleaseEvent(copied);
+}
+//window is a device tensor of at least (steps*batch) x n_in, uploaded once by the caller.
+//The whole window is a single lstm_sequence launch with h and c held on chip. Hidden sizes
+//too large for one work group fall back to one fused launch per step. Either way nothing
+//here waits on the device.
+void LSTMCell::forwardSequence(const clTensor &window, unsigned steps, clTensor *outputs)
+{
+	traceScope span("LSTMCell::forwardSequence");
+	if(!outputs)
+	{
+		if(this->seq_outputs.rows < steps*this->batch)
+		{
+			releaseTensorCl(this->seq_outputs);
+			this->seq_outputs = createTensorCl(steps*this->batch, this->n_hidden);
+		}
+		outputs = &this->seq_outputs;
+	}
+
+	cl_event done;
+	if(this->split)
+	{
+		//every timestep's input half in one GEMM, M = steps*batch reuses each weight across
+		//the whole window
+		const unsigned rows = steps*this->batch;
+		if(this->seq_proj.rows < rows)
+		{
+			releaseTensorCl(this->seq_proj);
+			this->seq_proj = createTensorCl(rows, NUM_GATES*this->n_hidden, CL_MEM_READ_WRITE, NULL, this->storage);
+		}
+		clTensor x = window;
+		x.rows = rows;
+		matrixMultiplyCl(x, this->w_x, this->seq_proj, 1, &this->step_done, &done);
+		clReleaseEvent(this->step_done);
+		this->step_done = done;
+
+		if(lstmSequenceProjectedCl(	this->seq_proj, steps, *outputs,
+						this->w_h, this->b_gates,
+						this->prev_output, this->prev_state,
+						1, &this->step_done, &done))
+		{
+			clReleaseEvent(this->step_done);
+			this->step_done = done;
+			return;
+		}
+		for(unsigned t = 0; t < steps; t++)
+		{
+			stepProjectedCl(this->seq_proj, t*this->batch);
+			copyRowsCl(this->prev_output, 0, *outputs, t*this->batch, this->batch, 1, &this->step_done, &done);
+			clReleaseEvent(this->step_done);
+			this->step_done = done;
+		}
+		return;
+	}
+
+	//the persistent kernel has no int8 path, int8 cells step through the window
+	if(this->storage != TENSOR_I8 && lstmSequenceCl(	window, steps, *outputs,
+				this->w_gates, this->b_gates,
+				this->prev_output, this->prev_state,
+				1, &this->step_done, &done))
+	{
+		clReleaseEvent(this->step_done);
+		this->step_done = done;
+		return;
+	}
+
+	for(unsigned t = 0; t < steps; t++)
+	{
+		cl_event copied;
+		copyRowsCl(window, t*this->batch, this->curr_input, 0, this->batch, 1, &this->step_done, &copied);
+		step(copied);
+		clReleaseEvent(copied);
+
+		copyRowsCl(this->prev_output, 0, *outputs, t*this->batch, this->batch, 1, &this->step_done, &done);
+		clReleaseEvent(this->step_done);
+		this->step_done = done;
+	}
+}
+void LSTMCell::forwardSequence(const cl_float *window, unsigned steps, cl_float *outputs)
+{
+	traceScope span("LSTMCell::forwardSequence host");
+	if(this->backend == BACKEND_CPU && this->split)
+	{
+		const unsigned rows = steps*this->batch;
+		float *proj = cpuProjection(rows);
+		projectCpu(window, proj, rows);
+		for(unsigned t = 0; t < steps; t++)
+		{
+			stepProjectedCpu(&proj[t*this->batch*NUM_GATES*this->n_hidden]);
+			if(outputs)
+				memcpy(&outputs[t*this->batch*this->n_hidden], this->cpu_prev_output, sizeof(float)*this->batch*this->n_hidden);
+		}
+		return;
+	}
+	if(this->backend == BACKEND_CPU)
+	{
+		for(unsigned t = 0; t < steps; t++)
+		{
+			stepCpu(&window[t*this->batch*this->n_in]);
+			if(outputs)
+				memcpy(&outputs[t*this->batch*this->n_hidden], this->cpu_prev_output, sizeof(float)*this->batch*this->n_hidden);
+		}
+		return;
+	}
+
+	const unsigned rows = steps*this->batch;
+	if(this->window_buf.rows < rows)
+	{
+		releaseTensorCl(this->window_buf);
+		this->window_buf = createTensorCl(rows, this->n_in, CL_MEM_READ_ONLY);
+	}
+	uploadRowsCl(this->window_buf, 0, rows, window, CL_TRUE, 1, &this->step_done);
+	forwardSequence(this->window_buf, steps);
+	if(outputs)
+	{
+		clTensor view = this->seq_outputs;
+		view.rows = rows;
+		downloadTensorCl(view, outputs, CL_TRUE, 1, &this->step_done);
+	}
+}
+//W_x and W_h are column slices of the packed weights, copied out once on first use
+void LSTMCell::splitWeights()
+{
+	if(this->storage == TENSOR_I8)
+	{
+		printf("int8 cells cannot cache input projections\n");
+		exit(1);
+	}
+	if(this->backend == BACKEND_CPU && this->storage != TENSOR_F32)
+	{
+		if(this->cpu_wh_h)
+			return;
+		this->cpu_wh_h = (uint16_t *)allocCpu(NUM_GATES*this->n_hidden*this->n_hidden/2);
+		this->cpu_wx_h = (uint16_t *)allocCpu(NUM_GATES*this->n_hidden*this->n_in/2);
+		for(unsigned r = 0; r < NUM_GATES*this->n_hidden; r++)
+		{
+			memcpy(&this->cpu_wh_h[r*this->n_hidden], &this->cpu_weights_h[r*this->n_concat], sizeof(uint16_t)*this->n_hidden);
+			memcpy(&this->cpu_wx_h[r*this->n_in], &this->cpu_weights_h[r*this->n_concat + this->n_hidden], sizeof(uint16_t)*this->n_in);
+		}
+		return;
+	}
+	if(this->backend == BACKEND_CPU)
+	{
+		if(this->cpu_wh)
+			return;
+		this->cpu_wh = allocCpu(NUM_GATES*this->n_hidden*this->n_hidden);
+		this->cpu_wx = allocCpu(NUM_GATES*this->n_hidden*this->n_in);
+		for(unsigned r = 0; r < NUM_GATES*this->n_hidden; r++)
+		{
+			memcpy(&this->cpu_wh[r*this->n_hidden], &this->cpu_weights[r*this->n_concat], sizeof(float)*this->n_hidden);
+			memcpy(&this->cpu_wx[r*this->n_in], &this->cpu_weights[r*this->n_concat + this->n_hidden], sizeof(float)*this->n_in);
+		}
+		return;
+	}
+
+	if(this->w_h.buf)
+		return;
+	this->w_h = createTensorCl(NUM_GATES*this->n_hidden, this->n_hidden, CL_MEM_READ_ONLY, NULL, this->storage);
+	this->w_x = createTensorCl(NUM_GATES*this->n_hidden, this->n_in, CL_MEM_READ_ONLY, NULL, this->storage);
+
+	cl_event copies[2];
+	copyColsCl(this->w_gates, 0, this->w_h, 0, this->n_hidden, 1, &this->step_done, &copies[0]);
+	copyColsCl(this->w_gates, this->n_hidden, this->w_x, 0, this->n_in, 1, &this->step_done, &copies[1]);
+	clReleaseEvent(this->step_done);
+	markerCl(2, copies, &this->step_done);
+	clReleaseEvent(copies[0]);
+	clReleaseEvent(copies[1]);
+}
+//a ring as deep as the longest window the caller will run through forwardProjected
+void LSTMCell::setProjectionSlots(unsigned slots)
+{
+	splitWeights();
+	this->proj_slots = slots;
+	if(this->backend == BACKEND_CPU)
+	{
+		freeCpu(this->cpu_proj_ring);
+		this->cpu_proj_ring = allocCpu(slots*this->batch*NUM_GATES*this->n_hidden);
+		return;
+	}
+	releaseTensorCl(this->proj_ring);
+	releaseTensorCl(this->proj_step);
+	this->proj_ring = createTensorCl(slots*this->batch, NUM_GATES*this->n_hidden, CL_MEM_READ_WRITE, NULL, this->storage);
+	this->proj_step = createTensorCl(this->batch, NUM_GATES*this->n_hidden, CL_MEM_READ_WRITE, NULL, this->storage);
+}
+void LSTMCell::projectInput(const cl_float *new_input, unsigned slot)
+{
+	traceScope span("LSTMCell::projectInput");
+	if(this->backend == BACKEND_CPU)
+	{
+		projectCpu(new_input, &this->cpu_proj_ring[slot*this->batch*NUM_GATES*this->n_hidden], this->batch);
+		return;
+	}
+
+	//the upload is blocking so the caller can reuse its sample buffer straight away
+	cl_event e[2];
+	uploadTensorCl(this->curr_input, new_input, CL_TRUE, 1, &this->step_done, &e[0]);
+	matrixMultiplyCl(this->curr_input, this->w_x, this->proj_step, 1, &e[0], &e[1]);
+	clReleaseEvent(e[0]);
+	clReleaseEvent(this->step_done);
+	copyRowsCl(this->proj_step, 0, this->proj_ring, slot*this->batch, this->batch, 1, &e[1], &this->step_done);
+	clReleaseEvent(e[1]);
+}
+void LSTMCell::stepProjectedCpu(const float *proj)
+{
+	if(this->cpu_wh_h)
+		lstmCellProjectedHalfCpu(	this->cpu_prev_output,	proj,
+						this->cpu_wh_h,		this->storage == TENSOR_BF16,	this->cpu_bias,
+						this->cpu_prev_state,	this->cpu_curr_state,	this->cpu_curr_output,
+						this->n_hidden, this->batch, this->cpu_scratch);
+	else
+		lstmCellProjectedCpu(	this->cpu_prev_output,	proj,
+					this->cpu_wh,		this->cpu_bias,
+					this->cpu_prev_state,	this->cpu_curr_state,	this->cpu_curr_output,
+					this->n_hidden, this->batch, this->cpu_scratch);
+	std::swap(this->cpu_prev_output, this->cpu_curr_output);
+	std::swap(this->cpu_prev_state, this->cpu_curr_state);
+}
+//this step's input half is rows row .. row+batch-1 of proj
+void LSTMCell::stepProjectedCl(const clTensor &proj, size_t row)
+{
+	cl_event done;
+	lstmCellProjectedCl(	this->prev_output,	proj,			row,
+				this->w_h,		this->b_gates,
+				this->prev_state,	this->curr_state,	this->curr_output,
+				1, &this->step_done, &done);
+	clReleaseEvent(this->step_done);
+	this->step_done = done;
+
+	std::swap(this->prev_output, this->curr_output);
+	std::swap(this->prev_state, this->curr_state);
+}
+//host scratch for projected inputs, grown to the longest window seen
+float *LSTMCell::cpuProjection(unsigned rows)
+{
+	if(this->cpu_seq_proj_rows < rows)
+	{
+		freeCpu(this->cpu_seq_proj);
+		this->cpu_seq_proj = allocCpu(rows*NUM_GATES*this->n_hidden);
+		this->cpu_seq_proj_rows = rows;
+	}
+	return this->cpu_seq_proj;
+}
+//x*W_x^T on the host, rows x NUM_GATES*n_hidden, from whichever copy of W_x the cell keeps
+void LSTMCell::projectCpu(const float *x, float *proj, unsigned rows)
+{
+	if(this->cpu_wx_h)
+		matrixMultiplyHalfCpu(x, this->cpu_wx_h, proj, rows, NUM_GATES*this->n_hidden, this->n_in, this->storage == TENSOR_BF16);
+	else
+		matrixMultiplyCpu(x, this->cpu_wx, proj, rows, NUM_GATES*this->n_hidden, this->n_in);
+}
+void LSTMCell::forwardProjected(unsigned first_slot, unsigned steps)
+{
+	traceScope span("LSTMCell::forwardProjected");
+	for(unsigned t = 0; t < steps; t++)
+	{
+		const unsigned slot = (first_slot + t) % this->proj_slots;
+		if(this->backend == BACKEND_CPU)
+			stepProjectedCpu(&this->cpu_proj_ring[slot*this->batch*NUM_GATES*this->n_hidden]);
+		else
+			stepProjectedCl(this->proj_ring, slot*this->batch);
+	}
+}
+//after a step the newest h and c sit in the prev_ handles.
+//These are the single synchronisation point for a step or a sequence.
+void LSTMCell::getOutput(cl_float *host)
+{
+	traceScope span("LSTMCell::getOutput");
+	if(this->backend == BACKEND_CPU)
+	{
+		memcpy(host, this->cpu_prev_output, sizeof(float)*this->batch*this->n_hidden);
+		return;
+	}
+	downloadTensorCl(this->prev_output, host, CL_TRUE, 1, &this->step_done);
+}
+void LSTMCell::getState(cl_float *host)
+{
+	traceScope span("LSTMCell::getState");
+	if(this->backend == BACKEND_CPU)
+	{
+		memcpy(host, this->cpu_prev_state, sizeof(float)*this->batch*this->n_hidden);
+		return;
+	}
+	downloadTensorCl(this->prev_state, host, CL_TRUE, 1, &this->step_done);
+}
+
+//    T R A I N I N G    //
+
+//every training command waits on the one before it and becomes step_done
+static void chain(cl_event &step_done, cl_event done)
+{
+	clReleaseEvent(step_done);
+	step_done = done;
+}
+void LSTMCell::checkTrainable() const
+{
+	if(this->storage != TENSOR_F32 || this->split || !this->owns_weights)
+	{
+		printf("Training needs float packed weights owned by the cell\n");
+		exit(1);
+	}
+}
+//training buffers for a window of steps in segments of k, the gradient accumulators are
+//zeroed when they are first made
+lstmTraining *LSTMCell::trainingBuffers(unsigned steps, unsigned k)
+{
+	checkTrainable();
+	const unsigned segments = (steps + k - 1)/k;
+	const size_t B = this->batch;
+	const size_t H = this->n_hidden;
+	const size_t gate_width = NUM_GATES*H;
+	lstmTraining *tr = this->train;
+	if(!tr)
+	{
+		const clTensor none = {NULL, 0, 0, TENSOR_F32};
+		tr = this->train = new lstmTraining;
+		tr->d_weights = tr->d_bias = tr->window = tr->d_out = none;
+		tr->ckpt_h = tr->ckpt_c = tr->seg_z = tr->seg_acts = tr->seg_dp = tr->seg_c = none;
+		tr->hidden = tr->d_hidden = tr->d_state = none;
+		if(this->backend == BACKEND_OPENCL)
+		{
+			tr->d_weights	= createTensorCl(gate_width, this->n_concat);
+			tr->d_bias	= createTensorCl(NUM_GATES, H);
+			tr->hidden	= createTensorCl(B, H);
+			tr->d_hidden	= createTensorCl(B, H);
+			tr->d_state	= createTensorCl(B, H);
+		}
+		else
+		{
+			tr->cpu_d_weights.resize(gate_width*this->n_concat);
+			tr->cpu_d_bias.resize(gate_width);
+			tr->cpu_hidden.resize(B*H);
+			tr->cpu_d_hidden.resize(B*H);
+			tr->cpu_d_state.resize(B*H);
+		}
+		zeroGradients();
+	}
+
+	if(this->backend == BACKEND_OPENCL)
+	{
+		growTensor(tr->window, steps*B, this->n_in);
+		growTensor(tr->d_out, steps*B, H);
+		growTensor(tr->ckpt_h, segments*B, H);
+		growTensor(tr->ckpt_c, segments*B, H);
+		growTensor(tr->seg_z, k*B, this->n_concat);
+		growTensor(tr->seg_acts, k*B, gate_width);
+		growTensor(tr->seg_dp, k*B, gate_width);
+		growTensor(tr->seg_c, (k + 1)*B, H);
+	}
+	else
+	{
+		growVector(tr->cpu_ckpt_h, segments*B*H);
+		growVector(tr->cpu_ckpt_c, segments*B*H);
+		growVector(tr->cpu_seg_z, k*B*this->n_concat);
+		growVector(tr->cpu_seg_acts, k*B*gate_width);
+		growVector(tr->cpu_seg_dp, k*B*gate_width);
+		growVector(tr->cpu_seg_c, (k + 1)*B*H);
+	}
+	return tr;
+}
+//Checkpointed BPTT. The forward pass keeps h/c at every k-th step only. Going back, each
+//segment is recomputed from its checkpoint, this time keeping [h, x], the activated gates
+//and c of every step, and then run backwards, carrying dL/dh and dL/dc into the segment
+//before it. The weight gradients of a segment are one a^T*b over all its steps and batch
+//rows, so each weight gradient is written once per segment rather than once per step.
+void LSTMCell::backwardPass(const cl_float *window, unsigned steps, const cl_float *d_outputs, unsigned checkpoint_every)
+{
+	traceScope span("LSTMCell::backwardPass");
+	if(steps == 0)
+		return;
+	const unsigned k = checkpoint_every == 0 || checkpoint_every > steps ? steps : checkpoint_every;
+	lstmTraining *tr = trainingBuffers(steps, k);
+	if(this->backend == BACKEND_CPU)
+		backwardPassCpu(tr, window, steps, d_outputs, k);
+	else
+		backwardPassCl(tr, window, steps, d_outputs, k);
+}
+void LSTMCell::backwardPassCl(lstmTraining *tr, const cl_float *window, unsigned steps, const cl_float *d_outputs, unsigned k)
+{
+	const unsigned B = this->batch;
+	const unsigned segments = (steps + k - 1)/k;
+	const unsigned last = (segments - 1)*k;
+	cl_event done;
+
+	//both are read before this returns
+	uploadRowsCl(tr->window, 0, steps*B, window, CL_TRUE, 1, &this->step_done);
+	uploadRowsCl(tr->d_out, 0, steps*B, d_outputs, CL_TRUE, 1, &this->step_done);
+
+	//forward up to the last checkpoint, keeping h and c at every segment start
+	for(unsigned t = 0; t <= last; t++)
+	{
+		if(t % k == 0)
+		{
+			copyRowsCl(this->prev_output, 0, tr->ckpt_h, (t/k)*B, B, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+			copyRowsCl(this->prev_state, 0, tr->ckpt_c, (t/k)*B, B, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+		}
+		if(t == last)
+			break;
+		cl_event copied;
+		copyRowsCl(tr->window, t*B, this->curr_input, 0, B, 1, &this->step_done, &copied);
+		step(copied);
+		clReleaseEvent(copied);
+	}
+
+	fillTensorCl(tr->d_hidden, 0.0f, 1, &this->step_done, &done);
+	chain(this->step_done, done);
+	fillTensorCl(tr->d_state, 0.0f, 1, &this->step_done, &done);
+	chain(this->step_done, done);
+	for(unsigned s = segments; s-- > 0;)
+	{
+		const unsigned t0 = s*k;
+		const unsigned len = std::min(k, steps - t0);
+
+		copyRowsCl(tr->ckpt_h, s*B, tr->hidden, 0, B, 1, &this->step_done, &done);
+		chain(this->step_done, done);
+		copyRowsCl(tr->ckpt_c, s*B, tr->seg_c, 0, B, 1, &this->step_done, &done);
+		chain(this->step_done, done);
+		for(unsigned j = 0; j < len; j++)
+		{
+			copyRowsCl(tr->window, (t0 + j)*B, this->curr_input, 0, B, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+			matrixConcatCl(tr->hidden, this->curr_input, this->concat_input, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+			copyRowsCl(this->concat_input, 0, tr->seg_z, j*B, B, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+			matrixMultiplyCl(this->concat_input, this->w_gates, this->gates_calc, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+			lstmPointwiseTrainCl(	this->gates_calc, this->b_gates, tr->seg_acts, j*B,
+						tr->seg_c, j*B, (j + 1)*B, tr->hidden, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+		}
+		//the window's final h and c, as forwardSequence leaves them
+		if(s == segments - 1)
+		{
+			copyRowsCl(tr->hidden, 0, this->prev_output, 0, B, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+			copyRowsCl(tr->seg_c, len*B, this->prev_state, 0, B, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+		}
+
+		for(unsigned j = len; j-- > 0;)
+		{
+			lstmBackwardPointwiseCl(tr->seg_acts, j*B, tr->seg_c, j*B, (j + 1)*B,
+						tr->d_out, (t0 + j)*B, tr->d_hidden, tr->d_state, tr->seg_dp,
+						1, &this->step_done, &done);
+			chain(this->step_done, done);
+			//dL/dh of the step before goes back through the W_h columns
+			matrixMultiplyNnCl(tr->seg_dp, j*B, B, this->w_gates, tr->d_hidden, 1, &this->step_done, &done);
+			chain(this->step_done, done);
+		}
+		matrixMultiplyTnCl(tr->seg_dp, tr->seg_z, len*B, tr->d_weights, 1, &this->step_done, &done);
+		chain(this->step_done, done);
+		columnSumCl(tr->seg_dp, len*B, tr->d_bias, 1, &this->step_done, &done);
+		chain(this->step_done, done);
+	}
+}
+void LSTMCell::backwardPassCpu(lstmTraining *tr, const cl_float *window, unsigned steps, const cl_float *d_outputs, unsigned k)
+{
+	const unsigned B = this->batch;
+	const unsigned H = this->n_hidden;
+	const unsigned gate_width = NUM_GATES*H;
+	const unsigned segments = (steps + k - 1)/k;
+	const unsigned last = (segments - 1)*k;
+	const size_t hs = B*H;
+
+	for(unsigned t = 0; t <= last; t++)
+	{
+		if(t % k == 0)
+		{
+			memcpy(&tr->cpu_ckpt_h[(t/k)*hs], this->cpu_prev_output, sizeof(float)*hs);
+			memcpy(&tr->cpu_ckpt_c[(t/k)*hs], this->cpu_prev_state, sizeof(float)*hs);
+		}
+		if(t < last)
+			stepCpu(&window[t*B*this->n_in]);
+	}
+
+	std::fill(tr->cpu_d_hidden.begin(), tr->cpu_d_hidden.end(), 0.0f);
+	std::fill(tr->cpu_d_state.begin(), tr->cpu_d_state.end(), 0.0f);
+	for(unsigned s = segments; s-- > 0;)
+	{
+		const unsigned t0 = s*k;
+		const unsigned len = std::min(k, steps - t0);
+		float *z = tr->cpu_seg_z.data();
+		float *acts = tr->cpu_seg_acts.data();
+		float *dp = tr->cpu_seg_dp.data();
+		float *c = tr->cpu_seg_c.data();
+
+		memcpy(tr->cpu_hidden.data(), &tr->cpu_ckpt_h[s*hs], sizeof(float)*hs);
+		memcpy(c, &tr->cpu_ckpt_c[s*hs], sizeof(float)*hs);
+		for(unsigned j = 0; j < len; j++)
+		{
+			float *zj = &z[j*B*this->n_concat];
+			float *aj = &acts[j*B*gate_width];
+			matrixConcatCpu(tr->cpu_hidden.data(), &window[(t0 + j)*B*this->n_in], zj, B, H, this->n_in);
+			matrixMultiplyCpu(zj, this->cpu_weights, aj, B, gate_width, this->n_concat);
+			lstmPointwiseTrainCpu(aj, this->cpu_bias, &c[j*hs], &c[(j + 1)*hs], tr->cpu_hidden.data(), H, B);
+		}
+		if(s == segments - 1)
+		{
+			memcpy(this->cpu_prev_output, tr->cpu_hidden.data(), sizeof(float)*hs);
+			memcpy(this->cpu_prev_state, &c[len*hs], sizeof(float)*hs);
+		}
+
+		for(unsigned j = len; j-- > 0;)
+		{
+			float *dpj = &dp[j*B*gate_width];
+			lstmBackwardPointwiseCpu(&acts[j*B*gate_width], &c[j*hs], &c[(j + 1)*hs],
+						&d_outputs[(t0 + j)*hs], tr->cpu_d_hidden.data(),
+						tr->cpu_d_state.data(), dpj, H, B);
+			matrixMultiplyNnCpu(dpj, this->cpu_weights, tr->cpu_d_hidden.data(), B, H, gate_width, this->n_concat);
+		}
+		matrixMultiplyTnCpu(dp, z, tr->cpu_d_weights.data(), gate_width, this->n_concat, len*B);
+		columnSumCpu(dp, tr->cpu_d_bias.data(), len*B, gate_width);
+	}
+}
+void LSTMCell::zeroGradients()
+{
+	lstmTraining *tr = this->train ? this->train : trainingBuffers(1, 1);
+	if(this->backend == BACKEND_CPU)
+	{
+		std::fill(tr->cpu_d_weights.begin(), tr->cpu_d_weights.end(), 0.0f);
+		std::fill(tr->cpu_d_bias.begin(), tr->cpu_d_bias.end(), 0.0f);
+		return;
+	}
+	cl_event done;
+	fillTensorCl(tr->d_weights, 0.0f, 1, &this->step_done, &done);
+	chain(this->step_done, done);
+	fillTensorCl(tr->d_bias, 0.0f, 1, &this->step_done, &done);
+	chain(this->step_done, done);
+}
+void LSTMCell::getGradients(cl_float *d_weights, cl_float *d_bias)
+{
+	lstmTraining *tr = this->train ? this->train : trainingBuffers(1, 1);
+	if(this->backend == BACKEND_CPU)
+	{
+		memcpy(d_weights, tr->cpu_d_weights.data(), sizeof(float)*tr->cpu_d_weights.size());
+		memcpy(d_bias, tr->cpu_d_bias.data(), sizeof(float)*tr->cpu_d_bias.size());
+		return;
+	}
+	downloadTensorCl(tr->d_weights, d_weights, CL_TRUE, 1, &this->step_done);
+	downloadTensorCl(tr->d_bias, d_bias, CL_TRUE, 1, &this->step_done);
+}
+void LSTMCell::applyGradients(float learning_rate, const cl_float *d_weights, const cl_float *d_bias)
+{
+	traceScope span("LSTMCell::applyGradients");
+	lstmTraining *tr = this->train ? this->train : trainingBuffers(1, 1);
+	if(this->backend == BACKEND_CPU)
+	{
+		axpyCpu(d_weights ? d_weights : tr->cpu_d_weights.data(), this->cpu_weights, -learning_rate, tr->cpu_d_weights.size());
+		axpyCpu(d_bias ? d_bias : tr->cpu_d_bias.data(), this->cpu_bias, -learning_rate, tr->cpu_d_bias.size());
+		return;
+	}
+
+	cl_event done;
+	//host gradients replace the accumulators, the uploads block so the caller's copy is free
+	if(d_weights)
+		uploadTensorCl(tr->d_weights, d_weights, CL_TRUE, 1, &this->step_done);
+	if(d_bias)
+		uploadTensorCl(tr->d_bias, d_bias, CL_TRUE, 1, &this->step_done);
+	axpyCl(tr->d_weights, this->w_gates, -learning_rate, 1, &this->step_done, &done);
+	chain(this->step_done, done);
+	axpyCl(tr->d_bias, this->b_gates, -learning_rate, 1, &this->step_done, &done);
+	chain(this->step_done, done);
+}
+void LSTMCell::getWeights(cl_float *weights, cl_float *bias)
+{
+	checkTrainable();
+	if(this->backend == BACKEND_CPU)
+	{
+		memcpy(weights, this->cpu_weights, sizeof(float)*NUM_GATES*this->n_hidden*this->n_concat);
+		memcpy(bias, this->cpu_bias, sizeof(float)*NUM_GATES*this->n_hidden);
+		return;
+	}
+	downloadTensorCl(this->w_gates, weights, CL_TRUE, 1, &this->step_done);
+	downloadTensorCl(this->b_gates, bias, CL_TRUE, 1, &this->step_done);
+}
+void LSTMCell::setWeights(const cl_float *weights, const cl_float *bias)
+{
+	checkTrainable();
+	if(this->backend == BACKEND_CPU)
+	{
+		memcpy(this->cpu_weights, weights, sizeof(float)*NUM_GATES*this->n_hidden*this->n_concat);
+		memcpy(this->cpu_bias, bias, sizeof(float)*NUM_GATES*this->n_hidden);
+		return;
+	}
+	uploadTensorCl(this->w_gates, weights, CL_TRUE, 1, &this->step_done);
+	uploadTensorCl(this->b_gates, bias, CL_TRUE, 1, &this->step_done);
+}
+void stageWindows(const cl_float *windows, unsigned first, unsigned rows, unsigned steps, unsigned n_in,
+		unsigned batch, cl_float *staged, size_t stride)
+{
+	if(stride == 0)
+		stride = (size_t)steps*n_in;
+	for(unsigned t = 0; t < steps; t++)
+	{
+		cl_float *dst = &staged[(size_t)t*batch*n_in];
+		for(unsigned r = 0; r < rows; r++)
+			memcpy(&dst[(size_t)r*n_in], &windows[(first + r)*stride + (size_t)t*n_in], sizeof(float)*n_in);
+		memset(&dst[(size_t)rows*n_in], 0, sizeof(float)*(batch - rows)*n_in);
+	}
+}
@@ -1,45 +1,193 @@
 #ifndef LSTM_H
 #define LSTM_H
 
-#include "oclabstract.hpp"
+#include "oclabstract.h"
+#include "cpubackend.h"
+#include "model.h"
 
+//backwardPass buffers, allocated on first use
+struct lstmTraining;
+
+//where a cell does its math. The OpenCL backend needs an environment bound to the calling
+//thread (setupOclEnv, or bindOclEnv on a worker) and enqueues on it for the cell's whole life.
+enum lstm_backend
+{
+	BACKEND_OPENCL,
+	BACKEND_CPU
+};
+
+//With BACKEND_OPENCL all weights, biases and the h/c state are device tensors and host
+//memory is only touched when a window is uploaded or the output is read back.
+//With BACKEND_CPU the same layout lives in aligned host memory and runs on the SIMD kernels.
+//A cell advances batch independent windows at once: every input, h and c is batch rows
+//deep and windows are time-major, (steps*batch) x n_in.
+//The shape is set at construction, INPUT_SIZE x OUTPUT_SIZE unless the caller or the model
+//file says otherwise. On platforms that build from source the OpenCL backend specializes
+//its kernels for it (specializeOclEnv).
+//With split_weights the gate weights are stored as W_x and W_h instead of one packed
+//[W_h W_x] block. A window then starts with one GEMM of all its timesteps against W_x and
+//the serial loop only multiplies h by W_h, which takes the input half of the FLOPs off the
+//critical path.
+//storage (TENSOR_F16 or TENSOR_BF16) keeps the weights in 16 bits, and on the device the
+//biases and cached projections too. The kernels widen them as they load, so all the
+//arithmetic and h/c stay float.
 class LSTMCell
 {
 	private:
-		//weight memory
-		cl_float *w_forget;
-		cl_float *w_input;
-		cl_float *w_internal;
-		cl_float *w_output;
-		//bias memory
-		cl_float *b_forget;
-		cl_float *b_input;
-		cl_float *b_internal;
-		cl_float *b_output;
-
-		//intermediate matrices
-		cl_float *forget_calc;
-		cl_float *input_calc;
-		cl_float *internal_calc;
-		cl_float *concat_input;
+		lstm_backend backend;
+		unsigned batch;
+		//input and hidden size, n_concat = n_hidden + n_in is the width of a packed weight row
+		unsigned n_in;
+		unsigned n_hidden;
+		unsigned n_concat;
+		//split weight mode, only W_x and W_h are kept and every step runs on projected inputs
+		bool split;
+		//element type of the weights. TENSOR_I8 comes from a MODEL_I8 file and has its row
+		//scales in w_scales, the 16-bit types also apply to the device biases and projections.
+		tensor_type storage;
+
+		//weight memory, NUM_GATES*n_hidden x n_concat, one row per hidden unit,
+		//gates packed in GATE_* order so one fused kernel reads them all
+		clTensor w_gates;
+		//bias memory, NUM_GATES x n_hidden
+		clTensor b_gates;
+		//int8 row scales, NUM_GATES*n_hidden x 1
+		clTensor w_scales;
+
+		//batched step intermediates, batch x n_concat and batch x NUM_GATES*n_hidden
+		clTensor concat_input;
+		clTensor gates_calc;
+		//TENSOR_I8 batches only, concat_input quantized by row and its batch x 1 scales
+		clTensor concat_q;
+		clTensor concat_scales;
 
 		//cell IO
-		cl_float *curr_input;
-		cl_float *curr_output;
-		cl_float *prev_output;
-		cl_float *curr_state;
-		cl_float *prev_state;
-
-		//private gate functions
-		inline void forget();
-		inline void input();
-		inline void internal();
-		inline void output();
-		inline void nextState();
-		inline void nextOutput();
+		clTensor curr_input;
+		clTensor curr_output;
+		clTensor prev_output;
+		clTensor curr_state;
+		clTensor prev_state;
+
+		//h for every step of the last sequence when the caller does not want them
+		clTensor seq_outputs;
+
+		//completion of the most recent step, everything enqueued later chains off it
+		cl_event step_done;
+
+		//CPU backend copies of the above, same packing. The weights may point into a model
+		//mapping instead, owns_weights says whether they are ours to free. On either backend
+		//only owned weights can be trained.
+		bool owns_weights;
+		float *cpu_weights;
+		const int8_t *cpu_weights_i8;
+		const float *cpu_w_scales;
+		//16-bit storage on the CPU covers the weights only, cpu_wx_h/cpu_wh_h are the split halves
+		uint16_t *cpu_weights_h;
+		float *cpu_bias;
+		float *cpu_prev_output;
+		float *cpu_curr_output;
+		float *cpu_prev_state;
+		float *cpu_curr_state;
+		float *cpu_scratch;
+		//device window used by the host-pointer forwardSequence
+		clTensor window_buf;
+
+		//input projection cache: the packed weights split into W_x (NUM_GATES*n_hidden x
+		//n_in) and W_h (NUM_GATES*n_hidden x n_hidden), and a ring of proj_slots
+		//projected timesteps, each batch x NUM_GATES*n_hidden
+		clTensor w_x;
+		clTensor w_h;
+		clTensor proj_ring;
+		//one timestep of projections in the ring's storage, on its way into a slot
+		clTensor proj_step;
+		float *cpu_wx;
+		float *cpu_wh;
+		uint16_t *cpu_wx_h;
+		uint16_t *cpu_wh_h;
+		float *cpu_proj_ring;
+		unsigned proj_slots;
+		//X*W_x^T for a whole window in split mode, (steps*batch) x NUM_GATES*n_hidden
+		clTensor seq_proj;
+		float *cpu_seq_proj;
+		unsigned cpu_seq_proj_rows;
+
+		lstmTraining *train;
+
+		void step(cl_event input_ready);
+		void stepCpu(const float *new_input);
+		void stepProjectedCl(const clTensor &proj, size_t row);
+		void stepProjectedCpu(const float *proj);
+		void splitWeights();
+		float *cpuProjection(unsigned rows);
+		void projectCpu(const float *x, float *proj, unsigned rows);
+		void initMembers(lstm_backend backend, unsigned batch, bool split_weights, tensor_type storage,
+				unsigned n_in, unsigned n_hidden);
+		void initState();
+		void checkTrainable() const;
+		lstmTraining *trainingBuffers(unsigned steps, unsigned k);
+		void backwardPassCl(lstmTraining *tr, const cl_float *window, unsigned steps, const cl_float *d_outputs, unsigned k);
+		void backwardPassCpu(lstmTraining *tr, const cl_float *window, unsigned steps, const cl_float *d_outputs, unsigned k);
 	public:
-		LSTMCell(cl_float*, cl_float*, cl_float*, cl_float*);
-		void forwardPass(cl_float *new_input);
-		void backwardPass(cl_float *training_input);
-}
+		LSTMCell(cl_float*, cl_float*, cl_float*, cl_float*,
+			cl_float* = NULL, cl_float* = NULL, cl_float* = NULL, cl_float* = NULL,
+			lstm_backend = BACKEND_OPENCL, unsigned batch = 1, bool split_weights = false,
+			tensor_type storage = TENSOR_F32, unsigned n_in = INPUT_SIZE, unsigned n_hidden = OUTPUT_SIZE);
+		//layer of an open model file, used in place without a host copy. The shape and storage
+		//follow the file. MODEL_I8 files run the int8 kernels and cannot be split.
+		LSTMCell(const lstmModel &model, unsigned layer,
+			lstm_backend = BACKEND_OPENCL, unsigned batch = 1, bool split_weights = false);
+		~LSTMCell();
+		void reset();
+		unsigned inputSize() const { return n_in; }
+		unsigned hiddenSize() const { return n_hidden; }
+		//both enqueue only, the host is not blocked until getOutput/getState
+		void forwardPass(const cl_float *new_input);
+		//OpenCL only, for chaining cells: rows row .. row+batch-1 of input (another cell's
+		//output, a window on the device) are copied in once wait_list completes. consumed,
+		//when given, receives the copy's event, input may be overwritten after it.
+		void forwardPass(const clTensor &input, size_t row, cl_uint num_events, const cl_event *wait_list,
+				cl_event *consumed = NULL);
+		//newest h on the device and the event it is complete after, both change with every step
+		const clTensor &outputTensor() const { return prev_output; }
+		cl_event stepDone() const { return step_done; }
+		//outputs, when given, receives h for every step ((steps*batch) x n_hidden)
+		void forwardSequence(const clTensor &window, unsigned steps, clTensor *outputs = NULL);
+		//host window ((steps*batch) x n_in) on either backend, blocks until outputs is filled
+		void forwardSequence(const cl_float *window, unsigned steps, cl_float *outputs = NULL);
+		//Cached input projections, for inputs that are seen by more than one window.
+		//projectInput stores x*W_x^T for one timestep (batch x n_in, read before it
+		//returns) in a slot of the ring, forwardProjected steps through steps slots from
+		//first_slot on, wrapping around, with only h*W_h^T left to do per step.
+		void setProjectionSlots(unsigned slots);
+		void projectInput(const cl_float *new_input, unsigned slot);
+		void forwardProjected(unsigned first_slot, unsigned steps);
+		void getOutput(cl_float *host);
+		void getState(cl_float *host);
+		//Truncated backpropagation through time over one window ((steps*batch) x n_in), starting
+		//from the current h and c, which are left at the end of the window as forwardSequence
+		//would. d_outputs is dL/dh for every step ((steps*batch) x n_hidden, zero where there is
+		//no loss). Gradients stop at the window start and are summed over steps and batch rows
+		//into the accumulators.
+		//Only every checkpoint_every-th h/c is kept from the forward pass and each segment in
+		//between is recomputed when the backward pass reaches it, so activation memory is
+		//O(steps/k + k) instead of O(steps). 0 keeps the whole window as one segment.
+		//Needs float packed weights owned by the cell (not split, not from a model file).
+		void backwardPass(const cl_float *window, unsigned steps, const cl_float *d_outputs, unsigned checkpoint_every = 0);
+		void zeroGradients();
+		//NUM_GATES*n_hidden x n_concat and NUM_GATES x n_hidden, in the packed weight layout
+		void getGradients(cl_float *d_weights, cl_float *d_bias);
+		//weights -= learning_rate*gradients, from the accumulators or, when given, from host
+		//gradients in the getGradients layout (summed over several replicas, say)
+		void applyGradients(float learning_rate, const cl_float *d_weights = NULL, const cl_float *d_bias = NULL);
+		//the weights in the getGradients layout, for copies of a cell kept in step by a trainer
+		void getWeights(cl_float *weights, cl_float *bias);
+		void setWeights(const cl_float *weights, const cl_float *bias);
+};
+
+//Regroups windows first .. first+rows-1 (steps x n_in each, stride floats apart, 0 for
+//steps*n_in) time-major into staged, the (steps*batch) x n_in layout forwardSequence and
+//backwardPass take: row t*batch + r is step t of window r. Rows from rows up to batch are
+//zeroed, so a short last chunk runs zero windows.
+void stageWindows(const cl_float *windows, unsigned first, unsigned rows, unsigned steps, unsigned n_in,
+		unsigned batch, cl_float *staged, size_t stride = 0);
 #endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <math.h>
+#include "oclabstract.h"
+#include "cpubackend.h"
+#include "blockfile.h"
+#include "model.h"
+
+//gate letters indexed by GATE_*
+static void gateOrder(char order[4])
+{
+	order[GATE_FORGET] = 'f';
+	order[GATE_INPUT] = 'i';
+	order[GATE_INTERNAL] = 'g';
+	order[GATE_OUTPUT] = 'o';
+}
+static uint64_t dtypeSize(uint32_t dtype)
+{
+	if(dtype == MODEL_I8)
+		return sizeof(int8_t);
+	if(dtype == MODEL_F16 || dtype == MODEL_BF16)
+		return sizeof(uint16_t);
+	return sizeof(float);
+}
+//fills in everything but the layer shapes, which the caller has already set
+static void layoutModel(modelHeader &h, uint32_t dtype, unsigned num_layers)
+{
+	memcpy(h.magic, MODEL_MAGIC, sizeof(h.magic));
+	h.version = MODEL_VERSION;
+	h.dtype = dtype;
+	gateOrder(h.gate_order);
+	h.num_layers = num_layers;
+
+	uint64_t offset = alignUp(sizeof(h), MODEL_ALIGN);
+	for(unsigned l = 0; l < num_layers; l++)
+	{
+		modelLayer &layer = h.layers[l];
+		const uint64_t rows = (uint64_t)NUM_GATES*layer.n_hidden;
+		layer.weight_offset = offset;
+		layer.weight_bytes = dtypeSize(dtype)*rows*(layer.n_hidden + layer.n_in);
+		offset = alignUp(layer.weight_offset + layer.weight_bytes, MODEL_ALIGN);
+		layer.scale_offset = dtype == MODEL_I8 ? offset : 0;
+		layer.scale_bytes = dtype == MODEL_I8 ? sizeof(float)*rows : 0;
+		offset = alignUp(offset + layer.scale_bytes, MODEL_ALIGN);
+		layer.bias_offset = offset;
+		layer.bias_bytes = sizeof(float)*rows;
+		offset = alignUp(layer.bias_offset + layer.bias_bytes, MODEL_ALIGN);
+	}
+}
+
+//mapped with mapBlockFile, see blockfile.h
+bool openModel(const char *path, lstmModel &model)
+{
+	model.map = NULL;
+	model.bytes = 0;
+	model.header = NULL;
+
+	size_t bytes;
+	void *map = mapBlockFile(path, sizeof(modelHeader), "model file", true, bytes);
+	if(!map)
+		return false;
+
+	const modelHeader *h = (const modelHeader *)map;
+	char order[4];
+	gateOrder(order);
+	const char *err = NULL;
+	if(memcmp(h->magic, MODEL_MAGIC, sizeof(h->magic)) != 0)
+		err = "bad magic";
+	else if(h->version != MODEL_VERSION)
+		err = "unsupported version";
+	else if(h->dtype > MODEL_BF16)
+		err = "unsupported dtype";
+	else if(memcmp(h->gate_order, order, sizeof(order)) != 0)
+		err = "gate order does not match GATE_*";
+	else if(h->num_layers == 0 || h->num_layers > MODEL_MAX_LAYERS)
+		err = "bad layer count";
+	for(unsigned l = 0; !err && l < h->num_layers; l++)
+	{
+		const modelLayer &layer = h->layers[l];
+		const uint64_t rows = (uint64_t)NUM_GATES*layer.n_hidden;
+		const uint64_t scale_bytes = h->dtype == MODEL_I8 ? sizeof(float)*rows : 0;
+		if(layer.weight_bytes != dtypeSize(h->dtype)*rows*(layer.n_hidden + layer.n_in) ||
+			layer.bias_bytes != sizeof(float)*rows || layer.scale_bytes != scale_bytes)
+			err = "layer shape does not match its block sizes";
+		if(!err)
+			err = checkBlock(layer.weight_offset, layer.weight_bytes, MODEL_ALIGN, bytes);
+		if(!err)
+			err = checkBlock(layer.scale_offset, layer.scale_bytes, MODEL_ALIGN, bytes);
+		if(!err)
+			err = checkBlock(layer.bias_offset, layer.bias_bytes, MODEL_ALIGN, bytes);
+	}
+	if(err)
+	{
+		printf("%s: %s\n", path, err);
+		unmapBlockFile(map, bytes);
+		return false;
+	}
+
+	model.map = map;
+	model.bytes = bytes;
+	model.header = h;
+	return true;
+}
+void closeModel(lstmModel &model)
+{
+	unmapBlockFile(model.map, model.bytes);
+	model.map = NULL;
+	model.bytes = 0;
+	model.header = NULL;
+}
+const void *modelWeights(const lstmModel &model, unsigned layer)
+{
+	return (const char *)model.map + model.header->layers[layer].weight_offset;
+}
+const float *modelScales(const lstmModel &model, unsigned layer)
+{
+	return (const float *)((const char *)model.map + model.header->layers[layer].scale_offset);
+}
+const float *modelBias(const lstmModel &model, unsigned layer)
+{
+	return (const float *)((const char *)model.map + model.header->layers[layer].bias_offset);
+}
+
+//the packed layout is what the gate-array LSTMCell constructor builds, gate blocks one after
+//another, so each gate is written as it is
+bool writeModel(const char *path, unsigned num_layers, const unsigned *n_in, const unsigned *n_hidden,
+		const float *const *weights, const float *const *biases)
+{
+	if(num_layers == 0 || num_layers > MODEL_MAX_LAYERS)
+		return false;
+
+	modelHeader h;
+	memset(&h, 0, sizeof(h));
+	for(unsigned l = 0; l < num_layers; l++)
+	{
+		h.layers[l].n_in = n_in[l];
+		h.layers[l].n_hidden = n_hidden[l];
+	}
+	layoutModel(h, MODEL_F32, num_layers);
+
+	FILE *file = fopen(path, "wb");
+	if(!file)
+	{
+		perror(path);
+		return false;
+	}
+	bool ok = writeBlock(file, 0, &h, sizeof(h));
+	std::vector<float> zeros;
+	for(unsigned l = 0; ok && l < num_layers; l++)
+	{
+		const modelLayer &layer = h.layers[l];
+		const size_t gate_weights = sizeof(float)*n_hidden[l]*(n_hidden[l] + n_in[l]);
+		const size_t gate_bias = sizeof(float)*n_hidden[l];
+		zeros.assign(n_hidden[l], 0.0f);
+
+		for(unsigned g = 0; ok && g < NUM_GATES; g++)
+		{
+			const float *b = (biases && biases[l*NUM_GATES + g]) ? biases[l*NUM_GATES + g] : zeros.data();
+			ok = writeBlock(file, layer.weight_offset + g*gate_weights, weights[l*NUM_GATES + g], gate_weights) &&
+				writeBlock(file, layer.bias_offset + g*gate_bias, b, gate_bias);
+		}
+	}
+	if(fclose(file) != 0)
+		ok = false;
+	if(!ok)
+		printf("Failed to write model %s\n", path);
+	return ok;
+}
+bool convertModel(const char *in_path, const char *out_path, model_dtype dtype)
+{
+	lstmModel in;
+	if(!openModel(in_path, in))
+		return false;
+	if(in.header->dtype != MODEL_F32 || dtype == MODEL_F32)
+	{
+		printf("Only float models can be converted, to int8 or 16-bit\n");
+		closeModel(in);
+		return false;
+	}
+
+	modelHeader h;
+	memset(&h, 0, sizeof(h));
+	for(unsigned l = 0; l < in.header->num_layers; l++)
+	{
+		h.layers[l].n_in = in.header->layers[l].n_in;
+		h.layers[l].n_hidden = in.header->layers[l].n_hidden;
+	}
+	layoutModel(h, dtype, in.header->num_layers);
+
+	FILE *file = fopen(out_path, "wb");
+	if(!file)
+	{
+		perror(out_path);
+		closeModel(in);
+		return false;
+	}
+	bool ok = writeBlock(file, 0, &h, sizeof(h));
+	for(unsigned l = 0; ok && l < h.num_layers; l++)
+	{
+		const modelLayer &layer = h.layers[l];
+		const int rows = NUM_GATES*layer.n_hidden;
+		const int cols = layer.n_hidden + layer.n_in;
+		const size_t count = (size_t)rows*cols;
+		const float *w = (const float *)modelWeights(in, l);
+		std::vector<float> scales(rows);
+		std::vector<float> back(count);
+		std::vector<char> q(layer.weight_bytes);
+		if(dtype == MODEL_I8)
+		{
+			quantizeRowsCpu(w, (int8_t *)q.data(), scales.data(), rows, cols);
+			for(size_t i = 0; i < count; i++)
+				back[i] = ((const int8_t *)q.data())[i]*scales[i/cols];
+		}
+		else
+		{
+			floatToHalfCpu(w, (uint16_t *)q.data(), count, dtype == MODEL_BF16);
+			halfToFloatCpu((const uint16_t *)q.data(), back.data(), count, dtype == MODEL_BF16);
+		}
+
+		//worst reconstruction error relative to the largest weight of its row
+		double worst = 0.0;
+		for(int r = 0; r < rows; r++)
+		{
+			double absmax = 0.0, err = 0.0;
+			for(int c = 0; c < cols; c++)
+			{
+				const size_t i = (size_t)r*cols + c;
+				absmax = fmax(absmax, fabs(w[i]));
+				err = fmax(err, fabs(w[i] - back[i]));
+			}
+			if(absmax > 0.0)
+				worst = fmax(worst, err/absmax);
+		}
+		printf("layer %u: %d x %d, worst error %.3g of row absmax\n", l, rows, cols, worst);
+
+		ok = writeBlock(file, layer.weight_offset, q.data(), layer.weight_bytes) &&
+			(dtype != MODEL_I8 || writeBlock(file, layer.scale_offset, scales.data(), layer.scale_bytes)) &&
+			writeBlock(file, layer.bias_offset, modelBias(in, l), layer.bias_bytes);
+	}
+	if(fclose(file) != 0)
+		ok = false;
+	if(!ok)
+		printf("Failed to write model %s\n", out_path);
+	closeModel(in);
+	return ok;
+}
@@ -0,0 +1,81 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Versioned binary model file, loaded with mmap so weights go straight from the page cache
+//to the device (or the CPU kernels) without an intermediate copy. Several processes that
+//load the same file share its pages.
+//
+//	offset 0:	modelHeader
+//	then:		per layer, packed weights (NUM_GATES*H x (H + I) of dtype, [W_h W_x] rows
+//			in GATE_* order), int8 row scales (NUM_GATES*H floats, MODEL_I8 only) and biases
+//			(NUM_GATES x H floats), each starting on a MODEL_ALIGN boundary
+//
+//All fields are little endian.
+
+#define MODEL_MAGIC "RNNMODEL"
+#define MODEL_VERSION 2
+#define MODEL_ALIGN 4096
+#define MODEL_MAX_LAYERS 8
+
+//element type of the weight block, scales and biases are always float
+enum model_dtype
+{
+	MODEL_F32 = 0,
+	//symmetric per-row int8, weight row r is q[r]*scale[r]
+	MODEL_I8 = 1,
+	//16-bit storage, IEEE half or the top half of a float
+	MODEL_F16 = 2,
+	MODEL_BF16 = 3
+};
+
+struct modelLayer
+{
+	uint32_t n_in;
+	uint32_t n_hidden;
+	uint64_t weight_offset;
+	uint64_t weight_bytes;
+	uint64_t bias_offset;
+	uint64_t bias_bytes;
+	uint64_t scale_offset;
+	uint64_t scale_bytes;
+};
+
+struct modelHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t dtype;
+	//one letter per packed gate slot, "figo" for the GATE_* order in oclabstract.h
+	char gate_order[4];
+	uint32_t num_layers;
+	modelLayer layers[MODEL_MAX_LAYERS];
+};
+
+//an open model, the mapping stays valid (and cells built from it may point into it) until closeModel
+struct lstmModel
+{
+	void *map;
+	size_t bytes;
+	const modelHeader *header;
+};
+
+bool openModel(const char *path, lstmModel &model);
+void closeModel(lstmModel &model);
+//float for MODEL_F32, int8_t for MODEL_I8, uint16_t for MODEL_F16/MODEL_BF16
+const void *modelWeights(const lstmModel &model, unsigned layer);
+const float *modelBias(const lstmModel &model, unsigned layer);
+//MODEL_I8 only
+const float *modelScales(const lstmModel &model, unsigned layer);
+
+//weights[l*NUM_GATES + g] is gate g of layer l, n_hidden x (n_hidden + n_in) as LSTMCell
+//takes them. biases is laid out the same way, any entry (or biases itself) may be NULL for zero.
+bool writeModel(const char *path, unsigned num_layers, const unsigned *n_in, const unsigned *n_hidden,
+		const float *const *weights, const float *const *biases);
+//Offline conversion of a MODEL_F32 file to a smaller dtype, biases stay float. MODEL_I8 gets
+//one scale per output row (absmax/127). Prints the worst weight error of every layer.
+bool convertModel(const char *in_path, const char *out_path, model_dtype dtype);
+
+#endif
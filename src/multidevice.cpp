@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "multidevice.h"
+
+MultiDeviceExecutor::MultiDeviceExecutor(	const char *kernel_file,
+						cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+						cl_float *forget_bias, cl_float *input_bias,
+						cl_float *internal_bias, cl_float *output_bias,
+						unsigned batch, unsigned n_in, unsigned n_hidden)
+{
+	oclEnv *caller = currentOclEnv();
+	this->batch = batch ? batch : 1;
+	this->n_in = n_in;
+	this->n_hidden = n_hidden;
+	if(createDeviceEnvs(kernel_file, this->envs) == 0)
+	{
+		printf("No OpenCL devices to run on\n");
+		exit(1);
+	}
+	//each cell uploads its own copy of the weights to its device
+	for(unsigned d = 0; d < this->envs.size(); d++)
+	{
+		bindOclEnv(this->envs[d]);
+		this->cells.push_back(new LSTMCell(	forget, input, internal, output,
+							forget_bias, input_bias, internal_bias, output_bias,
+							BACKEND_OPENCL, this->batch, false, TENSOR_F32, n_in, n_hidden));
+	}
+	this->rates.resize(this->envs.size(), 0.0);
+	bindOclEnv(caller);
+}
+MultiDeviceExecutor::~MultiDeviceExecutor()
+{
+	oclEnv *caller = currentOclEnv();
+	for(unsigned d = 0; d < this->envs.size(); d++)
+	{
+		bindOclEnv(this->envs[d]);
+		finishCl();
+		delete this->cells[d];
+		releaseOclEnv(this->envs[d]);
+	}
+	bindOclEnv(caller);
+}
+double MultiDeviceExecutor::share(unsigned d) const
+{
+	double total = 0.0;
+	for(unsigned i = 0; i < this->rates.size(); i++)
+	{
+		//until every device has a measurement they all get the same
+		if(this->rates[i] <= 0.0)
+			return 1.0/this->rates.size();
+		total += this->rates[i];
+	}
+	return this->rates[d]/total;
+}
+void MultiDeviceExecutor::forwardBatch(const cl_float *windows, unsigned count, unsigned steps, cl_float *outputs)
+{
+	const unsigned n = this->envs.size();
+	std::vector<unsigned> first(n + 1, 0);
+	double cum = 0.0;
+	for(unsigned d = 0; d < n; d++)
+	{
+		cum += share(d);
+		first[d + 1] = d + 1 == n ? count : std::min(count, (unsigned)(count*cum + 0.5));
+	}
+
+	std::vector<std::thread> threads;
+	for(unsigned d = 0; d < n; d++)
+	{
+		if(first[d + 1] > first[d])
+			threads.push_back(std::thread(&MultiDeviceExecutor::runDevice, this, d, windows,
+						first[d], first[d + 1] - first[d], steps, outputs));
+	}
+	for(unsigned i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+//Windows first .. first+count-1 on device d, batch at a time through stageWindows.
+void MultiDeviceExecutor::runDevice(unsigned d, const cl_float *windows, unsigned first, unsigned count,
+					unsigned steps, cl_float *outputs)
+{
+	bindOclEnv(this->envs[d]);
+	LSTMCell *cell = this->cells[d];
+	std::vector<float> staged((size_t)steps*this->batch*this->n_in);
+	std::vector<float> h((size_t)this->batch*this->n_hidden);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned i = 0; i < count; i += this->batch)
+	{
+		const unsigned rows = std::min(this->batch, count - i);
+		stageWindows(windows, first + i, rows, steps, this->n_in, this->batch, staged.data());
+		cell->reset();
+		cell->forwardSequence(staged.data(), steps);
+		cell->getOutput(h.data());
+		memcpy(&outputs[(size_t)(first + i)*this->n_hidden], h.data(), sizeof(float)*rows*this->n_hidden);
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	//only this thread writes rates[d], forwardBatch reads it after the join
+	const double measured = count/seconds;
+	this->rates[d] = this->rates[d] > 0.0 ? 0.5*(this->rates[d] + measured) : measured;
+}
@@ -0,0 +1,42 @@
+#ifndef MULTIDEVICE_H
+#define MULTIDEVICE_H
+
+#include <vector>
+#include "lstm.hpp"
+
+//Runs batches of independent windows on every OpenCL device of the platform at once (see
+//createDeviceEnvs, CPU devices come split by NUMA node). Each device has its own environment
+//and its own copy of the weights. Every call splits the windows across devices in proportion
+//to the windows per second each one has measured so far, evenly on the first call. A device
+//works through its share batch windows at a time, one window per row of a batched cell.
+class MultiDeviceExecutor
+{
+	private:
+		std::vector<oclEnv *> envs;
+		std::vector<LSTMCell *> cells;
+		//smoothed windows per second of each device, 0 until it has run
+		std::vector<double> rates;
+		unsigned batch;
+		unsigned n_in;
+		unsigned n_hidden;
+
+		void runDevice(unsigned d, const cl_float *windows, unsigned first, unsigned count,
+				unsigned steps, cl_float *outputs);
+	public:
+		//weights as for LSTMCell with n_in inputs and n_hidden units, copied to every device
+		//before this returns
+		MultiDeviceExecutor(const char *kernel_file,
+				cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+				cl_float *forget_bias = NULL, cl_float *input_bias = NULL,
+				cl_float *internal_bias = NULL, cl_float *output_bias = NULL,
+				unsigned batch = 8, unsigned n_in = INPUT_SIZE, unsigned n_hidden = OUTPUT_SIZE);
+		~MultiDeviceExecutor();
+		unsigned devices() const { return envs.size(); }
+		//fraction of the next call's windows device d gets
+		double share(unsigned d) const;
+		//count windows of steps x n_in, one after another. outputs receives the final h of
+		//each, count x n_hidden. Blocks until every device is done.
+		void forwardBatch(const cl_float *windows, unsigned count, unsigned steps, cl_float *outputs);
+};
+
+#endif
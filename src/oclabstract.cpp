@@ -1,314 +1,1986 @@
-#include "oclabstract.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AOCLUtils/aocl_utils.h"
+#include "oclabstract.h"
+#include "trace.h"
+
+using namespace aocl_utils;
 
 //    D A T A   S T R U C T U R E S    //
 
-cl_platform_id 		platform = NULL;
-cl_device_id 		device = NULL;
-cl_context		context = NULL;
-cl_program		program = NULL;
-cl_command_queue	queue = NULL;
-cl_kernel 		k_matrix_add = NULL;
-cl_kernel		k_matrix_mul = NULL;
-cl_kernel		k_sigmoid = NULL;
-cl_kernel		k_tanh = NULL;
-cl_kernel		k_concat = NULL;
-
-//Weight memory
-cl_mem			input_a_buf = NULL;
-cl_mem			input_b_buf = NULL;
-cl_mem			output_buf = NULL;
+//The LSTM kernels of one program: the generic one, or one built for a single n_in x n_hidden
+//shape (0 x 0 for the generic set)
+struct lstmKernels
+{
+	cl_int			n_in;
+	cl_int			n_hidden;
+	cl_program		program;
+	cl_kernel		cell;
+	cl_kernel		sequence;
+	cl_kernel		pointwise;
+	cl_kernel		projected;
+	cl_kernel		sequence_projected;
+	cl_kernel		cell_i8;
+};
+//matrix_mul and its transposed variants of one program with the work group and tiling they
+//were compiled with. variant 0 is the environment's own program, v > 0 one built with
+//gemm_tilings[v - 1].
+struct gemmKernels
+{
+	cl_int			variant;
+	cl_kernel		mul;
+	cl_kernel		mul_nn;
+	cl_kernel		mul_tn;
+	size_t			local;
+	cl_int			tile;
+	cl_int			wpt;
+	cl_int			tile_k;
+};
 
-bool setupOclEnv(char *kernel_file)
+//One per worker thread. The context and program may be shared with the environment it was
+//forked from, the queue and kernel objects never are: clSetKernelArg on a shared cl_kernel
+//is not thread safe, and a private queue per worker keeps workers off each other's locks.
+struct oclEnv
 {
-	cl_int status; //holds status of each operation for error checking
+	cl_platform_id 		platform;
+	cl_device_id 		device;
+	cl_context		context;
+	cl_program		program;
+	cl_command_queue	queue;
+	cl_kernel 		k_matrix_add;
+	gemmKernels		gemm;
+	cl_kernel		k_matrix_vec_mul;
+	cl_kernel		k_quantize_rows;
+	cl_kernel		k_matrix_vec_mul_i8;
+	cl_kernel		k_elem_mul;
+	cl_kernel		k_sigmoid;
+	cl_kernel		k_tanh;
+	cl_kernel		k_concat;
+	cl_kernel		k_bilstm_concat;
+	//training
+	cl_kernel		k_pointwise_train;
+	cl_kernel		k_backward_pointwise;
+	cl_kernel		k_column_sum;
+	cl_kernel		k_axpy;
+	lstmKernels		lstm;
+	//sets for the specialized programs this environment has launched so far
+	std::vector<lstmKernels> lstm_shapes;
+	//matrix_mul of the other tilings this environment has tried
+	std::vector<gemmKernels> gemm_variants;
+	//where the program came from, specialized ones are built from kernel_file.cl
+	std::string		kernel_file;
+	bool			from_source;
+	//profileKernelsCl: events of the kernels launched since the last takeKernelTimeCl
+	bool			profiling;
+	std::vector<cl_event>	profiled;
+	//"device\tdriver\t", the start of every autotuning cache key made on this environment
+	std::string		tune_key;
+};
 
-	//Get platform
-	platform = findPlatform("Intel(R) FPGA");
-	if (platform == NULL)
+//environment the calling thread enqueues on
+static thread_local oclEnv	*env = NULL;
+static thread_local cl_int	status;
+
+//a kernel to create and where it goes
+struct kernelSlot
+{
+	const char	*name;
+	cl_kernel	*kernel;
+};
+//Creates every kernel up front, spread over threads since some runtimes only finish
+//compiling a kernel when it is created. clCreateKernel is thread safe.
+static void createKernels(cl_program program, const kernelSlot *slots, size_t count)
+{
+	std::atomic<size_t> next(0);
+	std::vector<cl_int> errors(count, CL_SUCCESS);
+	const auto work = [&]()
 	{
-		printf("Unable to find FPGA OpenCL platform. Exiting.");
+		for(size_t i = next++; i < count; i = next++)
+			*slots[i].kernel = clCreateKernel(program, slots[i].name, &errors[i]);
+	};
+	size_t num_threads = std::thread::hardware_concurrency();
+	num_threads = num_threads < 1 ? 1 : (num_threads > count ? count : num_threads);
+	std::vector<std::thread> threads;
+	for(size_t t = 1; t < num_threads; t++)
+		threads.push_back(std::thread(work));
+	work();
+	for(size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+	for(size_t i = 0; i < count; i++)
+		checkError(errors[i], "Failed to create kernel \"%s\"", slots[i].name);
+}
+static void createLstmKernels(lstmKernels &ks, cl_program program, cl_int n_in, cl_int n_hidden)
+{
+	ks.n_in = n_in;
+	ks.n_hidden = n_hidden;
+	ks.program = program;
+	const kernelSlot slots[] = {
+		{"lstm_cell", &ks.cell},
+		{"lstm_sequence", &ks.sequence},
+		{"lstm_pointwise", &ks.pointwise},
+		{"lstm_cell_projected", &ks.projected},
+		{"lstm_sequence_projected", &ks.sequence_projected},
+		{"lstm_cell_i8", &ks.cell_i8}
+	};
+	createKernels(program, slots, sizeof(slots)/sizeof(slots[0]));
+}
+static void releaseLstmKernels(lstmKernels &ks)
+{
+	if(ks.cell) clReleaseKernel(ks.cell);
+	if(ks.sequence) clReleaseKernel(ks.sequence);
+	if(ks.pointwise) clReleaseKernel(ks.pointwise);
+	if(ks.projected) clReleaseKernel(ks.projected);
+	if(ks.sequence_projected) clReleaseKernel(ks.sequence_projected);
+	if(ks.cell_i8) clReleaseKernel(ks.cell_i8);
+}
+
+//The work group and tiling g.mul was compiled with, -D options may have changed them. The
+//group size comes from the kernel, the tile from running gemm_geometry once.
+static void readGemmGeometry(oclEnv *e, cl_program program, gemmKernels &g)
+{
+	size_t local[3];
+	status = clGetKernelWorkGroupInfo(g.mul, e->device, CL_KERNEL_COMPILE_WORK_GROUP_SIZE, sizeof(local), local, NULL);
+	checkError(status, "Failed to query the matrix_mul work group size");
+	g.local = local[0];
+
+	cl_kernel kernel = clCreateKernel(program, "gemm_geometry", &status);
+	checkError(status, "Failed to create kernel \"gemm_geometry\"");
+	cl_mem buf = clCreateBuffer(e->context, CL_MEM_WRITE_ONLY, sizeof(cl_int)*3, NULL, &status);
+	checkError(status, "Failed to create the gemm_geometry buffer");
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buf);
+	checkError(status, "Failed to set gemm_geometry arg 0");
+	const size_t one = 1;
+	cl_event done;
+	status = clEnqueueNDRangeKernel(e->queue, kernel, 1, NULL, &one, &one, 0, NULL, &done);
+	checkError(status, "Failed to launch gemm_geometry kernel");
+	cl_int geometry[3];
+	status = clEnqueueReadBuffer(e->queue, buf, CL_TRUE, 0, sizeof(geometry), geometry, 1, &done, NULL);
+	checkError(status, "Failed to read the matrix_mul tiling");
+	clReleaseEvent(done);
+	clReleaseMemObject(buf);
+	clReleaseKernel(kernel);
+	g.tile = geometry[0];
+	g.wpt = geometry[1];
+	g.tile_k = geometry[2];
+}
+
+//queue and kernels, the per-thread half of an environment
+static void createQueueAndKernels(oclEnv *e)
+{
+	//Create cmd queue. Out of order lets independent gate chains overlap, ordering comes
+	//from the event wait lists alone. Fall back to in-order where it is unsupported.
+	e->queue = clCreateCommandQueue(	e->context, e->device,
+						CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
+						&status);
+	if(status != CL_SUCCESS)
+	{
+		e->queue = clCreateCommandQueue(e->context, e->device, CL_QUEUE_PROFILING_ENABLE, &status);
+	}
+	checkError(status, "Failed to create queue");
+
+	char driver[256] = "";
+	clGetDeviceInfo(e->device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	e->tune_key = getDeviceName(e->device) + "\t" + driver + "\t";
+
+	//Create kernels
+	const kernelSlot slots[] = {
+		{"matrix_add", &e->k_matrix_add},
+		{"matrix_mul", &e->gemm.mul},
+		{"matrix_vec_mul", &e->k_matrix_vec_mul},
+		{"quantize_rows", &e->k_quantize_rows},
+		{"matrix_vec_mul_i8", &e->k_matrix_vec_mul_i8},
+		{"matrix_elem_mul", &e->k_elem_mul},
+		{"sigmoid_activation", &e->k_sigmoid},
+		{"tanh_activation", &e->k_tanh},
+		{"matrix_concat", &e->k_concat},
+		{"bilstm_concat", &e->k_bilstm_concat},
+		{"lstm_pointwise_train", &e->k_pointwise_train},
+		{"lstm_backward_pointwise", &e->k_backward_pointwise},
+		{"matrix_mul_nn", &e->gemm.mul_nn},
+		{"matrix_mul_tn", &e->gemm.mul_tn},
+		{"column_sum", &e->k_column_sum},
+		{"matrix_axpy", &e->k_axpy},
+		{"lstm_cell", &e->lstm.cell},
+		{"lstm_sequence", &e->lstm.sequence},
+		{"lstm_pointwise", &e->lstm.pointwise},
+		{"lstm_cell_projected", &e->lstm.projected},
+		{"lstm_sequence_projected", &e->lstm.sequence_projected},
+		{"lstm_cell_i8", &e->lstm.cell_i8}
+	};
+	createKernels(e->program, slots, sizeof(slots)/sizeof(slots[0]));
+	e->lstm.program = e->program;
+	readGemmGeometry(e, e->program, e->gemm);
+}
+
+//build log goes to stdout when the build fails
+static cl_int buildProgram(cl_program program, cl_device_id device, const char *options)
+{
+	const cl_int err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+	if(err != CL_SUCCESS)
+	{
+		size_t log_size = 0;
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+		std::string log(log_size, '\0');
+		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, &log[0], NULL);
+		printf("%s\n", log.c_str());
+	}
+	return err;
+}
+
+//    P R O G R A M   C A C H E    //
+
+//Programs built from source are kept on disk as CL_PROGRAM_BINARIES, one file per hash of
+//the source, build options and device/driver identity, so a warm start skips the compiler.
+//RNN_PROGRAM_CACHE is the directory, rnn_programs in the working directory by default.
+#define PROGRAM_CACHE_MAGIC "RNNPROG1"
+
+static const char *programCacheDir()
+{
+	const char *dir = getenv("RNN_PROGRAM_CACHE");
+	return dir ? dir : "rnn_programs";
+}
+//FNV-1a
+static cl_ulong hashBytes(const std::string &bytes)
+{
+	cl_ulong h = 14695981039346656037ull;
+	for(size_t i = 0; i < bytes.size(); i++)
+		h = (h ^ (unsigned char)bytes[i])*1099511628211ull;
+	return h;
+}
+//kernel_file.cl for platforms that compile OpenCL C at runtime
+static bool readKernelSource(const char *kernel_file, std::string &source)
+{
+	const std::string path = std::string(kernel_file) + ".cl";
+	FILE *file = fopen(path.c_str(), "rb");
+	if(!file)
+	{
+		perror(path.c_str());
 		return false;
 	}
+	char chunk[4096];
+	size_t n;
+	while((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		source.append(chunk, n);
+	fclose(file);
+	return true;
+}
+//file is the magic, the key it was stored under and the binary
+static bool readProgramBinary(const std::string &path, cl_ulong key, std::vector<unsigned char> &binary)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if(!file)
+		return false;
+	char magic[8];
+	cl_ulong stored = 0;
+	bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, PROGRAM_CACHE_MAGIC, sizeof(magic)) == 0 &&
+		fread(&stored, sizeof(stored), 1, file) == 1 && stored == key;
+	unsigned char chunk[4096];
+	size_t n;
+	while(ok && (n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		binary.insert(binary.end(), chunk, chunk + n);
+	fclose(file);
+	return ok && !binary.empty();
+}
+//written to a temporary and renamed, so processes starting together never read half a file
+static void writeProgramBinary(cl_program program, const std::string &path, cl_ulong key)
+{
+	size_t size = 0;
+	if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, NULL) != CL_SUCCESS || size == 0)
+		return;
+	std::vector<unsigned char> binary(size);
+	unsigned char *data = binary.data();
+	if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char *), &data, NULL) != CL_SUCCESS)
+		return;
 
-	//Get device ID. Since this is only running on the DE5NET for now, we only need to get one device.
-	status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL);
-	checkError(status, "Failed to get devices");
+	mkdir(programCacheDir(), 0755);
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+	const std::string tmp = path + suffix;
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if(!file)
+	{
+		perror(tmp.c_str());
+		return;
+	}
+	bool ok = fwrite(PROGRAM_CACHE_MAGIC, 1, 8, file) == 8 && fwrite(&key, sizeof(key), 1, file) == 1 &&
+		fwrite(data, 1, size, file) == size;
+	ok = fclose(file) == 0 && ok;
+	if(!ok || rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		printf("Failed to write program cache %s\n", path.c_str());
+		unlink(tmp.c_str());
+	}
+}
+//A built program for kernel_file.cl and options, from the cache when it has one for this
+//device and driver, otherwise compiled and stored. NULL when the source does not build.
+static cl_program buildProgramCached(cl_context context, cl_device_id device, const char *kernel_file, const char *options)
+{
+	std::string source;
+	if(!readKernelSource(kernel_file, source))
+		return NULL;
+	char version[256] = "", driver[256] = "";
+	clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version), version, NULL);
+	clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+	std::string identity = source;
+	identity.append(1, '\0').append(options).append(1, '\0').append(getDeviceName(device));
+	identity.append(1, '\0').append(version).append(1, '\0').append(driver);
+	const cl_ulong key = hashBytes(identity);
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+	const std::string path = std::string(programCacheDir()) + name;
 
+	std::vector<unsigned char> binary;
+	if(readProgramBinary(path, key, binary))
+	{
+		const unsigned char *data = binary.data();
+		const size_t size = binary.size();
+		cl_int binary_status = CL_SUCCESS;
+		cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, &data, &binary_status, &status);
+		if(status == CL_SUCCESS && binary_status == CL_SUCCESS &&
+			clBuildProgram(program, 1, &device, options, NULL, NULL) == CL_SUCCESS)
+			return program;
+		if(status == CL_SUCCESS)
+			clReleaseProgram(program);
+		printf("Program cache %s was not accepted, rebuilding\n", path.c_str());
+	}
+
+	const char *text = source.c_str();
+	cl_program program = clCreateProgramWithSource(context, 1, &text, NULL, &status);
+	checkError(status, "Failed to create program from %s.cl", kernel_file);
+	if(buildProgram(program, device, options) != CL_SUCCESS)
+	{
+		clReleaseProgram(program);
+		return NULL;
+	}
+	writeProgramBinary(program, path, key);
+	return program;
+}
+
+//RNN_CL_PLATFORM names another platform to run on instead of the FPGA board, e.g.
+//"Portable Computing Language" for pocl. Those build the kernels from source, or load
+//them from the program cache.
+static cl_platform_id findOclPlatform(bool &fpga)
+{
+	const char *platform_name = getenv("RNN_CL_PLATFORM");
+	fpga = platform_name == NULL;
+	cl_platform_id platform = findPlatform(fpga ? "Intel(R) FPGA" : platform_name);
+	if (platform == NULL)
+	{
+		printf("Unable to find %s OpenCL platform. Exiting.", fpga ? "FPGA" : platform_name);
+		return NULL;
+	}
 	printf("Platform: %s\n", getPlatformName(platform).c_str());
-	printf("Using %s for calculation.\n", getDeviceName(device).c_str());
+	return platform;
+}
+static activation_mode cl_activation = activationFromEnv();
+void setActivationCl(activation_mode mode)
+{
+	cl_activation = mode;
+}
+activation_mode activationCl()
+{
+	return cl_activation;
+}
+//a context, program, queue and kernels of its own on one device. The environment owns device,
+//which may be a sub-device.
+static oclEnv *createOclEnvOn(cl_platform_id platform, cl_device_id device, bool fpga, const char *kernel_file)
+{
+	oclEnv *e = new oclEnv();
+	e->platform = platform;
+	e->device = device;
+	e->kernel_file = kernel_file;
+	e->from_source = !fpga;
+
+	printf("Using %s for calculation.\n", getDeviceName(e->device).c_str());
 
 	//Create context
-	context = clCreateContext(NULL, 1, &device, NULL, NULL, &status);
+	e->context = clCreateContext(NULL, 1, &e->device, NULL, NULL, &status);
 	checkError(status, "Unable to create OpenCL context.");
 
-	//Create program
-	std::string binary_file = getBoardBinaryFile(kernel_file, device);
-	printf("Using binary %s to program FPGA\n", binary_file.c_str());
-	program = createProgramFromBinary(context, binary_file.c_str(), &device, 1);
+	//Create and build program
+	if(fpga)
+	{
+		std::string binary_file = getBoardBinaryFile(kernel_file, e->device);
+		printf("Using binary %s to program FPGA\n", binary_file.c_str());
+		e->program = createProgramFromBinary(e->context, binary_file.c_str(), &e->device, 1);
+		status = buildProgram(e->program, e->device, "");
+		checkError(status, "Failed to build program");
+	}
+	else
+	{
+		char options[32];
+		snprintf(options, sizeof(options), "-DACTIVATION=%d", cl_activation);
+		e->program = buildProgramCached(e->context, e->device, kernel_file, options);
+		if(!e->program)
+		{
+			printf("Failed to build %s.cl\n", kernel_file);
+			clReleaseContext(e->context);
+			clReleaseDevice(e->device);
+			delete e;
+			return NULL;
+		}
+	}
 
-	//Build program
-	status = clBuildProgram(program, 0, NULL, "", NULL, NULL);
-	checkError(status, "Failed to build program");
+	createQueueAndKernels(e);
+	return e;
+}
+oclEnv *createOclEnv(const char *kernel_file)
+{
+	bool fpga;
+	cl_platform_id platform = findOclPlatform(fpga);
+	if(!platform)
+		return NULL;
 
-	//Create cmd queue
-	queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &status);
-	checkError(status, "Failed to create queue");
+	//the first device, createDeviceEnvs takes all of them
+	cl_device_id device;
+	status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, NULL);
+	checkError(status, "Failed to get devices");
+	return createOclEnvOn(platform, device, fpga, kernel_file);
+}
+//Splits a CPU device into one sub-device per NUMA node, or with RNN_CPU_SUBDEVICE_CORES set
+//into sub-devices of that many compute units. Anything that cannot be split stays whole.
+static void partitionDevice(cl_device_id device, std::vector<cl_device_id> &out)
+{
+	cl_device_type type = 0;
+	cl_uint max_sub = 0;
+	clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(max_sub), &max_sub, NULL);
+	if(!(type & CL_DEVICE_TYPE_CPU) || max_sub < 2)
+	{
+		out.push_back(device);
+		return;
+	}
 
-	//Create kernels
-	k_matrix_add = clCreateKernel(program, "matrix_add", &status);
-	checkError(status, "Failed to create kernel \"matrix_add\"");
-	k_matrix_mul = clCreateKernel(program, "matrix_mul", &status);
-	checkError(status, "Failed to create kernel \"matrix_mul\"");
-	k_sigmoid = clCreateKernel(program, "sigmoid_activation", &status);
-	checkError(status, "Failed to create kernel \"sigmoid_activation\"");
-	k_tanh = clCreateKernel(program, "tanh_activation", &status);
-	checkError(status, "Failed to create kernel \"tanh_activation\"");
-	k_concat = clCreateKernel(program, "matrix_concat", &status);
-	checkError(status, "Failed to create kernel \"matrix_concat\"");
-
-	//Create buffers
-	input_a_buf = clCreateBuffer(	context, 
-					CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, 
-					NULL, 
-					CONCAT_SIZE,
-					&status);
-	checkError(status, "Failed to create buffer for first input");
-	input_b_buf = clCreateBuffer(	context, 
-					CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, 
-					NULL, 
-					CONCAT_SIZE,
-					&status);
-	checkError(status, "Failed to create buffer for second input");
-	output_buf = clCreateBuffer(	context, 
-					CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, 
-					NULL, 
-					CONCAT_SIZE,
-					&status);
-	checkError(status, "Failed to create buffer for output");
+	const char *cores = getenv("RNN_CPU_SUBDEVICE_CORES");
+	cl_device_partition_property props[3] = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+	if(cores && atoi(cores) > 0)
+	{
+		props[0] = CL_DEVICE_PARTITION_EQUALLY;
+		props[1] = atoi(cores);
+	}
+	cl_uint count = 0;
+	if(clCreateSubDevices(device, props, 0, NULL, &count) != CL_SUCCESS || count < 2)
+	{
+		out.push_back(device);
+		return;
+	}
+	std::vector<cl_device_id> subs(count);
+	status = clCreateSubDevices(device, props, count, subs.data(), NULL);
+	checkError(status, "Failed to create sub-devices");
+	printf("Split %s into %u sub-devices\n", getDeviceName(device).c_str(), count);
+	out.insert(out.end(), subs.begin(), subs.end());
+}
+unsigned createDeviceEnvs(const char *kernel_file, std::vector<oclEnv *> &envs)
+{
+	bool fpga;
+	cl_platform_id platform = findOclPlatform(fpga);
+	if(!platform)
+		return 0;
+
+	cl_uint count = 0;
+	status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, NULL, &count);
+	checkError(status, "Failed to get devices");
+	std::vector<cl_device_id> devices(count);
+	status = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, count, devices.data(), NULL);
+	checkError(status, "Failed to get devices");
+
+	std::vector<cl_device_id> targets;
+	for(cl_uint i = 0; i < count; i++)
+		partitionDevice(devices[i], targets);
+
+	const size_t first = envs.size();
+	for(size_t i = 0; i < targets.size(); i++)
+	{
+		oclEnv *e = createOclEnvOn(platform, targets[i], fpga, kernel_file);
+		if(e)
+			envs.push_back(e);
+	}
+	return envs.size() - first;
+}
+//Reprogramming the FPGA per worker is neither possible nor wanted, workers fork the
+//environment the main thread created. Tensors can be shared between forks of one context.
+oclEnv *forkOclEnv(const oclEnv *parent)
+{
+	oclEnv *e = new oclEnv();
+	e->platform = parent->platform;
+	e->device = parent->device;
+	e->context = parent->context;
+	e->program = parent->program;
+	e->kernel_file = parent->kernel_file;
+	e->from_source = parent->from_source;
+	clRetainDevice(e->device);
+	clRetainContext(e->context);
+	clRetainProgram(e->program);
+
+	createQueueAndKernels(e);
+	return e;
+}
+void releaseOclEnv(oclEnv *e)
+{
+	if(!e)
+		return;
+	if(e->k_matrix_add) clReleaseKernel(e->k_matrix_add);
+	if(e->gemm.mul) clReleaseKernel(e->gemm.mul);
+	if(e->gemm.mul_nn) clReleaseKernel(e->gemm.mul_nn);
+	if(e->gemm.mul_tn) clReleaseKernel(e->gemm.mul_tn);
+	for(size_t i = 0; i < e->gemm_variants.size(); i++)
+	{
+		clReleaseKernel(e->gemm_variants[i].mul);
+		clReleaseKernel(e->gemm_variants[i].mul_nn);
+		clReleaseKernel(e->gemm_variants[i].mul_tn);
+	}
+	if(e->k_matrix_vec_mul) clReleaseKernel(e->k_matrix_vec_mul);
+	if(e->k_quantize_rows) clReleaseKernel(e->k_quantize_rows);
+	if(e->k_matrix_vec_mul_i8) clReleaseKernel(e->k_matrix_vec_mul_i8);
+	if(e->k_elem_mul) clReleaseKernel(e->k_elem_mul);
+	if(e->k_sigmoid) clReleaseKernel(e->k_sigmoid);
+	if(e->k_tanh) clReleaseKernel(e->k_tanh);
+	if(e->k_concat) clReleaseKernel(e->k_concat);
+	if(e->k_bilstm_concat) clReleaseKernel(e->k_bilstm_concat);
+	cl_kernel training[] = {	e->k_pointwise_train, e->k_backward_pointwise, e->k_column_sum,
+					e->k_axpy};
+	for(unsigned i = 0; i < sizeof(training)/sizeof(training[0]); i++)
+	{
+		if(training[i]) clReleaseKernel(training[i]);
+	}
+	for(size_t i = 0; i < e->profiled.size(); i++)
+		clReleaseEvent(e->profiled[i]);
+	releaseLstmKernels(e->lstm);
+	for(size_t i = 0; i < e->lstm_shapes.size(); i++)
+		releaseLstmKernels(e->lstm_shapes[i]);
+	if(e->queue) clReleaseCommandQueue(e->queue);
+	if(e->program) clReleaseProgram(e->program);
+	if(e->context) clReleaseContext(e->context);
+	//a no-op unless the device is a sub-device
+	if(e->device) clReleaseDevice(e->device);
+	if(env == e)
+		env = NULL;
+	delete e;
+}
+void bindOclEnv(oclEnv *e)
+{
+	env = e;
+}
+oclEnv *currentOclEnv()
+{
+	return env;
+}
+
+//    S H A P E   S P E C I A L I Z A T I O N    //
+
+//specialized programs, shared by every environment on the same context
+struct shapeProgram
+{
+	cl_context	context;
+	cl_int		n_in;
+	cl_int		n_hidden;
+	cl_program	program;
+};
+static std::vector<shapeProgram> shape_programs;
+static std::mutex shape_lock;
+
+//matrix_mul tilings the autotuner tries besides the program's own: tile, work per item and
+//K slice. Each is a program built from source on first use and shared like the shape ones.
+struct gemmTiling
+{
+	cl_int	tile;
+	cl_int	wpt;
+	cl_int	tile_k;
+};
+static const gemmTiling gemm_tilings[] = {
+	{32, 4, 16}, {32, 4, 32}, {32, 2, 16}, {16, 2, 16}, {64, 8, 16}, {64, 4, 16}
+};
+#define NUM_GEMM_TILINGS ((cl_int)(sizeof(gemm_tilings)/sizeof(gemm_tilings[0])))
+struct gemmProgram
+{
+	cl_context	context;
+	cl_int		variant;
+	//NULL when the tiling does not build on this device
+	cl_program	program;
+};
+static std::vector<gemmProgram> gemm_programs;
+
+bool specializeOclEnv(unsigned n_in, unsigned n_hidden)
+{
+	if(!env->from_source)
+		return false;
+	std::lock_guard<std::mutex> lock(shape_lock);
+	for(size_t i = 0; i < shape_programs.size(); i++)
+	{
+		const shapeProgram &p = shape_programs[i];
+		if(p.context == env->context && p.n_in == (cl_int)n_in && p.n_hidden == (cl_int)n_hidden)
+			return true;
+	}
+
+	char options[96];
+	snprintf(options, sizeof(options), "-DSPEC_N_IN=%u -DSPEC_N_HIDDEN=%u -DACTIVATION=%d", n_in, n_hidden, cl_activation);
+	cl_program program = buildProgramCached(env->context, env->device, env->kernel_file.c_str(), options);
+	if(!program)
+	{
+		printf("Failed to build the %u x %u program, using the generic kernels\n", n_in, n_hidden);
+		return false;
+	}
+	const shapeProgram p = {env->context, (cl_int)n_in, (cl_int)n_hidden, program};
+	shape_programs.push_back(p);
+
+	//its kernels are created now rather than on the first step
+	lstmKernels ks;
+	createLstmKernels(ks, program, n_in, n_hidden);
+	env->lstm_shapes.push_back(ks);
+	return true;
+}
+static void releaseShapePrograms(cl_context context)
+{
+	std::lock_guard<std::mutex> lock(shape_lock);
+	for(size_t i = shape_programs.size(); i-- > 0;)
+	{
+		if(shape_programs[i].context == context)
+		{
+			clReleaseProgram(shape_programs[i].program);
+			shape_programs.erase(shape_programs.begin() + i);
+		}
+	}
+	for(size_t i = gemm_programs.size(); i-- > 0;)
+	{
+		if(gemm_programs[i].context == context)
+		{
+			if(gemm_programs[i].program) clReleaseProgram(gemm_programs[i].program);
+			gemm_programs.erase(gemm_programs.begin() + i);
+		}
+	}
+}
+//LSTM kernels for an n_in x n_hidden launch, n_in < 0 matches any input size for the
+//kernels that never see it. Kernels of a specialized program are created on the calling
+//thread's environment the first time it launches that shape, anything else is generic.
+static const lstmKernels &lstmKernelsFor(cl_int n_in, cl_int n_hidden)
+{
+	for(size_t i = 0; i < env->lstm_shapes.size(); i++)
+	{
+		const lstmKernels &ks = env->lstm_shapes[i];
+		if(ks.n_hidden == n_hidden && (n_in < 0 || ks.n_in == n_in))
+			return ks;
+	}
+	if(!env->from_source)
+		return env->lstm;
+
+	shapeProgram found = {NULL, 0, 0, NULL};
+	{
+		std::lock_guard<std::mutex> lock(shape_lock);
+		for(size_t i = 0; i < shape_programs.size() && !found.program; i++)
+		{
+			const shapeProgram &p = shape_programs[i];
+			if(p.context == env->context && p.n_hidden == n_hidden && (n_in < 0 || p.n_in == n_in))
+				found = p;
+		}
+	}
+	if(!found.program)
+		return env->lstm;
+	lstmKernels ks;
+	createLstmKernels(ks, found.program, found.n_in, found.n_hidden);
+	env->lstm_shapes.push_back(ks);
+	return env->lstm_shapes.back();
+}
+
+//GEMM kernels of tiling variant (see gemmKernels), NULL on the FPGA board, when the tiling is
+//the program's own or when it does not build. The program is built the first time any
+//environment on the context asks for it, the kernels the first time this one does.
+static const gemmKernels *gemmKernelsFor(cl_int variant)
+{
+	if(variant == 0)
+		return &env->gemm;
+	for(size_t i = 0; i < env->gemm_variants.size(); i++)
+	{
+		if(env->gemm_variants[i].variant == variant)
+			return &env->gemm_variants[i];
+	}
+	const gemmTiling &t = gemm_tilings[variant - 1];
+	if(!env->from_source || (t.tile == env->gemm.tile && t.wpt == env->gemm.wpt && t.tile_k == env->gemm.tile_k))
+		return NULL;
+
+	cl_program program = NULL;
+	{
+		std::lock_guard<std::mutex> lock(shape_lock);
+		bool found = false;
+		for(size_t i = 0; i < gemm_programs.size() && !found; i++)
+		{
+			found = gemm_programs[i].context == env->context && gemm_programs[i].variant == variant;
+			program = found ? gemm_programs[i].program : NULL;
+		}
+		if(!found)
+		{
+			char options[96];
+			snprintf(options, sizeof(options), "-DGEMM_TILE=%d -DGEMM_WPT=%d -DGEMM_TILE_K=%d -DACTIVATION=%d",
+				t.tile, t.wpt, t.tile_k, cl_activation);
+			program = buildProgramCached(env->context, env->device, env->kernel_file.c_str(), options);
+			if(!program)
+				printf("Failed to build the %d/%d/%d matrix_mul tiling, skipping it\n", t.tile, t.wpt, t.tile_k);
+			const gemmProgram p = {env->context, variant, program};
+			gemm_programs.push_back(p);
+		}
+	}
+	if(!program)
+		return NULL;
+	gemmKernels g;
+	g.variant = variant;
+	const kernelSlot slots[] = {
+		{"matrix_mul", &g.mul},
+		{"matrix_mul_nn", &g.mul_nn},
+		{"matrix_mul_tn", &g.mul_tn}
+	};
+	createKernels(program, slots, sizeof(slots)/sizeof(slots[0]));
+	readGemmGeometry(env, program, g);
+	env->gemm_variants.push_back(g);
+	return &env->gemm_variants.back();
+}
+
+//single threaded programs just use one environment bound to the main thread
+bool setupOclEnv(char *kernel_file)
+{
+	oclEnv *e = createOclEnv(kernel_file);
+	if(!e)
+		return false;
+	bindOclEnv(e);
+	if(getenv("RNN_TRACE"))
+		startTrace();
+
+	//Buffers are no longer shared between operations, callers own their tensors
+	return true;
+}
+
+void cleanupOclEnv()
+{
+	const char *trace = getenv("RNN_TRACE");
+	if(trace && env)
+	{
+		stopTrace();
+		writeTrace(trace);
+	}
+	const cl_context context = env ? env->context : NULL;
+	releaseOclEnv(env);
+	releaseShapePrograms(context);
+}
+
+//The only place the host waits for the device apart from blocking transfers
+void finishCl()
+{
+	clFinish(env->queue);
+}
+//Collapses several events into one, handy for keeping a single "done" event per step
+void markerCl(cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	status = clEnqueueMarkerWithWaitList(env->queue, num_events, wait_list, event);
+	checkError(status, "Failed to enqueue marker");
+}
+
+//Tracing and kernel profiling need an event from every enqueue. commandEvent hands the
+//enqueue the caller's event slot, or a local one when the caller passed NULL and an event
+//is needed. commandDone records the command and drops the local event.
+static cl_event *commandEvent(cl_event *event, cl_event *own, uint64_t trace_start, bool kernel)
+{
+	*own = NULL;
+	if(event || !(trace_start || (kernel && env->profiling)))
+		return event;
+	return own;
+}
+static void commandDone(const char *name, trace_kind kind, uint64_t trace_start, const cl_event *event, cl_event own)
+{
+	const cl_event e = event ? *event : own;
+	if(trace_start)
+		traceCommand(name, kind, trace_start, wtime_ns(), e);
+	if(kind == TRACE_KERNEL && env->profiling)
+	{
+		clRetainEvent(e);
+		env->profiled.push_back(e);
+	}
+	if(own)
+		clReleaseEvent(own);
+}
+
+//    T E N S O R   M A N A G E M E N T    //
+
+size_t tensorElemSize(tensor_type type)
+{
+	if(type == TENSOR_I8)
+		return sizeof(cl_char);
+	if(type == TENSOR_F16 || type == TENSOR_BF16)
+		return sizeof(cl_ushort);
+	return sizeof(cl_float);
+}
+clTensor createTensorCl(size_t rows, size_t cols, cl_mem_flags flags, void *host, tensor_type type)
+{
+	clTensor t;
+	t.rows = rows;
+	t.cols = cols;
+	t.type = type;
+	t.buf = clCreateBuffer(	env->context,
+				flags,
+				tensorElemSize(type)*rows*cols,
+				host,
+				&status);
+	checkError(status, "Failed to create tensor buffer");
+	return t;
+}
+void releaseTensorCl(clTensor &t)
+{
+	if(t.buf)
+	{
+		clReleaseMemObject(t.buf);
+	}
+	t.buf = NULL;
+	t.rows = t.cols = 0;
+}
+void uploadTensorCl(clTensor &t, const void *host, cl_bool blocking,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	uploadRowsCl(t, 0, t.rows, host, blocking, num_events, wait_list, event);
+}
+//Non-blocking uploads read host until the returned event completes, keep it alive until then
+void uploadRowsCl(clTensor &t, size_t first_row, size_t nrows, const void *host, cl_bool blocking,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const uint64_t t0 = tracing() ? wtime_ns() : 0;
+	cl_event own;
+	status = clEnqueueWriteBuffer(	env->queue,
+					t.buf,
+					blocking,
+					tensorElemSize(t.type)*first_row*t.cols,
+					tensorElemSize(t.type)*nrows*t.cols,
+					host,
+					num_events, wait_list, commandEvent(event, &own, t0, false));
+	checkError(status, "Failed to upload tensor");
+	commandDone("upload", TRACE_WRITE, t0, event, own);
+}
+void downloadTensorCl(const clTensor &t, void *host, cl_bool blocking,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const uint64_t t0 = tracing() ? wtime_ns() : 0;
+	cl_event own;
+	status = clEnqueueReadBuffer(	env->queue,
+					t.buf,
+					blocking, 0,
+					tensorElemSize(t.type)*t.rows*t.cols,
+					host,
+					num_events, wait_list, commandEvent(event, &own, t0, false));
+	checkError(status, "Failed to download tensor");
+	commandDone("download", TRACE_READ, t0, event, own);
+}
+//Device to device, used to pull single timesteps out of an uploaded window
+void copyRowsCl(const clTensor &src, size_t src_row, clTensor &dst, size_t dst_row, size_t nrows,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const uint64_t t0 = tracing() ? wtime_ns() : 0;
+	cl_event own;
+	status = clEnqueueCopyBuffer(	env->queue,
+					src.buf, dst.buf,
+					tensorElemSize(src.type)*src_row*src.cols,
+					tensorElemSize(dst.type)*dst_row*dst.cols,
+					tensorElemSize(src.type)*nrows*src.cols,
+					num_events, wait_list, commandEvent(event, &own, t0, false));
+	checkError(status, "Failed to copy tensor rows");
+	commandDone("copy_rows", TRACE_COPY, t0, event, own);
+}
+//Column slice of every row, e.g. one half of a packed weight matrix
+void copyColsCl(const clTensor &src, size_t src_col, clTensor &dst, size_t dst_col, size_t ncols,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const size_t elem = tensorElemSize(src.type);
+	const size_t src_origin[3] = {elem*src_col, 0, 0};
+	const size_t dst_origin[3] = {elem*dst_col, 0, 0};
+	const size_t region[3] = {elem*ncols, src.rows, 1};
+
+	const uint64_t t0 = tracing() ? wtime_ns() : 0;
+	cl_event own;
+	status = clEnqueueCopyBufferRect(	env->queue,
+						src.buf, dst.buf,
+						src_origin, dst_origin, region,
+						elem*src.cols, 0,
+						elem*dst.cols, 0,
+						num_events, wait_list, commandEvent(event, &own, t0, false));
+	checkError(status, "Failed to copy tensor columns");
+	commandDone("copy_cols", TRACE_COPY, t0, event, own);
+}
+//float tensors take any value, the other storage types are only ever cleared
+void fillTensorCl(clTensor &t, cl_float value,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const size_t elem = tensorElemSize(t.type);
+	const cl_uint zero = 0;
+	const uint64_t t0 = tracing() ? wtime_ns() : 0;
+	cl_event own;
+	status = clEnqueueFillBuffer(	env->queue,
+					t.buf,
+					t.type == TENSOR_F32 ? (const void *)&value : (const void *)&zero, elem,
+					0, elem*t.rows*t.cols,
+					num_events, wait_list, commandEvent(event, &own, t0, false));
+	checkError(status, "Failed to fill tensor");
+	commandDone("fill", TRACE_FILL, t0, event, own);
+}
+
+//    A U T O T U N I N G    //
+
+//One way to launch a kernel. local[0] == 0 leaves the work group size to the runtime,
+//per_item goes to kernels that take an outputs per work item argument.
+struct launchConfig
+{
+	size_t global[2];
+	size_t local[2];
+	cl_int per_item;
+	//matrix_mul tiling (gemmKernels), and the kernel to launch when it is not the one
+	//launchTuned is given
+	cl_int variant;
+	cl_kernel kernel;
+};
+//cached winner, the global size follows from it and the shape
+struct tunedLaunch
+{
+	size_t local[2];
+	cl_int per_item;
+	cl_int variant;
+};
+
+//runs of every candidate while tuning, the first is a warmup and the fastest of the rest counts
+#define TUNE_RUNS 5
+
+//keyed by "device\tdriver\tkernel\tshape", shared by every environment
+static std::map<std::string, tunedLaunch> tune_cache;
+static std::mutex tune_lock;
+static bool tune_loaded = false;
+static bool tuning = false;
+
+static const char *tuneCachePath()
+{
+	const char *path = getenv("RNN_TUNE_CACHE");
+	return path ? path : "rnn_tune.cache";
+}
+//one "key\tlocal_x local_y per_item variant" line per entry, called with tune_lock held.
+//Entries written before there were variants have three values and use variant 0.
+static void loadTuneCache()
+{
+	tune_loaded = true;
+	FILE *file = fopen(tuneCachePath(), "r");
+	if(!file)
+		return;
+	char line[1024];
+	while(fgets(line, sizeof(line), file))
+	{
+		const char *values = strrchr(line, '\t');
+		tunedLaunch t = {{0, 0}, 0, 0};
+		if(values && sscanf(values + 1, "%zu %zu %d %d", &t.local[0], &t.local[1], &t.per_item, &t.variant) >= 3)
+			tune_cache[std::string(line, values - line)] = t;
+	}
+	fclose(file);
+}
+void setTuningCl(bool enabled)
+{
+	tuning = enabled;
+}
+bool saveTuningCl()
+{
+	std::lock_guard<std::mutex> lock(tune_lock);
+	if(!tune_loaded)
+		loadTuneCache();
+	FILE *file = fopen(tuneCachePath(), "w");
+	if(!file)
+	{
+		perror(tuneCachePath());
+		return false;
+	}
+	for(std::map<std::string, tunedLaunch>::const_iterator it = tune_cache.begin(); it != tune_cache.end(); ++it)
+		fprintf(file, "%s\t%zu %zu %d %d\n", it->first.c_str(), it->second.local[0], it->second.local[1],
+			it->second.per_item, it->second.variant);
+	return fclose(file) == 0;
+}
+
+static size_t maxLocalSize(cl_kernel kernel, const char *name)
+{
+	size_t max_local;
+	status = clGetKernelWorkGroupInfo(kernel, env->device, CL_KERNEL_WORK_GROUP_SIZE,
+					sizeof(size_t), &max_local, NULL);
+	checkError(status, "Failed to query %s work group size", name);
+	return max_local;
+}
+static size_t roundUp(size_t x, size_t to)
+{
+	return (x + to - 1)/to*to;
+}
+//Kernels without bounds checks need the exact range, so only divisors of x are tried.
+//The runtime's own choice comes first, it is what they launched with before tuning.
+static void exactCandidates(std::vector<launchConfig> &candidates, size_t x, size_t y, size_t max_local)
+{
+	launchConfig c = {{x, y}, {0, 1}, 1};
+	candidates.push_back(c);
+	for(size_t l = 8; l <= max_local && l <= x; l *= 2)
+	{
+		if(x % l == 0)
+		{
+			c.local[0] = l;
+			candidates.push_back(c);
+		}
+	}
+}
+//the single step LSTM kernels: one batch row per work group, units rounded up to the group
+static void rowCandidates(std::vector<launchConfig> &candidates, size_t n_hidden, size_t rows, size_t max_local)
+{
+	const size_t def = n_hidden < max_local ? n_hidden : max_local;
+	launchConfig c = {{roundUp(n_hidden, def), rows}, {def, 1}, 1};
+	candidates.push_back(c);
+	for(size_t l = 16; l <= max_local && l < 2*n_hidden; l *= 2)
+	{
+		if(l != def)
+		{
+			c.global[0] = roundUp(n_hidden, l);
+			c.local[0] = l;
+			candidates.push_back(c);
+		}
+	}
+}
+//The persistent kernels: one work group per batch row, each work item owning
+//n_hidden/local units. False when even the largest group needs more than MAX_UNITS_PER_ITEM.
+static bool sequenceCandidates(std::vector<launchConfig> &candidates, size_t n_hidden, size_t batch, size_t max_local)
+{
+	const size_t def = n_hidden < max_local ? n_hidden : max_local;
+	if(def*MAX_UNITS_PER_ITEM < n_hidden)
+		return false;
+	launchConfig c = {{def*batch, 1}, {def, 1}, 1};
+	candidates.push_back(c);
+	for(size_t l = 16; l <= max_local && l < 2*n_hidden; l *= 2)
+	{
+		if(l != def && l*MAX_UNITS_PER_ITEM >= n_hidden)
+		{
+			c.global[0] = l*batch;
+			c.local[0] = l;
+			candidates.push_back(c);
+		}
+	}
+	return true;
+}
+
+//time of the fastest of TUNE_RUNS launches, negative when the runtime rejects the geometry
+static double timeLaunch(cl_kernel kernel, cl_uint dims, const launchConfig &c, int per_item_arg)
+{
+	if(c.kernel)
+		kernel = c.kernel;
+	if(per_item_arg >= 0)
+	{
+		status = clSetKernelArg(kernel, per_item_arg, sizeof(cl_int), &c.per_item);
+		checkError(status, "Failed to set per item arg");
+	}
+	double best = -1.0;
+	for(int r = 0; r <= TUNE_RUNS; r++)
+	{
+		cl_event done;
+		status = clEnqueueNDRangeKernel(env->queue, kernel, dims, NULL, c.global, c.local[0] ? c.local : NULL,
+						0, NULL, &done);
+		if(status != CL_SUCCESS)
+			return -1.0;
+		cl_ulong start = 0, end = 0;
+		status = clWaitForEvents(1, &done);
+		if(status == CL_SUCCESS)
+			status = clGetEventProfilingInfo(done, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		if(status == CL_SUCCESS)
+			status = clGetEventProfilingInfo(done, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		clReleaseEvent(done);
+		if(status != CL_SUCCESS)
+			return -1.0;
+		if(r > 0 && (best < 0.0 || end - start < best))
+			best = end - start;
+	}
+	return best;
+}
+
+//cached winner of name and shape on this environment's device, false on a miss
+static bool cachedLaunch(const char *name, const char *shape, tunedLaunch &t)
+{
+	const std::string key = env->tune_key + name + "\t" + shape;
+	std::lock_guard<std::mutex> lock(tune_lock);
+	if(!tune_loaded)
+		loadTuneCache();
+	std::map<std::string, tunedLaunch>::const_iterator it = tune_cache.find(key);
+	if(it == tune_cache.end())
+		return false;
+	t = it->second;
 	return true;
-	
+}
+//Launches with the cached winner for this device, kernel and shape, or candidates[0] on a
+//miss. With tuning on a miss first times every candidate on the operands as they are once
+//wait_list completes. keep lists the num_keep buffers the kernel reads as well as writes
+//(accumulated or updated in place), they are copied aside before the sweep and back after
+//it, so the real launch sees them as the caller left them.
+//per_item_arg is the argument that takes launchConfig::per_item, -1 for none.
+static void launchTuned(cl_kernel kernel, const char *name, const char *shape, cl_uint dims,
+			const std::vector<launchConfig> &candidates, int per_item_arg,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event,
+			cl_uint num_keep = 0, const cl_mem *keep = NULL)
+{
+	const std::string key = env->tune_key + name + "\t" + shape;
+	size_t pick = 0;
+	bool found = false;
+	tunedLaunch cached;
+	if(cachedLaunch(name, shape, cached))
+	{
+		for(size_t i = 0; !found && i < candidates.size(); i++)
+		{
+			const launchConfig &c = candidates[i];
+			found = c.local[0] == cached.local[0] && c.local[1] == cached.local[1] &&
+				c.per_item == cached.per_item && c.variant == cached.variant;
+			pick = found ? i : 0;
+		}
+	}
+
+	if(!found && tuning)
+	{
+		if(num_events)
+		{
+			status = clWaitForEvents(num_events, wait_list);
+			checkError(status, "Failed to wait before tuning %s", name);
+		}
+		std::vector<cl_mem> saved(num_keep);
+		std::vector<size_t> sizes(num_keep);
+		for(cl_uint i = 0; i < num_keep; i++)
+		{
+			status = clGetMemObjectInfo(keep[i], CL_MEM_SIZE, sizeof(size_t), &sizes[i], NULL);
+			checkError(status, "Failed to query a %s operand", name);
+			saved[i] = clCreateBuffer(env->context, CL_MEM_READ_WRITE, sizes[i], NULL, &status);
+			checkError(status, "Failed to create a copy of a %s operand", name);
+			status = clEnqueueCopyBuffer(env->queue, keep[i], saved[i], 0, 0, sizes[i], 0, NULL, NULL);
+			checkError(status, "Failed to copy a %s operand", name);
+		}
+		if(num_keep)
+		{
+			status = clFinish(env->queue);
+			checkError(status, "Failed to copy the %s operands", name);
+		}
+		double best = -1.0;
+		for(size_t i = 0; i < candidates.size(); i++)
+		{
+			const double t = timeLaunch(kernel, dims, candidates[i], per_item_arg);
+			if(t >= 0.0 && (best < 0.0 || t < best))
+			{
+				best = t;
+				pick = i;
+			}
+		}
+		for(cl_uint i = 0; i < num_keep; i++)
+		{
+			status = clEnqueueCopyBuffer(env->queue, saved[i], keep[i], 0, 0, sizes[i], 0, NULL, NULL);
+			checkError(status, "Failed to restore a %s operand", name);
+		}
+		if(num_keep)
+		{
+			status = clFinish(env->queue);
+			checkError(status, "Failed to restore the %s operands", name);
+		}
+		for(cl_uint i = 0; i < num_keep; i++)
+			clReleaseMemObject(saved[i]);
+		if(best >= 0.0)
+		{
+			const launchConfig &c = candidates[pick];
+			const tunedLaunch t = {{c.local[0], c.local[1]}, c.per_item, c.variant};
+			std::lock_guard<std::mutex> lock(tune_lock);
+			tune_cache[key] = t;
+			printf("Tuned %s %s: local %zu x %zu, %d per item, variant %d, %.1f us\n",
+				name, shape, c.local[0], c.local[1], c.per_item, c.variant, best*1e-3);
+		}
+	}
+
+	const launchConfig &c = candidates[pick];
+	if(c.kernel)
+		kernel = c.kernel;
+	if(per_item_arg >= 0)
+	{
+		status = clSetKernelArg(kernel, per_item_arg, sizeof(cl_int), &c.per_item);
+		checkError(status, "Failed to set %s arg %d", name, per_item_arg);
+	}
+	const uint64_t t0 = tracing() ? wtime_ns() : 0;
+	cl_event own;
+	status = clEnqueueNDRangeKernel(	env->queue,
+						kernel,
+						dims, NULL,
+						c.global, c.local[0] ? c.local : NULL,
+						num_events, wait_list, commandEvent(event, &own, t0, true));
+	checkError(status, "Failed to launch %s kernel", name);
+	commandDone(name, TRACE_KERNEL, t0, event, own);
+}
+
+void profileKernelsCl(bool enabled)
+{
+	env->profiling = enabled;
+}
+
+cl_ulong takeKernelTimeCl()
+{
+	cl_ulong total = 0;
+	for(size_t i = 0; i < env->profiled.size(); i++)
+	{
+		cl_ulong start = 0, end = 0;
+		status = clWaitForEvents(1, &env->profiled[i]);
+		checkError(status, "Failed to wait for a profiled kernel");
+		clGetEventProfilingInfo(env->profiled[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+		clGetEventProfilingInfo(env->profiled[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+		total += end - start;
+		clReleaseEvent(env->profiled[i]);
+	}
+	env->profiled.clear();
+	return total;
 }
 
 //    O P E N C L   A B S T R A C T I O N   F U N C T I O N S    //
 
-//These functions make the acceleration functions into simple function calls
-
-void matrixMultiplyCl(cl_float *a, cl_float *b, cl_float *output)
-{
-	//TODO these may be wrong or subject to change, keep an eye on this section
-	const size_t global_work_size = OUTPUT_SIZE;
-	const size_t local_work_size = WINDOW_COLS;
-
-	clEnqueueWriteBuffer(	queue, 
-				input_a_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				a, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				input_b_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				b, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE,
-				output, 
-				0, NULL, NULL);
-
-	status = clSetKernelArg(k_matrix_mul, 0, sizeof(cl_mem), &input_a_buf);
-	checkError(status, "Failed to set matrix_mul arg 0");
-	status = clSetKernelArg(k_matrix_mul, 1, sizeof(cl_mem), &input_b_buf);
-	checkError(status, "Failed to set matrix_mul arg 1");
-	status = clSetKernelArg(k_matrix_mul, 2, sizeof(cl_mem), &output_buf);
-	checkError(status, "Failed to set matrix_mul arg 2");
-
-	clEnqueueNDRangeKernel(	queue, 
-				k_matrix_mul, 
-				1, NULL, 
-				&global_work_size, &local_work_size, 
-				0, NULL, NULL);
-	checkError(status, "Failed to launch matrix mul kernel");
-
-	clEnqueueReadBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE,
-				output, 
-				0, NULL, NULL);
-	clFinish(queue);
-}
-void matrixAddCl(cl_float *a, cl_float *b, cl_float *output)
-{
-	//TODO these may be wrong or subject to change, keep an eye on this section
-	const size_t global_work_size = OUTPUT_SIZE;
-	const size_t local_work_size = OUTPUT_SIZE;
-
-	clEnqueueWriteBuffer(	queue, 
-				input_a_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				a, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				input_b_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				b, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				output, 
-				0, NULL, NULL);
-
-	status = clSetKernelArg(k_matrix_add, 0, sizeof(cl_mem), &input_a_buf);
-	checkError(status, "Failed to set matrix_add arg 0");
-	status = clSetKernelArg(k_matrix_add, 1, sizeof(cl_mem), &input_b_buf);
-	checkError(status, "Failed to set matrix_add arg 1");
-	status = clSetKernelArg(k_matrix_add, 2, sizeof(cl_mem), &output_buf);
-	checkError(status, "Failed to set matrix_add arg 2");
-
-	clEnqueueNDRangeKernel(	queue, 
-				k_matrix_add, 
-				1, NULL, 
-				&global_work_size, &local_work_size, 
-				0, NULL, NULL);
-	checkError(status, "Failed to launch matrix add kernel");
-
-	clEnqueueReadBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*INPUT_SIZE,
-				output, 
-				0, NULL, NULL);
-	clFinish(queue);
-}
-void sigmoidCl(cl_float *in, cl_float *out)
-{
-	//TODO these may be wrong or subject to change, keep an eye on this section
-	const size_t global_work_size = OUTPUT_SIZE;
-	const size_t local_work_size = OUTPUT_SIZE;
-
-	clEnqueueWriteBuffer(	queue, 
-				input_a_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE,
-				a, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE,
-				output, 
-				0, NULL, NULL);
-
-	status = clSetKernelArg(k_sigmoid, 0, sizeof(cl_mem), &input_a_buf);
-	checkError(status, "Failed to set sigmoid arg 0");
-	status = clSetKernelArg(k_sigmoid, 1, sizeof(cl_mem), &output_buf);
-	checkError(status, "Failed to set sigmoid arg 1");
-
-	clEnqueueNDRangeKernel(	queue, 
-				k_sigmoid, 
-				1, NULL, 
-				&global_work_size, &local_work_size, 
-				0, NULL, NULL);
-	checkError(status, "Failed to launch matrix add kernel");
-
-	clEnqueueReadBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE;
-				output, 
-				0, NULL, NULL);
-	clFinish(queue);
-}
-void tanhCl(cl_float *in, cl_float *out)
-{
-	//TODO these may be wrong or subject to change, keep an eye on this section
-	const size_t global_work_size = OUTPUT_SIZE;
-	const size_t local_work_size = OUTPUT_SIZE;
-
-	clEnqueueWriteBuffer(	queue, 
-				input_a_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE,
-				a, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE,
-				output, 
-				0, NULL, NULL);
-
-	status = clSetKernelArg(k_tanh, 0, sizeof(cl_mem), &input_a_buf);
-	checkError(status, "Failed to set tanh arg 0");
-	status = clSetKernelArg(k_tanh, 1, sizeof(cl_mem), &output_buf);
-	checkError(status, "Failed to set tanh arg 1");
-
-	clEnqueueNDRangeKernel(	queue, 
-				k_tanh, 
-				1, NULL, 
-				&global_work_size, &local_work_size, 
-				0, NULL, NULL);
-	checkError(status, "Failed to launch matrix add kernel");
-
-	clEnqueueReadBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE;
-				output, 
-				0, NULL, NULL);
-	clFinish(queue);
-}
-void matrixConcatCl(cl_float *a, cl_float *b, cl_float *output)
-{
-	//TODO these may be wrong or subject to change, keep an eye on this section
-	const size_t global_work_size = CONCAT_SIZE;
-	const size_t local_work_size = INPUT_SIZE;
-
-	clEnqueueWriteBuffer(	queue, 
-				input_a_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*INPUT_SIZE
-				a, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				input_b_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*OUTPUT_SIZE
-				b, 
-				0, NULL, NULL);
-	clEnqueueWriteBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				output, 
-				0, NULL, NULL);
-
-	status = clSetKernelArg(k_concat, 0, sizeof(cl_mem), &input_a_buf);
+//These functions make the acceleration functions into simple function calls.
+//Operands are device tensors, nothing is copied to or from the host here, and
+//nothing waits: dependencies are expressed through the wait list only.
+
+//One work group per m x n output tile of GEMM kernel mul. The program's own tiling comes
+//first, the others only while tuning or when the cache picked one of them.
+static void gemmCandidates(std::vector<launchConfig> &candidates, cl_kernel gemmKernels::*mul,
+			const char *name, const char *shape, cl_int m, cl_int n)
+{
+	tunedLaunch cached;
+	const bool hit = cachedLaunch(name, shape, cached);
+	for(cl_int v = 0; v <= NUM_GEMM_TILINGS; v++)
+	{
+		if(v > 0 && !tuning && !(hit && cached.variant == v))
+			continue;
+		const gemmKernels *g = gemmKernelsFor(v);
+		if(!g)
+			continue;
+		const size_t tiles[2] = {(size_t)(n + g->tile - 1)/g->tile, (size_t)(m + g->tile - 1)/g->tile};
+		const launchConfig c = {{tiles[0]*g->local, tiles[1]*g->local}, {g->local, g->local}, 1, v, g->*mul};
+		candidates.push_back(c);
+	}
+}
+void matrixMultiplyCl(const clTensor &a, const clTensor &b, clTensor &output,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int m = a.rows;
+	const cl_int n = b.rows;
+	const cl_int k = a.cols;
+	const cl_int b_type = b.type;
+	const cl_int out_type = output.type;
+
+	//a step's few batch rows take the GEMV kernel, taller products the tiled GEMM
+	const bool gemv = m <= GEMV_MAX_ROWS;
+	cl_kernel kernel = gemv ? env->k_matrix_vec_mul : env->gemm.mul;
+	const char *name = gemv ? "matrix_vec_mul" : "matrix_mul";
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%dx%d %d%d", m, n, k, b_type, out_type);
+
+	std::vector<launchConfig> candidates;
+	if(gemv)
+	{
+		//per_item columns per work item, range rounded up to the work group
+		const launchConfig def = {{(size_t)n, 1}, {0, 1}, 1};
+		candidates.push_back(def);
+		const size_t max_local = maxLocalSize(kernel, name);
+		for(cl_int per_item = 1; per_item <= MAX_COLS_PER_ITEM; per_item *= 2)
+		{
+			const size_t cols = (n + per_item - 1)/per_item;
+			for(size_t lx = 16; lx <= 256 && lx <= max_local && lx < 2*cols; lx *= 2)
+			{
+				const launchConfig c = {{roundUp(cols, lx), 1}, {lx, 1}, per_item};
+				candidates.push_back(c);
+			}
+		}
+	}
+	else
+		gemmCandidates(candidates, &gemmKernels::mul, name, shape, m, n);
+
+	//every GEMM tiling is a kernel of its own
+	for(size_t i = 0; i < (gemv ? 1 : candidates.size()); i++)
+	{
+		cl_kernel target = gemv ? kernel : candidates[i].kernel;
+		status = clSetKernelArg(target, 0, sizeof(cl_mem), &a.buf);
+		checkError(status, "Failed to set %s arg 0", name);
+		status = clSetKernelArg(target, 1, sizeof(cl_mem), &b.buf);
+		checkError(status, "Failed to set %s arg 1", name);
+		status = clSetKernelArg(target, 2, sizeof(cl_mem), &output.buf);
+		checkError(status, "Failed to set %s arg 2", name);
+		status = clSetKernelArg(target, 3, sizeof(cl_int), &m);
+		checkError(status, "Failed to set %s arg 3", name);
+		status = clSetKernelArg(target, 4, sizeof(cl_int), &n);
+		checkError(status, "Failed to set %s arg 4", name);
+		status = clSetKernelArg(target, 5, sizeof(cl_int), &k);
+		checkError(status, "Failed to set %s arg 5", name);
+		status = clSetKernelArg(target, 6, sizeof(cl_int), &b_type);
+		checkError(status, "Failed to set %s arg 6", name);
+		status = clSetKernelArg(target, 7, sizeof(cl_int), &out_type);
+		checkError(status, "Failed to set %s arg 7", name);
+	}
+
+	launchTuned(kernel, name, shape, gemv ? 1 : 2, candidates, gemv ? 8 : -1, num_events, wait_list, event);
+}
+//shared body for the three-operand element-wise kernels
+static void elementwise3(cl_kernel kernel, const char *name, const clTensor &a, const clTensor &b, clTensor &output,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, output.rows*output.cols, 1, maxLocalSize(kernel, name));
+	char shape[32];
+	snprintf(shape, sizeof(shape), "%zu", output.rows*output.cols);
+
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a.buf);
+	checkError(status, "Failed to set %s arg 0", name);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &b.buf);
+	checkError(status, "Failed to set %s arg 1", name);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &output.buf);
+	checkError(status, "Failed to set %s arg 2", name);
+
+	//matrixAddCl(a, b, a) and the like run in place
+	const bool in_place = output.buf == a.buf || output.buf == b.buf;
+	launchTuned(kernel, name, shape, 1, candidates, -1, num_events, wait_list, event, in_place ? 1 : 0, &output.buf);
+}
+//shared body for the activation kernels
+static void elementwise2(cl_kernel kernel, const char *name, const clTensor &in, clTensor &out,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, out.rows*out.cols, 1, maxLocalSize(kernel, name));
+	char shape[32];
+	snprintf(shape, sizeof(shape), "%zu", out.rows*out.cols);
+
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in.buf);
+	checkError(status, "Failed to set %s arg 0", name);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &out.buf);
+	checkError(status, "Failed to set %s arg 1", name);
+
+	launchTuned(kernel, name, shape, 1, candidates, -1, num_events, wait_list, event, out.buf == in.buf ? 1 : 0, &out.buf);
+}
+void matrixAddCl(const clTensor &a, const clTensor &b, clTensor &output,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	elementwise3(env->k_matrix_add, "matrix_add", a, b, output, num_events, wait_list, event);
+}
+void matrixElemMulCl(const clTensor &a, const clTensor &b, clTensor &output,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	elementwise3(env->k_elem_mul, "matrix_elem_mul", a, b, output, num_events, wait_list, event);
+}
+void sigmoidCl(const clTensor &in, clTensor &out,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	elementwise2(env->k_sigmoid, "sigmoid", in, out, num_events, wait_list, event);
+}
+void tanhCl(const clTensor &in, clTensor &out,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	elementwise2(env->k_tanh, "tanh", in, out, num_events, wait_list, event);
+}
+//int8 rows of a with one symmetric scale per row, for matrixMultiplyI8Cl
+void quantizeRowsCl(const clTensor &a, clTensor &a_q, clTensor &a_scales,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int k = a.cols;
+	const size_t max_local = maxLocalSize(env->k_quantize_rows, "quantize_rows");
+
+	//one work group per row, as wide as the range
+	std::vector<launchConfig> candidates;
+	for(size_t l = max_local < 256 ? max_local : 256; l >= 16; l /= 2)
+	{
+		const launchConfig c = {{l, a.rows}, {l, 1}, 1};
+		candidates.push_back(c);
+	}
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%d", a.rows, k);
+
+	status = clSetKernelArg(env->k_quantize_rows, 0, sizeof(cl_mem), &a.buf);
+	checkError(status, "Failed to set quantize_rows arg 0");
+	status = clSetKernelArg(env->k_quantize_rows, 1, sizeof(cl_mem), &a_q.buf);
+	checkError(status, "Failed to set quantize_rows arg 1");
+	status = clSetKernelArg(env->k_quantize_rows, 2, sizeof(cl_mem), &a_scales.buf);
+	checkError(status, "Failed to set quantize_rows arg 2");
+	status = clSetKernelArg(env->k_quantize_rows, 3, sizeof(cl_int), &k);
+	checkError(status, "Failed to set quantize_rows arg 3");
+	//sized for the widest candidate
+	status = clSetKernelArg(env->k_quantize_rows, 4, sizeof(cl_float)*candidates[0].local[0], NULL);
+	checkError(status, "Failed to set quantize_rows arg 4");
+
+	launchTuned(env->k_quantize_rows, "quantize_rows", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void matrixMultiplyI8Cl(const clTensor &a_q, const clTensor &a_scales, const clTensor &b, const clTensor &b_scales,
+			clTensor &output, cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int m = a_q.rows;
+	const cl_int n = b.rows;
+	const cl_int k = a_q.cols;
+	const size_t blocks = (m + GEMV_MAX_ROWS - 1)/GEMV_MAX_ROWS;
+
+	//matrix_vec_mul's candidates with a second dimension of row blocks
+	std::vector<launchConfig> candidates;
+	const launchConfig def = {{(size_t)n, blocks}, {0, 1}, 1};
+	candidates.push_back(def);
+	const size_t max_local = maxLocalSize(env->k_matrix_vec_mul_i8, "matrix_vec_mul_i8");
+	for(cl_int per_item = 1; per_item <= MAX_COLS_PER_ITEM; per_item *= 2)
+	{
+		const size_t cols = (n + per_item - 1)/per_item;
+		for(size_t lx = 16; lx <= 256 && lx <= max_local && lx < 2*cols; lx *= 2)
+		{
+			const launchConfig c = {{roundUp(cols, lx), blocks}, {lx, 1}, per_item};
+			candidates.push_back(c);
+		}
+	}
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%dx%d", m, n, k);
+
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 0, sizeof(cl_mem), &a_q.buf);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 0");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 1, sizeof(cl_mem), &a_scales.buf);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 1");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 2, sizeof(cl_mem), &b.buf);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 2");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 3, sizeof(cl_mem), &b_scales.buf);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 3");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 4, sizeof(cl_mem), &output.buf);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 4");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 5, sizeof(cl_int), &m);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 5");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 6, sizeof(cl_int), &n);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 6");
+	status = clSetKernelArg(env->k_matrix_vec_mul_i8, 7, sizeof(cl_int), &k);
+	checkError(status, "Failed to set matrix_vec_mul_i8 arg 7");
+
+	launchTuned(env->k_matrix_vec_mul_i8, "matrix_vec_mul_i8", shape, 2, candidates, 8, num_events, wait_list, event);
+}
+//Row-wise concatenation: output row r is [a row r, b row r]
+void matrixConcatCl(const clTensor &a, const clTensor &b, clTensor &output,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int a_cols = a.cols;
+	const cl_int b_cols = b.cols;
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, output.cols, output.rows, maxLocalSize(env->k_concat, "matrix_concat"));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%dx%d", output.rows, a_cols, b_cols);
+
+	status = clSetKernelArg(env->k_concat, 0, sizeof(cl_mem), &a.buf);
 	checkError(status, "Failed to set concat arg 0");
-	status = clSetKernelArg(k_concat, 1, sizeof(cl_mem), &input_b_buf);
+	status = clSetKernelArg(env->k_concat, 1, sizeof(cl_mem), &b.buf);
 	checkError(status, "Failed to set concat arg 1");
-	status = clSetKernelArg(k_concat, 2, sizeof(cl_mem), &output_buf);
+	status = clSetKernelArg(env->k_concat, 2, sizeof(cl_mem), &output.buf);
 	checkError(status, "Failed to set concat arg 2");
+	status = clSetKernelArg(env->k_concat, 3, sizeof(cl_int), &a_cols);
+	checkError(status, "Failed to set concat arg 3");
+	status = clSetKernelArg(env->k_concat, 4, sizeof(cl_int), &b_cols);
+	checkError(status, "Failed to set concat arg 4");
+
+	launchTuned(env->k_concat, "matrix_concat", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+//output row t*batch + r is [fwd row t*batch + r, bwd row (steps-1-t)*batch + r]
+void bilstmConcatCl(const clTensor &fwd, const clTensor &bwd, unsigned steps, unsigned batch, clTensor &output,
+			cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int n_steps = steps;
+	const cl_int n_batch = batch;
+	const cl_int n_hidden = fwd.cols;
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, 2*fwd.cols, steps*batch, maxLocalSize(env->k_bilstm_concat, "bilstm_concat"));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%ux%ux%d", steps, batch, n_hidden);
+
+	status = clSetKernelArg(env->k_bilstm_concat, 0, sizeof(cl_mem), &fwd.buf);
+	checkError(status, "Failed to set bilstm_concat arg 0");
+	status = clSetKernelArg(env->k_bilstm_concat, 1, sizeof(cl_mem), &bwd.buf);
+	checkError(status, "Failed to set bilstm_concat arg 1");
+	status = clSetKernelArg(env->k_bilstm_concat, 2, sizeof(cl_mem), &output.buf);
+	checkError(status, "Failed to set bilstm_concat arg 2");
+	status = clSetKernelArg(env->k_bilstm_concat, 3, sizeof(cl_int), &n_steps);
+	checkError(status, "Failed to set bilstm_concat arg 3");
+	status = clSetKernelArg(env->k_bilstm_concat, 4, sizeof(cl_int), &n_batch);
+	checkError(status, "Failed to set bilstm_concat arg 4");
+	status = clSetKernelArg(env->k_bilstm_concat, 5, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set bilstm_concat arg 5");
+
+	launchTuned(env->k_bilstm_concat, "bilstm_concat", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void lstmCellCl(const clTensor &prev_output, const clTensor &curr_input,
+		const clTensor &weights, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int n_in = curr_input.cols;
+	const cl_int n_hidden = curr_output.cols;
+	const lstmKernels &ks = lstmKernelsFor(n_in, n_hidden);
+	const cl_int w_type = weights.type;
+	const cl_int b_type = bias.type;
+
+	//work groups are one batch row tall because each stages its own row of [h, x]
+	std::vector<launchConfig> candidates;
+	rowCandidates(candidates, n_hidden, curr_output.rows, maxLocalSize(ks.cell, "lstm_cell"));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%dx%d %d%d%s", curr_output.rows, n_hidden, n_in, w_type, b_type, ks.n_hidden ? " spec" : "");
+
+	status = clSetKernelArg(ks.cell, 0, sizeof(cl_mem), &prev_output.buf);
+	checkError(status, "Failed to set lstm_cell arg 0");
+	status = clSetKernelArg(ks.cell, 1, sizeof(cl_mem), &curr_input.buf);
+	checkError(status, "Failed to set lstm_cell arg 1");
+	status = clSetKernelArg(ks.cell, 2, sizeof(cl_mem), &weights.buf);
+	checkError(status, "Failed to set lstm_cell arg 2");
+	status = clSetKernelArg(ks.cell, 3, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set lstm_cell arg 3");
+	status = clSetKernelArg(ks.cell, 4, sizeof(cl_mem), &prev_state.buf);
+	checkError(status, "Failed to set lstm_cell arg 4");
+	status = clSetKernelArg(ks.cell, 5, sizeof(cl_mem), &curr_state.buf);
+	checkError(status, "Failed to set lstm_cell arg 5");
+	status = clSetKernelArg(ks.cell, 6, sizeof(cl_mem), &curr_output.buf);
+	checkError(status, "Failed to set lstm_cell arg 6");
+	status = clSetKernelArg(ks.cell, 7, sizeof(cl_int), &n_in);
+	checkError(status, "Failed to set lstm_cell arg 7");
+	status = clSetKernelArg(ks.cell, 8, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set lstm_cell arg 8");
+	status = clSetKernelArg(ks.cell, 9, sizeof(cl_int), &w_type);
+	checkError(status, "Failed to set lstm_cell arg 9");
+	status = clSetKernelArg(ks.cell, 10, sizeof(cl_int), &b_type);
+	checkError(status, "Failed to set lstm_cell arg 10");
+	status = clSetKernelArg(ks.cell, 11, sizeof(cl_float)*(n_in + n_hidden), NULL);
+	checkError(status, "Failed to set lstm_cell arg 11");
+
+	launchTuned(ks.cell, "lstm_cell", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void lstmPointwiseCl(const clTensor &gates, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int n_hidden = curr_output.cols;
+	const lstmKernels &ks = lstmKernelsFor(-1, n_hidden);
+	const cl_int b_type = bias.type;
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, curr_output.cols, curr_output.rows, maxLocalSize(ks.pointwise, "lstm_pointwise"));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%d %d%s", curr_output.rows, n_hidden, b_type, ks.n_hidden ? " spec" : "");
+
+	status = clSetKernelArg(ks.pointwise, 0, sizeof(cl_mem), &gates.buf);
+	checkError(status, "Failed to set lstm_pointwise arg 0");
+	status = clSetKernelArg(ks.pointwise, 1, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set lstm_pointwise arg 1");
+	status = clSetKernelArg(ks.pointwise, 2, sizeof(cl_mem), &prev_state.buf);
+	checkError(status, "Failed to set lstm_pointwise arg 2");
+	status = clSetKernelArg(ks.pointwise, 3, sizeof(cl_mem), &curr_state.buf);
+	checkError(status, "Failed to set lstm_pointwise arg 3");
+	status = clSetKernelArg(ks.pointwise, 4, sizeof(cl_mem), &curr_output.buf);
+	checkError(status, "Failed to set lstm_pointwise arg 4");
+	status = clSetKernelArg(ks.pointwise, 5, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set lstm_pointwise arg 5");
+	status = clSetKernelArg(ks.pointwise, 6, sizeof(cl_int), &b_type);
+	checkError(status, "Failed to set lstm_pointwise arg 6");
+
+	launchTuned(ks.pointwise, "lstm_pointwise", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void lstmCellProjectedCl(const clTensor &prev_output, const clTensor &proj, size_t proj_row,
+		const clTensor &weights_h, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int row = proj_row;
+	const cl_int n_hidden = curr_output.cols;
+	const lstmKernels &ks = lstmKernelsFor(-1, n_hidden);
+	const cl_int p_type = proj.type;
+	const cl_int w_type = weights_h.type;
+	const cl_int b_type = bias.type;
+
+	//same geometry as lstm_cell
+	std::vector<launchConfig> candidates;
+	rowCandidates(candidates, n_hidden, curr_output.rows, maxLocalSize(ks.projected, "lstm_cell_projected"));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%d %d%d%d%s", curr_output.rows, n_hidden, p_type, w_type, b_type, ks.n_hidden ? " spec" : "");
+
+	status = clSetKernelArg(ks.projected, 0, sizeof(cl_mem), &prev_output.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 0");
+	status = clSetKernelArg(ks.projected, 1, sizeof(cl_mem), &proj.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 1");
+	status = clSetKernelArg(ks.projected, 2, sizeof(cl_mem), &weights_h.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 2");
+	status = clSetKernelArg(ks.projected, 3, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 3");
+	status = clSetKernelArg(ks.projected, 4, sizeof(cl_mem), &prev_state.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 4");
+	status = clSetKernelArg(ks.projected, 5, sizeof(cl_mem), &curr_state.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 5");
+	status = clSetKernelArg(ks.projected, 6, sizeof(cl_mem), &curr_output.buf);
+	checkError(status, "Failed to set lstm_cell_projected arg 6");
+	status = clSetKernelArg(ks.projected, 7, sizeof(cl_int), &row);
+	checkError(status, "Failed to set lstm_cell_projected arg 7");
+	status = clSetKernelArg(ks.projected, 8, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set lstm_cell_projected arg 8");
+	status = clSetKernelArg(ks.projected, 9, sizeof(cl_int), &p_type);
+	checkError(status, "Failed to set lstm_cell_projected arg 9");
+	status = clSetKernelArg(ks.projected, 10, sizeof(cl_int), &w_type);
+	checkError(status, "Failed to set lstm_cell_projected arg 10");
+	status = clSetKernelArg(ks.projected, 11, sizeof(cl_int), &b_type);
+	checkError(status, "Failed to set lstm_cell_projected arg 11");
+	status = clSetKernelArg(ks.projected, 12, sizeof(cl_float)*n_hidden, NULL);
+	checkError(status, "Failed to set lstm_cell_projected arg 12");
+
+	launchTuned(ks.projected, "lstm_cell_projected", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void lstmCellI8Cl(const clTensor &prev_output, const clTensor &curr_input,
+		const clTensor &weights, const clTensor &w_scales, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int n_in = curr_input.cols;
+	const cl_int n_hidden = curr_output.cols;
+	const lstmKernels &ks = lstmKernelsFor(n_in, n_hidden);
+
+	//same geometry as lstm_cell
+	std::vector<launchConfig> candidates;
+	const size_t max_local = maxLocalSize(ks.cell_i8, "lstm_cell_i8");
+	rowCandidates(candidates, n_hidden, curr_output.rows, max_local);
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%dx%d%s", curr_output.rows, n_hidden, n_in, ks.n_hidden ? " spec" : "");
+
+	status = clSetKernelArg(ks.cell_i8, 0, sizeof(cl_mem), &prev_output.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 0");
+	status = clSetKernelArg(ks.cell_i8, 1, sizeof(cl_mem), &curr_input.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 1");
+	status = clSetKernelArg(ks.cell_i8, 2, sizeof(cl_mem), &weights.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 2");
+	status = clSetKernelArg(ks.cell_i8, 3, sizeof(cl_mem), &w_scales.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 3");
+	status = clSetKernelArg(ks.cell_i8, 4, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 4");
+	status = clSetKernelArg(ks.cell_i8, 5, sizeof(cl_mem), &prev_state.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 5");
+	status = clSetKernelArg(ks.cell_i8, 6, sizeof(cl_mem), &curr_state.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 6");
+	status = clSetKernelArg(ks.cell_i8, 7, sizeof(cl_mem), &curr_output.buf);
+	checkError(status, "Failed to set lstm_cell_i8 arg 7");
+	status = clSetKernelArg(ks.cell_i8, 8, sizeof(cl_int), &n_in);
+	checkError(status, "Failed to set lstm_cell_i8 arg 8");
+	status = clSetKernelArg(ks.cell_i8, 9, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set lstm_cell_i8 arg 9");
+	//the float scratch carries one extra slot per work item for the absmax reduction,
+	//sized for the largest work group so it fits every candidate
+	status = clSetKernelArg(ks.cell_i8, 10, sizeof(cl_float)*(n_in + n_hidden + max_local), NULL);
+	checkError(status, "Failed to set lstm_cell_i8 arg 10");
+	status = clSetKernelArg(ks.cell_i8, 11, sizeof(cl_char)*(n_in + n_hidden), NULL);
+	checkError(status, "Failed to set lstm_cell_i8 arg 11");
+
+	launchTuned(ks.cell_i8, "lstm_cell_i8", shape, 2, candidates, -1, num_events, wait_list, event);
+}
+bool lstmSequenceCl(const clTensor &inputs, unsigned steps, clTensor &outputs,
+		const clTensor &weights, const clTensor &bias, clTensor &hidden, clTensor &state,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int n_in = inputs.cols;
+	const cl_int n_hidden = hidden.cols;
+	const lstmKernels &ks = lstmKernelsFor(n_in, n_hidden);
+	const cl_int n_steps = steps;
+	const cl_int batch = hidden.rows;
+	const cl_int w_type = weights.type;
+	const cl_int b_type = bias.type;
+	const size_t concat_bytes = sizeof(cl_float)*(n_in + n_hidden);
+	//the on-chip copy is widened to float whatever the storage
+	const size_t weight_bytes = sizeof(cl_float)*weights.rows*weights.cols;
+
+	//the whole window runs in one work group, so it has to cover every hidden unit
+	std::vector<launchConfig> candidates;
+	if(!sequenceCandidates(candidates, n_hidden, batch, maxLocalSize(ks.sequence, "lstm_sequence")))
+		return false;
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%dx%dx%d %d%d%s", n_steps, batch, n_hidden, n_in, w_type, b_type, ks.n_hidden ? " spec" : "");
+
+	//keep the weights on chip for the whole launch when local memory allows
+	cl_ulong local_mem;
+	clGetDeviceInfo(env->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &local_mem, NULL);
+	const cl_int cache_weights = (concat_bytes + weight_bytes) <= local_mem;
+
+	status = clSetKernelArg(ks.sequence, 0, sizeof(cl_mem), &inputs.buf);
+	checkError(status, "Failed to set lstm_sequence arg 0");
+	status = clSetKernelArg(ks.sequence, 1, sizeof(cl_mem), &weights.buf);
+	checkError(status, "Failed to set lstm_sequence arg 1");
+	status = clSetKernelArg(ks.sequence, 2, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set lstm_sequence arg 2");
+	status = clSetKernelArg(ks.sequence, 3, sizeof(cl_mem), &hidden.buf);
+	checkError(status, "Failed to set lstm_sequence arg 3");
+	status = clSetKernelArg(ks.sequence, 4, sizeof(cl_mem), &state.buf);
+	checkError(status, "Failed to set lstm_sequence arg 4");
+	status = clSetKernelArg(ks.sequence, 5, sizeof(cl_mem), &outputs.buf);
+	checkError(status, "Failed to set lstm_sequence arg 5");
+	status = clSetKernelArg(ks.sequence, 6, sizeof(cl_int), &n_steps);
+	checkError(status, "Failed to set lstm_sequence arg 6");
+	status = clSetKernelArg(ks.sequence, 7, sizeof(cl_int), &batch);
+	checkError(status, "Failed to set lstm_sequence arg 7");
+	status = clSetKernelArg(ks.sequence, 8, sizeof(cl_int), &n_in);
+	checkError(status, "Failed to set lstm_sequence arg 8");
+	status = clSetKernelArg(ks.sequence, 9, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set lstm_sequence arg 9");
+	status = clSetKernelArg(ks.sequence, 10, sizeof(cl_int), &cache_weights);
+	checkError(status, "Failed to set lstm_sequence arg 10");
+	status = clSetKernelArg(ks.sequence, 11, sizeof(cl_int), &w_type);
+	checkError(status, "Failed to set lstm_sequence arg 11");
+	status = clSetKernelArg(ks.sequence, 12, sizeof(cl_int), &b_type);
+	checkError(status, "Failed to set lstm_sequence arg 12");
+	status = clSetKernelArg(ks.sequence, 13, concat_bytes, NULL);
+	checkError(status, "Failed to set lstm_sequence arg 13");
+	//a zero sized local argument is invalid, so hand over a token float when not caching
+	status = clSetKernelArg(ks.sequence, 14, cache_weights ? weight_bytes : sizeof(cl_float), NULL);
+	checkError(status, "Failed to set lstm_sequence arg 14");
+
+	const cl_mem keep[2] = {hidden.buf, state.buf};
+	launchTuned(ks.sequence, "lstm_sequence", shape, 1, candidates, -1, num_events, wait_list, event, 2, keep);
+	return true;
+}
+bool lstmSequenceProjectedCl(const clTensor &proj, unsigned steps, clTensor &outputs,
+		const clTensor &weights_h, const clTensor &bias, clTensor &hidden, clTensor &state,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const cl_int n_hidden = hidden.cols;
+	const lstmKernels &ks = lstmKernelsFor(-1, n_hidden);
+	const cl_int n_steps = steps;
+	const cl_int batch = hidden.rows;
+	const cl_int p_type = proj.type;
+	const cl_int w_type = weights_h.type;
+	const cl_int b_type = bias.type;
+	const size_t hidden_bytes = sizeof(cl_float)*n_hidden;
+	const size_t weight_bytes = sizeof(cl_float)*weights_h.rows*weights_h.cols;
+
+	//same limits as lstm_sequence
+	std::vector<launchConfig> candidates;
+	if(!sequenceCandidates(candidates, n_hidden, batch, maxLocalSize(ks.sequence_projected, "lstm_sequence_projected")))
+		return false;
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%dx%d %d%d%d%s", n_steps, batch, n_hidden, p_type, w_type, b_type, ks.n_hidden ? " spec" : "");
+
+	//W_h is a third of the packed weights, so it fits on chip more often
+	cl_ulong local_mem;
+	clGetDeviceInfo(env->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &local_mem, NULL);
+	const cl_int cache_weights = (hidden_bytes + weight_bytes) <= local_mem;
+
+	status = clSetKernelArg(ks.sequence_projected, 0, sizeof(cl_mem), &proj.buf);
+	checkError(status, "Failed to set lstm_sequence_projected arg 0");
+	status = clSetKernelArg(ks.sequence_projected, 1, sizeof(cl_mem), &weights_h.buf);
+	checkError(status, "Failed to set lstm_sequence_projected arg 1");
+	status = clSetKernelArg(ks.sequence_projected, 2, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set lstm_sequence_projected arg 2");
+	status = clSetKernelArg(ks.sequence_projected, 3, sizeof(cl_mem), &hidden.buf);
+	checkError(status, "Failed to set lstm_sequence_projected arg 3");
+	status = clSetKernelArg(ks.sequence_projected, 4, sizeof(cl_mem), &state.buf);
+	checkError(status, "Failed to set lstm_sequence_projected arg 4");
+	status = clSetKernelArg(ks.sequence_projected, 5, sizeof(cl_mem), &outputs.buf);
+	checkError(status, "Failed to set lstm_sequence_projected arg 5");
+	status = clSetKernelArg(ks.sequence_projected, 6, sizeof(cl_int), &n_steps);
+	checkError(status, "Failed to set lstm_sequence_projected arg 6");
+	status = clSetKernelArg(ks.sequence_projected, 7, sizeof(cl_int), &batch);
+	checkError(status, "Failed to set lstm_sequence_projected arg 7");
+	status = clSetKernelArg(ks.sequence_projected, 8, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set lstm_sequence_projected arg 8");
+	status = clSetKernelArg(ks.sequence_projected, 9, sizeof(cl_int), &cache_weights);
+	checkError(status, "Failed to set lstm_sequence_projected arg 9");
+	status = clSetKernelArg(ks.sequence_projected, 10, sizeof(cl_int), &p_type);
+	checkError(status, "Failed to set lstm_sequence_projected arg 10");
+	status = clSetKernelArg(ks.sequence_projected, 11, sizeof(cl_int), &w_type);
+	checkError(status, "Failed to set lstm_sequence_projected arg 11");
+	status = clSetKernelArg(ks.sequence_projected, 12, sizeof(cl_int), &b_type);
+	checkError(status, "Failed to set lstm_sequence_projected arg 12");
+	status = clSetKernelArg(ks.sequence_projected, 13, hidden_bytes, NULL);
+	checkError(status, "Failed to set lstm_sequence_projected arg 13");
+	status = clSetKernelArg(ks.sequence_projected, 14, cache_weights ? weight_bytes : sizeof(cl_float), NULL);
+	checkError(status, "Failed to set lstm_sequence_projected arg 14");
+
+	const cl_mem keep[2] = {hidden.buf, state.buf};
+	launchTuned(ks.sequence_projected, "lstm_sequence_projected", shape, 1, candidates, -1,
+			num_events, wait_list, event, 2, keep);
+	return true;
+}
+
+//    T R A I N I N G    //
+
+//Training kernels, float tensors only. Row arguments address one batch of rows inside a
+//tensor holding a whole segment of steps.
+
+void lstmPointwiseTrainCl(const clTensor &pre, const clTensor &bias, clTensor &acts, size_t act_row,
+		clTensor &states, size_t prev_row, size_t curr_row, clTensor &hidden,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const char *name = "lstm_pointwise_train";
+	cl_kernel kernel = env->k_pointwise_train;
+	const cl_int rows[3] = {(cl_int)act_row, (cl_int)prev_row, (cl_int)curr_row};
+	const cl_int n_hidden = hidden.cols;
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, hidden.cols, hidden.rows, maxLocalSize(kernel, name));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%d", hidden.rows, n_hidden);
+
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &pre.buf);
+	checkError(status, "Failed to set %s arg 0", name);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &bias.buf);
+	checkError(status, "Failed to set %s arg 1", name);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &acts.buf);
+	checkError(status, "Failed to set %s arg 2", name);
+	status = clSetKernelArg(kernel, 3, sizeof(cl_int), &rows[0]);
+	checkError(status, "Failed to set %s arg 3", name);
+	status = clSetKernelArg(kernel, 4, sizeof(cl_mem), &states.buf);
+	checkError(status, "Failed to set %s arg 4", name);
+	status = clSetKernelArg(kernel, 5, sizeof(cl_int), &rows[1]);
+	checkError(status, "Failed to set %s arg 5", name);
+	status = clSetKernelArg(kernel, 6, sizeof(cl_int), &rows[2]);
+	checkError(status, "Failed to set %s arg 6", name);
+	status = clSetKernelArg(kernel, 7, sizeof(cl_mem), &hidden.buf);
+	checkError(status, "Failed to set %s arg 7", name);
+	status = clSetKernelArg(kernel, 8, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set %s arg 8", name);
+
+	launchTuned(kernel, name, shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void lstmBackwardPointwiseCl(const clTensor &acts, size_t act_row,
+		const clTensor &states, size_t prev_row, size_t curr_row,
+		const clTensor &d_out, size_t out_row, const clTensor &d_hidden,
+		clTensor &d_state, clTensor &d_pre,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const char *name = "lstm_backward_pointwise";
+	cl_kernel kernel = env->k_backward_pointwise;
+	const cl_int rows[4] = {(cl_int)act_row, (cl_int)prev_row, (cl_int)curr_row, (cl_int)out_row};
+	const cl_int n_hidden = d_state.cols;
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, d_state.cols, d_state.rows, maxLocalSize(kernel, name));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%zux%d", d_state.rows, n_hidden);
+
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &acts.buf);
+	checkError(status, "Failed to set %s arg 0", name);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_int), &rows[0]);
+	checkError(status, "Failed to set %s arg 1", name);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &states.buf);
+	checkError(status, "Failed to set %s arg 2", name);
+	status = clSetKernelArg(kernel, 3, sizeof(cl_int), &rows[1]);
+	checkError(status, "Failed to set %s arg 3", name);
+	status = clSetKernelArg(kernel, 4, sizeof(cl_int), &rows[2]);
+	checkError(status, "Failed to set %s arg 4", name);
+	status = clSetKernelArg(kernel, 5, sizeof(cl_mem), &d_out.buf);
+	checkError(status, "Failed to set %s arg 5", name);
+	status = clSetKernelArg(kernel, 6, sizeof(cl_int), &rows[3]);
+	checkError(status, "Failed to set %s arg 6", name);
+	status = clSetKernelArg(kernel, 7, sizeof(cl_mem), &d_hidden.buf);
+	checkError(status, "Failed to set %s arg 7", name);
+	status = clSetKernelArg(kernel, 8, sizeof(cl_mem), &d_state.buf);
+	checkError(status, "Failed to set %s arg 8", name);
+	status = clSetKernelArg(kernel, 9, sizeof(cl_mem), &d_pre.buf);
+	checkError(status, "Failed to set %s arg 9", name);
+	status = clSetKernelArg(kernel, 10, sizeof(cl_int), &n_hidden);
+	checkError(status, "Failed to set %s arg 10", name);
+
+	launchTuned(kernel, name, shape, 2, candidates, -1, num_events, wait_list, event, 1, &d_state.buf);
+}
+void matrixMultiplyNnCl(const clTensor &a, size_t a_row, size_t m, const clTensor &b, clTensor &output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const char *name = "matrix_mul_nn";
+	const cl_int row = a_row;
+	const cl_int dims[4] = {(cl_int)m, (cl_int)output.cols, (cl_int)a.cols, (cl_int)b.cols};
+
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%dx%d", dims[0], dims[1], dims[2]);
+	std::vector<launchConfig> candidates;
+	gemmCandidates(candidates, &gemmKernels::mul_nn, name, shape, dims[0], dims[1]);
+
+	//every GEMM tiling is a kernel of its own
+	for(size_t i = 0; i < candidates.size(); i++)
+	{
+		cl_kernel kernel = candidates[i].kernel;
+		status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a.buf);
+		checkError(status, "Failed to set %s arg 0", name);
+		status = clSetKernelArg(kernel, 1, sizeof(cl_int), &row);
+		checkError(status, "Failed to set %s arg 1", name);
+		status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &b.buf);
+		checkError(status, "Failed to set %s arg 2", name);
+		status = clSetKernelArg(kernel, 3, sizeof(cl_mem), &output.buf);
+		checkError(status, "Failed to set %s arg 3", name);
+		status = clSetKernelArg(kernel, 4, sizeof(cl_int), &dims[0]);
+		checkError(status, "Failed to set %s arg 4", name);
+		status = clSetKernelArg(kernel, 5, sizeof(cl_int), &dims[1]);
+		checkError(status, "Failed to set %s arg 5", name);
+		status = clSetKernelArg(kernel, 6, sizeof(cl_int), &dims[2]);
+		checkError(status, "Failed to set %s arg 6", name);
+		status = clSetKernelArg(kernel, 7, sizeof(cl_int), &dims[3]);
+		checkError(status, "Failed to set %s arg 7", name);
+	}
+
+	launchTuned(env->gemm.mul_nn, name, shape, 2, candidates, -1, num_events, wait_list, event);
+}
+void matrixMultiplyTnCl(const clTensor &a, const clTensor &b, size_t k, clTensor &output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const char *name = "matrix_mul_tn";
+	const cl_int dims[3] = {(cl_int)a.cols, (cl_int)b.cols, (cl_int)k};
+
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%dx%d", dims[0], dims[1], dims[2]);
+	std::vector<launchConfig> candidates;
+	gemmCandidates(candidates, &gemmKernels::mul_tn, name, shape, dims[0], dims[1]);
+
+	for(size_t i = 0; i < candidates.size(); i++)
+	{
+		cl_kernel kernel = candidates[i].kernel;
+		status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a.buf);
+		checkError(status, "Failed to set %s arg 0", name);
+		status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &b.buf);
+		checkError(status, "Failed to set %s arg 1", name);
+		status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &output.buf);
+		checkError(status, "Failed to set %s arg 2", name);
+		status = clSetKernelArg(kernel, 3, sizeof(cl_int), &dims[0]);
+		checkError(status, "Failed to set %s arg 3", name);
+		status = clSetKernelArg(kernel, 4, sizeof(cl_int), &dims[1]);
+		checkError(status, "Failed to set %s arg 4", name);
+		status = clSetKernelArg(kernel, 5, sizeof(cl_int), &dims[2]);
+		checkError(status, "Failed to set %s arg 5", name);
+	}
+
+	launchTuned(env->gemm.mul_tn, name, shape, 2, candidates, -1, num_events, wait_list, event, 1, &output.buf);
+}
+void columnSumCl(const clTensor &a, size_t rows, clTensor &output,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const char *name = "column_sum";
+	cl_kernel kernel = env->k_column_sum;
+	const cl_int dims[2] = {(cl_int)rows, (cl_int)a.cols};
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, a.cols, 1, maxLocalSize(kernel, name));
+	char shape[64];
+	snprintf(shape, sizeof(shape), "%dx%d", dims[0], dims[1]);
+
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a.buf);
+	checkError(status, "Failed to set %s arg 0", name);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &output.buf);
+	checkError(status, "Failed to set %s arg 1", name);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_int), &dims[0]);
+	checkError(status, "Failed to set %s arg 2", name);
+	status = clSetKernelArg(kernel, 3, sizeof(cl_int), &dims[1]);
+	checkError(status, "Failed to set %s arg 3", name);
+
+	launchTuned(kernel, name, shape, 1, candidates, -1, num_events, wait_list, event, 1, &output.buf);
+}
+void axpyCl(const clTensor &x, clTensor &y, cl_float alpha,
+		cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	const char *name = "matrix_axpy";
+	cl_kernel kernel = env->k_axpy;
+
+	std::vector<launchConfig> candidates;
+	exactCandidates(candidates, y.rows*y.cols, 1, maxLocalSize(kernel, name));
+	char shape[32];
+	snprintf(shape, sizeof(shape), "%zu", y.rows*y.cols);
+
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &x.buf);
+	checkError(status, "Failed to set %s arg 0", name);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &y.buf);
+	checkError(status, "Failed to set %s arg 1", name);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_float), &alpha);
+	checkError(status, "Failed to set %s arg 2", name);
 
-	clEnqueueNDRangeKernel(	queue, 
-				k_concat, 
-				1, NULL, 
-				&global_work_size, &local_work_size, 
-				0, NULL, NULL);
-	checkError(status, "Failed to launch matrix add kernel");
-
-	clEnqueueReadBuffer(	queue, 
-				output_buf,
-				CL_FALSE, 0, 
-				sizeof(cl_float)*CONCAT_SIZE,
-				output, 
-				0, NULL, NULL);
-	clFinish(queue);
+	launchTuned(kernel, name, shape, 1, candidates, -1, num_events, wait_list, event, 1, &y.buf);
 }
@@ -1,19 +1,210 @@
 #ifndef OCL_ABS_H
 #define OCL_ABS_H
 
+#include <vector>
 #include <CL/opencl.h>
+#include "activation.h"
 
 //define some additional constants
-#define INPUT_SIZE 128*6
-#define OUTPUT_SIZE 128*6
-#define CONCAT_SIZE INPUT_SIZE*2
+#define INPUT_SIZE (128*6)
+#define OUTPUT_SIZE (128*6)
+#define CONCAT_SIZE (INPUT_SIZE + OUTPUT_SIZE)
 
+//gate order of packed weights/biases, must match kernels.cl
+#define GATE_FORGET 0
+#define GATE_INPUT 1
+#define GATE_INTERNAL 2
+#define GATE_OUTPUT 3
+#define NUM_GATES 4
+//hidden units each lstm_sequence work item can own, must match kernels.cl
+#define MAX_UNITS_PER_ITEM 8
+//matrix_vec_mul geometry, must match kernels.cl: up to GEMV_MAX_ROWS rows of a with up to
+//MAX_COLS_PER_ITEM outputs per work item. The matrix_mul tiling is read from the program.
+#define GEMV_MAX_ROWS 8
+#define MAX_COLS_PER_ITEM 4
+
+//element type of a tensor, must match kernels.cl. Activations are always float, weights,
+//biases and cached projections may be int8 or 16-bit storage that the kernels widen to
+//float as they load it.
+enum tensor_type
+{
+	TENSOR_F32 = 0,
+	TENSOR_I8,
+	TENSOR_F16,
+	//the top 16 bits of a float
+	TENSOR_BF16
+};
+
+//Handle to a row-major matrix that lives in device memory.
+//Data only crosses the bus through uploadTensorCl/downloadTensorCl.
+struct clTensor
+{
+	cl_mem buf;
+	size_t rows;
+	size_t cols;
+	tensor_type type;
+};
+size_t tensorElemSize(tensor_type type);
+
+//Every call below enqueues on the environment bound to the calling thread.
+//setupOclEnv creates one and binds it, which is all a single threaded program needs.
+//Worker threads fork the main environment and bind their fork: same context and program,
+//so tensors can be passed around, but a private queue and private kernel objects.
+//RNN_CL_PLATFORM runs on the named platform instead of the FPGA board (a substring such
+//as "Portable Computing Language" for pocl), building kernel_file.cl from source. Built
+//programs are cached as binaries in RNN_PROGRAM_CACHE (rnn_programs by default), keyed by
+//the source, build options, device and driver, so later starts skip the compiler.
+//There specializeOclEnv also builds a program with n_in and n_hidden compiled in as
+//constants (one per distinct shape, shared by every fork) that LSTM launches of that
+//shape use from then on. It returns false, leaving the generic kernels in charge, on the
+//FPGA board, whose binary is fixed.
+//createOclEnv takes the platform's first device. createDeviceEnvs appends one independent
+//environment (own context, program and queue) per device of the platform instead, and
+//returns how many it made. CPU devices are split into one sub-device per NUMA node, or into
+//sub-devices of RNN_CPU_SUBDEVICE_CORES compute units each, where the driver allows it.
+struct oclEnv;
 bool setupOclEnv(char *kernel_file);
-void matrixMultiplyCl(cl_float *a, cl_float *b, cl_float *output);
-void matrixAddCl(cl_float *a, cl_float *b, cl_float *output);
-void sigmoidCl(cl_float *in, cl_float *out);
-void tanhCl(cl_float *in, cl_float *out);
-void matrixConcatCl(cl_float *a, cl_float *b, cl_float *output);
+void cleanupOclEnv();
+oclEnv *createOclEnv(const char *kernel_file);
+unsigned createDeviceEnvs(const char *kernel_file, std::vector<oclEnv *> &envs);
+oclEnv *forkOclEnv(const oclEnv *parent);
+void releaseOclEnv(oclEnv *env);
+bool specializeOclEnv(unsigned n_in, unsigned n_hidden);
+//Activation compiled into programs built from here on (activation.h). The FPGA binary keeps
+//whatever it was compiled with.
+void setActivationCl(activation_mode mode);
+activation_mode activationCl();
+void bindOclEnv(oclEnv *env);
+oclEnv *currentOclEnv();
+void finishCl();
+void markerCl(cl_uint num_events, const cl_event *wait_list, cl_event *event);
 
-#endif
+//Launch geometry autotuning. Every kernel launch below looks its device, driver version,
+//kernel and shape up in a cache of measured winners (local size, outputs per work item) and
+//uses the old fixed guess on a miss. With tuning on, a miss first times every candidate with
+//profiling events. Buffers a kernel accumulates into or updates in place are copied aside
+//for the sweep and restored after it, so tuning does not change results. matrix_mul and its
+//transposed variants also try other tilings, each a program built from source on first use
+//(not on the FPGA board, whose binary is fixed).
+//The cache is the file RNN_TUNE_CACHE, rnn_tune.cache in the working directory by default,
+//read on the first launch and written by saveTuningCl.
+void setTuningCl(bool enabled);
+bool saveTuningCl();
+
+//Kernel time for benchmarks. While profiling is on, every kernel the calling thread launches
+//keeps its event, and takeKernelTimeCl waits for them and returns their summed execution
+//time in ns since the last call. Transfers are not counted.
+void profileKernelsCl(bool enabled);
+cl_ulong takeKernelTimeCl();
+//With tracing on (trace.h, RNN_TRACE) every enqueue below also records a timeline span.
+
+//Every enqueue below follows the clEnqueue* convention: it runs after the events in
+//wait_list and, when event is not NULL, hands back an event the caller must release.
+//Nothing blocks the host except the blocking uploads/downloads and finishCl.
+//tensor management
+//host is passed through to clCreateBuffer, for CL_MEM_USE_HOST_PTR/CL_MEM_COPY_HOST_PTR
+clTensor createTensorCl(size_t rows, size_t cols, cl_mem_flags flags = CL_MEM_READ_WRITE, void *host = NULL, tensor_type type = TENSOR_F32);
+void releaseTensorCl(clTensor &t);
+void uploadTensorCl(clTensor &t, const void *host, cl_bool blocking = CL_TRUE, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void uploadRowsCl(clTensor &t, size_t first_row, size_t nrows, const void *host, cl_bool blocking = CL_TRUE, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void downloadTensorCl(const clTensor &t, void *host, cl_bool blocking = CL_TRUE, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void copyRowsCl(const clTensor &src, size_t src_row, clTensor &dst, size_t dst_row, size_t nrows, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void copyColsCl(const clTensor &src, size_t src_col, clTensor &dst, size_t dst_col, size_t ncols, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void fillTensorCl(clTensor &t, cl_float value, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//operations, all operands stay on the device
+//matrixMultiplyCl: a is MxK, b is NxK (stored transposed), output is MxN, any sizes.
+//b and output may be TENSOR_F16/TENSOR_BF16, the same goes for the weight, bias and
+//projection operands of the LSTM ops below. The arithmetic is float either way.
+void matrixMultiplyCl(const clTensor &a, const clTensor &b, clTensor &output, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+//int8 product for TENSOR_I8 weights. quantizeRowsCl quantizes each row of a (M x K float)
+//into a_q (M x K, TENSOR_I8) with its scale in a_scales (M x 1), as quantizeRowsCpu does.
+//matrixMultiplyI8Cl multiplies that by b (N x K, TENSOR_I8, one scale per row in b_scales)
+//with int32 accumulation into the float MxN output.
+void quantizeRowsCl(const clTensor &a, clTensor &a_q, clTensor &a_scales, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void matrixMultiplyI8Cl(const clTensor &a_q, const clTensor &a_scales, const clTensor &b, const clTensor &b_scales, clTensor &output, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void matrixAddCl(const clTensor &a, const clTensor &b, clTensor &output, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void matrixElemMulCl(const clTensor &a, const clTensor &b, clTensor &output, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void sigmoidCl(const clTensor &in, clTensor &out, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void tanhCl(const clTensor &in, clTensor &out, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+void matrixConcatCl(const clTensor &a, const clTensor &b, clTensor &output, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+//both directions of a bidirectional window, (steps*batch) x n_hidden each, into (steps*batch) x 2*n_hidden.
+//bwd ran on the reversed window and is put back in time order on the way.
+void bilstmConcatCl(const clTensor &fwd, const clTensor &bwd, unsigned steps, unsigned batch, clTensor &output, cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//fused timestep: all four gates plus c = f*c + i*g, h = o*tanh(c) in one launch
+//weights is NUM_GATES*H x (H + I) in GATE_* order, bias is NUM_GATES x H.
+//Every row of the B x H / B x I operands is an independent window.
+void lstmCellCl(const clTensor &prev_output, const clTensor &curr_input,
+		const clTensor &weights, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//batched step, second half: gates is the B x NUM_GATES*H product of the concatenated
+//input with the packed weights, this adds the bias, activates and updates the state
+void lstmPointwiseCl(const clTensor &gates, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//lstmCellCl with the input half precomputed: rows proj_row .. proj_row+B-1 of proj hold
+//x*W_x^T for this step (NUM_GATES*H wide, no bias), weights_h is NUM_GATES*H x H
+void lstmCellProjectedCl(const clTensor &prev_output, const clTensor &proj, size_t proj_row,
+		const clTensor &weights_h, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//lstmCellCl for int8 weights (TENSOR_I8) with one scale per weight row in w_scales
+//(NUM_GATES*H x 1). [h, x] is quantized per batch row inside the kernel.
+void lstmCellI8Cl(const clTensor &prev_output, const clTensor &curr_input,
+		const clTensor &weights, const clTensor &w_scales, const clTensor &bias,
+		const clTensor &prev_state, clTensor &curr_state, clTensor &curr_output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
 
+//whole window in one launch: inputs is time-major (steps*B) x I, outputs receives h for every
+//step ((steps*B) x H). hidden and state (B x H) hold the initial h and c and are overwritten
+//with the final ones.
+//Returns false when the hidden size cannot fit one work group, callers then step with lstmCellCl.
+bool lstmSequenceCl(const clTensor &inputs, unsigned steps, clTensor &outputs,
+		const clTensor &weights, const clTensor &bias, clTensor &hidden, clTensor &state,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//lstmSequenceCl for split weights: proj is the time-major (steps*B) x NUM_GATES*H product of
+//the window with W_x (no bias), so only h*W_h^T is left inside the serial loop
+bool lstmSequenceProjectedCl(const clTensor &proj, unsigned steps, clTensor &outputs,
+		const clTensor &weights_h, const clTensor &bias, clTensor &hidden, clTensor &state,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//Training, float tensors only. Row arguments pick a batch of rows out of tensors holding a
+//whole segment of steps, see LSTMCell::backwardPass.
+
+//lstm_pointwise on pre (B x NUM_GATES*H, no bias) that also writes the activated gates to
+//rows act_row.. of acts and c to rows curr_row.. of states, reading c from rows prev_row..
+void lstmPointwiseTrainCl(const clTensor &pre, const clTensor &bias, clTensor &acts, size_t act_row,
+		clTensor &states, size_t prev_row, size_t curr_row, clTensor &hidden,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//gate gradients of one step into rows act_row.. of d_pre. d_out (rows out_row..) and d_hidden
+//are dL/dh from the loss and from the next step, d_state is dL/dc in and dL/dc_prev out.
+void lstmBackwardPointwiseCl(const clTensor &acts, size_t act_row,
+		const clTensor &states, size_t prev_row, size_t curr_row,
+		const clTensor &d_out, size_t out_row, const clTensor &d_hidden,
+		clTensor &d_state, clTensor &d_pre,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//output = rows a_row..a_row+m-1 of a times b, keeping the first output.cols columns of b
+void matrixMultiplyNnCl(const clTensor &a, size_t a_row, size_t m, const clTensor &b, clTensor &output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//output += a^T*b over the first k rows of a and b
+void matrixMultiplyTnCl(const clTensor &a, const clTensor &b, size_t k, clTensor &output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//output += the column sums of the first rows rows of a, output holds a.cols values
+void columnSumCl(const clTensor &a, size_t rows, clTensor &output,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+//y += alpha*x, same sizes
+void axpyCl(const clTensor &x, clTensor &y, cl_float alpha,
+		cl_uint num_events = 0, const cl_event *wait_list = NULL, cl_event *event = NULL);
+
+#endif
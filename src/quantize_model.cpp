@@ -0,0 +1,36 @@
+/*
+
+Filename: quantize_model.cpp
+Author: agent
+Purpose: Offline quantizer, turns a float model file into a MODEL_I8 one with a scale
+for every output row, or into 16-bit MODEL_F16/MODEL_BF16 storage.
+
+Usage: quantize_model <float model> <output model> [i8|f16|bf16]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+10/16/26	Added the f16 and bf16 targets, i8 stays the default.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "model.h"
+
+int main(int argc, char **argv)
+{
+	model_dtype dtype = MODEL_I8;
+	if(argc == 4 && !strcmp(argv[3], "f16"))
+		dtype = MODEL_F16;
+	else if(argc == 4 && !strcmp(argv[3], "bf16"))
+		dtype = MODEL_BF16;
+	else if(argc == 4 && strcmp(argv[3], "i8"))
+		argc = 0;
+	if(argc != 3 && argc != 4)
+	{
+		printf("Usage: %s <float model> <output model> [i8|f16|bf16]\n", argv[0]);
+		return 1;
+	}
+	return convertModel(argv[1], argv[2], dtype) ? 0 : 1;
+}
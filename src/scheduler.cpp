@@ -0,0 +1,147 @@
+#include "scheduler.h"
+
+InferenceScheduler::InferenceScheduler(	unsigned threads, lstm_backend backend,
+					cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+					cl_float *forget_bias, cl_float *input_bias,
+					cl_float *internal_bias, cl_float *output_bias,
+					unsigned n_in, unsigned n_hidden)
+	: queues(threads ? threads : 1)
+{
+	cl_float *w[NUM_GATES] = {forget, input, internal, output};
+	cl_float *b[NUM_GATES] = {forget_bias, input_bias, internal_bias, output_bias};
+	for(unsigned g = 0; g < NUM_GATES; g++)
+	{
+		this->weights[g] = w[g];
+		this->biases[g] = b[g];
+	}
+
+	this->backend = backend;
+	this->n_in = n_in;
+	this->n_hidden = n_hidden;
+	this->root_env = currentOclEnv();
+	this->next_queue = 0;
+	this->queued = 0;
+	this->pending = 0;
+	this->stopping = false;
+	this->ready = 0;
+
+	for(unsigned i = 0; i < this->queues.size(); i++)
+		this->workers.push_back(std::thread(&InferenceScheduler::workerMain, this, i));
+
+	std::unique_lock<std::mutex> lk(this->idle_lock);
+	this->done_cv.wait(lk, [this]{ return this->ready == this->workers.size(); });
+}
+InferenceScheduler::~InferenceScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lk(this->idle_lock);
+		this->stopping = true;
+	}
+	this->idle_cv.notify_all();
+	for(unsigned i = 0; i < this->workers.size(); i++)
+		this->workers[i].join();
+}
+//submission is the only producer, dealing round robin keeps the deques even so stealing
+//is the exception rather than the rule
+void InferenceScheduler::submit(const inferenceJob &job)
+{
+	workQueue &q = this->queues[this->next_queue];
+	this->next_queue = (this->next_queue + 1) % this->queues.size();
+
+	this->pending++;
+	{
+		std::lock_guard<std::mutex> lk(q.lock);
+		q.jobs.push_back(job);
+	}
+	{
+		std::lock_guard<std::mutex> lk(this->idle_lock);
+		this->queued++;
+	}
+	this->idle_cv.notify_one();
+}
+void InferenceScheduler::wait()
+{
+	std::unique_lock<std::mutex> lk(this->idle_lock);
+	this->done_cv.wait(lk, [this]{ return this->pending == 0; });
+}
+//owner end of the deque, newest job first
+bool InferenceScheduler::popJob(unsigned id, inferenceJob &job)
+{
+	workQueue &q = this->queues[id];
+	std::lock_guard<std::mutex> lk(q.lock);
+	if(q.jobs.empty())
+		return false;
+	job = q.jobs.back();
+	q.jobs.pop_back();
+	this->queued--;
+	return true;
+}
+//thief end, oldest job first, victims are tried starting from the next worker along
+bool InferenceScheduler::stealJob(unsigned id, inferenceJob &job)
+{
+	const unsigned n = this->queues.size();
+	for(unsigned k = 1; k < n; k++)
+	{
+		workQueue &q = this->queues[(id + k) % n];
+		std::lock_guard<std::mutex> lk(q.lock);
+		if(q.jobs.empty())
+			continue;
+		job = q.jobs.front();
+		q.jobs.pop_front();
+		this->queued--;
+		return true;
+	}
+	return false;
+}
+//false once the scheduler is stopping and every deque is drained
+bool InferenceScheduler::nextJob(unsigned id, inferenceJob &job)
+{
+	for(;;)
+	{
+		if(popJob(id, job) || stealJob(id, job))
+			return true;
+
+		std::unique_lock<std::mutex> lk(this->idle_lock);
+		this->idle_cv.wait(lk, [this]{ return this->queued > 0 || this->stopping; });
+		if(this->queued == 0 && this->stopping)
+			return false;
+	}
+}
+void InferenceScheduler::workerMain(unsigned id)
+{
+	oclEnv *env = NULL;
+	if(this->backend == BACKEND_OPENCL)
+	{
+		env = forkOclEnv(this->root_env);
+		bindOclEnv(env);
+	}
+
+	{
+		LSTMCell cell(	this->weights[GATE_FORGET], this->weights[GATE_INPUT],
+				this->weights[GATE_INTERNAL], this->weights[GATE_OUTPUT],
+				this->biases[GATE_FORGET], this->biases[GATE_INPUT],
+				this->biases[GATE_INTERNAL], this->biases[GATE_OUTPUT],
+				this->backend, 1, false, TENSOR_F32, this->n_in, this->n_hidden);
+		{
+			std::lock_guard<std::mutex> lk(this->idle_lock);
+			this->ready++;
+		}
+		this->done_cv.notify_all();
+
+		inferenceJob job;
+		while(nextJob(id, job))
+		{
+			cell.reset();
+			cell.forwardSequence(job.window, job.steps);
+			cell.getOutput(job.output);
+
+			if(--this->pending == 0)
+			{
+				std::lock_guard<std::mutex> lk(this->idle_lock);
+				this->done_cv.notify_all();
+			}
+		}
+	}
+
+	releaseOclEnv(env);
+}
@@ -0,0 +1,78 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "lstm.hpp"
+
+//One independent window: steps x n_in in, the final h (n_hidden) out, in the scheduler's shape.
+//Both buffers belong to the caller and must stay valid until wait() returns.
+struct inferenceJob
+{
+	const cl_float *window;
+	unsigned steps;
+	cl_float *output;
+};
+
+//Work-stealing pool for independent windows. Every worker owns its own LSTMCell and, on
+//the OpenCL backend, its own queue and kernels forked from the calling thread's environment,
+//so workers share nothing while running a window. Jobs are dealt round robin onto per-worker
+//deques, a worker pops its own newest job and steals the oldest from the others when idle.
+class InferenceScheduler
+{
+	private:
+		//one per worker, padded so neighbouring deque locks do not share a cache line
+		struct alignas(64) workQueue
+		{
+			std::mutex lock;
+			std::deque<inferenceJob> jobs;
+		};
+
+		lstm_backend backend;
+		cl_float *weights[NUM_GATES];
+		cl_float *biases[NUM_GATES];
+		unsigned n_in;
+		unsigned n_hidden;
+		oclEnv *root_env;
+
+		std::vector<std::thread> workers;
+		std::vector<workQueue> queues;
+		unsigned next_queue;
+
+		//jobs sitting in a deque, and jobs submitted but not finished
+		std::atomic<unsigned> queued;
+		std::atomic<unsigned> pending;
+		bool stopping;
+		unsigned ready;
+
+		//only touched by idle workers, submit and wait, never while a window runs
+		std::mutex idle_lock;
+		std::condition_variable idle_cv;
+		std::condition_variable done_cv;
+
+		bool popJob(unsigned id, inferenceJob &job);
+		bool stealJob(unsigned id, inferenceJob &job);
+		bool nextJob(unsigned id, inferenceJob &job);
+		void workerMain(unsigned id);
+	public:
+		//weights as for LSTMCell with n_in inputs and n_hidden units, read by every worker
+		//while it builds its cell. Returns once all workers are ready. BACKEND_OPENCL needs
+		//setupOclEnv on this thread.
+		InferenceScheduler(unsigned threads, lstm_backend backend,
+				cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+				cl_float *forget_bias = NULL, cl_float *input_bias = NULL,
+				cl_float *internal_bias = NULL, cl_float *output_bias = NULL,
+				unsigned n_in = INPUT_SIZE, unsigned n_hidden = OUTPUT_SIZE);
+		//finishes everything already submitted
+		~InferenceScheduler();
+		void submit(const inferenceJob &job);
+		//blocks until every submitted job has its output
+		void wait();
+		unsigned threads() const { return workers.size(); }
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include "stacked.hpp"
+#include "trace.h"
+
+StackedLSTM::StackedLSTM(const lstmModel &model, lstm_backend backend, unsigned batch, bool split_weights)
+{
+	const modelHeader *h = model.header;
+	const clTensor none = {NULL, 0, 0, TENSOR_F32};
+	this->backend = backend;
+	this->batch = batch;
+	this->window_buf = this->seq_outputs = none;
+	this->cpu_steps = 0;
+
+	for(unsigned k = 0; k < h->num_layers; k++)
+	{
+		if(k > 0 && h->layers[k].n_in != h->layers[k - 1].n_hidden)
+		{
+			printf("Layer %u takes %u inputs but layer %u has %u hidden units\n",
+				k, h->layers[k].n_in, k - 1, h->layers[k - 1].n_hidden);
+			exit(1);
+		}
+		//every layer builds its tensors and kernels on the queue it will run on
+		if(backend == BACKEND_OPENCL)
+		{
+			this->envs.push_back(k == 0 ? currentOclEnv() : forkOclEnv(this->envs[0]));
+			bindLayer(k);
+		}
+		this->layers.push_back(new LSTMCell(model, k, backend, batch, split_weights));
+	}
+	bindLayer(0);
+	this->progress.resize(this->layers.size());
+}
+StackedLSTM::~StackedLSTM()
+{
+	for(unsigned k = 0; k < this->layers.size(); k++)
+	{
+		bindLayer(k);
+		if(this->backend == BACKEND_OPENCL)
+			finishCl();
+		delete this->layers[k];
+	}
+	bindLayer(0);
+	releaseTensorCl(this->window_buf);
+	releaseTensorCl(this->seq_outputs);
+	for(unsigned k = 1; k < this->envs.size(); k++)
+		releaseOclEnv(this->envs[k]);
+	for(unsigned k = 0; k < this->cpu_outputs.size(); k++)
+		freeCpu(this->cpu_outputs[k]);
+}
+//LSTMCell enqueues on whatever environment is bound, so layer k's calls go through this first
+void StackedLSTM::bindLayer(unsigned k)
+{
+	if(this->backend == BACKEND_OPENCL)
+		bindOclEnv(this->envs[k]);
+}
+void StackedLSTM::reset()
+{
+	for(unsigned k = 0; k < this->layers.size(); k++)
+	{
+		bindLayer(k);
+		this->layers[k]->reset();
+	}
+	bindLayer(0);
+}
+void StackedLSTM::forwardSequence(const cl_float *window, unsigned steps, cl_float *outputs)
+{
+	traceScope span("StackedLSTM::forwardSequence");
+	if(this->backend == BACKEND_CPU)
+		forwardSequenceCpu(window, steps, outputs);
+	else
+		forwardSequenceCl(window, steps, outputs);
+}
+//Wave w runs step w - k of every layer k it covers, deepest layer first so that layer k copies
+//layer k-1's h before layer k-1 advances. A layer overwrites its older h buffer on every step,
+//so each step also waits for the last reader of its h (the next layer's copy, or the copy into
+//seq_outputs for the top layer). All of it is enqueued up front, nothing waits on the host.
+void StackedLSTM::forwardSequenceCl(const cl_float *window, unsigned steps, cl_float *outputs)
+{
+	const unsigned n = this->layers.size();
+	const unsigned rows = steps*this->batch;
+
+	bindLayer(0);
+	if(this->window_buf.rows < rows)
+	{
+		releaseTensorCl(this->window_buf);
+		this->window_buf = createTensorCl(rows, this->layers[0]->inputSize(), CL_MEM_READ_ONLY);
+	}
+	//layer 0's last step is the last read of the previous window
+	const cl_event first = this->layers[0]->stepDone();
+	uploadRowsCl(this->window_buf, 0, rows, window, CL_TRUE, 1, &first);
+
+	bindLayer(n - 1);
+	if(outputs && this->seq_outputs.rows < rows)
+	{
+		releaseTensorCl(this->seq_outputs);
+		this->seq_outputs = createTensorCl(rows, this->layers[n - 1]->hiddenSize());
+	}
+
+	std::vector<cl_event> readers(n, (cl_event)NULL);
+	for(unsigned w = 0; w + 1 < steps + n; w++)
+	{
+		for(unsigned k = n; k-- > 0;)
+		{
+			if(w < k || w - k >= steps)
+				continue;
+			const unsigned t = w - k;
+			bindLayer(k);
+
+			cl_event deps[2];
+			cl_uint ndeps = 0;
+			if(readers[k])
+				deps[ndeps++] = readers[k];
+			if(k == 0)
+				this->layers[0]->forwardPass(this->window_buf, t*this->batch, ndeps, deps);
+			else
+			{
+				cl_event consumed;
+				deps[ndeps++] = this->layers[k - 1]->stepDone();
+				this->layers[k]->forwardPass(this->layers[k - 1]->outputTensor(), 0, ndeps, deps, &consumed);
+				if(readers[k - 1])
+					clReleaseEvent(readers[k - 1]);
+				readers[k - 1] = consumed;
+			}
+			if(readers[k])
+				clReleaseEvent(readers[k]);
+			readers[k] = NULL;
+
+			if(k == n - 1 && outputs)
+			{
+				const cl_event done = this->layers[k]->stepDone();
+				copyRowsCl(this->layers[k]->outputTensor(), 0, this->seq_outputs, t*this->batch, this->batch,
+					1, &done, &readers[k]);
+			}
+		}
+	}
+
+	if(outputs)
+	{
+		clTensor view = this->seq_outputs;
+		view.rows = rows;
+		downloadTensorCl(view, outputs, CL_TRUE, 1, &readers[n - 1]);
+	}
+	for(unsigned k = 0; k < n; k++)
+	{
+		if(readers[k])
+			clReleaseEvent(readers[k]);
+	}
+	bindLayer(0);
+}
+//the calling thread runs layer 0, every other layer gets a thread for this window
+void StackedLSTM::forwardSequenceCpu(const cl_float *window, unsigned steps, cl_float *outputs)
+{
+	const unsigned n = this->layers.size();
+	if(this->cpu_steps < steps)
+	{
+		for(unsigned k = 0; k < this->cpu_outputs.size(); k++)
+			freeCpu(this->cpu_outputs[k]);
+		this->cpu_outputs.clear();
+		for(unsigned k = 0; k < n; k++)
+			this->cpu_outputs.push_back(allocCpu(steps*this->batch*this->layers[k]->hiddenSize()));
+		this->cpu_steps = steps;
+	}
+	for(unsigned k = 0; k < n; k++)
+		this->progress[k] = 0;
+
+	std::vector<std::thread> threads;
+	for(unsigned k = 1; k < n; k++)
+		threads.push_back(std::thread(&StackedLSTM::runLayerCpu, this, k, window, steps));
+	runLayerCpu(0, window, steps);
+	for(unsigned k = 0; k < threads.size(); k++)
+		threads[k].join();
+
+	if(outputs)
+		memcpy(outputs, this->cpu_outputs[n - 1], sizeof(float)*steps*this->batch*this->layers[n - 1]->hiddenSize());
+}
+void StackedLSTM::runLayerCpu(unsigned k, const float *window, unsigned steps)
+{
+	LSTMCell *cell = this->layers[k];
+	const unsigned in_row = this->batch*cell->inputSize();
+	const unsigned out_row = this->batch*cell->hiddenSize();
+
+	for(unsigned t = 0; t < steps; t++)
+	{
+		const float *input = &window[t*in_row];
+		if(k > 0)
+		{
+			std::unique_lock<std::mutex> lk(this->progress_lock);
+			this->progress_cv.wait(lk, [&]{ return this->progress[k - 1] > t; });
+			input = &this->cpu_outputs[k - 1][t*in_row];
+		}
+		cell->forwardPass(input);
+		cell->getOutput(&this->cpu_outputs[k][t*out_row]);
+		{
+			std::lock_guard<std::mutex> lk(this->progress_lock);
+			this->progress[k] = t + 1;
+		}
+		this->progress_cv.notify_all();
+	}
+}
+void StackedLSTM::getOutput(cl_float *host)
+{
+	bindLayer(this->layers.size() - 1);
+	this->layers.back()->getOutput(host);
+	bindLayer(0);
+}
@@ -0,0 +1,52 @@
+#ifndef STACKED_H
+#define STACKED_H
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "lstm.hpp"
+
+//Every layer of a model file as a chain of cells, layer k fed layer k-1's h. A window runs as
+//a wavefront: layer k works on step t while layer k-1 works on step t+1, so the critical path
+//is layers + steps - 1 cell steps instead of layers*steps.
+//On OpenCL each layer enqueues on its own queue, forked from the environment bound to the
+//constructing thread, and layers are joined only by events. On the CPU each layer runs on its
+//own thread for the length of a window, joined by per-layer step counters.
+class StackedLSTM
+{
+	private:
+		lstm_backend backend;
+		unsigned batch;
+		std::vector<LSTMCell *> layers;
+		//OpenCL: layer k enqueues on envs[k], envs[0] is the caller's and is not ours to release
+		std::vector<oclEnv *> envs;
+		//window on layer 0's queue, top layer h for every step on the top layer's queue
+		clTensor window_buf;
+		clTensor seq_outputs;
+		//CPU: every layer's h for every step, so no layer waits for the next to read it
+		std::vector<float *> cpu_outputs;
+		unsigned cpu_steps;
+		std::mutex progress_lock;
+		std::condition_variable progress_cv;
+		//steps each layer has finished in the current window
+		std::vector<unsigned> progress;
+
+		void bindLayer(unsigned k);
+		void runLayerCpu(unsigned k, const float *window, unsigned steps);
+		void forwardSequenceCl(const cl_float *window, unsigned steps, cl_float *outputs);
+		void forwardSequenceCpu(const cl_float *window, unsigned steps, cl_float *outputs);
+	public:
+		//layer k's n_in must be layer k-1's n_hidden
+		StackedLSTM(const lstmModel &model, lstm_backend = BACKEND_OPENCL, unsigned batch = 1,
+				bool split_weights = false);
+		~StackedLSTM();
+		unsigned numLayers() const { return layers.size(); }
+		//clears h and c of every layer
+		void reset();
+		//host window ((steps*batch) x layer 0's n_in), blocks until outputs, when given, holds
+		//the top layer's h for every step ((steps*batch) x its n_hidden)
+		void forwardSequence(const cl_float *window, unsigned steps, cl_float *outputs = NULL);
+		//top layer's newest h
+		void getOutput(cl_float *host);
+};
+#endif
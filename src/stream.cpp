@@ -0,0 +1,27 @@
+#include "stream.hpp"
+
+StreamingLSTM::StreamingLSTM(LSTMCell &cell, unsigned window, unsigned stride)
+	: cell(cell)
+{
+	this->window = window;
+	this->stride = stride ? stride : 1;
+	this->seen = 0;
+	cell.setProjectionSlots(window);
+}
+void StreamingLSTM::reset()
+{
+	this->seen = 0;
+}
+bool StreamingLSTM::push(const cl_float *sample, cl_float *output)
+{
+	this->cell.projectInput(sample, this->seen % this->window);
+	this->seen++;
+	if(this->seen < this->window || (this->seen - this->window) % this->stride != 0)
+		return false;
+
+	//the oldest sample of the window sits in the slot the next one will overwrite
+	this->cell.reset();
+	this->cell.forwardProjected(this->seen % this->window, this->window);
+	this->cell.getOutput(output);
+	return true;
+}
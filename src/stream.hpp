@@ -0,0 +1,28 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "lstm.hpp"
+
+//Sliding-window inference over a continuous feed. Samples arrive one at a time (batch x
+//the cell's input size, one row per feed) and are projected through W_x as they arrive,
+//into a ring of window projections held by the cell. Every stride samples, once the first
+//window is full, the cell is reset and run over the last window of projections. With the
+//usual 50% overlap every sample is projected once instead of once per window it belongs to.
+class StreamingLSTM
+{
+	private:
+		LSTMCell &cell;
+		unsigned window;
+		unsigned stride;
+		unsigned long long seen;
+	public:
+		//takes over cell's projection ring, the cell should not be shared with anything else
+		StreamingLSTM(LSTMCell &cell, unsigned window = 128, unsigned stride = 64);
+		//returns true when this sample completed a window, output then holds the final h
+		//of that window (batch x the cell's hidden size)
+		bool push(const cl_float *sample, cl_float *output);
+		//forgets every sample seen so far, e.g. when a feed drops out
+		void reset();
+};
+
+#endif
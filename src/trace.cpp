@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+#include "trace.h"
+
+std::atomic<bool> trace_on(false);
+
+struct traceSpan
+{
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+	//retained, NULL for host spans
+	cl_event event;
+	trace_kind kind;
+};
+
+//head counts every span the owning thread has recorded and is published with release order
+//after the span is written. tail is how far writeTrace has read. Rings are never freed so a
+//trace can still be written after worker threads exit.
+struct traceRing
+{
+	unsigned tid;
+	std::atomic<uint64_t> head;
+	uint64_t tail;
+	traceSpan spans[TRACE_RING_SIZE];
+};
+
+static std::mutex ring_lock;
+static std::vector<traceRing *> rings;
+static thread_local traceRing *ring = NULL;
+
+void startTrace()
+{
+	trace_on.store(true);
+}
+void stopTrace()
+{
+	trace_on.store(false);
+}
+
+//the lock is only taken the first time a thread records
+static traceRing *threadRing()
+{
+	if(!ring)
+	{
+		ring = new traceRing();
+		std::lock_guard<std::mutex> lock(ring_lock);
+		ring->tid = rings.size() + 1;
+		rings.push_back(ring);
+	}
+	return ring;
+}
+
+static void record(const char *name, trace_kind kind, uint64_t start, uint64_t end, cl_event event)
+{
+	traceRing *r = threadRing();
+	const uint64_t h = r->head.load(std::memory_order_relaxed);
+	traceSpan &s = r->spans[h % TRACE_RING_SIZE];
+	//overwriting a span writeTrace never read
+	if(s.event)
+		clReleaseEvent(s.event);
+	s.name = name;
+	s.kind = kind;
+	s.start = start;
+	s.end = end;
+	s.event = event;
+	r->head.store(h + 1, std::memory_order_release);
+}
+
+void traceHost(const char *name, uint64_t start, uint64_t end)
+{
+	record(name, TRACE_HOST, start, end, NULL);
+}
+void traceCommand(const char *name, trace_kind kind, uint64_t start, uint64_t end, cl_event event)
+{
+	if(event)
+		clRetainEvent(event);
+	record(name, kind, start, end, event);
+}
+
+static const char *kindName(trace_kind kind)
+{
+	switch(kind)
+	{
+		case TRACE_KERNEL:	return "kernel";
+		case TRACE_WRITE:	return "write";
+		case TRACE_READ:	return "read";
+		case TRACE_COPY:	return "copy";
+		case TRACE_FILL:	return "fill";
+		default:		return "host";
+	}
+}
+
+//first span of a ring writeTrace has not read and is still in the ring
+static uint64_t firstUnread(const traceRing *r, uint64_t head)
+{
+	const uint64_t oldest = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+	return r->tail > oldest ? r->tail : oldest;
+}
+
+//Host spans go on process 1, one track per thread. Device spans go on process 2, on the track
+//of the thread that enqueued them (every thread has its own queue). Device clocks are not the
+//host clock, so each command is placed at its host enqueue time plus the device's queued to
+//start delay.
+bool writeTrace(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if(!f)
+	{
+		printf("Could not write trace %s\n", path);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(ring_lock);
+	uint64_t base = UINT64_MAX;
+	for(size_t i = 0; i < rings.size(); i++)
+	{
+		const uint64_t head = rings[i]->head.load(std::memory_order_acquire);
+		for(uint64_t n = firstUnread(rings[i], head); n < head; n++)
+		{
+			const uint64_t start = rings[i]->spans[n % TRACE_RING_SIZE].start;
+			if(start < base)
+				base = start;
+		}
+	}
+
+	fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"host\"}},\n");
+	fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"device\"}}");
+	for(size_t i = 0; i < rings.size(); i++)
+	{
+		traceRing *r = rings[i];
+		fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}", r->tid, r->tid);
+		fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 2, \"tid\": %u, \"args\": {\"name\": \"queue %u\"}}", r->tid, r->tid);
+
+		const uint64_t head = r->head.load(std::memory_order_acquire);
+		for(uint64_t n = firstUnread(r, head); n < head; n++)
+		{
+			traceSpan &s = r->spans[n % TRACE_RING_SIZE];
+			fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+				s.name, kindName(s.kind), r->tid, (s.start - base)*1e-3, (s.end - s.start)*1e-3);
+			if(!s.event)
+				continue;
+
+			cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+			cl_int status = clWaitForEvents(1, &s.event);
+			if(status == CL_SUCCESS)
+				status = clGetEventProfilingInfo(s.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+			if(status == CL_SUCCESS)
+				status = clGetEventProfilingInfo(s.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL);
+			if(status == CL_SUCCESS)
+				status = clGetEventProfilingInfo(s.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+			if(status == CL_SUCCESS)
+				status = clGetEventProfilingInfo(s.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+			if(status == CL_SUCCESS)
+				fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 2, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+					"\"args\": {\"submit_us\": %.3f, \"queued_us\": %.3f}}",
+					s.name, kindName(s.kind), r->tid, (s.start - base + (start - queued))*1e-3, (end - start)*1e-3,
+					(submit - queued)*1e-3, (start - queued)*1e-3);
+			clReleaseEvent(s.event);
+			s.event = NULL;
+		}
+		r->tail = head;
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	return true;
+}
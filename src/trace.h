@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <CL/opencl.h>
+#include "wtime.h"
+
+//Runtime tracing of the hot path, exported as Chrome trace JSON (chrome://tracing, Perfetto).
+//Every enqueue in oclabstract records a span with the host time of the enqueue call and,
+//through its event, the CL_PROFILING_COMMAND_* times of the command. LSTMCell phases record
+//host spans. Spans go into a fixed ring per thread that only that thread writes, so recording
+//takes no lock, and the oldest spans are overwritten when a ring fills up.
+//
+//Tracing is off until startTrace, or RNN_TRACE=<file> which starts it in setupOclEnv and
+//writes the file in cleanupOclEnv. Off, a span costs one relaxed load. Host times are wtime_ns.
+
+//spans kept per thread
+#define TRACE_RING_SIZE (1 << 15)
+
+enum trace_kind
+{
+	TRACE_HOST = 0,
+	TRACE_KERNEL,
+	TRACE_WRITE,
+	TRACE_READ,
+	TRACE_COPY,
+	TRACE_FILL
+};
+
+extern std::atomic<bool> trace_on;
+inline bool tracing() { return trace_on.load(std::memory_order_relaxed); }
+
+void startTrace();
+void stopTrace();
+//Writes every span recorded since the last write and empties the rings. Device times are
+//read here, waiting for commands still in flight. Only call while no other thread records.
+bool writeTrace(const char *path);
+
+//name must be a string literal or otherwise outlive the trace
+void traceHost(const char *name, uint64_t start, uint64_t end);
+//an enqueue between start and end, event is retained until the trace is written
+void traceCommand(const char *name, trace_kind kind, uint64_t start, uint64_t end, cl_event event);
+
+//host span covering a scope, e.g. one LSTMCell phase
+struct traceScope
+{
+	const char *name;
+	uint64_t start;
+	traceScope(const char *name) : name(name), start(tracing() ? wtime_ns() : 0) {}
+	~traceScope() { if(start) traceHost(name, start, wtime_ns()); }
+};
+
+#endif
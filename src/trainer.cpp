@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "trainer.h"
+#include "trace.h"
+
+DataParallelTrainer::DataParallelTrainer(	unsigned threads, lstm_backend backend,
+						cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+						cl_float *forget_bias, cl_float *input_bias,
+						cl_float *internal_bias, cl_float *output_bias,
+						unsigned batch, update_mode mode, unsigned checkpoint_every,
+						unsigned n_in, unsigned n_hidden)
+{
+	cl_float *w[NUM_GATES] = {forget, input, internal, output};
+	cl_float *b[NUM_GATES] = {forget_bias, input_bias, internal_bias, output_bias};
+	if(mode == UPDATE_HOGWILD && backend != BACKEND_CPU)
+	{
+		printf("Hogwild updates need the CPU backend\n");
+		exit(1);
+	}
+	threads = threads ? threads : 1;
+	this->backend = backend;
+	this->mode = mode;
+	this->batch = batch ? batch : 1;
+	this->checkpoint_every = checkpoint_every;
+	this->n_in = n_in;
+	this->n_hidden = n_hidden;
+	this->arrived = 0;
+	this->generation = 0;
+
+	const size_t gate_size = (size_t)n_hidden*(n_hidden + n_in);
+	this->n_weights = NUM_GATES*gate_size;
+	this->params.resize(this->n_weights + NUM_GATES*n_hidden);
+	for(unsigned g = 0; g < NUM_GATES; g++)
+	{
+		memcpy(&this->params[g*gate_size], w[g], sizeof(float)*gate_size);
+		if(b[g])
+			memcpy(&this->params[this->n_weights + g*n_hidden], b[g], sizeof(float)*n_hidden);
+	}
+	this->grads.resize(threads, std::vector<float>(this->params.size()));
+	this->losses.resize(threads, 0.0);
+
+	oclEnv *caller = currentOclEnv();
+	for(unsigned t = 0; t < threads; t++)
+	{
+		oclEnv *env = NULL;
+		if(backend == BACKEND_OPENCL)
+		{
+			env = forkOclEnv(caller);
+			bindOclEnv(env);
+		}
+		this->envs.push_back(env);
+		this->cells.push_back(new LSTMCell(	w[GATE_FORGET], w[GATE_INPUT], w[GATE_INTERNAL], w[GATE_OUTPUT],
+							b[GATE_FORGET], b[GATE_INPUT], b[GATE_INTERNAL], b[GATE_OUTPUT],
+							backend, this->batch, false, TENSOR_F32, n_in, n_hidden));
+	}
+	if(backend == BACKEND_OPENCL)
+		bindOclEnv(caller);
+}
+DataParallelTrainer::~DataParallelTrainer()
+{
+	oclEnv *caller = currentOclEnv();
+	for(unsigned t = 0; t < this->cells.size(); t++)
+	{
+		if(this->envs[t])
+		{
+			bindOclEnv(this->envs[t]);
+			finishCl();
+		}
+		delete this->cells[t];
+		releaseOclEnv(this->envs[t]);
+	}
+	if(this->backend == BACKEND_OPENCL)
+		bindOclEnv(caller);
+}
+void DataParallelTrainer::getWeights(cl_float *weights, cl_float *bias) const
+{
+	memcpy(weights, this->params.data(), sizeof(float)*this->n_weights);
+	memcpy(bias, &this->params[this->n_weights], sizeof(float)*(this->params.size() - this->n_weights));
+}
+double DataParallelTrainer::trainBatch(const cl_float *windows, const cl_float *targets, unsigned count, unsigned steps,
+					float learning_rate)
+{
+	traceScope span("DataParallelTrainer::trainBatch");
+	if(count == 0 || steps == 0)
+		return 0.0;
+	//every worker takes part in the reduction, even one with no windows
+	std::vector<std::thread> threads;
+	for(unsigned t = 0; t < this->cells.size(); t++)
+		threads.push_back(std::thread(&DataParallelTrainer::runWorker, this, t, windows, targets, count, steps, learning_rate));
+	double loss = 0.0;
+	for(unsigned t = 0; t < threads.size(); t++)
+	{
+		threads[t].join();
+		loss += this->losses[t];
+	}
+	return loss/count;
+}
+//Spinning barrier, generation counts the times it has opened. Workers yield while they
+//wait so it still opens when there are more workers than cores.
+void DataParallelTrainer::barrier()
+{
+	const unsigned gen = this->generation.load(std::memory_order_acquire);
+	if(this->arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == this->cells.size())
+	{
+		this->arrived.store(0, std::memory_order_relaxed);
+		this->generation.fetch_add(1, std::memory_order_release);
+		return;
+	}
+	while(this->generation.load(std::memory_order_acquire) == gen)
+		std::this_thread::yield();
+}
+//Hogwild reads and writes of the shared weights. Each element is loaded and stored on its
+//own, so an update can be lost when two workers hit the same weight, which Hogwild accepts.
+static void hogwildRead(const float *shared, float *out, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+		__atomic_load(&shared[i], &out[i], __ATOMIC_RELAXED);
+}
+static void hogwildAxpy(const float *x, float *shared, float alpha, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+	{
+		float v;
+		__atomic_load(&shared[i], &v, __ATOMIC_RELAXED);
+		v += alpha*x[i];
+		__atomic_store(&shared[i], &v, __ATOMIC_RELAXED);
+	}
+}
+//Worker id runs windows first .. last-1 of the minibatch, batch at a time through
+//stageWindows, the zero windows padding a short last chunk have no loss.
+void DataParallelTrainer::runWorker(unsigned id, const cl_float *windows, const cl_float *targets, unsigned count,
+				unsigned steps, float learning_rate)
+{
+	const unsigned n = this->cells.size();
+	const unsigned first = (unsigned)((size_t)count*id/n);
+	const unsigned last = (unsigned)((size_t)count*(id + 1)/n);
+	const size_t hs = (size_t)this->batch*this->n_hidden;
+	LSTMCell *cell = this->cells[id];
+	std::vector<float> &grad = this->grads[id];
+	if(this->envs[id])
+		bindOclEnv(this->envs[id]);
+
+	std::vector<float> staged((size_t)steps*this->batch*this->n_in);
+	std::vector<float> d_out(steps*hs, 0.0f), h(hs);
+	std::vector<float> snapshot(this->mode == UPDATE_HOGWILD ? this->params.size() : 0);
+	float *d_last = &d_out[(steps - 1)*hs];
+	if(this->mode == UPDATE_HOGWILD)
+	{
+		hogwildRead(this->params.data(), snapshot.data(), snapshot.size());
+		cell->setWeights(snapshot.data(), &snapshot[this->n_weights]);
+	}
+
+	double loss = 0.0;
+	cell->zeroGradients();
+	for(unsigned i = first; i < last; i += this->batch)
+	{
+		const unsigned rows = std::min(this->batch, last - i);
+		stageWindows(windows, i, rows, steps, this->n_in, this->batch, staged.data());
+		cell->reset();
+		cell->forwardSequence(staged.data(), steps);
+		cell->getOutput(h.data());
+
+		//only the final h has a loss, scaled so the gradients sum to those of the mean
+		std::fill(d_last, d_last + hs, 0.0f);
+		for(unsigned r = 0; r < rows; r++)
+		{
+			for(unsigned u = 0; u < this->n_hidden; u++)
+			{
+				const float diff = h[r*this->n_hidden + u] - targets[(size_t)(i + r)*this->n_hidden + u];
+				loss += 0.5*diff*diff;
+				d_last[r*this->n_hidden + u] = diff/count;
+			}
+		}
+		cell->reset();
+		cell->backwardPass(staged.data(), steps, d_out.data(), this->checkpoint_every);
+
+		if(this->mode == UPDATE_HOGWILD)
+		{
+			cell->getGradients(grad.data(), &grad[this->n_weights]);
+			cell->zeroGradients();
+			hogwildAxpy(grad.data(), this->params.data(), -learning_rate, grad.size());
+			hogwildRead(this->params.data(), snapshot.data(), snapshot.size());
+			cell->setWeights(snapshot.data(), &snapshot[this->n_weights]);
+		}
+	}
+	this->losses[id] = loss;
+	if(this->mode == UPDATE_HOGWILD)
+		return;
+
+	//reduce-scatter: once every buffer is complete worker id owns params[lo, hi), sums that
+	//slice of every buffer into its own and applies it. The second barrier makes the whole
+	//update visible before any worker copies it into its cell.
+	cell->getGradients(grad.data(), &grad[this->n_weights]);
+	barrier();
+	const size_t lo = this->params.size()*id/n;
+	const size_t hi = this->params.size()*(id + 1)/n;
+	for(unsigned w = 0; w < n; w++)
+	{
+		if(w != id)
+			axpyCpu(&this->grads[w][lo], &grad[lo], 1.0f, hi - lo);
+	}
+	axpyCpu(&grad[lo], &this->params[lo], -learning_rate, hi - lo);
+	barrier();
+	cell->setWeights(this->params.data(), &this->params[this->n_weights]);
+}
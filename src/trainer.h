@@ -0,0 +1,71 @@
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include <atomic>
+#include <vector>
+#include "lstm.hpp"
+
+//how workers combine their gradients
+enum update_mode
+{
+	//every worker finishes its share of the minibatch, the gradients are summed and applied
+	//once, and all workers start the next minibatch from the same weights
+	UPDATE_REDUCE,
+	//Hogwild: every worker applies its gradients to the shared weights as soon as it has
+	//them, without locks, and picks up whatever the others have written. CPU backend only.
+	UPDATE_HOGWILD
+};
+
+//Data-parallel SGD on one layer. Each minibatch is split across worker threads, each with
+//its own LSTMCell (and on OpenCL its own queue, forked from the constructing thread's
+//environment) and its own gradient buffer. With UPDATE_REDUCE the buffers are combined by
+//a reduce-scatter: after a barrier each worker sums one slice of every worker's gradients
+//and updates that slice of the weights, so no lock is ever taken around the weights.
+//The loss is 0.5*|h - target|^2 on the final h of each window, averaged over the minibatch.
+class DataParallelTrainer
+{
+	private:
+		lstm_backend backend;
+		update_mode mode;
+		unsigned batch;
+		unsigned checkpoint_every;
+		unsigned n_in;
+		unsigned n_hidden;
+		//one per worker, envs are NULL on the CPU
+		std::vector<oclEnv *> envs;
+		std::vector<LSTMCell *> cells;
+		//the weights every worker works from, the packed LSTMCell layout followed by the bias
+		std::vector<float> params;
+		size_t n_weights;
+		//each worker's gradients and losses, in the params layout
+		std::vector<std::vector<float> > grads;
+		std::vector<double> losses;
+		//spinning barrier for the reduction
+		std::atomic<unsigned> arrived;
+		std::atomic<unsigned> generation;
+
+		void barrier();
+		void runWorker(unsigned id, const cl_float *windows, const cl_float *targets, unsigned count,
+				unsigned steps, float learning_rate);
+	public:
+		//weights as for LSTMCell, copied before this returns. batch is the rows of each
+		//worker's cell, the windows a worker runs at once. BACKEND_OPENCL needs setupOclEnv
+		//on this thread.
+		DataParallelTrainer(unsigned threads, lstm_backend backend,
+				cl_float *forget, cl_float *input, cl_float *internal, cl_float *output,
+				cl_float *forget_bias = NULL, cl_float *input_bias = NULL,
+				cl_float *internal_bias = NULL, cl_float *output_bias = NULL,
+				unsigned batch = 1, update_mode mode = UPDATE_REDUCE, unsigned checkpoint_every = 0,
+				unsigned n_in = INPUT_SIZE, unsigned n_hidden = OUTPUT_SIZE);
+		~DataParallelTrainer();
+		unsigned threads() const { return cells.size(); }
+		//One SGD step over count windows of steps x n_in, one after another, with targets
+		//count x n_hidden. Returns the mean loss before the update. Blocks until every
+		//worker is done.
+		double trainBatch(const cl_float *windows, const cl_float *targets, unsigned count, unsigned steps,
+				float learning_rate);
+		//the current weights in the getGradients layout of LSTMCell
+		void getWeights(cl_float *weights, cl_float *bias) const;
+};
+
+#endif
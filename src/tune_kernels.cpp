@@ -0,0 +1,123 @@
+/*
+
+Filename: tune_kernels.cpp
+Author: agent
+Purpose: Fills the autotuning cache for this device. Runs every launch path of a cell
+(single steps, whole windows, split weights and cached projections) on random data with
+tuning on, then writes the winners to RNN_TUNE_CACHE (rnn_tune.cache by default).
+The cache is keyed by shape, so tune the shape that will run: -m tunes every layer of a
+model file with its own storage, -s random float weights of n_in inputs and n_hidden
+units, and without either the compiled INPUT_SIZE x OUTPUT_SIZE.
+Set RNN_CL_PLATFORM to tune on a platform other than the FPGA board, e.g. pocl.
+
+Usage: tune_kernels [-m model | -s n_in n_hidden] [steps] [batch ...]
+
+Date		Change
+----------------------------------------------------------------------
+10/16/26	File created.
+10/16/26	Tunes the shape of a model file or of -s n_in n_hidden.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "lstm.hpp"
+#include "bench_common.h"
+
+//every launch path of one cell
+static void tuneCell(LSTMCell &cell, unsigned steps, unsigned batch, bool split)
+{
+	const unsigned n_in = cell.inputSize(), n_hidden = cell.hiddenSize();
+	std::vector<float> window((size_t)steps*batch*n_in);
+	std::vector<float> outputs((size_t)steps*batch*n_hidden);
+	for(size_t j = 0; j < window.size(); j++) window[j] = rand_weight();
+
+	cell.forwardPass(window.data());
+	cell.getOutput(outputs.data());
+	cell.forwardSequence(window.data(), steps, outputs.data());
+	if(split)
+	{
+		cell.setProjectionSlots(steps);
+		for(unsigned t = 0; t < steps; t++)
+			cell.projectInput(&window[(size_t)t*batch*n_in], t);
+		cell.forwardProjected(0, steps);
+		cell.getOutput(outputs.data());
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *model_path = NULL;
+	unsigned n_in = INPUT_SIZE, n_hidden = OUTPUT_SIZE;
+	int arg = 1;
+	if(argc > 2 && strcmp(argv[1], "-m") == 0)
+	{
+		model_path = argv[2];
+		arg = 3;
+	}
+	else if(argc > 3 && strcmp(argv[1], "-s") == 0)
+	{
+		n_in = atoi(argv[2]);
+		n_hidden = atoi(argv[3]);
+		arg = 4;
+	}
+	const unsigned steps = argc > arg ? atoi(argv[arg]) : 16;
+	std::vector<unsigned> batches;
+	for(int i = arg + 1; i < argc; i++)
+		batches.push_back(atoi(argv[i]));
+	if(batches.empty())
+		batches.push_back(1);
+	if(steps == 0 || n_in == 0 || n_hidden == 0)
+	{
+		printf("Usage: %s [-m model | -s n_in n_hidden] [steps] [batch ...]\n", argv[0]);
+		return 1;
+	}
+
+	if(!setupOclEnv((char*)"kernels"))
+		return 1;
+	setTuningCl(true);
+
+	lstmModel model;
+	if(model_path && !openModel(model_path, model))
+		return 1;
+	std::vector<float> w[NUM_GATES], b[NUM_GATES];
+	if(!model_path)
+		randomGates(w, b, n_in, n_hidden);
+
+	for(size_t i = 0; i < batches.size(); i++)
+	{
+		const unsigned batch = batches[i];
+		if(model_path)
+		{
+			//int8 layers cannot be split
+			const int splits = model.header->dtype == MODEL_I8 ? 1 : 2;
+			for(unsigned l = 0; l < model.header->num_layers; l++)
+			{
+				for(int split = 0; split < splits; split++)
+				{
+					printf("batch %u, layer %u (%u x %u), %s weights\n", batch, l, model.header->layers[l].n_in,
+						model.header->layers[l].n_hidden, split ? "split" : "packed");
+					LSTMCell cell(model, l, BACKEND_OPENCL, batch, split);
+					tuneCell(cell, steps, batch, split);
+				}
+			}
+			continue;
+		}
+		for(int split = 0; split < 2; split++)
+		{
+			printf("batch %u, %u x %u, %s weights\n", batch, n_in, n_hidden, split ? "split" : "packed");
+			LSTMCell cell(	w[0].data(), w[1].data(), w[2].data(), w[3].data(),
+					b[0].data(), b[1].data(), b[2].data(), b[3].data(),
+					BACKEND_OPENCL, batch, split, TENSOR_F32, n_in, n_hidden);
+			tuneCell(cell, steps, batch, split);
+		}
+	}
+
+	const bool saved = saveTuningCl();
+	if(model_path)
+		closeModel(model);
+	cleanupOclEnv();
+	return saved ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+#ifndef __H_TIME__
+#define __H_TIME__
+
+#include <stdint.h>
+#include <time.h>
+
+//monotonic clock in ns, unaffected by wall clock adjustments
+inline uint64_t wtime_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+//seconds on the same clock, for the callers that subtract two readings
+inline double wtime()
+{
+	return wtime_ns()*1.0e-9;
+}
+
+#endif
@@ -37,7 +37,7 @@ Date		Change
 #include <cstring>
 #include <cmath>
 #include <CL/opencl.h>
-#include "wtime.h"
+#include "../src/wtime.h"
 
 #define WINDOW_SIZE 128
 #define MATRIX_SIZE WINDOW_SIZE*6
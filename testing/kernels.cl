@@ -80,7 +80,7 @@ __kernel void sigmoid_activation(
 )
 {
 	int tid = get_global_id(0);
-	output[tid] = 1.0 / (1 + exp(-input[tid]));
+	output[tid] = 1.0f / (1.0f + exp(-input[tid]));
 }
 __kernel void tanh_activation(
 	__global const	float *restrict input,